@@ -0,0 +1,116 @@
+/**
+ * @file
+ * @brief Result Cache API
+ *
+ * Memoizes sp_run() for deterministic commands. The result of a command, its exit code,
+ * stdout and stderr, is stored in a cache directory under a hash of everything declared
+ * to affect it, and replayed without spawning when the same command runs again.
+ * <br>
+ * The key covers argv, the working directory, the redirections, the bytes of
+ * SP_REDIR_BYTES, the selected environment variables, and the size, mtime and contents
+ * of the input files, including a file redirected to stdin.
+ * Stdin is /dev/null unless it is redirected with SP_REDIR_BYTES() or SP_REDIR_PATH().
+ * <br>
+ * Example:
+ * \code{.c}
+ * SP_Cache* cache = sp_cache_create(".cache/sp", 64 << 20);
+ * SP_CacheKey key = {.env = SP_ARGV("LANG"), .files = SP_ARGV("main.c")};
+ * SP_Process* p = sp_cache_run(cache, SP_ARGV("cc", "-fsyntax-only", "main.c"),
+ *                              SP_OPTS(.spstderr = SP_REDIR_PIPE()), &key);
+ * \endcode
+ */
+
+#ifndef SP_CACHE_H
+#define SP_CACHE_H
+
+#include <stdint.h>
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * An opaque result cache.
+ *
+ * @see sp_cache_create
+ */
+typedef struct sp_cache SP_Cache;
+
+/**
+ * What else, besides argv and the options, determines the result of a command.
+ */
+typedef struct sp_cache_key {
+    char** env;    ///< NULL terminated names of environment variables, or NULL.
+    char** files;  ///< NULL terminated paths of files the command reads, or NULL.
+} SP_CacheKey;
+
+/**
+ * Counters of a cache since it was created.
+ *
+ * @see sp_cache_stats
+ */
+typedef struct sp_cache_stats {
+    uint64_t hits;       ///< results replayed without spawning.
+    uint64_t misses;     ///< commands run because no result was stored.
+    uint64_t bypassed;   ///< commands run uncached, see sp_cache_run().
+    uint64_t stores;     ///< results stored.
+    uint64_t evictions;  ///< results removed to stay within the size limit.
+    uint64_t bytes;      ///< estimated size of the stored results.
+} SP_CacheStats;
+
+/**
+ * Open a cache, creating its directory if needed. Several caches, in this or other
+ * processes, can share a directory.
+ *
+ * @param[in] dir the directory holding the results.
+ * @param[in] maxBytes the results are evicted least recently used first once their
+ *            total size exceeds maxBytes, 0 for no limit.
+ * @return a pointer to a new sp_cache or NULL on error and errno is set accordingly.
+ */
+SP_Cache* sp_cache_create(const char* dir, uint64_t maxBytes);
+
+/**
+ * Run a command like sp_run(), replaying its stored result if there is one.
+ *
+ * The returned process has exited. Outputs redirected with SP_REDIR_PIPE() are replayed
+ * from memory, outputs that are inherited are written to the caller's stdout and stderr
+ * once the command is done. Results are only stored for exit codes below
+ * SP_EXIT_NOT_EXECUTE, so failures to spawn and deaths by signal are not memoized.
+ * <br>
+ * The command is run uncached, and counted as bypassed, if the options can not be
+ * replayed: stdin other than SP_REDIR_INHERIT, SP_REDIR_BYTES() or SP_REDIR_PATH(),
+ * outputs other than SP_REDIR_INHERIT, SP_REDIR_PIPE() or SP_REDIR_DEVNULL(),
+ * sp_opts::fdMap, sp_opts::notify, sp_opts::rlimits or sp_opts::cgroup.
+ *
+ * @param[in,out] cache
+ * @param[in] argv NULL terminated array of arguments. argv[0] is the program to run.
+ * @param[in] opts options, can be NULL. See sp_opts
+ * @param[in] key environment variables and files of the key, can be NULL.
+ * @return a pointer to a sp_process, whose sp_process::pid is 0 if it was replayed,
+ *         or NULL on error and errno is set accordingly.
+ */
+SP_Process* sp_cache_run(SP_Cache* cache, char** argv, SP_Opts* opts,
+                         const SP_CacheKey* key);
+
+/**
+ * Get the counters of a cache.
+ *
+ * @param[in] cache
+ * @param[out] stats
+ */
+void sp_cache_stats(SP_Cache* cache, SP_CacheStats* stats);
+
+/**
+ * Close a cache. The stored results are kept.
+ *
+ * @param[in] cache
+ */
+void sp_cache_destroy(SP_Cache* cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_CACHE_H
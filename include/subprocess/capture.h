@@ -0,0 +1,91 @@
+/**
+ * @file
+ * @brief Interleaved Capture API
+ */
+
+#ifndef SP_CAPTURE_H
+#define SP_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "subprocess/process.h"
+#include "subprocess/redirect.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A chunk of output read from one of the streams of a process.
+ * Records are stored back to back in sp_capture::buf and are iterated with sp_capture_next().
+ */
+typedef struct sp_capture_record {
+    uint64_t timestamp;  ///< CLOCK_MONOTONIC time in nanoseconds the chunk was read.
+    uint32_t size;       ///< Number of bytes in data.
+    uint8_t stream;  ///< The stream the chunk came from, SP_STDOUT_FILENO or SP_STDERR_FILENO.
+    char data[];     ///< The bytes read, not NULL terminated.
+} SP_CaptureRecord;
+
+/**
+ * An append-only buffer of sp_capture_record's in the order they were read.
+ * Zero initialize before the first call to sp_capture() and free with sp_capture_free().
+ */
+typedef struct sp_capture {
+    char* buf;        ///< The records, back to back.
+    size_t size;      ///< Number of bytes of buf in use.
+    size_t capacity;  ///< Allocated size of buf.
+    size_t count;     ///< Number of records.
+    size_t bytes[3];  ///< Total bytes captured, indexed by sp_redir_target.
+} SP_Capture;
+
+/**
+ * Read stdout and stderr of a process until both reach end of file,
+ * appending each chunk read to capture as an sp_capture_record.
+ *
+ * Both pipes are read through a single poll(2) loop so the records keep the relative
+ * order the output was produced in, at the granularity of the child's writes.
+ * At least one of sp_process::spstdout and sp_process::spstderr must have been opened
+ * with sp_redir_type::SP_REDIR_PIPE.
+ * <br>
+ * Example:
+ * \code{.c}
+ * SP_Process* proc = sp_open(SP_ARGV("make"), SP_OPTS(.spstdout = SP_REDIR_PIPE(),
+ *                                                     .spstderr = SP_REDIR_PIPE()));
+ * SP_Capture capture = {0};
+ * sp_capture(proc, &capture);
+ * for (SP_CaptureRecord* r = sp_capture_next(&capture, NULL); r;
+ *      r = sp_capture_next(&capture, r)) {
+ *     printf("%llu %d %.*s", r->timestamp, r->stream, r->size, r->data);
+ * }
+ * sp_capture_free(&capture);
+ * \endcode
+ *
+ * @param[in,out] process
+ * @param[in,out] capture
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_capture(SP_Process* process, SP_Capture* capture);
+
+/**
+ * Iterate over the records of a capture.
+ *
+ * @param[in] capture
+ * @param[in] record the previous record, or NULL to get the first record.
+ * @return the record following record, or NULL if there are no more records.
+ */
+SP_CaptureRecord* sp_capture_next(SP_Capture* capture,
+                                  SP_CaptureRecord* record);
+
+/**
+ * Free all memory allocated to a capture and reset it so it can be reused.
+ *
+ * @param[in,out] capture
+ */
+void sp_capture_free(SP_Capture* capture);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_CAPTURE_H
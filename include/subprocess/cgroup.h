@@ -0,0 +1,102 @@
+/**
+ * @file
+ * @brief Cgroup API
+ *
+ * A process spawned with sp_opts::cgroup runs in a cgroup v2 of its own, created in a
+ * delegated parent cgroup, so memory.max and cpu.max apply to it and its descendants.
+ * The cgroup is removed by sp_destroy(), or by the reaper after sp_destroy_async(),
+ * killing the descendants of the process still in it.
+ * <br>
+ * Example, limiting a build to 2GiB and half a CPU:
+ * \code{.c}
+ * SP_CgroupOpts cgroup = {
+ *     .parent = "/sys/fs/cgroup/user.slice/user-1000.slice/builds",
+ *     .memoryMax = 2ULL << 30,
+ *     .cpuQuotaUs = 50000,
+ * };
+ * SP_Process* p = sp_run(SP_ARGV("make"), SP_OPTS(.cgroup = &cgroup));
+ * if (p->limitHit & SP_LIMIT_HIT_MEMORY) {
+ *     fputs("make ran out of memory\n", stderr);
+ * }
+ * \endcode
+ */
+
+#ifndef SP_CGROUP_H
+#define SP_CGROUP_H
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Default of sp_cgroup_opts::cpuPeriodUs.
+ */
+#define SP_CGROUP_CPU_PERIOD_US 100000
+
+/**
+ * Get the path of the cgroup of a process spawned with sp_opts::cgroup.
+ *
+ * @param[in] process
+ * @return the path owned by the process, or NULL if it has no cgroup.
+ */
+const char* sp_cgroup_path(const SP_Process* process);
+
+/**
+ * Create the cgroup and write its limits. Called by sp_open() before compiling the plan.
+ *
+ * @param[in,out] process
+ * @param[in] opts
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_cgroup_create(SP_Process* process, const SP_Opts* opts);
+
+/**
+ * Get the cgroup directory, to create the process in with CLONE_INTO_CGROUP.
+ * Called by sp_open().
+ *
+ * @param[in] process
+ * @return the file descriptor owned by the process, or -1 if it has no cgroup.
+ */
+int sp_cgroup_fd(const SP_Process* process);
+
+/**
+ * Add the limits hit in the cgroup to sp_process::limitHit. Called once the process
+ * is waited on, also by sp_poll(), so it neither kills nor waits for anything.
+ *
+ * @param[in,out] process
+ */
+void sp_cgroup_reaped(SP_Process* process);
+
+/**
+ * Take the path of the cgroup, for the reaper to remove it once the process is reaped.
+ *
+ * @param[in,out] process
+ * @return the path, to be freed with free(), or NULL if the process has no cgroup.
+ */
+char* sp_cgroup_release(SP_Process* process);
+
+/**
+ * Kill the processes in a cgroup and remove it. Called by the reaper.
+ *
+ * @param[in] path the cgroup directory.
+ * @param[in] timeoutMs milliseconds to wait for the killed processes to exit, 0 to try once.
+ * @return 0 on success, -1 on error and errno is set accordingly, EAGAIN if killed
+ *         processes are still exiting, EBUSY if child cgroups are left.
+ */
+int sp_cgroup_remove(const char* path, int timeoutMs);
+
+/**
+ * Remove the cgroup like sp_cgroup_remove(), killing the descendants of the process
+ * still in it, and free it. Called by sp_destroy().
+ *
+ * @param[in,out] process
+ */
+void sp_cgroup_free(SP_Process* process);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_CGROUP_H
@@ -0,0 +1,374 @@
+/**
+ * @file
+ * @brief Shared Memory Channel API
+ *
+ * A single-producer single-consumer byte stream between two processes, backed by a
+ * ring buffer in a memfd. Bytes are copied straight into shared memory without a syscall,
+ * futex(2) is only called when the reader finds the ring empty or the writer finds it full.
+ * <br>
+ * The parent creates the channel with sp_channel_create() and passes sp_channel::fd to the
+ * child, e.g. with SP_FD_MAP(). Everything else is defined inline in this header,
+ * so a child can attach with sp_channel_attach() without linking against libsubprocess.
+ * <br>
+ * The creator and the last process to attach record their pids in the channel, and while
+ * waiting each side checks every #SP_CHANNEL_PEER_CHECK_MS that the other is still alive,
+ * so a peer dying without closing its end is reported as EPIPE instead of blocking forever.
+ * A process that inherited the mapping through fork(2) without attaching is not watched.
+ * <br>
+ * Example, streaming from a child:
+ * \code{.c}
+ * // parent
+ * SP_Channel ch;
+ * sp_channel_create(&ch, 1 << 20);
+ * SP_Process* p = sp_open(SP_ARGV("producer"), SP_OPTS(SP_FD_MAP({ch.fd, 3})));
+ * char buf[4096];
+ * ssize_t n;
+ * while ((n = sp_channel_read(&ch, buf, sizeof buf)) > 0) {
+ *     consume(buf, n);
+ * }
+ * sp_channel_detach(&ch);
+ *
+ * // producer
+ * SP_Channel ch;
+ * sp_channel_attach(&ch, 3);
+ * sp_channel_write(&ch, data, size);
+ * sp_channel_close_write(&ch);
+ * \endcode
+ */
+
+#ifndef SP_CHANNEL_H
+#define SP_CHANNEL_H
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Identifies the memory layout of a channel.
+ */
+#define SP_CHANNEL_MAGIC 0x53504348414e0002ULL
+
+/**
+ * Offset of the ring buffer in the memfd, the control block lives before it.
+ */
+#define SP_CHANNEL_DATA_OFFSET 4096
+
+/**
+ * Milliseconds between checks that the other side is alive while waiting on it.
+ */
+#define SP_CHANNEL_PEER_CHECK_MS 100
+
+/**
+ * The control block at the start of the memfd.
+ * The writer and reader positions are on separate cache lines.
+ */
+typedef struct sp_channel_shared {
+    uint64_t magic;     ///< SP_CHANNEL_MAGIC
+    uint64_t capacity;  ///< size of the ring buffer, a power of 2.
+    int32_t creatorPid;   ///< the process that called sp_channel_create().
+    int32_t attacherPid;  ///< the last process that called sp_channel_attach(), or 0.
+    /// total bytes written, only modified by the writer.
+    __attribute__((aligned(64))) uint64_t head;
+    uint32_t dataSeq;        ///< futex word the reader waits on.
+    uint32_t readerWaiting;  ///< the reader is about to wait on dataSeq.
+    uint32_t writerClosed;   ///< the writer will not write anymore.
+    /// total bytes read, only modified by the reader.
+    __attribute__((aligned(64))) uint64_t tail;
+    uint32_t spaceSeq;       ///< futex word the writer waits on.
+    uint32_t writerWaiting;  ///< the writer is about to wait on spaceSeq.
+    uint32_t readerClosed;   ///< the reader will not read anymore.
+} SP_ChannelShared;
+
+/**
+ * A process's view of a channel.
+ *
+ * @see sp_channel_create
+ * @see sp_channel_attach
+ */
+typedef struct sp_channel {
+    int fd;                    ///< the memfd, pass it to the other process.
+    SP_ChannelShared* shared;  ///< the mapped control block.
+    char* data;                ///< the mapped ring buffer.
+    size_t mapSize;            ///< size of the mapping.
+} SP_Channel;
+
+/**
+ * Create a channel.
+ * The fd is close-on-exec, it is passed to a child through sp_opts::fdMap.
+ *
+ * @param[out] channel
+ * @param[in] capacity size of the ring buffer, rounded up to a power of 2 of at least a page.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_channel_create(SP_Channel* channel, size_t capacity);
+
+/**
+ * Wait until the futex word no longer holds val, or for #SP_CHANNEL_PEER_CHECK_MS.
+ *
+ * @param[in] addr
+ * @param[in] val
+ * @return 0 when woken, -1 on error and errno is set, e.g. to ETIMEDOUT.
+ */
+static inline int sp_channel_futex_wait(uint32_t* addr, uint32_t val) {
+    struct timespec timeout = {.tv_nsec = SP_CHANNEL_PEER_CHECK_MS * 1000000L};
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, &timeout, NULL, 0) < 0
+               ? -1
+               : 0;
+}
+
+/**
+ * Check whether the other side of the channel is still alive.
+ * A child that exited is dead even before it is waited on.
+ *
+ * @param[in] channel
+ * @return false if the other side is known to be dead.
+ */
+static inline bool sp_channel_peer_alive(const SP_Channel* channel) {
+    SP_ChannelShared* shared = channel->shared;
+    pid_t self = getpid();
+    pid_t peer = __atomic_load_n(&shared->creatorPid, __ATOMIC_RELAXED);
+    if (peer == self) {
+        peer = __atomic_load_n(&shared->attacherPid, __ATOMIC_RELAXED);
+    }
+    if (peer <= 0 || peer == self) {
+        return true;
+    }
+    siginfo_t info;
+    info.si_pid = 0;
+    if (!waitid(P_PID, peer, &info, WEXITED | WNOHANG | WNOWAIT)) {
+        // A child of ours, which is left to be waited on.
+        return info.si_pid != peer;
+    }
+    return kill(peer, 0) == 0 || errno != ESRCH;
+}
+
+/**
+ * Bump the futex word and wake everyone waiting on it.
+ *
+ * @param[in,out] addr
+ */
+static inline void sp_channel_futex_wake(uint32_t* addr) {
+    __atomic_add_fetch(addr, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Wake the other side if it announced that it is waiting.
+ * Must follow the publication of the new position.
+ *
+ * @param[in,out] waiting the waiting flag of the other side.
+ * @param[in,out] seq the futex word of the other side.
+ */
+static inline void sp_channel_notify(uint32_t* waiting, uint32_t* seq) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED)) {
+        __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+        sp_channel_futex_wake(seq);
+    }
+}
+
+/**
+ * Attach to a channel created by another process with sp_channel_create().
+ * The channel takes ownership of fd.
+ *
+ * @param[out] channel
+ * @param[in] fd the memfd, e.g. the sp_fd_map::childFd it was passed as.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static inline int sp_channel_attach(SP_Channel* channel, int fd) {
+    struct stat st;
+    if (!channel || fstat(fd, &st) < 0) {
+        return -1;
+    }
+    if ((size_t)st.st_size <= SP_CHANNEL_DATA_OFFSET) {
+        errno = EINVAL;
+        return -1;
+    }
+    void* mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    if (mem == MAP_FAILED) {
+        return -1;
+    }
+    SP_ChannelShared* shared = (SP_ChannelShared*)mem;
+    if (shared->magic != SP_CHANNEL_MAGIC ||
+        shared->capacity + SP_CHANNEL_DATA_OFFSET != (uint64_t)st.st_size) {
+        munmap(mem, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    __atomic_store_n(&shared->attacherPid, getpid(), __ATOMIC_RELAXED);
+    channel->fd = fd;
+    channel->shared = shared;
+    channel->data = (char*)mem + SP_CHANNEL_DATA_OFFSET;
+    channel->mapSize = st.st_size;
+    return 0;
+}
+
+/**
+ * Write all bytes to the channel, blocking while the ring buffer is full.
+ *
+ * @param[in,out] channel
+ * @param[in] buf
+ * @param[in] size
+ * @return size on success, or -1 on error and errno is set to EPIPE if the reader closed
+ *         the channel or died.
+ */
+static inline ssize_t sp_channel_write(SP_Channel* channel, const void* buf,
+                                       size_t size) {
+    SP_ChannelShared* shared = channel->shared;
+    uint64_t capacity = shared->capacity;
+    uint64_t head = shared->head;
+    const char* src = (const char*)buf;
+    size_t left = size;
+    while (left) {
+        uint64_t tail = __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE);
+        if (head - tail == capacity) {
+            uint32_t seq =
+                __atomic_load_n(&shared->spaceSeq, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&shared->writerWaiting, 1, __ATOMIC_SEQ_CST);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&shared->readerClosed, __ATOMIC_ACQUIRE)) {
+                errno = EPIPE;
+                return -1;
+            }
+            if (head - __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE) ==
+                    capacity &&
+                sp_channel_futex_wait(&shared->spaceSeq, seq) < 0 &&
+                errno == ETIMEDOUT && !sp_channel_peer_alive(channel)) {
+                errno = EPIPE;
+                return -1;
+            }
+            continue;
+        }
+        if (__atomic_load_n(&shared->readerClosed, __ATOMIC_RELAXED)) {
+            errno = EPIPE;
+            return -1;
+        }
+        size_t n = capacity - (head - tail);
+        n = n < left ? n : left;
+        size_t offset = head & (capacity - 1);
+        size_t first = n < capacity - offset ? n : capacity - offset;
+        memcpy(channel->data + offset, src, first);
+        memcpy(channel->data, src + first, n - first);
+        head += n;
+        src += n;
+        left -= n;
+        __atomic_store_n(&shared->head, head, __ATOMIC_RELEASE);
+        sp_channel_notify(&shared->readerWaiting, &shared->dataSeq);
+    }
+    return size;
+}
+
+/**
+ * Read up to size bytes from the channel, blocking while the ring buffer is empty.
+ *
+ * @param[in,out] channel
+ * @param[out] buf
+ * @param[in] size
+ * @return the number of bytes read, or 0 once the writer closed the channel and
+ *         everything has been read, or -1 and errno is set to EPIPE if the writer died
+ *         without closing the channel and everything it wrote has been read.
+ */
+static inline ssize_t sp_channel_read(SP_Channel* channel, void* buf,
+                                      size_t size) {
+    SP_ChannelShared* shared = channel->shared;
+    uint64_t capacity = shared->capacity;
+    uint64_t tail = shared->tail;
+    uint64_t head;
+    while ((head = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE)) == tail) {
+        if (!size) {
+            return 0;
+        }
+        uint32_t seq = __atomic_load_n(&shared->dataSeq, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&shared->readerWaiting, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&shared->head, __ATOMIC_ACQUIRE) != tail) {
+            continue;
+        }
+        if (__atomic_load_n(&shared->writerClosed, __ATOMIC_ACQUIRE)) {
+            // Bytes written before closing are visible now.
+            if (__atomic_load_n(&shared->head, __ATOMIC_ACQUIRE) != tail) {
+                continue;
+            }
+            return 0;
+        }
+        if (sp_channel_futex_wait(&shared->dataSeq, seq) < 0 &&
+            errno == ETIMEDOUT && !sp_channel_peer_alive(channel)) {
+            // Bytes written before dying are visible now.
+            if (__atomic_load_n(&shared->head, __ATOMIC_ACQUIRE) != tail) {
+                continue;
+            }
+            errno = EPIPE;
+            return -1;
+        }
+    }
+    size_t n = head - tail;
+    n = n < size ? n : size;
+    size_t offset = tail & (capacity - 1);
+    size_t first = n < capacity - offset ? n : capacity - offset;
+    memcpy(buf, channel->data + offset, first);
+    memcpy((char*)buf + first, channel->data, n - first);
+    __atomic_store_n(&shared->tail, tail + n, __ATOMIC_RELEASE);
+    sp_channel_notify(&shared->writerWaiting, &shared->spaceSeq);
+    return n;
+}
+
+/**
+ * Tell the reader that nothing more will be written.
+ * The reader gets 0 from sp_channel_read() once it has read everything.
+ *
+ * @param[in,out] channel
+ */
+static inline void sp_channel_close_write(SP_Channel* channel) {
+    __atomic_store_n(&channel->shared->writerClosed, 1, __ATOMIC_RELEASE);
+    sp_channel_futex_wake(&channel->shared->dataSeq);
+}
+
+/**
+ * Tell the writer that nothing more will be read.
+ * The writer gets EPIPE from sp_channel_write().
+ *
+ * @param[in,out] channel
+ */
+static inline void sp_channel_close_read(SP_Channel* channel) {
+    __atomic_store_n(&channel->shared->readerClosed, 1, __ATOMIC_RELEASE);
+    sp_channel_futex_wake(&channel->shared->spaceSeq);
+}
+
+/**
+ * Unmap the channel and close its fd. The channel is not closed for the other side,
+ * use sp_channel_close_write() or sp_channel_close_read() first.
+ *
+ * @param[in,out] channel
+ */
+static inline void sp_channel_detach(SP_Channel* channel) {
+    if (!channel || !channel->shared) {
+        return;
+    }
+    munmap(channel->shared, channel->mapSize);
+    close(channel->fd);
+    channel->shared = NULL;
+    channel->data = NULL;
+    channel->fd = -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_CHANNEL_H
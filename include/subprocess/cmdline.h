@@ -0,0 +1,91 @@
+/**
+ * @file
+ * @brief Command Line API
+ */
+
+#ifndef SP_CMDLINE_H
+#define SP_CMDLINE_H
+
+#include <stddef.h>
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The processes of a pipeline, such as `a | b | c`.
+ *
+ * @see sp_open_cmdline
+ * @see sp_pipeline_destroy
+ */
+typedef struct sp_pipeline {
+    SP_Process** procs;  ///< processes in pipeline order
+    size_t size;         ///< number of processes
+} SP_Pipeline;
+
+/**
+ * Parse a command line and open its pipeline without spawning a shell.
+ *
+ * The syntax is a safe subset of sh(1):
+ * - words separated by whitespace, quoted with '...' or "...", or escaped with \\
+ * - `|` connects stdout of a command to stdin of the next
+ * - `<`, `>` and `>>` redirect to a path, optionally prefixed with the fd 0, 1 or 2,
+ *   mapping onto sp_redir_type::SP_REDIR_PATH and sp_redir_type::SP_REDIR_APPEND
+ * - `2>&1` and `>&2` map onto sp_redir_type::SP_REDIR_STDOUT and sp_redir_type::SP_REDIR_STDERR
+ *
+ * Redirections apply in the order they are written, after the pipes, so
+ * `a 2>&1 >/dev/null | b` pipes only the stderr of a to b.
+ * There is no variable expansion, globbing, or command substitution, so `$` and `*` are
+ * passed through literally, while unquoted `;`, `&`, `(`, `)` and backticks are rejected.
+ *
+ * opts is applied to every process in the pipeline, except sp_opts::spstdin which is
+ * only used for the first process, sp_opts::spstdout which is only used for the last,
+ * and sp_opts::redirOrder which is ignored. Redirections in cmdline take precedence.
+ * <br>
+ * Example, mimicking `sh -c "grep foo in.txt | sort | uniq -c > out.txt"`:
+ * \code{.c}
+ * SP_Pipeline* p = sp_run_cmdline("grep foo in.txt | sort | uniq -c > out.txt", 0);
+ * sp_pipeline_destroy(p);
+ * \endcode
+ *
+ * @param[in] cmdline the command line to parse.
+ * @param[in,out] opts options used when spawning the processes. See sp_opts
+ * @return a pointer to a new sp_pipeline or NULL on error and errno is set accordingly.
+ *         errno is EINVAL if cmdline is not valid, or if it duplicates a fd set by opts
+ *         after redirecting it, such as `>&2 2>file` with sp_opts::spstderr set.
+ */
+SP_Pipeline* sp_open_cmdline(const char* cmdline, SP_Opts* opts);
+
+/**
+ * Parse a command line, open its pipeline, and wait for every process to finish.
+ *
+ * @param[in] cmdline the command line to parse.
+ * @param[in,out] opts options used when spawning the processes. See sp_opts
+ * @return a pointer to a new sp_pipeline or NULL on error and errno is set accordingly.
+ * @see sp_open_cmdline
+ */
+SP_Pipeline* sp_run_cmdline(const char* cmdline, SP_Opts* opts);
+
+/**
+ * Wait for every process in a pipeline to exit.
+ *
+ * @param[in,out] pipeline
+ * @return the exit code of the last process, or -1 on error and errno is set accordingly.
+ */
+int sp_pipeline_wait(SP_Pipeline* pipeline);
+
+/**
+ * Free all memory allocated to a pipeline, destroying each process with sp_destroy().
+ * If the pipeline is NULL, this function does nothing.
+ *
+ * @param[in,out] pipeline
+ */
+void sp_pipeline_destroy(SP_Pipeline* pipeline);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_CMDLINE_H
@@ -0,0 +1,164 @@
+/**
+ * @file
+ * @brief Coprocess API
+ *
+ * A coprocess is a long-lived child serving many requests over its stdin and stdout,
+ * so the cost of spawning it is paid once instead of once per request.
+ * <br>
+ * Requests are framed and written to the child's stdin, responses are read from its stdout
+ * and matched to requests in the order they were sent. Several requests can be outstanding
+ * at once, sp_coproc_send() never blocks on a full pipe, the remaining bytes are written while
+ * waiting for responses in sp_coproc_recv().
+ * <br>
+ * If the child exits or closes its pipes it is restarted on demand and every request that has
+ * not been answered yet is sent again. A request that was being served by
+ * more than SP_COPROC_RETRIES children that died fails with EPIPE.
+ * A request that times out fails with ETIMEDOUT, and the child is killed
+ * since its responses can no longer be matched to requests.
+ * <br>
+ * Example:
+ * \code{.c}
+ * SP_Coproc* co = sp_coproc_create(SP_ARGV("bc"), NULL, SP_FRAME_LINE);
+ * char* answer;
+ * size_t size;
+ * if (sp_coproc_call(co, "6*7", 3, 1000, &answer, &size) == 0) {
+ *     printf("%s\n", answer);  // 42
+ *     free(answer);
+ * }
+ * sp_coproc_destroy(co);
+ * \endcode
+ */
+
+#ifndef SP_COPROC_H
+#define SP_COPROC_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Number of times a request is sent again after the child serving it died.
+ */
+#define SP_COPROC_RETRIES 1
+
+/**
+ * Milliseconds sp_coproc_destroy() waits for the child to exit after closing its stdin,
+ * before killing it.
+ */
+#define SP_COPROC_GRACE_MS 1000
+
+/**
+ * How messages are delimited on the child's stdin and stdout.
+ */
+typedef enum sp_coproc_framing {
+    /**
+     * Every message is a line terminated by '\n', which is not part of the message.
+     * Requests can't contain '\n'.
+     */
+    SP_FRAME_LINE = 0,
+    SP_FRAME_LENGTH,  ///< Every message is preceded by its size as a 32 bit big endian integer.
+} SP_CoprocFraming;
+
+/**
+ * An opaque coprocess.
+ *
+ * @see sp_coproc_create
+ */
+typedef struct sp_coproc SP_Coproc;
+
+/**
+ * Start a coprocess.
+ *
+ * sp_opts::spstdin and sp_opts::spstdout are replaced by pipes, the other options are kept
+ * and used again whenever the child is restarted, so anything they reference such as
+ * sp_opts::cwd must remain valid until sp_coproc_destroy().
+ *
+ * @param[in] argv NULL terminated array of arguments. argv[0] is the program to run.
+ * @param[in] opts options used when spawning the child, can be NULL. See sp_opts
+ * @param[in] framing how messages are delimited.
+ * @return a pointer to a new sp_coproc or NULL on error and errno is set accordingly.
+ */
+SP_Coproc* sp_coproc_create(char** argv, SP_Opts* opts,
+                            SP_CoprocFraming framing);
+
+/**
+ * Queue a request. As much of it as the pipe accepts is written without blocking.
+ *
+ * @param[in,out] coproc
+ * @param[in] msg the request, copied until it has been answered.
+ * @param[in] size size of msg in bytes.
+ * @param[in] timeoutMs milliseconds from now until the request fails with ETIMEDOUT,
+ *            or -1 to wait indefinitely.
+ * @return the id of the request, or -1 on error and errno is set accordingly.
+ */
+ssize_t sp_coproc_send(SP_Coproc* coproc, const void* msg, size_t size,
+                       int timeoutMs);
+
+/**
+ * Wait for the response to the oldest outstanding request.
+ *
+ * @param[in,out] coproc
+ * @param[out] id the id of the request, set even if the request failed.
+ * @param[out] response the response with an extra NUL byte appended, to be freed with free().
+ * @param[out] size size of the response without the extra NUL byte.
+ * @return 0 on success, -1 on error and errno is set accordingly:
+ *         ETIMEDOUT or EPIPE if the request failed, ENOMSG if no request is outstanding,
+ *         or the errno of sp_open() if the child could not be restarted.
+ */
+int sp_coproc_recv(SP_Coproc* coproc, size_t* id, char** response,
+                   size_t* size);
+
+/**
+ * Send a request and wait for its response.
+ *
+ * @param[in,out] coproc
+ * @param[in] msg the request.
+ * @param[in] size size of msg in bytes.
+ * @param[in] timeoutMs see sp_coproc_send()
+ * @param[out] response see sp_coproc_recv()
+ * @param[out] responseSize see sp_coproc_recv()
+ * @return 0 on success, -1 on error and errno is set accordingly,
+ *         EBUSY if other requests are outstanding.
+ */
+int sp_coproc_call(SP_Coproc* coproc, const void* msg, size_t size,
+                   int timeoutMs, char** response, size_t* responseSize);
+
+/**
+ * @param[in] coproc
+ * @return the number of requests sent and not received yet.
+ */
+size_t sp_coproc_pending(const SP_Coproc* coproc);
+
+/**
+ * @param[in] coproc
+ * @return the number of times the child was restarted.
+ */
+size_t sp_coproc_restarts(const SP_Coproc* coproc);
+
+/**
+ * Get the current child, which is restarted on demand.
+ * Its pipes are managed by the coprocess and must not be used.
+ *
+ * @param[in] coproc
+ * @return the child, or NULL if it is not running.
+ */
+SP_Process* sp_coproc_process(SP_Coproc* coproc);
+
+/**
+ * Close the child's stdin, give it SP_COPROC_GRACE_MS to exit, then kill it
+ * and free the coprocess along with the outstanding requests.
+ *
+ * @param[in] coproc
+ */
+void sp_coproc_destroy(SP_Coproc* coproc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_COPROC_H
@@ -0,0 +1,172 @@
+/**
+ * @file
+ * @brief DAG Executor API
+ *
+ * Runs a batch of commands whose ordering is given as a directed acyclic graph.
+ * A dependency edge starts a node once another one has exited successfully, e.g. when
+ * it consumes a file the other produces. A pipe edge connects stdout of a node to stdin
+ * of another, and both are started together, like a pipeline of the shell.
+ * <br>
+ * Example, mimicking `make -j4` over `gen > a.txt; gen > b.txt; sort a.txt b.txt | uniq`:
+ * \code{.c}
+ * SP_Dag* dag = sp_dag_create(4, SP_DAG_CRITICAL_PATH, NULL, NULL);
+ * ssize_t a = sp_dag_add(dag, SP_ARGV("gen"), SP_OPTS(.spstdout = SP_REDIR_PATH("a.txt")), 1);
+ * ssize_t b = sp_dag_add(dag, SP_ARGV("gen"), SP_OPTS(.spstdout = SP_REDIR_PATH("b.txt")), 1);
+ * ssize_t sort = sp_dag_add(dag, SP_ARGV("sort", "a.txt", "b.txt"), NULL, 1);
+ * ssize_t uniq = sp_dag_add(dag, SP_ARGV("uniq"), NULL, 1);
+ * sp_dag_depend(dag, sort, a);
+ * sp_dag_depend(dag, sort, b);
+ * sp_dag_pipe(dag, sort, uniq);
+ * sp_dag_run(dag);
+ * sp_dag_destroy(dag);
+ * \endcode
+ */
+
+#ifndef SP_DAG_H
+#define SP_DAG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Flags of sp_dag_create().
+ */
+typedef enum sp_dag_flags {
+    /// Stop at the first failure: running nodes are killed and the others are not started.
+    SP_DAG_FAIL_FAST = 0,
+    /// Keep running every node that does not depend on a failed node.
+    SP_DAG_KEEP_GOING = 1 << 0,
+    /// Start the ready node with the longest path of costs to the end of the graph
+    /// first, instead of the node added first.
+    SP_DAG_CRITICAL_PATH = 1 << 1,
+} SP_DagFlags;
+
+/**
+ * The result of a node, reported through sp_dag_callback and sp_dag_result().
+ *
+ * Times are in nanoseconds since sp_dag_run() was called, and are 0 for the steps the
+ * node never reached.
+ */
+typedef struct sp_dag_result {
+    size_t id;  ///< id returned by sp_dag_add()
+    /**
+     * The process that ran the node, or NULL if it was never started.
+     * Only set in the callback, as it is destroyed after the callback returns.
+     */
+    SP_Process* process;
+    int exitCode;  ///< exit code of the process, or -1 if it was never started.
+    /// errno of sp_open() if it failed, ECANCELED if it was killed or skipped
+    /// because of a failure, else 0.
+    int error;
+    uint64_t readyNs;  ///< when every dependency of the node had finished.
+    uint64_t startNs;  ///< when the node was started.
+    uint64_t endNs;    ///< when the node was reaped.
+} SP_DagResult;
+
+/**
+ * Called once for every node when it finishes, fails to start, or is skipped.
+ *
+ * @param[in] result
+ * @param[in] data the data given to sp_dag_create()
+ */
+typedef void (*SP_DagCallback)(const SP_DagResult* result, void* data);
+
+/**
+ * An opaque graph of commands.
+ *
+ * @see sp_dag_create
+ */
+typedef struct sp_dag SP_Dag;
+
+/**
+ * Create an empty graph.
+ *
+ * @param[in] maxRunning maximum number of processes running at once, must be at least 1.
+ *            Nodes connected by pipes count as one process each, and are started together
+ *            even if they exceed the limit when nothing else is running.
+ * @param[in] flags a combination of sp_dag_flags.
+ * @param[in] callback called when a node finishes, or NULL.
+ * @param[in] data passed to callback.
+ * @return a pointer to a new sp_dag or NULL on error and errno is set accordingly.
+ */
+SP_Dag* sp_dag_create(size_t maxRunning, int flags, SP_DagCallback callback,
+                      void* data);
+
+/**
+ * Add a node to the graph.
+ *
+ * argv is copied, but anything referenced by opts, such as sp_opts::cwd or redirection paths,
+ * must remain valid until sp_dag_run() returns.
+ *
+ * @param[in,out] dag
+ * @param[in] argv NULL terminated array of arguments. argv[0] is the program to run.
+ * @param[in] opts options used when spawning the process, can be NULL. See sp_opts
+ * @param[in] cost the expected run time of the node in any unit, used with
+ *            #SP_DAG_CRITICAL_PATH. 0 is counted as 1.
+ * @return the id of the node, or -1 on error and errno is set accordingly.
+ */
+ssize_t sp_dag_add(SP_Dag* dag, char** argv, SP_Opts* opts, uint64_t cost);
+
+/**
+ * Start a node only once another one has exited successfully.
+ *
+ * @param[in,out] dag
+ * @param[in] node the id of the dependent node.
+ * @param[in] dependency the id of the node it depends on.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_dag_depend(SP_Dag* dag, size_t node, size_t dependency);
+
+/**
+ * Connect stdout of a node to stdin of another one through a pipe.
+ * This takes precedence over sp_opts::spstdout of from and sp_opts::spstdin of to.
+ * As in the shell, from being killed by SIGPIPE because to exited without reading
+ * everything is not a failure, though sp_dag_result::exitCode still reports it.
+ *
+ * @param[in,out] dag
+ * @param[in] from the id of the writing node.
+ * @param[in] to the id of the reading node.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ *         errno is EINVAL if either end is already piped or the pipes form a cycle.
+ */
+int sp_dag_pipe(SP_Dag* dag, size_t from, size_t to);
+
+/**
+ * Run the whole graph to completion.
+ * Every node is reported through the callback, and its result is kept for sp_dag_result().
+ *
+ * @param[in,out] dag
+ * @return the number of nodes that did not succeed, or -1 on error and errno is set
+ *         accordingly. errno is EINVAL if the graph has a cycle, in which case nothing
+ *         is started.
+ */
+int sp_dag_run(SP_Dag* dag);
+
+/**
+ * Get the result of a node after sp_dag_run().
+ *
+ * @param[in] dag
+ * @param[in] node the id of the node.
+ * @return the result, or NULL if the id is not valid.
+ */
+const SP_DagResult* sp_dag_result(SP_Dag* dag, size_t node);
+
+/**
+ * Free the graph. If the dag is NULL, this function does nothing.
+ *
+ * @param[in,out] dag
+ */
+void sp_dag_destroy(SP_Dag* dag);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_DAG_H
@@ -9,6 +9,10 @@
 #include <errno.h>
 #include <string.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Exit code when the command invoked cannot execute.
  */
@@ -36,4 +40,8 @@
  */
 #define SP_NORMALIZE_ERROR(cond) ((cond) ? 0 : -1)
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif  // SP_ERROR_H
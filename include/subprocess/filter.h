@@ -0,0 +1,201 @@
+/**
+ * @file
+ * @brief Filter API
+ *
+ * Filters are pipeline stages run inside the calling process, replacing helper processes
+ * such as `wc`, `grep -F`, `head` or `sha256sum` that only post-process the output of
+ * another process. Running them in place saves a fork, an exec and a pipe hop per stage.
+ */
+
+#ifndef SP_FILTER_H
+#define SP_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Returned by a filter that needs no more input, e.g. once a head limit is reached.
+ */
+#define SP_FILTER_DONE 1
+
+/**
+ * Size in bytes of the digest computed by sp_filter_type::SP_FILTER_SHA256.
+ */
+#define SP_FILTER_SHA256_SIZE 32
+
+/**
+ * The output of a filter, passed on to the next filter of the chain
+ * or written to the output file descriptor.
+ *
+ * @see sp_filter_emit
+ */
+typedef struct sp_filter_out SP_FilterOut;
+
+struct sp_filter;
+
+/**
+ * A filter function.
+ *
+ * Called for every chunk of input, then once more with data NULL and size 0
+ * at the end of the input to emit anything it held back, unless it returned
+ * #SP_FILTER_DONE.
+ * Chunks do not follow line boundaries.
+ *
+ * @param[in,out] filter the filter, holding sp_filter::arg.
+ * @param[in] data the input chunk.
+ * @param[in] size number of bytes in data.
+ * @param[in,out] out where to emit the output with sp_filter_emit().
+ * @return 0 to continue, #SP_FILTER_DONE when no more input is needed,
+ *         or -1 on error and errno is set accordingly.
+ */
+typedef int (*SP_FilterFn)(struct sp_filter* filter, const char* data,
+                           size_t size, SP_FilterOut* out);
+
+/**
+ * The built-in filters.
+ *
+ * @see sp_filter
+ */
+typedef enum sp_filter_type {
+    SP_FILTER_FN = 0,      ///< Call the function sp_filter::value::fn.
+    SP_FILTER_COUNT,       ///< Count lines like `wc -l`, passing the input through.
+    SP_FILTER_GREP,        ///< Keep lines containing sp_filter::value::pattern, like `grep -F`.
+    SP_FILTER_HEAD,        ///< Keep the first sp_filter::value::limit bytes, like `head -c`.
+    SP_FILTER_HEAD_LINES,  ///< Keep the first sp_filter::value::limit lines, like `head -n`.
+    SP_FILTER_SHA256,      ///< Compute a SHA-256 digest, passing the input through.
+} SP_FilterType;
+
+/**
+ * A stage of a filter chain, and its results once sp_filter() returns.
+ *
+ * It is recommended to use the SP_FILTER_* macros below for configuring the struct.
+ * @see filter.h
+ */
+typedef struct sp_filter {
+    SP_FilterType type;  ///< The type of filter.
+    union {
+        SP_FilterFn fn;       ///< The function of sp_filter_type::SP_FILTER_FN.
+        const char* pattern;  ///< The substring matched by sp_filter_type::SP_FILTER_GREP.
+        uint64_t limit;       ///< The limit of the head filters.
+    } value;                  ///< The value of the filter.
+    void* arg;          ///< Passed to sp_filter::value::fn, unused by built-in filters.
+    uint64_t bytesIn;   ///< Number of bytes given to the filter.
+    uint64_t bytesOut;  ///< Number of bytes emitted by the filter.
+    /// Number of lines counted by sp_filter_type::SP_FILTER_COUNT,
+    /// or matched by sp_filter_type::SP_FILTER_GREP.
+    uint64_t lines;
+    /// The digest computed by sp_filter_type::SP_FILTER_SHA256.
+    unsigned char digest[SP_FILTER_SHA256_SIZE];
+} SP_Filter;
+
+/**
+ * Setup sp_filter to call a function.
+ *
+ * @param[in] _fn SP_FilterFn
+ * @param[in] _arg void* stored in sp_filter::arg.
+ */
+#define SP_FILTER_FN(_fn, _arg) \
+    (SP_Filter) { .type = SP_FILTER_FN, .value.fn = (_fn), .arg = (_arg) }
+
+/**
+ * Setup sp_filter to count lines.
+ */
+#define SP_FILTER_COUNT() \
+    (SP_Filter) { .type = SP_FILTER_COUNT }
+
+/**
+ * Setup sp_filter to keep the lines containing a substring.
+ *
+ * @param[in] _pattern char* holding the substring, which must not contain a newline.
+ */
+#define SP_FILTER_GREP(_pattern) \
+    (SP_Filter) { .type = SP_FILTER_GREP, .value.pattern = (_pattern) }
+
+/**
+ * Setup sp_filter to keep the first bytes.
+ *
+ * @param[in] _limit number of bytes.
+ */
+#define SP_FILTER_HEAD(_limit) \
+    (SP_Filter) { .type = SP_FILTER_HEAD, .value.limit = (_limit) }
+
+/**
+ * Setup sp_filter to keep the first lines.
+ *
+ * @param[in] _limit number of lines.
+ */
+#define SP_FILTER_HEAD_LINES(_limit) \
+    (SP_Filter) { .type = SP_FILTER_HEAD_LINES, .value.limit = (_limit) }
+
+/**
+ * Setup sp_filter to compute a SHA-256 digest.
+ */
+#define SP_FILTER_SHA256() \
+    (SP_Filter) { .type = SP_FILTER_SHA256 }
+
+/**
+ * Run everything read from fd through a chain of filters until end of file,
+ * writing the output of the last filter to outFd.
+ *
+ * Reading stops early once the first filter returns #SP_FILTER_DONE, like a pipeline stops
+ * when `head` exits. The caller should then close fd so the writing process gets SIGPIPE.
+ * A later filter returning it gets no more input, but the filters before it keep running,
+ * e.g. SP_FILTER_COUNT() still counts every line, and their output is dropped.
+ * sp_filter_emit() tells them, so they can return #SP_FILTER_DONE too, as SP_FILTER_GREP()
+ * does.
+ * outFd is not closed.
+ * <br>
+ * Example, mimicking `seq 1000 | grep 7 | head -n 5 | tr -d 7` with one process less:
+ * \code{.c}
+ * SP_Process* seq = sp_open(SP_ARGV("seq", "1000"), SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+ * SP_Process* tr = sp_open(SP_ARGV("tr", "-d", "7"), SP_OPTS(.spstdin = SP_REDIR_PIPE()));
+ * SP_Filter filters[] = {SP_FILTER_GREP("7"), SP_FILTER_HEAD_LINES(5)};
+ * sp_filter(fileno(seq->spstdout), filters, 2, fileno(tr->spstdin));
+ * sp_close(tr);
+ * \endcode
+ *
+ * @param[in] fd the file descriptor being read, e.g. fileno(proc->spstdout).
+ * @param[in,out] filters the chain of filters, in order.
+ * @param[in] nFilters number of filters.
+ * @param[in] outFd where to write the output, or -1 to discard it, e.g. when only the
+ *            counters or the digest are needed.
+ * @return the number of bytes read from fd, or -1 on error and errno is set accordingly.
+ */
+ssize_t sp_filter(int fd, SP_Filter* filters, size_t nFilters, int outFd);
+
+/**
+ * Run a buffer through a chain of filters, e.g. the output captured by
+ * sp_tee_type::SP_TEE_CAPTURE.
+ *
+ * @param[in] buf the input.
+ * @param[in] size number of bytes in buf.
+ * @param[in,out] filters the chain of filters, in order.
+ * @param[in] nFilters number of filters.
+ * @param[in] outFd where to write the output, or -1 to discard it.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ * @see sp_filter
+ */
+int sp_filter_buf(const char* buf, size_t size, SP_Filter* filters,
+                  size_t nFilters, int outFd);
+
+/**
+ * Emit output from a filter function.
+ *
+ * @param[in,out] out the output given to the filter function.
+ * @param[in] data
+ * @param[in] size number of bytes in data.
+ * @return 0 to continue, #SP_FILTER_DONE if the rest of the chain needs no more input,
+ *         or -1 on error and errno is set accordingly.
+ */
+int sp_filter_emit(SP_FilterOut* out, const char* data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_FILTER_H
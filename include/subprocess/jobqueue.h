@@ -0,0 +1,168 @@
+/**
+ * @file
+ * @brief Job Queue API
+ */
+
+#ifndef SP_JOBQUEUE_H
+#define SP_JOBQUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "subprocess/pressure.h"
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The result of a job, reported through sp_job_callback.
+ */
+typedef struct sp_job_result {
+    size_t id;  ///< id returned by sp_jobqueue_push()
+    /**
+     * The process that ran the job, or NULL if it was never started.
+     * Destroyed after the callback returns.
+     */
+    SP_Process* process;
+    int exitCode;  ///< exit code of the process, or -1 if it was never started or reaped.
+    /**
+     * errno of sp_open() if it failed, ECANCELED if cancelled, ECHILD if the process
+     * was reaped by someone else, e.g. with waitpid(-1), else 0.
+     */
+    int error;
+    uint64_t runtimeNs;  ///< nanoseconds between spawning and reaping the process.
+} SP_JobResult;
+
+/**
+ * Called once for every job pushed to a queue when it finishes, fails to start,
+ * or is cancelled.
+ *
+ * @param[in] result
+ * @param[in] data the data given to sp_jobqueue_create()
+ */
+typedef void (*SP_JobCallback)(const SP_JobResult* result, void* data);
+
+/**
+ * Throughput counters of a job queue.
+ *
+ * @see sp_jobqueue_stats
+ */
+typedef struct sp_jobqueue_stats {
+    size_t pushed;     ///< jobs pushed to the queue.
+    size_t queued;     ///< jobs waiting for a free slot.
+    size_t running;    ///< jobs currently running.
+    size_t succeeded;  ///< jobs that exited with 0.
+    size_t failed;     ///< jobs that exited non zero or were reaped elsewhere.
+    size_t spawnErrors;  ///< jobs that could not be started.
+    size_t cancelled;    ///< jobs cancelled before they finished.
+    uint64_t elapsedNs;  ///< nanoseconds since the first job was started.
+    double jobsPerSec;   ///< finished jobs per second over elapsedNs.
+} SP_JobQueueStats;
+
+/**
+ * An opaque queue of jobs of which at most a fixed number run at once.
+ *
+ * @see sp_jobqueue_create
+ */
+typedef struct sp_jobqueue SP_JobQueue;
+
+/**
+ * Create a job queue, mimicking `xargs -P maxRunning`.
+ *
+ * Jobs are started when the queue is driven by sp_jobqueue_poll() or sp_jobqueue_wait().
+ * The next job is started as soon as a running one exits, which is detected through
+ * pidfds rather than by periodically polling waitpid(2) where the kernel supports them.
+ *
+ * @param[in] maxRunning maximum number of jobs running at once, must be at least 1.
+ * @param[in] callback called when a job finishes, or NULL.
+ * @param[in] data passed to callback.
+ * @return a pointer to a new sp_jobqueue or NULL on error and errno is set accordingly.
+ */
+SP_JobQueue* sp_jobqueue_create(size_t maxRunning, SP_JobCallback callback,
+                                void* data);
+
+/**
+ * Add a job to the end of the queue. It is started later by sp_jobqueue_poll().
+ *
+ * argv is copied, but anything referenced by opts, such as sp_opts::cwd or redirection paths,
+ * must remain valid until the job has started.
+ * Pipes opened through opts must be small enough or drained by the callback,
+ * otherwise the job blocks while writing to them.
+ *
+ * @param[in,out] queue
+ * @param[in] argv NULL terminated array of arguments. argv[0] is the program to run.
+ * @param[in] opts options used when spawning the process, can be NULL. See sp_opts
+ * @return the id of the job, or -1 on error and errno is set accordingly.
+ */
+ssize_t sp_jobqueue_push(SP_JobQueue* queue, char** argv, SP_Opts* opts);
+
+/**
+ * Start jobs until the running limit is reached, then wait for at least one of them to exit
+ * and report every finished job through the callback.
+ *
+ * @param[in,out] queue
+ * @param[in] timeoutMs maximum time to wait in milliseconds, or -1 to wait indefinitely.
+ * @return the number of jobs reported, 0 if the timeout expired or the queue is empty,
+ *         or -1 on error and errno is set accordingly.
+ */
+int sp_jobqueue_poll(SP_JobQueue* queue, int timeoutMs);
+
+/**
+ * Throttle starting jobs with a pressure controller, on top of the running limit.
+ * A job is only started while sp_pressure_admit() allows it, except when no job is running.
+ *
+ * @param[in,out] queue
+ * @param[in] pressure the controller, which must outlive the queue, or NULL to stop throttling.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ * @see pressure.h
+ */
+int sp_jobqueue_set_pressure(SP_JobQueue* queue, SP_Pressure* pressure);
+
+/**
+ * Run every job in the queue to completion.
+ *
+ * @param[in,out] queue
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_jobqueue_wait(SP_JobQueue* queue);
+
+/**
+ * Cancel a job. A queued job is reported as cancelled right away,
+ * a running job is sent SIGKILL and reported as cancelled once it is reaped.
+ *
+ * @param[in,out] queue
+ * @param[in] id the id returned by sp_jobqueue_push()
+ * @return 0 on success, -1 on error and errno is set to ENOENT if the job already finished.
+ */
+int sp_jobqueue_cancel(SP_JobQueue* queue, size_t id);
+
+/**
+ * Cancel every queued and running job.
+ *
+ * @param[in,out] queue
+ */
+void sp_jobqueue_cancel_all(SP_JobQueue* queue);
+
+/**
+ * Get the throughput counters of a queue.
+ *
+ * @param[in] queue
+ * @param[out] stats
+ */
+void sp_jobqueue_stats(SP_JobQueue* queue, SP_JobQueueStats* stats);
+
+/**
+ * Cancel all jobs, wait for the running ones to exit, and free the queue.
+ * If the queue is NULL, this function does nothing.
+ *
+ * @param[in,out] queue
+ */
+void sp_jobqueue_destroy(SP_JobQueue* queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_JOBQUEUE_H
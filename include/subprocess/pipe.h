@@ -11,6 +11,10 @@
 
 #include "subprocess/redirect.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Close the file descriptor and set it to -1.
  * If the fd is already closed (-1) then nothing is done.
@@ -25,6 +29,8 @@ int sp_fd_close(int* fd);
  * If nonBlocking is true the O_NONBLOCK flag is also applied.
  * If opt->type is SP_REDIR_BYTES the data is written to the pipe as soon as it is created,
  * and the write end is closed.
+ * If opt->type is SP_REDIR_SOCKET a socketpair is created instead, with the ends
+ * placed like those of a pipe.
  *
  * @param[in,out] opt the redirect option being changed.
  * @param[in] nonBlocking if true the pipe will be non-blocking.
@@ -51,4 +57,8 @@ int sp_pipe_close(int fd[2]);
  */
 FILE* sp_pipe_fdopen(int fd[2], bool isInput);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif  // SP_PIPE_H
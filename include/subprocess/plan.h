@@ -0,0 +1,207 @@
+/**
+ * @file
+ * @brief Spawn Plan API
+ *
+ * The options of sp_open() are compiled by the parent into a flat list of operations,
+ * which the child runs between fork(2) and exec with raw system calls only.
+ * Nothing in the child allocates memory, uses stdio or takes a lock, so it is
+ * async-signal-safe and does not depend on the state other threads left the parent in.
+ */
+
+#ifndef SP_PLAN_H
+#define SP_PLAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "subprocess/process.h"
+#include "subprocess/trace.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The operations a child can run.
+ *
+ * @see sp_plan_op
+ */
+typedef enum sp_plan_op_type {
+    SP_OP_MARK = 0,     ///< Record the trace mark sp_plan_op::arg.
+    SP_OP_CHDIR,        ///< chdir(2) to sp_plan_op::path.
+    SP_OP_SETSID,       ///< setsid(2).
+    SP_OP_SETPGID,      ///< setpgid(2) to lead a new process group.
+    /**
+     * Set the parent death signal to sp_plan_op::arg, and raise it if the parent
+     * with pid sp_plan_op::fd already died.
+     */
+    SP_OP_DEATHSIG,
+    /**
+     * open(2) sp_plan_op::path with the flags sp_plan_op::arg and the mode
+     * sp_plan_op::mode, preallocate sp_plan_op::length bytes, and move it to
+     * sp_plan_op::target.
+     */
+    SP_OP_OPEN,
+    SP_OP_DUP2,   ///< dup2(2) sp_plan_op::fd to sp_plan_op::target.
+    SP_OP_CLOSE,  ///< close(2) sp_plan_op::fd.
+    /**
+     * Duplicate sp_plan_op::fd to the lowest fd from sp_plan_op::target, close-on-exec.
+     * The new fd is the number sp_plan_op::arg of the moved fds.
+     */
+    SP_OP_MOVE,
+    SP_OP_PLACE,  ///< dup2(2) the moved fd number sp_plan_op::arg to sp_plan_op::target.
+    /**
+     * Close every fd from sp_plan_op::fd to sp_plan_op::target, or to the last one
+     * if sp_plan_op::target is -1.
+     */
+    SP_OP_CLOSE_RANGE,
+    SP_OP_FAIL,  ///< Fail with the errno sp_plan_op::arg, for options that are invalid.
+    /**
+     * Move the child into the cgroup directory sp_plan_op::fd, unless it is -1 because
+     * the child was created in it, see sp_plan_cgroup().
+     */
+    SP_OP_CGROUP,
+    SP_OP_RLIMIT,  ///< setrlimit(2) the first sp_plan_op::arg entries of sp_plan::rlimits.
+    /**
+     * Read the program to execute from sp_plan_op::fd, see sp_plan_message(), and close it.
+     * The child exits quietly with 0 if it is closed without a message.
+     */
+    SP_OP_GATE,
+} SP_PlanOpType;
+
+/**
+ * A single operation of a sp_plan.
+ */
+typedef struct sp_plan_op {
+    SP_PlanOpType type;  ///< the operation.
+    int fd;              ///< the source fd, see sp_plan_op_type.
+    int target;          ///< the target fd, see sp_plan_op_type.
+    int arg;             ///< flags, signal, errno, index or trace mark, see sp_plan_op_type.
+    const char* path;    ///< path for SP_OP_CHDIR and SP_OP_OPEN, owned by the options.
+    const char* what;    ///< printed to stderr if the operation fails.
+    mode_t mode;         ///< permissions of a file created by SP_OP_OPEN.
+    off_t length;        ///< bytes preallocated by SP_OP_OPEN, or 0.
+} SP_PlanOp;
+
+/**
+ * The operations to run in the child and the program to execute.
+ *
+ * @see sp_plan_compile
+ */
+typedef struct sp_plan {
+    SP_PlanOp* ops;      ///< the operations, run in order.
+    size_t size;         ///< number of operations.
+    size_t capacity;     ///< allocated size of ops.
+    size_t nMoved;       ///< number of SP_OP_MOVE operations.
+    int fdLimit;         ///< one above the highest fd, for closing ranges without close_range(2).
+    char** argv;         ///< the arguments, owned by the caller of sp_open().
+    size_t argc;         ///< number of arguments.
+    char** env;          ///< the environment, or NULL to keep the parent's.
+    bool search;         ///< search argv[0] in PATH, false if sp_opts::env is set.
+    /**
+     * NULL terminated list of paths passed to execve(2) in turn, mirroring the PATH search
+     * of execvp(3), which is not async-signal-safe.
+     */
+    char** candidates;
+    SP_ChildFn fn;  ///< called instead of executing argv if not NULL, see sp_fork_fn().
+    void* fnArg;    ///< the argument of fn.
+    const SP_Rlimit* rlimits;  ///< sp_opts::rlimits, owned by the options.
+} SP_Plan;
+
+/**
+ * Compile the options of a process into a plan. Called by sp_open() after the pipes of
+ * the redirections are created and before fork(2).
+ * Invalid options are compiled into a SP_OP_FAIL operation so the child reports them.
+ *
+ * @param[out] plan
+ * @param[in] argv NULL terminated array of arguments, referenced by the plan.
+ * @param[in,out] opts options of the process, can be NULL. sp_opts::redirOrder is fixed
+ *                if it is invalid.
+ * @param[in] parent pid of the parent process.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_plan_compile(SP_Plan* plan, char** argv, SP_Opts* opts, pid_t parent);
+
+/**
+ * Set the program a plan executes, without any operation.
+ * Called by sp_plan_compile().
+ *
+ * @param[out] plan
+ * @param[in] argv NULL terminated array of arguments, referenced by the plan.
+ * @param[in] env the environment, or NULL to keep the parent's and search argv[0] in PATH.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_plan_exec(SP_Plan* plan, char** argv, char** env);
+
+/**
+ * Make the child wait after the operations for the program to execute,
+ * which the parent sends later with sp_plan_message(). The program set by
+ * sp_plan_compile() is ignored.
+ *
+ * @param[in,out] plan
+ * @param[in] fd the fd the child reads the program from, mapped with sp_opts::fdMap.
+ * @param[in] parentFd the parent's end of fd, closed in the child so it sees the end of
+ *            file if the parent closes it, or -1.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_plan_gate(SP_Plan* plan, int fd, int parentFd);
+
+/**
+ * Make the child move itself into a cgroup, because it could not be created in it
+ * with CLONE_INTO_CGROUP. Called by sp_open() before fork(2).
+ *
+ * @param[in,out] plan compiled with sp_opts::cgroup.
+ * @param[in] fd the cgroup directory.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_plan_cgroup(SP_Plan* plan, int fd);
+
+/**
+ * Serialize the program of a plan for a child waiting on SP_OP_GATE.
+ * The parent's environment is sent if sp_plan::env is NULL.
+ *
+ * @param[in] plan
+ * @param[out] msg the message, to be freed with free().
+ * @param[out] size size of msg in bytes.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_plan_message(const SP_Plan* plan, char** msg, size_t* size);
+
+/**
+ * open(2) a file, preallocate it and move it to a target fd, which runs SP_OP_OPEN.
+ * Async-signal-safe. Also called by sp_redirect() for SP_REDIR_OPEN().
+ *
+ * @param[in] path
+ * @param[in] flags open(2) flags.
+ * @param[in] mode permissions of a created file.
+ * @param[in] length bytes to preallocate, or 0.
+ * @param[in] target the fd the file is moved to.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_plan_open(const char* path, int flags, mode_t mode, off_t length,
+                 int target);
+
+/**
+ * Run a plan and execute the program. Called in the child after fork(2).
+ * Only async-signal-safe functions are called, apart from sp_plan::fn.
+ *
+ * @param[in] plan
+ * @param[in,out] trace memory shared with the parent when tracing, or NULL
+ * @return the exit code for the child if an operation or exec fails,
+ *         SP_EXIT_NOT_EXECUTE or SP_EXIT_NOT_FOUND, or the return value of sp_plan::fn.
+ */
+int sp_plan_run(const SP_Plan* plan, SP_TraceChild* trace);
+
+/**
+ * Free the memory of a plan.
+ *
+ * @param[in,out] plan
+ */
+void sp_plan_free(SP_Plan* plan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_PLAN_H
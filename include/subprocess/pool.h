@@ -0,0 +1,121 @@
+/**
+ * @file
+ * @brief Process Pool API
+ *
+ * A pool keeps children that have already been forked and have applied the options,
+ * the redirections, the fd sweep and so on, and that wait on a gate just before
+ * execve(2). Spawning from the pool only sends the arguments and environment through
+ * the gate, so the latency left on the caller's path is about that of a single exec.
+ * A background thread forks new children to keep the pool at its size.
+ * <br>
+ * Example:
+ * \code{.c}
+ * SP_Pool* pool = sp_pool_create(SP_OPTS(.spstdout = SP_REDIR_PIPE()), 4);
+ * sp_pool_fill(pool);
+ * SP_Process* p = sp_pool_open(pool, SP_ARGV("echo", "hi"), NULL);
+ * sp_wait(p);
+ * sp_destroy(p);
+ * sp_pool_destroy(pool);
+ * \endcode
+ */
+
+#ifndef SP_POOL_H
+#define SP_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * An opaque pool of pre-forked children.
+ *
+ * @see sp_pool_create
+ */
+typedef struct sp_pool SP_Pool;
+
+/**
+ * Counters of a pool.
+ *
+ * @see sp_pool_stats
+ */
+typedef struct sp_pool_stats {
+    size_t warm;      ///< children forked and waiting on their gate.
+    uint64_t hits;    ///< processes spawned by a waiting child.
+    uint64_t misses;  ///< processes spawned by forking, as no child was waiting.
+} SP_PoolStats;
+
+/**
+ * Create a pool and start forking its children in the background.
+ *
+ * Every child is spawned with the same options, which are copied, but anything they
+ * reference such as sp_opts::cwd must remain valid until sp_pool_destroy().
+ * sp_opts::notify is not supported, nor is sp_opts::deathSignal, as prctl(2) ties it to
+ * the background thread forking the children rather than to the process.
+ *
+ * @param[in] opts options of every child, can be NULL. See sp_opts
+ * @param[in] size number of children kept waiting.
+ * @return a pointer to a new sp_pool or NULL on error and errno is set accordingly.
+ */
+SP_Pool* sp_pool_create(const SP_Opts* opts, size_t size);
+
+/**
+ * Wait until the pool holds all of its children.
+ *
+ * @param[in,out] pool
+ * @return 0 on success, -1 on error and errno is set accordingly, if a child
+ *         could not be forked.
+ */
+int sp_pool_fill(SP_Pool* pool);
+
+/**
+ * Run a program in a waiting child, or in a new one if none is waiting.
+ * The program is found like with sp_open().
+ *
+ * @param[in,out] pool
+ * @param[in] argv NULL terminated array of arguments. argv[0] is the program to run.
+ * @param[in] env the environment, or NULL for sp_opts::env of the pool or, if that is
+ *            NULL too, the caller's current environment.
+ * @return a pointer to a new sp_process, owned by the caller,
+ *         or NULL on error and errno is set accordingly.
+ */
+SP_Process* sp_pool_open(SP_Pool* pool, char** argv, char** env);
+
+/**
+ * Get the counters of a pool.
+ *
+ * @param[in,out] pool
+ * @param[out] stats
+ */
+void sp_pool_stats(SP_Pool* pool, SP_PoolStats* stats);
+
+/**
+ * Stop the background thread and kill the waiting children.
+ * Processes returned by sp_pool_open() are not affected.
+ *
+ * @param[in] pool
+ */
+void sp_pool_destroy(SP_Pool* pool);
+
+/**
+ * Spawn a child that runs the options, then waits on a gate for its program.
+ * Called by the pool.
+ *
+ * @param[in,out] opts options of the child, mapping the gate with sp_opts::fdMap.
+ * @param[in] gateFd the fd of the gate in the child.
+ * @param[in] gateParentFd the parent's end of the gate, closed in the child.
+ * @return a pointer to a new sp_process with no sp_process::argv,
+ *         or NULL on error and errno is set accordingly.
+ * @see sp_plan_gate
+ */
+SP_Process* sp_open_gated(SP_Opts* opts, int gateFd, int gateParentFd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_POOL_H
@@ -0,0 +1,156 @@
+/**
+ * @file
+ * @brief Pressure Controller API
+ *
+ * Adapts the number of live children to the load of the machine, using the Linux
+ * pressure stall information (PSI) in /proc/pressure instead of a fixed limit.
+ * The limit is halved while the stall time of the CPU, memory or I/O is above a target,
+ * and grows by one while it is below half of the target.
+ * <br>
+ * Example, deferring spawns on a busy machine:
+ * \code{.c}
+ * SP_Pressure* pressure = sp_pressure_create(&(SP_PressureOpts){.target = 20});
+ * for (int i = 0; i < 100; i++) {
+ *     procs[i] = sp_pressure_open(pressure, SP_ARGV("work"), NULL, -1);
+ *     // Children are counted until they are reaped.
+ *     reap_finished(procs, i);
+ * }
+ * sp_pressure_destroy(pressure);
+ * \endcode
+ */
+
+#ifndef SP_PRESSURE_H
+#define SP_PRESSURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The directory holding the pressure files of the whole system.
+ */
+#define SP_PRESSURE_DIR "/proc/pressure"
+
+/**
+ * Options of a pressure controller. Zero initialized fields take their default.
+ *
+ * @see sp_pressure_create
+ */
+typedef struct sp_pressure_opts {
+    /// Directory holding the files cpu, memory and io, #SP_PRESSURE_DIR by default.
+    /// Tests can point this to files they write themselves.
+    const char* dir;
+    double target;  ///< highest acceptable stall percentage, 10 by default.
+    size_t minLimit;  ///< lowest limit, 1 by default.
+    size_t maxLimit;  ///< highest limit, twice the number of online CPUs by default.
+    int intervalMs;   ///< minimum time between two samples, 500 by default.
+} SP_PressureOpts;
+
+/**
+ * A reading of the pressure files.
+ *
+ * @see sp_pressure_update
+ */
+typedef struct sp_pressure_sample {
+    /// Percentage of time some tasks stalled on the CPU, memory and I/O, indexed by
+    /// sp_pressure_resource, or -1 when the file could not be read.
+    /// Computed from the growth of the `total` stall time since the previous sample,
+    /// or taken from `avg10` for the first sample.
+    double stall[3];
+    uint64_t live;  ///< processes spawned by the library and not reaped yet.
+    size_t limit;   ///< the limit after this sample.
+} SP_PressureSample;
+
+/**
+ * Indexes of sp_pressure_sample::stall.
+ */
+typedef enum sp_pressure_resource {
+    SP_PRESSURE_CPU = 0,  ///< the file cpu.
+    SP_PRESSURE_MEMORY,   ///< the file memory.
+    SP_PRESSURE_IO,       ///< the file io.
+} SP_PressureResource;
+
+/**
+ * An opaque pressure controller.
+ *
+ * A controller is not thread-safe.
+ * @see sp_pressure_create
+ */
+typedef struct sp_pressure SP_Pressure;
+
+/**
+ * Create a pressure controller. The limit starts at the number of online CPUs.
+ *
+ * @param[in] opts options of the controller, can be NULL. See sp_pressure_opts
+ * @return a pointer to a new sp_pressure or NULL on error and errno is set accordingly.
+ */
+SP_Pressure* sp_pressure_create(const SP_PressureOpts* opts);
+
+/**
+ * Read the pressure files now and adapt the limit.
+ * Files that cannot be read are ignored, so the limit only changes with at least one.
+ *
+ * @param[in,out] pressure
+ * @param[out] sample the reading, can be NULL.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_pressure_update(SP_Pressure* pressure, SP_PressureSample* sample);
+
+/**
+ * Get the current limit of live children, sampling first if sp_pressure_opts::intervalMs
+ * passed since the previous sample.
+ *
+ * @param[in,out] pressure
+ * @return the limit, or 0 if pressure is NULL.
+ */
+size_t sp_pressure_limit(SP_Pressure* pressure);
+
+/**
+ * Whether one more child may be spawned now, because the live children are below the limit.
+ *
+ * @param[in,out] pressure
+ * @return true if a child may be spawned.
+ */
+bool sp_pressure_admit(SP_Pressure* pressure);
+
+/**
+ * Spawn a process once the controller admits it, sampling the pressure while waiting.
+ *
+ * The live children are only counted down once they are reaped, so processes spawned
+ * before must be reaped, e.g. with sp_poll(), by another thread or by the reaper.
+ *
+ * @param[in,out] pressure
+ * @param[in] argv NULL terminated array of arguments. argv[0] is the program to run.
+ * @param[in,out] opts options used when spawning the process, can be NULL. See sp_opts
+ * @param[in] timeoutMs maximum time to wait in milliseconds, or -1 to wait indefinitely.
+ * @return a pointer to a new sp_process or NULL on error and errno is set accordingly.
+ *         errno is ETIMEDOUT if the process was not admitted in time.
+ */
+SP_Process* sp_pressure_open(SP_Pressure* pressure, char** argv, SP_Opts* opts,
+                             int timeoutMs);
+
+/**
+ * Free a pressure controller. If the controller is NULL, this function does nothing.
+ *
+ * @param[in] pressure
+ */
+void sp_pressure_destroy(SP_Pressure* pressure);
+
+/**
+ * Get the minimum time between two samples. Called by the job queue.
+ *
+ * @param[in] pressure
+ * @return milliseconds
+ */
+int sp_pressure_interval(SP_Pressure* pressure);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_PRESSURE_H
@@ -6,13 +6,19 @@
 #ifndef SP_PROCESS_H
 #define SP_PROCESS_H
 
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
 #include "subprocess/error.h"
 #include "subprocess/pipe.h"
 #include "subprocess/redirect.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Offset added to signal numbers when setting the exit code.
  */
@@ -31,7 +37,8 @@ typedef enum sp_status {
  * A struct containing data pertintent to a process.
  * sp_process::spstdin, sp_process::spstdout, and sp_process::spstderr
  * are only opened if the corresponding option in sp_opts
- * specifies sp_redir_type::SP_REDIR_PIPE.
+ * specifies sp_redir_type::SP_REDIR_PIPE, sp_process::sockets if it specifies
+ * sp_redir_type::SP_REDIR_SOCKET.
  *
  * @see sp_destroy
  */
@@ -43,8 +50,93 @@ typedef struct sp_process {
     FILE* spstdin;   ///< stdin of process
     FILE* spstdout;  ///< stdout of process
     FILE* spstderr;  ///< stderr of process
+    /**
+     * The parent's end of the sockets of SP_REDIR_SOCKET() by target, e.g. SP_STDIN_FILENO,
+     * or -1. Closed by sp_destroy().
+     */
+    int sockets[3];
+    pid_t pgid;  ///< process group id if the process leads its own group, otherwise 0
+    bool signalGroup;  ///< signals are sent to the whole process group
+    struct sp_tail* tail;  ///< outputs redirected with SP_REDIR_TAIL(), see tail.h
+    struct sp_trace_child* trace;  ///< child timestamps when traced, see trace.h
+    struct sp_ready* ready;  ///< readiness notification, see ready.h
+    struct sp_cgroup* cgroup;  ///< cgroup created for sp_opts::cgroup, see cgroup.h
+    /**
+     * The limits the process hit, a combination of sp_limit_hit, set once it is waited on.
+     */
+    int limitHit;
 } SP_Process;
 
+/**
+ * Places a file descriptor of the parent at a chosen file descriptor in the child.
+ *
+ * @see sp_opts::fdMap
+ * @see SP_FD_MAP()
+ */
+typedef struct sp_fd_map {
+    int parentFd;  ///< file descriptor in the parent, it is not closed.
+    int childFd;   ///< file descriptor in the child, must be greater than 2.
+} SP_FdMap;
+
+/**
+ * A resource limit set with setrlimit(2) in the child before exec.
+ *
+ * @see sp_opts::rlimits
+ * @see SP_RLIMITS()
+ */
+typedef struct sp_rlimit {
+    int resource;  ///< e.g. RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE, RLIMIT_NPROC or RLIMIT_CORE
+    rlim_t soft;   ///< the soft limit, RLIM_INFINITY for none.
+    rlim_t hard;   ///< the hard limit, which can't be raised again by the process.
+} SP_Rlimit;
+
+/**
+ * A cgroup v2 the process is created in, with limits enforced by the kernel
+ * on the process and all its descendants.
+ *
+ * @see sp_opts::cgroup
+ */
+typedef struct sp_cgroup_opts {
+    /**
+     * A cgroup directory delegated to the caller, e.g. by systemd with Delegate=yes,
+     * in which a cgroup is created per process and removed by sp_destroy().
+     * The controllers of the limits must be enabled in its cgroup.subtree_control.
+     */
+    const char* parent;
+    uint64_t memoryMax;    ///< memory.max in bytes, 0 for no limit.
+    uint64_t cpuQuotaUs;   ///< CPU time per period for cpu.max, 0 for no limit.
+    uint64_t cpuPeriodUs;  ///< period of cpu.max, 100000 by default.
+} SP_CgroupOpts;
+
+/**
+ * The limits a process hit, see sp_process::limitHit.
+ */
+typedef enum sp_limit_hit {
+    SP_LIMIT_HIT_NONE = 0,
+    SP_LIMIT_HIT_CPU = 1,     ///< killed by SIGXCPU at the soft RLIMIT_CPU.
+    SP_LIMIT_HIT_FSIZE = 2,   ///< killed by SIGXFSZ for writing beyond RLIMIT_FSIZE.
+    SP_LIMIT_HIT_MEMORY = 4,  ///< the OOM killer ran in its cgroup at memory.max.
+    SP_LIMIT_HIT_CPU_THROTTLED = 8,  ///< its cgroup was throttled by cpu.max.
+} SP_LimitHit;
+
+/**
+ * How a process tells its parent it is ready, see sp_wait_ready().
+ */
+typedef enum sp_notify_type {
+    SP_NOTIFY_NONE = 0,  ///< no notification.
+    /**
+     * The environment variable SP_NOTIFY_FD holds the number of a file descriptor
+     * the process writes the line "READY=1" to.
+     */
+    SP_NOTIFY_FD,
+    /**
+     * The environment variable NOTIFY_SOCKET holds the abstract unix socket the
+     * process sends the datagram "READY=1" to, like sd_notify(3). As with NotifyAccess=main
+     * of systemd.service(5), only datagrams sent by the process itself are accepted.
+     */
+    SP_NOTIFY_SOCKET,
+} SP_NotifyType;
+
 /**
  * A struct containing options when spawning a process.
  *
@@ -55,6 +147,22 @@ typedef struct sp_opts {
     char* cwd;        ///< change the working directory of the process
     char** env;       ///< environment passed to execve
     bool detach;      ///< detach process from parent
+    bool newGroup;    ///< place process in a new process group led by itself
+    /**
+     * Send signals to the whole process group instead of only the process,
+     * including the SIGKILL sent by sp_destroy(), which kills what is left of the group
+     * even if the process already exited. Implies newGroup unless detach is set.
+     * Once the process was waited on, the group is only signalled while a member
+     * is still a child of the caller, see sp_subreaper(), as its id may be reused
+     * otherwise. Those members are reaped by sp_destroy(), which waits for them for
+     * at most a second.
+     */
+    bool signalGroup;
+    /**
+     * Signal sent to the process when the thread that spawned it dies,
+     * see PR_SET_PDEATHSIG in prctl(2). 0 disables it.
+     */
+    int deathSignal;
     bool inheritFds;  ///< don't attempt to close other open file descriptors.
     bool nonBlockingPipes;  ///< Make pipes non-blocking.
     SP_RedirOpt spstdin;    ///< options for stdin
@@ -67,6 +175,26 @@ typedef struct sp_opts {
     * e.g. .redirOrder = {2, 1, 0}
     */
     SP_RedirTarget redirOrder[3];
+    /**
+     * Extra file descriptors to pass to the process, which are kept open even if
+     * inheritFds is false. Each childFd must be unique, but a parentFd may be used
+     * by several entries or be the same number as another entry's childFd.
+     */
+    SP_FdMap* fdMap;
+    size_t fdMapSize;  ///< number of entries in fdMap
+    SP_NotifyType notify;  ///< how the process notifies readiness, see sp_wait_ready()
+    /**
+     * Resource limits set in the child before exec, also see SP_RLIMITS().
+     * A hard limit above the caller's own can't be set, so the process fails to start.
+     */
+    SP_Rlimit* rlimits;
+    size_t rlimitsSize;  ///< number of entries in rlimits
+    /**
+     * Create the process in a cgroup of its own, can be NULL.
+     * The process is created in it directly with CLONE_INTO_CGROUP, or
+     * moves itself into it before exec where clone3(2) does not support it.
+     */
+    const SP_CgroupOpts* cgroup;
 } SP_Opts;
 
 /**
@@ -105,6 +233,35 @@ typedef struct sp_opts {
  */
 #define SP_OPTS(...) &((SP_Opts){__VA_ARGS__})
 
+/**
+ * A convenience macro for setting sp_opts::fdMap and sp_opts::fdMapSize in SP_OPTS().
+ * <br>
+ * Example, passing pipeFd as fd 3 and sockFd as fd 4:
+ * \code{.c}
+ * sp_run(SP_ARGV("prog"), SP_OPTS(SP_FD_MAP({pipeFd, 3}, {sockFd, 4})));
+ * \endcode
+ *
+ * @param[in] ... sp_fd_map initializers
+ */
+#define SP_FD_MAP(...)                  \
+    .fdMap = (SP_FdMap[]){__VA_ARGS__}, \
+    .fdMapSize = sizeof((SP_FdMap[]){__VA_ARGS__}) / sizeof(SP_FdMap)
+
+/**
+ * A convenience macro for setting sp_opts::rlimits and sp_opts::rlimitsSize in SP_OPTS().
+ * <br>
+ * Example, limiting the address space to 1GiB and disabling core dumps:
+ * \code{.c}
+ * sp_run(SP_ARGV("prog"), SP_OPTS(SP_RLIMITS({RLIMIT_AS, 1 << 30, 1 << 30},
+ *                                            {RLIMIT_CORE, 0, 0})));
+ * \endcode
+ *
+ * @param[in] ... sp_rlimit initializers
+ */
+#define SP_RLIMITS(...)                     \
+    .rlimits = (SP_Rlimit[]){__VA_ARGS__}, \
+    .rlimitsSize = sizeof((SP_Rlimit[]){__VA_ARGS__}) / sizeof(SP_Rlimit)
+
 /**
  * Macro for getting the size of a fixed array.
  *
@@ -133,6 +290,33 @@ SP_Process* sp_run(char** argv, SP_Opts* options);
  */
 SP_Process* sp_open(char** argv, SP_Opts* options);
 
+/**
+ * A function run in a child by sp_fork_fn().
+ *
+ * @param[in] arg the argument passed to sp_fork_fn().
+ * @return the exit code of the child.
+ */
+typedef int (*SP_ChildFn)(void* arg);
+
+/**
+ * Fork a child that runs a function of this program instead of executing another one.
+ * The options are applied like sp_open() does, then the child calls fn and
+ * _exit(2)'s with its return value, so the exit code is the return value & 0377.
+ * The result is an ordinary sp_process with no sp_process::argv.
+ *
+ * Unlike a program executed by sp_open(), fn inherits the signal handlers and the
+ * memory of the parent. If the parent has other threads, only async-signal-safe
+ * functions are safe to call in fn, as with fork(2).
+ * The parent's stdio buffers are flushed first so fn doesn't write them again,
+ * and the child flushes its own before exiting. sp_opts::env replaces environ.
+ *
+ * @param[in] fn the function to run in the child.
+ * @param[in] arg passed to fn.
+ * @param[in,out] options options used when spawning the process, can be NULL. See sp_opts
+ * @return a pointer to a new sp_process or NULL on error and errno is set accordingly.
+ */
+SP_Process* sp_fork_fn(SP_ChildFn fn, void* arg, SP_Opts* options);
+
 /**
  * Send SIGTERM to a running process.
  *
@@ -153,6 +337,10 @@ int sp_kill(SP_Process* process);
 
 /**
  * Send a signal to a running process.
+ * If the process was opened with sp_opts::signalGroup the signal is sent to its
+ * whole process group, which is possible even after the process itself was waited on
+ * as long as a member of the group is still a child of the caller, see sp_subreaper().
+ * Otherwise it fails like for any process that was waited on.
  *
  * @param[in] process
  * @param[in] signal
@@ -163,6 +351,8 @@ int sp_signal(SP_Process* process, int signal);
 /**
  * Close stdin of a process if it was opened with a pipe and set it to NULL.
  * Can be called multiple times, but only the first call has affect.
+ * A socket of SP_REDIR_SOCKET() is shut down for writing instead, so the process
+ * reads end of file but can still reply.
  *
  * @param[in,out] process
  */
@@ -170,6 +360,8 @@ void sp_close(SP_Process* process);
 
 /**
  * Wait for a process to exit and set process->exitCode accordingly.
+ * Outputs redirected with SP_REDIR_TAIL() are drained of what is left in them, without
+ * waiting for descendants that inherited them to exit.
  *
  * @param[in,out] process
  * @return the exit code of the process or -1 on error and errno is set accordingly.
@@ -193,4 +385,42 @@ int sp_poll(SP_Process* process);
  */
 void sp_destroy(SP_Process* process);
 
+/**
+ * Free all memory allocated to an sp_process without waiting for it to exit.
+ * If the process is NULL, this function does nothing.
+ * If the process is still running, it is killed and handed to the background reaper
+ * with sp_reap_async(), so this never blocks on a process that is slow to die,
+ * e.g. one in uninterruptible sleep.
+ * Unflushed data written to sp_process::spstdin is discarded.
+ *
+ * @param[in,out] process the process being freed
+ * @see sp_reap_async
+ */
+void sp_destroy_async(SP_Process* process);
+
+/**
+ * Open a pidfd referring to a running process, see pidfd_open(2).
+ * The pidfd becomes readable when the process exits, which allows waiting on processes
+ * with poll(2) or epoll(7). It has the O_CLOEXEC flag and must be closed by the caller.
+ *
+ * @param[in] process
+ * @return the pidfd, or -1 on error and errno is set accordingly.
+ */
+int sp_pidfd(SP_Process* process);
+
+/**
+ * Make the calling process a child subreaper, see PR_SET_CHILD_SUBREAPER in prctl(2).
+ * Orphaned descendants are then reparented to the caller instead of init,
+ * allowing sp_destroy() to kill and reap whole process trees opened with
+ * sp_opts::signalGroup.
+ *
+ * @param[in] enable
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_subreaper(bool enable);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif  // SP_PROCESS_H
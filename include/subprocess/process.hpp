@@ -0,0 +1,903 @@
+/**
+ * @file
+ * @brief Header-only C++ API
+ *
+ * RAII wrappers around the C API, and with C++20 coroutine support,
+ * awaitables driven by an epoll(7) event loop over pidfds and pipes.
+ * <br>
+ * Example:
+ * \code{.cpp}
+ * sp::Task<int> count_lines(sp::EventLoop& loop) {
+ *     sp::Process proc = sp::Process::open(
+ *         {"ls", "-l"}, sp::Opts().out(sp::Redir::pipe()));
+ *     char buf[4096];
+ *     int lines = 0;
+ *     while (size_t n = co_await proc.read(loop, buf, sizeof buf)) {
+ *         lines += std::count(buf, buf + n, '\n');
+ *     }
+ *     co_await proc.exited(loop);
+ *     co_return lines;
+ * }
+ *
+ * sp::EventLoop loop;
+ * int lines = loop.run(count_lines(loop));
+ * \endcode
+ */
+
+#ifndef SP_PROCESS_HPP
+#define SP_PROCESS_HPP
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "subprocess/process.h"
+#include "subprocess/ready.h"
+#include "subprocess/redirect.h"
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#include <exception>
+#include <optional>
+#define SP_COROUTINES 1
+#endif
+
+namespace sp {
+
+/**
+ * Throw the current errno as a std::system_error.
+ *
+ * @param[in] what description of the failed operation
+ */
+[[noreturn]] inline void throwErrno(const char* what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+/**
+ * Owning replacement for the SP_REDIR_* macros.
+ * Paths and bytes are copied so the Redir does not depend on the lifetime of its arguments.
+ */
+class Redir {
+public:
+    /// Inherit from the parent, see sp_redir_type::SP_REDIR_INHERIT.
+    Redir() = default;
+
+    /// See SP_REDIR_PIPE().
+    static Redir pipe() { return Redir(SP_REDIR_PIPE); }
+
+    /// See SP_REDIR_PATH().
+    static Redir path(std::string path) {
+        return Redir(SP_REDIR_PATH, std::move(path));
+    }
+
+    /// See SP_REDIR_APPEND().
+    static Redir append(std::string path) {
+        return Redir(SP_REDIR_APPEND, std::move(path));
+    }
+
+    /// See SP_REDIR_DEVNULL().
+    static Redir devnull() { return path("/dev/null"); }
+
+    /// See SP_REDIR_FD().
+    static Redir fd(int fd) {
+        Redir redir(SP_REDIR_FD);
+        redir.fd_ = fd;
+        return redir;
+    }
+
+    /// See SP_REDIR_FILE().
+    static Redir file(FILE* file) { return fd(file ? fileno(file) : -1); }
+
+    /// See SP_REDIR_BYTES(). Only valid for stdin.
+    static Redir bytes(std::string bytes) {
+        return Redir(SP_REDIR_BYTES, std::move(bytes));
+    }
+
+    /// See SP_REDIR_STDOUT(). Only valid for stderr.
+    static Redir toStdout() { return Redir(SP_REDIR_STDOUT); }
+
+    /// See SP_REDIR_STDERR(). Only valid for stdout.
+    static Redir toStderr() { return Redir(SP_REDIR_STDERR); }
+
+    /// See SP_REDIR_TAIL(). Only valid for stdout and stderr.
+    static Redir tail(size_t size) {
+        Redir redir(SP_REDIR_TAIL);
+        redir.size_ = size;
+        return redir;
+    }
+
+    /// See SP_REDIR_SOCKET().
+    static Redir socket(int type = SOCK_STREAM, size_t bufSize = 0) {
+        Redir redir(SP_REDIR_SOCKET);
+        redir.flags_ = type;
+        redir.size_ = bufSize;
+        return redir;
+    }
+
+    /// See SP_REDIR_OPEN().
+    static Redir open(std::string path, int flags, unsigned int mode = 0666,
+                      size_t size = 0) {
+        Redir redir(SP_REDIR_OPEN, std::move(path));
+        redir.flags_ = flags;
+        redir.mode_ = mode;
+        redir.size_ = size;
+        return redir;
+    }
+
+    /**
+     * Build the C struct, which refers to memory owned by this Redir.
+     *
+     * @return the sp_redir_opt
+     */
+    SP_RedirOpt get() const {
+        SP_RedirOpt opt{};
+        opt.type = type_;
+        switch (type_) {
+        case SP_REDIR_PATH:
+        case SP_REDIR_APPEND:
+            opt.value.path = const_cast<char*>(str_.c_str());
+            break;
+        case SP_REDIR_FD:
+            opt.value.fd = fd_;
+            break;
+        case SP_REDIR_BYTES:
+            opt.value.bytes = const_cast<char*>(str_.data());
+            opt.size = str_.size();
+            break;
+        case SP_REDIR_TAIL:
+            opt.size = size_;
+            break;
+        case SP_REDIR_SOCKET:
+            opt.size = size_;
+            opt.flags = flags_;
+            break;
+        case SP_REDIR_OPEN:
+            opt.value.path = const_cast<char*>(str_.c_str());
+            opt.flags = flags_;
+            opt.mode = mode_;
+            opt.size = size_;
+            break;
+        default:
+            break;
+        }
+        return opt;
+    }
+
+private:
+    explicit Redir(SP_RedirType type, std::string str = {})
+        : type_(type), str_(std::move(str)) {}
+
+    SP_RedirType type_ = SP_REDIR_INHERIT;
+    std::string str_;
+    int fd_ = -1;
+    size_t size_ = 0;
+    int flags_ = 0;
+    unsigned int mode_ = 0;
+};
+
+/**
+ * Builder replacing the SP_OPTS() macro, which relies on C compound literals.
+ * Strings are copied so the Opts does not depend on the lifetime of its arguments.
+ * <br>
+ * Example:
+ * \code{.cpp}
+ * sp::Opts opts = sp::Opts().cwd("/etc").out(sp::Redir::pipe()).newGroup();
+ * \endcode
+ */
+class Opts {
+public:
+    /// See sp_opts::cwd.
+    Opts& cwd(std::string cwd) {
+        cwd_ = std::move(cwd);
+        hasCwd_ = true;
+        return *this;
+    }
+
+    /// See sp_opts::env. Each entry is of the form NAME=value.
+    Opts& env(std::vector<std::string> env) {
+        env_ = std::move(env);
+        hasEnv_ = true;
+        return *this;
+    }
+
+    /// See sp_opts::detach.
+    Opts& detach(bool detach = true) {
+        opts_.detach = detach;
+        return *this;
+    }
+
+    /// See sp_opts::inheritFds.
+    Opts& inheritFds(bool inheritFds = true) {
+        opts_.inheritFds = inheritFds;
+        return *this;
+    }
+
+    /// See sp_opts::nonBlockingPipes.
+    Opts& nonBlockingPipes(bool nonBlockingPipes = true) {
+        opts_.nonBlockingPipes = nonBlockingPipes;
+        return *this;
+    }
+
+    /// See sp_opts::newGroup.
+    Opts& newGroup(bool newGroup = true) {
+        opts_.newGroup = newGroup;
+        return *this;
+    }
+
+    /// See sp_opts::signalGroup.
+    Opts& signalGroup(bool signalGroup = true) {
+        opts_.signalGroup = signalGroup;
+        return *this;
+    }
+
+    /// See sp_opts::deathSignal.
+    Opts& deathSignal(int signal) {
+        opts_.deathSignal = signal;
+        return *this;
+    }
+
+    /// See sp_opts::spstdin.
+    Opts& in(Redir redir) {
+        in_ = std::move(redir);
+        return *this;
+    }
+
+    /// See sp_opts::spstdout.
+    Opts& out(Redir redir) {
+        out_ = std::move(redir);
+        return *this;
+    }
+
+    /// See sp_opts::spstderr.
+    Opts& err(Redir redir) {
+        err_ = std::move(redir);
+        return *this;
+    }
+
+    /// See sp_opts::redirOrder.
+    Opts& redirOrder(SP_RedirTarget first, SP_RedirTarget second,
+                     SP_RedirTarget third) {
+        opts_.redirOrder[0] = first;
+        opts_.redirOrder[1] = second;
+        opts_.redirOrder[2] = third;
+        return *this;
+    }
+
+    /// See sp_opts::notify.
+    Opts& notify(SP_NotifyType notify = SP_NOTIFY_FD) {
+        opts_.notify = notify;
+        return *this;
+    }
+
+    /// See sp_opts::fdMap.
+    Opts& mapFd(int parentFd, int childFd) {
+        fdMap_.push_back({parentFd, childFd});
+        return *this;
+    }
+
+    /// See sp_opts::rlimits.
+    Opts& rlimit(int resource, rlim_t soft, rlim_t hard) {
+        rlimits_.push_back({resource, soft, hard});
+        return *this;
+    }
+
+    /// See sp_opts::cgroup.
+    Opts& cgroup(std::string parent, uint64_t memoryMax = 0,
+                 uint64_t cpuQuotaUs = 0, uint64_t cpuPeriodUs = 0) {
+        cgroupParent_ = std::move(parent);
+        cgroup_ = {nullptr, memoryMax, cpuQuotaUs, cpuPeriodUs};
+        hasCgroup_ = true;
+        return *this;
+    }
+
+    /**
+     * Build the C struct, which refers to memory owned by this Opts.
+     * A new struct must be built for every spawn as sp_open() modifies it.
+     * Building fills buffers of this Opts, invalidating the previously built struct,
+     * so an Opts shared between threads must be copied first, as Process::open() does.
+     *
+     * @return the sp_opts
+     */
+    SP_Opts get() {
+        SP_Opts opts = opts_;
+        opts.cwd = hasCwd_ ? const_cast<char*>(cwd_.c_str()) : nullptr;
+        envp_.clear();
+        if (hasEnv_) {
+            for (const std::string& var : env_) {
+                envp_.push_back(const_cast<char*>(var.c_str()));
+            }
+            envp_.push_back(nullptr);
+            opts.env = envp_.data();
+        }
+        opts.spstdin = in_.get();
+        opts.spstdout = out_.get();
+        opts.spstderr = err_.get();
+        opts.fdMap = fdMap_.empty() ? nullptr : fdMap_.data();
+        opts.fdMapSize = fdMap_.size();
+        opts.rlimits = rlimits_.empty() ? nullptr : rlimits_.data();
+        opts.rlimitsSize = rlimits_.size();
+        if (hasCgroup_) {
+            cgroup_.parent = cgroupParent_.c_str();
+            opts.cgroup = &cgroup_;
+        }
+        return opts;
+    }
+
+private:
+    SP_Opts opts_{};
+    std::string cwd_;
+    bool hasCwd_ = false;
+    std::vector<std::string> env_;
+    bool hasEnv_ = false;
+    std::vector<char*> envp_;
+    std::vector<SP_FdMap> fdMap_;
+    std::vector<SP_Rlimit> rlimits_;
+    std::string cgroupParent_;
+    SP_CgroupOpts cgroup_{};
+    bool hasCgroup_ = false;
+    Redir in_;
+    Redir out_;
+    Redir err_;
+};
+
+#ifdef SP_COROUTINES
+class EventLoop;
+
+/**
+ * A lazily started coroutine returning T.
+ * Awaiting a Task starts it and resumes the awaiter once it completes.
+ * Run the outermost Task with EventLoop::run().
+ */
+template <typename T = void>
+class Task;
+#endif
+
+/**
+ * Move-only owner of an SP_Process*.
+ * The process is freed with sp_destroy_async() when the Process is destroyed,
+ * so destroying a running process never blocks.
+ */
+class Process {
+public:
+    /// An empty Process that owns nothing.
+    Process() = default;
+
+    /// Take ownership of proc.
+    explicit Process(SP_Process* proc) : proc_(proc) {}
+
+    Process(const Process&) = delete;
+    Process& operator=(const Process&) = delete;
+
+    Process(Process&& other) noexcept : proc_(other.release()) {}
+
+    Process& operator=(Process&& other) noexcept {
+        if (this != &other) {
+            sp_destroy_async(proc_);
+            proc_ = other.release();
+        }
+        return *this;
+    }
+
+    ~Process() { sp_destroy_async(proc_); }
+
+    /**
+     * Open a process, see sp_open().
+     *
+     * @param[in] argv arguments, argv[0] is the program.
+     * @param[in] opts options used when spawning the process.
+     * @return the running process.
+     * @throws std::system_error if the process could not be spawned.
+     */
+    static Process open(const std::vector<std::string>& argv,
+                        const Opts& opts = Opts()) {
+        return spawn(sp_open, argv, opts);
+    }
+
+    /**
+     * Run a process and wait for it to finish, see sp_run().
+     *
+     * @param[in] argv arguments, argv[0] is the program.
+     * @param[in] opts options used when spawning the process.
+     * @return the finished process.
+     * @throws std::system_error if the process could not be spawned.
+     */
+    static Process run(const std::vector<std::string>& argv,
+                       const Opts& opts = Opts()) {
+        return spawn(sp_run, argv, opts);
+    }
+
+    /// The owned SP_Process*, or nullptr.
+    SP_Process* get() const { return proc_; }
+
+    /// Give up ownership of the SP_Process*.
+    SP_Process* release() { return std::exchange(proc_, nullptr); }
+
+    explicit operator bool() const { return proc_; }
+
+    /// See sp_process::pid.
+    pid_t pid() const { return proc_->pid; }
+
+    /// See sp_process::status.
+    SP_Status status() const { return proc_->status; }
+
+    /// See sp_process::exitCode.
+    int exitCode() const { return proc_->exitCode; }
+
+    /// See sp_process::limitHit.
+    int limitHit() const { return proc_->limitHit; }
+
+    /// See sp_process::spstdin.
+    FILE* in() const { return proc_->spstdin; }
+
+    /// See sp_process::spstdout.
+    FILE* out() const { return proc_->spstdout; }
+
+    /// See sp_process::spstderr.
+    FILE* err() const { return proc_->spstderr; }
+
+    /// See sp_process::sockets.
+    int socket(int target) const { return proc_->sockets[target]; }
+
+    /// See sp_wait().
+    int wait() { return sp_wait(proc_); }
+
+    /// See sp_poll().
+    int poll() { return sp_poll(proc_); }
+
+    /// See sp_signal().
+    int signal(int signal) { return sp_signal(proc_, signal); }
+
+    /// See sp_terminate().
+    int terminate() { return sp_terminate(proc_); }
+
+    /// See sp_kill().
+    int kill() { return sp_kill(proc_); }
+
+    /// See sp_close().
+    void close() { sp_close(proc_); }
+
+    /// See sp_wait_ready().
+    int waitReady(int timeoutMs = -1) { return sp_wait_ready(proc_, timeoutMs); }
+
+#ifdef SP_COROUTINES
+    class ExitAwaitable;
+    class ReadableAwaitable;
+
+    /**
+     * Wait for the process to exit without blocking the thread.
+     * co_await's to the exit code.
+     *
+     * @param[in] loop the event loop driving the coroutine.
+     */
+    ExitAwaitable exited(EventLoop& loop);
+
+    /**
+     * Read from the stdout or stderr pipe without blocking the thread.
+     * co_await's to the number of bytes read, 0 at end of file.
+     * The pipe is read directly, bypassing the buffer of the FILE*, so do not mix with
+     * buffered reads through it. O_NONBLOCK is only set during each read.
+     *
+     * @param[in] loop the event loop driving the coroutine.
+     * @param[out] buf
+     * @param[in] size size of buf
+     * @param[in] stream SP_STDOUT_FILENO or SP_STDERR_FILENO
+     * @throws std::system_error if reading fails.
+     */
+    Task<size_t> read(EventLoop& loop, void* buf, size_t size,
+                      SP_RedirTarget stream = SP_STDOUT_FILENO);
+#endif
+
+private:
+    static Process spawn(SP_Process* (*start)(char**, SP_Opts*),
+                         const std::vector<std::string>& argv,
+                         const Opts& opts) {
+        std::vector<char*> args;
+        for (const std::string& arg : argv) {
+            args.push_back(const_cast<char*>(arg.c_str()));
+        }
+        args.push_back(nullptr);
+        // The caller's Opts stays untouched, it may be shared.
+        Opts copy = opts;
+        SP_Opts spOpts = copy.get();
+        SP_Process* proc = start(args.data(), &spOpts);
+        if (!proc) {
+            throwErrno("sp_open");
+        }
+        return Process(proc);
+    }
+
+    SP_Process* proc_ = nullptr;
+};
+
+#ifdef SP_COROUTINES
+
+namespace detail {
+
+/**
+ * Promise state shared by Task<T> and Task<void>.
+ */
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    /// Resumes whoever awaited the task, if anyone.
+    struct FinalAwaitable {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(
+            std::coroutine_handle<Promise> handle) noexcept {
+            std::coroutine_handle<> next = handle.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaitable final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    void rethrow() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+
+    template <typename U>
+    void return_value(U&& result) {
+        value.emplace(std::forward<U>(result));
+    }
+
+    T result() {
+        rethrow();
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    void result() { rethrow(); }
+};
+
+}  // namespace detail
+
+template <typename T>
+class Task {
+public:
+    using promise_type = detail::Promise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle)
+        : handle_(handle) {}
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    Task(Task&& other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)) {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) {
+                handle_.destroy();
+            }
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    /// True once the coroutine has run to completion.
+    bool done() const { return !handle_ || handle_.done(); }
+
+    bool await_ready() const { return done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+
+    T await_resume() { return handle_.promise().result(); }
+
+private:
+    friend class EventLoop;
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(
+        std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}  // namespace detail
+
+/**
+ * A single threaded epoll(7) event loop that resumes coroutines when the
+ * file descriptors they wait on become ready.
+ * Only one coroutine may wait on a file descriptor at a time.
+ */
+class EventLoop {
+public:
+    /// @throws std::system_error if the epoll instance cannot be created.
+    EventLoop() : epollFd_(epoll_create1(EPOLL_CLOEXEC)) {
+        if (epollFd_ < 0) {
+            throwErrno("epoll_create1");
+        }
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    ~EventLoop() { ::close(epollFd_); }
+
+    /**
+     * Resume handle once fd is readable.
+     *
+     * @param[in] fd
+     * @param[in] handle
+     * @throws std::system_error if fd cannot be watched.
+     */
+    void watch(int fd, std::coroutine_handle<> handle) {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = handle.address();
+        // One shot fds stay registered but disabled, re-arm them with MOD.
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) < 0 &&
+            (errno != EEXIST ||
+             epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &event) < 0)) {
+            throwErrno("epoll_ctl");
+        }
+        watching_++;
+    }
+
+    /**
+     * Wait for events and resume the coroutines waiting on them.
+     *
+     * @param[in] timeoutMs passed to epoll_wait(2), -1 waits forever.
+     * @return the number of coroutines resumed.
+     * @throws std::system_error if epoll_wait(2) fails.
+     */
+    int runOnce(int timeoutMs = -1) {
+        if (!watching_) {
+            return 0;
+        }
+        epoll_event events[64];
+        int n = epoll_wait(epollFd_, events, 64, timeoutMs);
+        if (n < 0) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            throwErrno("epoll_wait");
+        }
+        watching_ -= n;
+        for (int i = 0; i < n; i++) {
+            std::coroutine_handle<>::from_address(events[i].data.ptr).resume();
+        }
+        return n;
+    }
+
+    /**
+     * Run task until it completes.
+     *
+     * @param[in] task
+     * @return the result of task.
+     * @throws whatever task throws.
+     */
+    template <typename T>
+    T run(Task<T> task) {
+        task.handle_.resume();
+        while (!task.done()) {
+            if (!watching_) {
+                throw std::logic_error(
+                    "sp::EventLoop::run: task is not waiting on anything");
+            }
+            runOnce();
+        }
+        return task.handle_.promise().result();
+    }
+
+    /**
+     * Start task in the background. It is driven by runOnce() and run().
+     *
+     * @param[in] task
+     */
+    void spawn(Task<void> task) {
+        task.handle_.resume();
+        if (!task.done()) {
+            spawned_.push_back(std::move(task));
+        } else {
+            task.handle_.promise().result();
+        }
+    }
+
+    /**
+     * Run until every task started with spawn() completes.
+     *
+     * @throws the first exception thrown by a spawned task.
+     */
+    void run() {
+        while (!spawned_.empty()) {
+            runOnce();
+            for (size_t i = spawned_.size(); i > 0; i--) {
+                if (spawned_[i - 1].done()) {
+                    Task<void> task = std::move(spawned_[i - 1]);
+                    spawned_[i - 1] = std::move(spawned_.back());
+                    spawned_.pop_back();
+                    task.handle_.promise().result();
+                }
+            }
+            if (!spawned_.empty() && !watching_) {
+                throw std::logic_error(
+                    "sp::EventLoop::run: tasks are not waiting on anything");
+            }
+        }
+    }
+
+private:
+    int epollFd_;
+    size_t watching_ = 0;
+    std::vector<Task<void>> spawned_;
+};
+
+/**
+ * Awaitable returned by Process::exited().
+ */
+class Process::ExitAwaitable {
+public:
+    ExitAwaitable(EventLoop& loop, SP_Process* proc)
+        : loop_(loop), proc_(proc) {}
+
+    ExitAwaitable(const ExitAwaitable&) = delete;
+    ExitAwaitable& operator=(const ExitAwaitable&) = delete;
+
+    ~ExitAwaitable() {
+        if (pidfd_ >= 0) {
+            ::close(pidfd_);
+        }
+    }
+
+    bool await_ready() {
+        return !proc_ || proc_->status == SP_STATUS_DEAD ||
+               sp_poll(proc_) >= 0;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        pidfd_ = sp_pidfd(proc_);
+        if (pidfd_ < 0) {
+            // No pidfd support, fall back to a blocking sp_wait().
+            return false;
+        }
+        loop_.watch(pidfd_, handle);
+        return true;
+    }
+
+    int await_resume() {
+        if (!proc_) {
+            throw std::system_error(EINVAL, std::generic_category(),
+                                    "sp::Process::exited");
+        }
+        int exitCode = sp_wait(proc_);
+        if (exitCode < 0) {
+            throwErrno("sp_wait");
+        }
+        return exitCode;
+    }
+
+private:
+    EventLoop& loop_;
+    SP_Process* proc_;
+    int pidfd_ = -1;
+};
+
+/**
+ * Awaitable used by Process::read() to wait for a pipe to be readable.
+ */
+class Process::ReadableAwaitable {
+public:
+    ReadableAwaitable(EventLoop& loop, int fd) : loop_(loop), fd_(fd) {}
+
+    bool await_ready() { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        loop_.watch(fd_, handle);
+    }
+
+    void await_resume() {}
+
+    /**
+     * Read without blocking, restoring the flags of fd afterwards so the FILE* the
+     * fd belongs to keeps blocking.
+     *
+     * @return the number of bytes read, or -1 and errno is set, to EAGAIN if the
+     *         read would block.
+     */
+    static ssize_t tryRead(int fd, void* buf, size_t size) {
+        int flags = fcntl(fd, F_GETFL);
+        bool set = flags >= 0 && !(flags & O_NONBLOCK);
+        if (set && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            return -1;
+        }
+        ssize_t n;
+        do {
+            n = ::read(fd, buf, size);
+        } while (n < 0 && errno == EINTR);
+        int readErrno = errno;
+        if (set) {
+            fcntl(fd, F_SETFL, flags);
+        }
+        errno = readErrno;
+        return n;
+    }
+
+private:
+    EventLoop& loop_;
+    int fd_;
+};
+
+inline Process::ExitAwaitable Process::exited(EventLoop& loop) {
+    return ExitAwaitable(loop, proc_);
+}
+
+inline Task<size_t> Process::read(EventLoop& loop, void* buf, size_t size,
+                                  SP_RedirTarget stream) {
+    FILE* file = nullptr;
+    if (proc_) {
+        file = stream == SP_STDERR_FILENO ? proc_->spstderr : proc_->spstdout;
+    }
+    int fd = file ? fileno(file) : -1;
+    if (fd < 0) {
+        errno = EBADF;
+        throwErrno("sp::Process::read");
+    }
+    ssize_t n;
+    // Waiting again after a spurious wake up, e.g. if the data was consumed elsewhere.
+    while ((n = ReadableAwaitable::tryRead(fd, buf, size)) < 0 &&
+           errno == EAGAIN) {
+        co_await ReadableAwaitable(loop, fd);
+    }
+    if (n < 0) {
+        throwErrno("sp::Process::read");
+    }
+    co_return n;
+}
+
+#endif  // SP_COROUTINES
+
+}  // namespace sp
+
+#endif  // SP_PROCESS_HPP
@@ -0,0 +1,123 @@
+/**
+ * @file
+ * @brief Readiness Notification API
+ *
+ * A process spawned with sp_opts::notify tells its parent when it has finished starting up,
+ * e.g. once a server listens on its socket, so the parent doesn't need to sleep or retry.
+ * The process writes "READY=1" on a line of its own, other lines are ignored, which is
+ * the sd_notify(3) protocol for SP_NOTIFY_SOCKET.
+ * <br>
+ * Example, in a shell:
+ * \code{.sh}
+ * echo READY=1 >&"$SP_NOTIFY_FD"
+ * \endcode
+ * and with SP_NOTIFY_SOCKET, from the process itself rather than a child of it:
+ * \code{.c}
+ * sd_notify(0, "READY=1");
+ * \endcode
+ */
+
+#ifndef SP_READY_H
+#define SP_READY_H
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Environment variable holding the file descriptor for SP_NOTIFY_FD.
+ */
+#define SP_NOTIFY_FD_ENV "SP_NOTIFY_FD"
+
+/**
+ * Environment variable holding the socket for SP_NOTIFY_SOCKET,
+ * an abstract address prefixed with '@'.
+ */
+#define SP_NOTIFY_SOCKET_ENV "NOTIFY_SOCKET"
+
+/**
+ * Wait for a process spawned with sp_opts::notify to be ready.
+ * Sleeps in poll(2) on the notification and a pidfd of the process, so it returns
+ * as soon as the process is ready or exits.
+ * <br>
+ * Example:
+ * \code{.c}
+ * SP_Process* p = sp_open(SP_ARGV("server"), SP_OPTS(.notify = SP_NOTIFY_FD));
+ * if (sp_wait_ready(p, 5000) < 0) {
+ *     perror("server");
+ * }
+ * \endcode
+ *
+ * @param[in,out] process
+ * @param[in] timeoutMs milliseconds to wait, 0 to only check, or -1 to wait indefinitely.
+ * @return 0 once the process is ready, -1 on error and errno is set accordingly:
+ *         ETIMEDOUT if it is not ready yet, ECHILD if it exited or closed the
+ *         notification without being ready, EINVAL if sp_opts::notify was not set.
+ */
+int sp_wait_ready(SP_Process* process, int timeoutMs);
+
+/**
+ * Get the file descriptor that becomes readable when a notification arrives,
+ * to wait for readiness in an event loop, then call sp_wait_ready() with a timeout of 0.
+ * It also becomes readable for notifications other than "READY=1".
+ *
+ * @param[in] process
+ * @return the file descriptor owned by the process, or -1 if sp_opts::notify was not set.
+ */
+int sp_ready_fd(const SP_Process* process);
+
+/**
+ * Spawn a process and wait for it to be ready. The process is destroyed if it is not.
+ *
+ * @param[in] argv NULL terminated array of arguments. argv[0] is the program to run.
+ * @param[in,out] opts options, can be NULL. sp_opts::notify defaults to SP_NOTIFY_FD.
+ * @param[in] timeoutMs see sp_wait_ready()
+ * @return a pointer to a new sp_process or NULL on error and errno is set accordingly.
+ * @see sp_open
+ */
+SP_Process* sp_open_ready(char** argv, SP_Opts* opts, int timeoutMs);
+
+/**
+ * Create the notification. Called by sp_open() before compiling the plan.
+ * For SP_NOTIFY_FD, sp_opts::fdMap is replaced by a copy including the
+ * descriptor passed to the process, which sp_ready_forked() restores.
+ *
+ * @param[in,out] process
+ * @param[in,out] opts
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_ready_create(SP_Process* process, SP_Opts* opts);
+
+/**
+ * Get the environment passing the notification to the process.
+ * Called by sp_open() after compiling the plan.
+ *
+ * @param[in,out] process
+ * @param[in] env the environment of the process, or NULL for the parent's.
+ * @return the environment owned by the notification, or NULL on error.
+ */
+char** sp_ready_env(SP_Process* process, char** env);
+
+/**
+ * Release what was only needed by the child, after fork(2) or if it failed.
+ * Called by sp_open().
+ *
+ * @param[in,out] process
+ * @param[in,out] opts sp_opts::fdMap is restored.
+ */
+void sp_ready_forked(SP_Process* process, SP_Opts* opts);
+
+/**
+ * Free the notification. Called by sp_destroy().
+ *
+ * @param[in,out] process
+ */
+void sp_ready_free(SP_Process* process);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_READY_H
@@ -0,0 +1,44 @@
+/**
+ * @file
+ * @brief Background Reaper API
+ */
+
+#ifndef SP_REAPER_H
+#define SP_REAPER_H
+
+#include <stddef.h>
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Hand a process over to the library-owned reaper thread, which waits on it in the background.
+ *
+ * The reaper is started on first use and waits for pidfds to become readable,
+ * falling back to periodically polling waitpid(2) on kernels without pidfd_open(2).
+ * If the process was opened with sp_opts::signalGroup, members of its process group that are
+ * reparented to the caller are reaped as well.
+ * Afterwards sp_process::status is sp_status::SP_STATUS_DEAD, sp_process::exitCode is -1
+ * and sp_process::pgid is 0, so the process can be freed with sp_destroy() without blocking.
+ *
+ * @param[in,out] process
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ * @see sp_destroy_async
+ */
+int sp_reap_async(SP_Process* process);
+
+/**
+ * Get the number of processes handed to the reaper that have not been reaped yet.
+ *
+ * @return number of pending processes
+ */
+size_t sp_reap_pending(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_REAPER_H
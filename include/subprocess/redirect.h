@@ -9,6 +9,10 @@
 #include <stdbool.h>
 #include <unistd.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Standard redirect targets.
  * Synonymous to STDIN_FILENO, STDOUT_FILENO, and STDERR_FILENO
@@ -25,6 +29,8 @@ typedef enum sp_redir_target {
  * sp_redir_type::SP_REDIR_BYTES is only valid for stdin.
  * sp_redir_type::SP_REDIR_STDERR is only valid for stdout.
  * sp_redir_type::SP_REDIR_STDOUT is only valid for stderr.
+ * sp_redir_type::SP_REDIR_TAIL is only valid for stdout and stderr.
+ * sp_redir_type::SP_REDIR_SOCKET is valid for any target and is read and written by both ends.
  *
  * @see sp_redir_opt
  */
@@ -38,6 +44,9 @@ typedef enum sp_redir_type {
     SP_REDIR_BYTES,   ///< Redirect a byte stream to stdin.
     SP_REDIR_STDERR,  ///< Redirect stdout to stderr
     SP_REDIR_STDOUT,  ///< Redirect stderr to stdout.
+    SP_REDIR_TAIL,    ///< Keep the last bytes of the output in memory, see tail.h
+    SP_REDIR_SOCKET,  ///< Redirect to a unix socketpair connected to parent, see socket.h
+    SP_REDIR_OPEN,    ///< Redirect to a file opened with the given flags and mode.
 } SP_RedirType;
 
 /**
@@ -55,6 +64,8 @@ typedef struct sp_redir_opt {
         int pipeFd[2];  ///< Redirecting to a pipe.
     } value;            ///< The value of the redirection.
     size_t size;
+    int flags;  ///< The socket type of SP_REDIR_SOCKET(), or the open(2) flags of SP_REDIR_OPEN().
+    unsigned int mode;  ///< The permissions of a file created by SP_REDIR_OPEN().
 } SP_RedirOpt;
 
 /**
@@ -80,6 +91,24 @@ typedef struct sp_redir_opt {
 #define SP_REDIR_APPEND(_path) \
     (SP_RedirOpt) { .type = SP_REDIR_APPEND, .value.path = (_path) }
 
+/**
+ * Setup sp_redir_opt to redirect to a file opened with open(2) and the given flags,
+ * e.g. O_WRONLY | O_CREAT | O_EXCL | O_NOATIME, or O_WRONLY | O_TMPFILE with a directory.
+ * If _size is not 0, that many bytes are preallocated with fallocate(2), keeping the
+ * size of the file, so that a large output isn't fragmented. Preallocation is skipped
+ * on file systems that don't support it.
+ *
+ * @param[in] _path char* holding the file path to redirect to.
+ * @param[in] _flags int flags passed to open(2).
+ * @param[in] _mode unsigned int permissions of the file if it is created, before the umask.
+ * @param[in] _size size_t bytes to preallocate, or 0.
+ */
+#define SP_REDIR_OPEN(_path, _flags, _mode, _size)                       \
+    (SP_RedirOpt) {                                                      \
+        .type = SP_REDIR_OPEN, .value.path = (_path), .flags = (_flags), \
+        .mode = (_mode), .size = (_size)                                 \
+    }
+
 /**
  * Setup sp_redir_opt to redirect to /dev/null.
  */
@@ -130,6 +159,29 @@ typedef struct sp_redir_opt {
 #define SP_REDIR_STDERR() \
     (SP_RedirOpt) { .type = SP_REDIR_STDERR }
 
+/**
+ * Setup sp_redir_opt to keep only the last _size bytes of the output in memory.
+ * The pipe is drained by a background thread so the process never blocks on it.
+ *
+ * @param[in] _size size_t maximum number of bytes to keep.
+ * @see sp_tail
+ */
+#define SP_REDIR_TAIL(_size) \
+    (SP_RedirOpt) { .type = SP_REDIR_TAIL, .size = (_size) }
+
+/**
+ * Setup sp_redir_opt to redirect to an AF_UNIX socketpair connected to the parent,
+ * whose end is in sp_process::sockets rather than a FILE*.
+ * Besides bytes, file descriptors can be passed both ways, see sp_socket_send().
+ *
+ * @param[in] _type int SOCK_STREAM or SOCK_SEQPACKET.
+ * @param[in] _bufSize size_t SO_SNDBUF and SO_RCVBUF of both ends, or 0 for the default.
+ */
+#define SP_REDIR_SOCKET(_type, _bufSize)                              \
+    (SP_RedirOpt) {                                                   \
+        .type = SP_REDIR_SOCKET, .size = (_bufSize), .flags = (_type) \
+    }
+
 /**
  * Redirect the target file descriptor using the given opts.
  * This function is intended to be used from within the child process before calling exec.
@@ -144,4 +196,8 @@ typedef struct sp_redir_opt {
  */
 int sp_redirect(SP_RedirOpt* opts, SP_RedirTarget target);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif  // SP_REDIRECT_H
@@ -0,0 +1,99 @@
+/**
+ * @file
+ * @brief Socket API
+ *
+ * A process spawned with SP_REDIR_SOCKET() has a bidirectional AF_UNIX socket instead of
+ * a pipe, on which file descriptors can be passed both ways with SCM_RIGHTS.
+ * Large data is passed without copying it through the socket by writing it to a memfd
+ * and sending the memfd, which the receiver maps.
+ * <br>
+ * Example, handing a buffer to a child reading fds from stdin:
+ * \code{.c}
+ * SP_Process* p = sp_open(SP_ARGV("worker"),
+ *                         SP_OPTS(.spstdin = SP_REDIR_SOCKET(SOCK_SEQPACKET, 0)));
+ * void* map;
+ * int fd = sp_memfd_create("input", size, &map);
+ * memcpy(map, data, size);
+ * munmap(map, size);
+ * sp_socket_send(p->sockets[SP_STDIN_FILENO], "input", 5, &fd, 1);
+ * close(fd);
+ * \endcode
+ */
+
+#ifndef SP_SOCKET_H
+#define SP_SOCKET_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Maximum number of file descriptors passed by a single message, SCM_MAX_FD of the kernel.
+ */
+#define SP_SOCKET_MAX_FDS 253
+
+/**
+ * Send bytes and file descriptors on a unix socket, e.g. one of sp_process::sockets.
+ * The descriptors stay open in the caller.
+ * On SOCK_STREAM at least one byte must be sent along with the descriptors, and
+ * the bytes may be sent partially, but the descriptors are always sent with the first one.
+ *
+ * @param[in] sock the socket.
+ * @param[in] data the bytes to send.
+ * @param[in] size number of bytes, can be 0 on SOCK_SEQPACKET.
+ * @param[in] fds the file descriptors to send, can be NULL if nFds is 0.
+ * @param[in] nFds number of fds, at most #SP_SOCKET_MAX_FDS.
+ * @return number of bytes sent, or -1 on error and errno is set accordingly.
+ *         errno is EINVAL for descriptors without bytes on SOCK_STREAM.
+ */
+ssize_t sp_socket_send(int sock, const void* data, size_t size, const int* fds,
+                       size_t nFds);
+
+/**
+ * Receive bytes and file descriptors from a unix socket.
+ * The received descriptors are close-on-exec and owned by the caller.
+ *
+ * @param[in] sock the socket.
+ * @param[out] buf the bytes received.
+ * @param[in] size size of buf in bytes.
+ * @param[out] fds the file descriptors received, can be NULL if *nFds is 0.
+ * @param[in,out] nFds size of fds, set to the number of descriptors received.
+ *                Can be NULL to receive none.
+ * @return number of bytes received, 0 on end of file, or -1 on error and errno is set
+ *         accordingly. errno is EMSGSIZE if more descriptors were sent than fit in fds,
+ *         which are all closed.
+ */
+ssize_t sp_socket_recv(int sock, void* buf, size_t size, int* fds,
+                       size_t* nFds);
+
+/**
+ * Create an anonymous memory file of a given size to pass data to a process.
+ *
+ * @param[in] name shown in /proc/pid/fd, for debugging.
+ * @param[in] size size of the file in bytes.
+ * @param[out] map the file mapped for reading and writing, to be unmapped with
+ *             munmap(2) with size. Can be NULL.
+ * @return the close-on-exec file descriptor, or -1 on error and errno is set accordingly.
+ */
+int sp_memfd_create(const char* name, size_t size, void** map);
+
+/**
+ * Map a memory file, or any regular file, received from a socket for reading.
+ *
+ * @param[in] fd
+ * @param[out] size size of the file, and of the mapping to unmap with munmap(2).
+ * @return the mapping, or NULL on error and errno is set accordingly.
+ *         errno is EINVAL for an empty file, which can't be mapped.
+ */
+void* sp_memfd_map(int fd, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_SOCKET_H
@@ -0,0 +1,136 @@
+/**
+ * @file
+ * @brief Metrics API
+ *
+ * Library-wide counters kept with relaxed atomic operations, so they are always on and
+ * taking a snapshot with sp_stats_get() only costs a few dozen loads.
+ */
+
+#ifndef SP_STATS_H
+#define SP_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Number of buckets in sp_stats::latency.
+ */
+#define SP_STATS_LATENCY_BUCKETS 32
+
+/**
+ * The stages of spawning a process that can fail.
+ *
+ * @see sp_stats::failures
+ */
+typedef enum sp_spawn_stage {
+    SP_STAGE_ALLOC = 0,  ///< allocating the sp_process.
+    SP_STAGE_PIPES,      ///< creating the pipes for redirections.
+    SP_STAGE_NOTIFY,     ///< creating the pipe or socket for sp_opts::notify.
+    SP_STAGE_CGROUP,     ///< creating the cgroup for sp_opts::cgroup.
+    SP_STAGE_FORK,       ///< fork(2) failed.
+    SP_STAGE_SETUP,      ///< setting up the pipes in the parent after fork(2).
+    /**
+     * The child exited with SP_EXIT_NOT_EXECUTE or SP_EXIT_NOT_FOUND, which is how failing to
+     * apply the options or to exec is reported. Programs exiting with these codes themselves
+     * are counted as well.
+     */
+    SP_STAGE_EXEC,
+    SP_N_STAGES,  ///< number of stages.
+} SP_SpawnStage;
+
+/**
+ * A snapshot of the library-wide counters.
+ *
+ * @see sp_stats_get
+ */
+typedef struct sp_stats {
+    uint64_t spawns;  ///< processes forked by sp_open().
+    uint64_t failures[SP_N_STAGES];  ///< failed spawns by stage, see sp_spawn_stage.
+    uint64_t live;    ///< processes spawned and not reaped yet.
+    uint64_t reaped;  ///< processes reaped, including by the background reaper.
+    /**
+     * Bytes written to processes by the library, e.g. for SP_REDIR_BYTES().
+     * Writes to sp_process::spstdin by the application are not counted.
+     */
+    uint64_t bytesWritten;
+    /**
+     * Bytes read from pipes by the library, e.g. by sp_tee(), sp_capture() and SP_REDIR_TAIL().
+     * Reads from sp_process::spstdout and sp_process::spstderr by the application are not counted.
+     */
+    uint64_t bytesRead;
+    /**
+     * Histogram of the time spent in successful calls to sp_open().
+     * Bucket i counts calls taking [2^i, 2^(i+1)) nanoseconds,
+     * the last bucket also counts anything slower.
+     */
+    uint64_t latency[SP_STATS_LATENCY_BUCKETS];
+    uint64_t latencySumNs;  ///< total time spent in successful calls to sp_open().
+} SP_Stats;
+
+/**
+ * Take a snapshot of the counters.
+ * Each counter is read atomically, but counters updated concurrently may be slightly
+ * out of step with each other.
+ *
+ * @param[out] stats
+ */
+void sp_stats_get(SP_Stats* stats);
+
+/**
+ * Reset every counter to 0, except sp_stats::live.
+ */
+void sp_stats_reset(void);
+
+/**
+ * Estimate a percentile of the spawn latency from the histogram of a snapshot.
+ *
+ * @param[in] stats
+ * @param[in] percentile between 0 and 100.
+ * @return the upper bound in nanoseconds of the bucket holding the percentile,
+ *         or 0 if nothing has been spawned.
+ */
+uint64_t sp_stats_latency(const SP_Stats* stats, double percentile);
+
+/**
+ * Count a forked process. Called by sp_open().
+ */
+void sp_stats_spawned(void);
+
+/**
+ * Count the latency of a successful call to sp_open().
+ *
+ * @param[in] latencyNs time spent in sp_open()
+ */
+void sp_stats_opened(uint64_t latencyNs);
+
+/**
+ * Count a failed spawn. Called by sp_open().
+ *
+ * @param[in] stage
+ */
+void sp_stats_failed(SP_SpawnStage stage);
+
+/**
+ * Count a reaped process.
+ *
+ * @param[in] exitCode the exit code, or -1 if unknown.
+ */
+void sp_stats_reaped(int exitCode);
+
+/**
+ * Count bytes moved through a pipe managed by the library.
+ *
+ * @param[in] written bytes written to a process.
+ * @param[in] read bytes read from a process.
+ */
+void sp_stats_bytes(size_t written, size_t read);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_STATS_H
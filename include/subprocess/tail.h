@@ -0,0 +1,103 @@
+/**
+ * @file
+ * @brief Tail Capture API
+ */
+
+#ifndef SP_TAIL_H
+#define SP_TAIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Get the last bytes written by a process to an output redirected with SP_REDIR_TAIL().
+ *
+ * At most sp_redir_opt::size bytes are kept no matter how much the process writes,
+ * older bytes are overwritten as the pipe is drained.
+ * The process must have been waited on, which drains the bytes left in the pipe.
+ * Bytes written afterwards by descendants that inherited the pipe are not kept.
+ * <br>
+ * Example, keeping the last 4 KiB of stderr:
+ * \code{.c}
+ * SP_Process* p = sp_run(SP_ARGV("make"), SP_OPTS(.spstderr = SP_REDIR_TAIL(4096)));
+ * size_t size;
+ * const char* tail = sp_tail(p, SP_STDERR_FILENO, &size);
+ * fwrite(tail, 1, size, stderr);
+ * sp_destroy(p);
+ * \endcode
+ *
+ * @param[in,out] process
+ * @param[in] target SP_STDOUT_FILENO or SP_STDERR_FILENO
+ * @param[out] size number of bytes kept
+ * @return the kept bytes, owned by the process and not NUL terminated,
+ *         or NULL on error and errno is set accordingly.
+ *         errno is EBUSY if the process is still running.
+ */
+const char* sp_tail(SP_Process* process, SP_RedirTarget target, size_t* size);
+
+/**
+ * Get the last lines written by a process to an output redirected with SP_REDIR_TAIL().
+ * Only lines that fit in the kept bytes are returned, the first of which may be partial.
+ *
+ * @param[in,out] process
+ * @param[in] target SP_STDOUT_FILENO or SP_STDERR_FILENO
+ * @param[in] nLines maximum number of lines.
+ * @param[out] size number of bytes in the lines.
+ * @return the start of the lines, owned by the process and not NUL terminated,
+ *         or NULL on error and errno is set accordingly.
+ * @see sp_tail
+ */
+const char* sp_tail_lines(SP_Process* process, SP_RedirTarget target,
+                          size_t nLines, size_t* size);
+
+/**
+ * Get the total number of bytes written by a process to an output redirected with
+ * SP_REDIR_TAIL(), including the ones that were overwritten.
+ * Can be called while the process is running.
+ *
+ * @param[in] process
+ * @param[in] target SP_STDOUT_FILENO or SP_STDERR_FILENO
+ * @return the number of bytes, 0 if the target is not redirected with SP_REDIR_TAIL().
+ */
+uint64_t sp_tail_total(SP_Process* process, SP_RedirTarget target);
+
+/**
+ * Start draining the outputs redirected with SP_REDIR_TAIL().
+ * Intended to be called by sp_open() in the parent process after fork().
+ *
+ * @param[in,out] process
+ * @param[in,out] opts options used to setup the process, the read ends of the pipes
+ *                are taken over.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_tail_start(SP_Process* process, SP_Opts* opts);
+
+/**
+ * Wait for the outputs redirected with SP_REDIR_TAIL() to be drained.
+ * If stop is true, only the bytes already buffered in the pipes are drained,
+ * so descendants that still hold the pipes open can not block the caller.
+ *
+ * @param[in,out] process
+ * @param[in] stop
+ */
+void sp_tail_join(SP_Process* process, bool stop);
+
+/**
+ * Free the memory used by the outputs redirected with SP_REDIR_TAIL().
+ * Called by sp_destroy().
+ *
+ * @param[in,out] process
+ */
+void sp_tail_free(SP_Process* process);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_TAIL_H
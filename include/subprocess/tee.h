@@ -0,0 +1,138 @@
+/**
+ * @file
+ * @brief Tee API
+ */
+
+#ifndef SP_TEE_H
+#define SP_TEE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "subprocess/process.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Different types of sinks that sp_tee() can copy a stream to.
+ *
+ * @see sp_tee_sink
+ */
+typedef enum sp_tee_type {
+    SP_TEE_FD = 0,   ///< Copy to the given fd. The fd is not closed.
+    SP_TEE_PATH,     ///< Copy to the file named path, truncating it first.
+    SP_TEE_APPEND,   ///< Copy to the file named path, appending the output.
+    SP_TEE_CAPTURE,  ///< Copy into memory at sp_tee_sink::buf.
+    SP_TEE_PROCESS,  ///< Copy to the stdin pipe of another sp_process.
+} SP_TeeType;
+
+/**
+ * Struct used to configure a sink for sp_tee().
+ *
+ * It is recommended to use the SP_TEE_* macros below for configuring the struct.
+ * @see tee.h
+ */
+typedef struct sp_tee_sink {
+    SP_TeeType type;  ///< The type of sink.
+    union {
+        char* path;            ///< Copying to a file path.
+        int fd;                ///< Copying to a file descriptor.
+        SP_Process* process;  ///< Copying to the stdin of a process.
+    } value;                   ///< The value of the sink.
+    size_t size;  ///< Number of bytes copied to this sink so far.
+    char* buf;    ///< Captured bytes when type is SP_TEE_CAPTURE, or NULL.
+    size_t capacity;  ///< Allocated size of buf.
+} SP_TeeSink;
+
+/**
+ * Setup sp_tee_sink to copy to a file descriptor.
+ *
+ * @param[in] _fd int
+ */
+#define SP_TEE_FD(_fd) \
+    (SP_TeeSink) { .type = SP_TEE_FD, .value.fd = (_fd) }
+
+/**
+ * Setup sp_tee_sink to copy to a FILE*.
+ * The FILE* should be flushed before calling sp_tee().
+ *
+ * @param[in] _file FILE*
+ */
+#define SP_TEE_FILE(_file)                                        \
+    (SP_TeeSink) {                                                \
+        .type = SP_TEE_FD, .value.fd = _file ? fileno(_file) : -1 \
+    }
+
+/**
+ * Setup sp_tee_sink to copy to a file path.
+ *
+ * @param[in] _path char* holding the file path to copy to.
+ */
+#define SP_TEE_PATH(_path) \
+    (SP_TeeSink) { .type = SP_TEE_PATH, .value.path = (_path) }
+
+/**
+ * Setup sp_tee_sink to copy to a file path appending the output.
+ *
+ * @param[in] _path char* holding the file path to copy to.
+ */
+#define SP_TEE_APPEND(_path) \
+    (SP_TeeSink) { .type = SP_TEE_APPEND, .value.path = (_path) }
+
+/**
+ * Setup sp_tee_sink to capture the output in memory.
+ * The captured bytes must be freed with sp_tee_free().
+ */
+#define SP_TEE_CAPTURE() \
+    (SP_TeeSink) { .type = SP_TEE_CAPTURE }
+
+/**
+ * Setup sp_tee_sink to copy to the stdin of a process.
+ * The process must have been opened with stdin as sp_redir_type::SP_REDIR_PIPE.
+ *
+ * @param[in] _process SP_Process*
+ */
+#define SP_TEE_PROCESS(_process) \
+    (SP_TeeSink) { .type = SP_TEE_PROCESS, .value.process = (_process) }
+
+/**
+ * Copy everything read from fd to each of the sinks until end of file.
+ *
+ * The data is moved between pipes with splice(2) and duplicated with tee(2),
+ * so it is only copied into user-space memory for sp_tee_type::SP_TEE_CAPTURE sinks,
+ * or when the kernel cannot splice to or from a file descriptor.
+ * Sinks are not closed, except for the files opened for path sinks.
+ * <br>
+ * Example, mimicking `ls | tee ls.txt | wc -l`:
+ * \code{.c}
+ * SP_Process* ls = sp_open(SP_ARGV("ls"), SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+ * SP_Process* wc = sp_open(SP_ARGV("wc", "-l"), SP_OPTS(.spstdin = SP_REDIR_PIPE()));
+ * SP_TeeSink sinks[] = {SP_TEE_PATH("ls.txt"), SP_TEE_PROCESS(wc)};
+ * sp_tee(fileno(ls->spstdout), sinks, SP_SIZE_FIXED_ARR(sinks));
+ * sp_close(wc);
+ * \endcode
+ *
+ * @param[in] fd the file descriptor being read, e.g. fileno(proc->spstdout).
+ * @param[in,out] sinks array of sinks to copy to.
+ * @param[in] nSinks number of sinks.
+ * @return the number of bytes read from fd, or -1 on error and errno is set accordingly.
+ */
+ssize_t sp_tee(int fd, SP_TeeSink* sinks, size_t nSinks);
+
+/**
+ * Free the memory captured by sp_tee_type::SP_TEE_CAPTURE sinks.
+ * Other sinks are left untouched.
+ *
+ * @param[in,out] sinks
+ * @param[in] nSinks number of sinks.
+ */
+void sp_tee_free(SP_TeeSink* sinks, size_t nSinks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_TEE_H
@@ -0,0 +1,159 @@
+/**
+ * @file
+ * @brief Spawn Tracing API
+ *
+ * Records how long each phase of spawning and running a process takes and exports the
+ * timings as Chrome trace event JSON, which can be loaded in chrome://tracing or Perfetto.
+ * Tracing is disabled by default and costs a single branch per call of sp_open() and
+ * sp_wait() until enabled with sp_trace_enable().
+ * Defining SP_TRACE_DISABLED when building the library, e.g. with `make TRACE=0`,
+ * compiles it out entirely.
+ * <br>
+ * Events recorded in the parent:
+ * - `sp_open`: the whole call, made of `create_pipes`, `fork`, and `parent_setup`
+ * - `sp_wait`: time blocked waiting for the process
+ *
+ * Events recorded in the child and reported back to the parent through shared memory,
+ * shown on the track of the child:
+ * - `fork`: from calling fork(2) until the child starts running
+ * - `child_opts`: handling sp_opts::cwd, sp_opts::detach, process groups, and death signals
+ * - `redirect`: redirecting stdin, stdout, and stderr
+ * - `close_fds`: closing inherited file descriptors, unless sp_opts::inheritFds is set
+ * - `run`: from calling exec until the process is reaped
+ */
+
+#ifndef SP_TRACE_H
+#define SP_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Timestamps recorded by the child between fork(2) and exec.
+ *
+ * @see sp_trace_child
+ */
+typedef enum sp_trace_mark {
+    SP_TRACE_FORK = 0,        ///< just before fork(2), recorded by the parent.
+    SP_TRACE_CHILD_START,     ///< the child starts running.
+    SP_TRACE_REDIRECT_BEGIN,  ///< the child starts redirecting.
+    SP_TRACE_REDIRECT_END,    ///< the child finished redirecting.
+    SP_TRACE_CLOSE_BEGIN,     ///< the child starts closing file descriptors.
+    SP_TRACE_CLOSE_END,       ///< the child finished closing file descriptors.
+    SP_TRACE_EXEC,            ///< the child calls exec.
+    SP_TRACE_N_MARKS,         ///< number of marks.
+} SP_TraceMark;
+
+/**
+ * Memory shared between the parent and the child of a traced spawn.
+ */
+typedef struct sp_trace_child {
+    uint64_t marks[SP_TRACE_N_MARKS];  ///< timestamps in ns, 0 if not reached.
+} SP_TraceChild;
+
+/**
+ * Non-zero when tracing is enabled. Use SP_TRACE_ENABLED() instead of reading it directly.
+ */
+extern int spTraceEnabled;
+
+#ifdef SP_TRACE_DISABLED
+#define SP_TRACE_ENABLED() false
+#define SP_TRACE_MARK(_trace, _mark)
+#else
+/**
+ * Check if tracing is enabled, a single predictable branch.
+ */
+#define SP_TRACE_ENABLED() __builtin_expect(spTraceEnabled, 0)
+
+/**
+ * Record a timestamp in the memory shared with the parent, if the spawn is traced.
+ *
+ * @param[in] _trace SP_TraceChild* or NULL
+ * @param[in] _mark SP_TraceMark
+ */
+#define SP_TRACE_MARK(_trace, _mark)                 \
+    do {                                             \
+        if (_trace) {                                \
+            (_trace)->marks[_mark] = sp_trace_now(); \
+        }                                            \
+    } while (0)
+#endif
+
+/**
+ * Enable or disable tracing for every thread.
+ *
+ * @param[in] enable
+ */
+void sp_trace_enable(bool enable);
+
+/**
+ * Write every recorded event as Chrome trace event JSON.
+ *
+ * @param[in,out] file
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+int sp_trace_export(FILE* file);
+
+/**
+ * Discard every recorded event.
+ * Can be called while other threads record events, which are kept if they are
+ * recorded after the call returns. The buffers of exited threads are freed.
+ */
+void sp_trace_clear(void);
+
+/**
+ * Get the number of recorded events.
+ *
+ * @return number of events
+ */
+size_t sp_trace_count(void);
+
+/**
+ * Get the current time of the monotonic clock, which is the clock used for all events.
+ *
+ * @return nanoseconds
+ */
+uint64_t sp_trace_now(void);
+
+/**
+ * Record an event in the buffer of the calling thread.
+ *
+ * @param[in] name static string naming the event.
+ * @param[in] child pid of the child the event is about, or 0.
+ * @param[in] inChild the event happened in the child and is shown on its track,
+ *            otherwise it is shown on the track of the calling thread.
+ * @param[in] beginNs
+ * @param[in] endNs
+ */
+void sp_trace_event(const char* name, pid_t child, bool inChild,
+                    uint64_t beginNs, uint64_t endNs);
+
+/**
+ * Map the memory shared with the child of a traced spawn. Called before fork(2).
+ *
+ * @return the shared memory, or NULL on error and errno is set accordingly.
+ */
+SP_TraceChild* sp_trace_child_create(void);
+
+/**
+ * Record the events reported by a child, and unmap the shared memory.
+ *
+ * @param[in,out] trace may be NULL
+ * @param[in] pid pid of the child
+ * @param[in] reapedNs time the child was reaped, or 0 if it was not.
+ */
+void sp_trace_child_finish(SP_TraceChild* trace, pid_t pid,
+                           uint64_t reapedNs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_TRACE_H
@@ -0,0 +1,585 @@
+#define _GNU_SOURCE  // for O_DIRECTORY and get_current_dir_name()
+
+#include "subprocess/cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "subprocess/capture.h"
+#include "subprocess/pipe.h"
+#include "util.h"
+
+/**
+ * Identifies the format of stored results, and is hashed into every key.
+ */
+#define SP_CACHE_MAGIC "SPCACHE1"
+
+/**
+ * Size of the buffer used to hash files.
+ */
+#define SP_CACHE_CHUNK (64 * 1024)
+
+/**
+ * FNV-1a 64 bit prime.
+ */
+#define SP_FNV_PRIME 0x100000001b3ull
+
+/**
+ * Header of a stored result, followed by stdout and stderr.
+ */
+typedef struct sp_cache_header {
+    char magic[8];     ///< SP_CACHE_MAGIC, not NUL terminated.
+    int32_t exitCode;  ///< exit code of the command.
+    uint32_t unused;   ///< padding, 0.
+    uint64_t size[2];  ///< bytes of stdout and stderr.
+} SP_CacheHeader;
+
+/**
+ * Two FNV-1a lanes with different offset bases, giving a 128 bit key.
+ * Not a cryptographic hash, inputs are trusted.
+ */
+typedef struct sp_cache_hash {
+    uint64_t a;
+    uint64_t b;
+} SP_CacheHash;
+
+struct sp_cache {
+    int dirFd;          ///< the cache directory.
+    uint64_t maxBytes;  ///< size limit, or 0.
+    pthread_mutex_t mutex;  ///< serializes eviction.
+    SP_CacheStats stats;    ///< counters, accessed atomically.
+};
+
+static void hash_bytes(SP_CacheHash* hash, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash->a = (hash->a ^ bytes[i]) * SP_FNV_PRIME;
+        hash->b = (hash->b ^ (bytes[i] ^ 0x5c)) * SP_FNV_PRIME;
+    }
+}
+
+/**
+ * Hash a field preceded by its size, so fields can't run into each other.
+ */
+static void hash_field(SP_CacheHash* hash, const void* data, size_t size) {
+    uint64_t size64 = size;
+    hash_bytes(hash, &size64, sizeof size64);
+    hash_bytes(hash, data, size);
+}
+
+static void hash_string(SP_CacheHash* hash, const char* str) {
+    hash_field(hash, str ? str : "", str ? strlen(str) + 1 : 0);
+}
+
+/**
+ * Hash the metadata and contents of a file, or that it does not exist.
+ *
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static int hash_file(SP_CacheHash* hash, const char* path) {
+    hash_string(hash, path);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && (errno == ENOENT || errno == ENOTDIR)) {
+        hash_field(hash, NULL, 0);
+        return 0;
+    }
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        int tmpErrno = errno;
+        sp_fd_close(&fd);
+        errno = tmpErrno;
+        return -1;
+    }
+    uint64_t meta[] = {st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+    hash_field(hash, meta, sizeof meta);
+    char* buf = malloc(SP_CACHE_CHUNK);
+    ssize_t n = buf ? 1 : -1;
+    while (n > 0) {
+        n = read(fd, buf, SP_CACHE_CHUNK);
+        if (n < 0 && errno == EINTR) {
+            n = 1;
+        } else if (n > 0) {
+            hash_bytes(hash, buf, n);
+        }
+    }
+    int tmpErrno = errno;
+    free(buf);
+    close(fd);
+    errno = tmpErrno;
+    return n < 0 ? -1 : 0;
+}
+
+/**
+ * Get the value of an environment variable in env, or in the caller's if env is NULL.
+ */
+static const char* get_env(char** env, const char* name) {
+    if (!env) {
+        return getenv(name);
+    }
+    size_t size = strlen(name);
+    for (; *env; env++) {
+        if (!strncmp(*env, name, size) && (*env)[size] == '=') {
+            return *env + size + 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Check whether the options can be replayed.
+ */
+static bool cacheable(const SP_Opts* opts) {
+    if (!opts) {
+        return true;
+    }
+    // A NULL path fails in the child, which is left to sp_run().
+    SP_RedirType in = opts->spstdin.type;
+    if (in != SP_REDIR_INHERIT && in != SP_REDIR_BYTES &&
+        (in != SP_REDIR_PATH || !opts->spstdin.value.path)) {
+        return false;
+    }
+    const SP_RedirOpt* outputs[] = {&opts->spstdout, &opts->spstderr};
+    for (size_t i = 0; i < SP_SIZE_FIXED_ARR(outputs); i++) {
+        SP_RedirType type = outputs[i]->type;
+        bool devnull = type == SP_REDIR_PATH && outputs[i]->value.path &&
+                       !strcmp(outputs[i]->value.path, "/dev/null");
+        if (type != SP_REDIR_INHERIT && type != SP_REDIR_PIPE && !devnull) {
+            return false;
+        }
+    }
+    return !opts->fdMapSize && !opts->notify && !opts->rlimitsSize &&
+           !opts->cgroup;
+}
+
+/**
+ * Compute the key of a command.
+ *
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static int hash_command(SP_CacheHash* hash, char** argv, const SP_Opts* opts,
+                        const SP_CacheKey* key) {
+    *hash = (SP_CacheHash){0xcbf29ce484222325ull, 0x84222325cbf29ce4ull};
+    hash_string(hash, SP_CACHE_MAGIC);
+    for (char** arg = argv; *arg; arg++) {
+        hash_string(hash, *arg);
+    }
+    hash_field(hash, NULL, 0);
+    if (opts && opts->cwd) {
+        hash_string(hash, opts->cwd);
+    } else {
+        char* cwd = get_current_dir_name();
+        if (!cwd) {
+            return -1;
+        }
+        hash_string(hash, cwd);
+        free(cwd);
+    }
+    SP_Opts none = {0};
+    if (!opts) {
+        opts = &none;
+    }
+    const SP_RedirOpt* redirs[] = {&opts->spstdin, &opts->spstdout,
+                                   &opts->spstderr};
+    for (size_t i = 0; i < SP_SIZE_FIXED_ARR(redirs); i++) {
+        uint32_t type = redirs[i]->type;
+        hash_field(hash, &type, sizeof type);
+    }
+    if (opts->spstdin.type == SP_REDIR_BYTES) {
+        hash_field(hash, opts->spstdin.value.bytes, opts->spstdin.size);
+    } else if (opts->spstdin.type == SP_REDIR_PATH &&
+               hash_file(hash, opts->spstdin.value.path) < 0) {
+        return -1;
+    }
+    for (char** name = key && key->env ? key->env : NULL; name && *name;
+         name++) {
+        hash_string(hash, *name);
+        hash_string(hash, get_env(opts->env, *name));
+    }
+    hash_field(hash, NULL, 0);
+    for (char** path = key && key->files ? key->files : NULL; path && *path;
+         path++) {
+        if (hash_file(hash, *path) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Open an in-memory stream holding a copy of data, freed by fclose().
+ */
+static FILE* memory_stream(const char* data, size_t size) {
+    // Room for the NUL written when flushing.
+    FILE* file = fmemopen(NULL, size + 1, "w+");
+    if (!file) {
+        return NULL;
+    }
+    if (fwrite(data, 1, size, file) != size || fseek(file, 0, SEEK_SET)) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+/**
+ * Hand the outputs to the caller as the options request.
+ *
+ * @param[in,out] proc
+ * @param[in] opts
+ * @param[in] outputs stdout and stderr.
+ * @param[in] sizes
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static int replay(SP_Process* proc, const SP_Opts* opts, char* outputs[2],
+                  const uint64_t sizes[2]) {
+    SP_RedirType types[] = {opts ? opts->spstdout.type : SP_REDIR_INHERIT,
+                            opts ? opts->spstderr.type : SP_REDIR_INHERIT};
+    FILE** files[] = {&proc->spstdout, &proc->spstderr};
+    for (int i = 0; i < 2; i++) {
+        if (types[i] == SP_REDIR_PIPE) {
+            *files[i] = memory_stream(outputs[i], sizes[i]);
+            if (!*files[i]) {
+                return -1;
+            }
+        } else if (types[i] == SP_REDIR_INHERIT) {
+            fflush(i ? stderr : stdout);
+            // Not an error if the caller's output is closed.
+            sp_write_all(i ? STDERR_FILENO : STDOUT_FILENO, outputs[i], sizes[i]);
+        }
+    }
+    return 0;
+}
+
+static void hash_name(const SP_CacheHash* hash, char name[33]) {
+    snprintf(name, 33, "%016llx%016llx", (unsigned long long)hash->a,
+             (unsigned long long)hash->b);
+}
+
+/**
+ * Load a stored result.
+ *
+ * @return the result, to be freed with free(), or NULL if it is missing or invalid.
+ */
+static char* load(SP_Cache* cache, const char* name, SP_CacheHeader* header) {
+    int fd = openat(cache->dirFd, name, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof *header) {
+        sp_fd_close(&fd);
+        return NULL;
+    }
+    char* data = malloc(st.st_size);
+    size_t size = 0;
+    while (data && size < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + size, st.st_size - size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        size += n;
+    }
+    close(fd);
+    if (data && size == (size_t)st.st_size) {
+        memcpy(header, data, sizeof *header);
+        if (!memcmp(header->magic, SP_CACHE_MAGIC, sizeof header->magic) &&
+            header->size[0] <= size - sizeof *header &&
+            header->size[1] == size - sizeof *header - header->size[0]) {
+            // Most recently used, for eviction.
+            utimensat(cache->dirFd, name, NULL, 0);
+            return data;
+        }
+        // Corrupted, so it is replaced.
+        unlinkat(cache->dirFd, name, 0);
+    }
+    free(data);
+    return NULL;
+}
+
+/**
+ * A stored result, for eviction.
+ */
+typedef struct sp_cache_entry {
+    struct timespec mtime;
+    uint64_t size;
+    char name[33];
+} SP_CacheEntry;
+
+static int compare_entries(const void* a, const void* b) {
+    const struct timespec* x = &((const SP_CacheEntry*)a)->mtime;
+    const struct timespec* y = &((const SP_CacheEntry*)b)->mtime;
+    if (x->tv_sec != y->tv_sec) {
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/**
+ * Measure the stored results, and remove the least recently used ones while
+ * they exceed the size limit.
+ */
+static void evict(SP_Cache* cache) {
+    pthread_mutex_lock(&cache->mutex);
+    int fd = openat(cache->dirFd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        sp_fd_close(&fd);
+        pthread_mutex_unlock(&cache->mutex);
+        return;
+    }
+    SP_CacheEntry* entries = NULL;
+    size_t n = 0;
+    size_t capacity = 0;
+    uint64_t total = 0;
+    struct dirent* dirent;
+    while ((dirent = readdir(dir))) {
+        struct stat st;
+        // Skips temporary files, which start with '.'.
+        if (strlen(dirent->d_name) != 32 ||
+            fstatat(cache->dirFd, dirent->d_name, &st, 0) < 0) {
+            continue;
+        }
+        if (n == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            SP_CacheEntry* tmp = realloc(entries, capacity * sizeof *entries);
+            if (!tmp) {
+                break;
+            }
+            entries = tmp;
+        }
+        entries[n].mtime = st.st_mtim;
+        entries[n].size = st.st_size;
+        memcpy(entries[n].name, dirent->d_name, 33);
+        total += st.st_size;
+        n++;
+    }
+    closedir(dir);
+    if (cache->maxBytes && total > cache->maxBytes) {
+        qsort(entries, n, sizeof *entries, compare_entries);
+        for (size_t i = 0; i < n && total > cache->maxBytes; i++) {
+            if (unlinkat(cache->dirFd, entries[i].name, 0) == 0) {
+                __atomic_add_fetch(&cache->stats.evictions, 1,
+                                   __ATOMIC_RELAXED);
+            }
+            total -= entries[i].size;
+        }
+    }
+    free(entries);
+    __atomic_store_n(&cache->stats.bytes, total, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+/**
+ * Store a result atomically, so concurrent readers see either nothing or all of it.
+ */
+static void store(SP_Cache* cache, const char* name, int exitCode,
+                  char* outputs[2], const uint64_t sizes[2]) {
+    static size_t counter;
+    char tmpName[64];
+    snprintf(tmpName, sizeof tmpName, ".tmp-%d-%zu", getpid(),
+             __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED));
+    int fd = openat(cache->dirFd, tmpName,
+                    O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    SP_CacheHeader header = {
+        .magic = SP_CACHE_MAGIC,
+        .exitCode = exitCode,
+        .size = {sizes[0], sizes[1]},
+    };
+    int err = sp_write_all(fd, (char*)&header, sizeof header) < 0 ||
+              sp_write_all(fd, outputs[0], sizes[0]) < 0 ||
+              sp_write_all(fd, outputs[1], sizes[1]) < 0;
+    err = close(fd) < 0 || err;
+    if (err || renameat(cache->dirFd, tmpName, cache->dirFd, name) < 0) {
+        unlinkat(cache->dirFd, tmpName, 0);
+        return;
+    }
+    __atomic_add_fetch(&cache->stats.stores, 1, __ATOMIC_RELAXED);
+    uint64_t size = sizeof header + sizes[0] + sizes[1];
+    uint64_t bytes =
+        __atomic_add_fetch(&cache->stats.bytes, size, __ATOMIC_RELAXED);
+    if (cache->maxBytes && bytes > cache->maxBytes) {
+        evict(cache);
+    }
+}
+
+/**
+ * Run a command, capturing its outputs.
+ *
+ * @param[out] outputs stdout and stderr, to be freed with free().
+ * @param[out] sizes
+ * @return the process that exited, or NULL on error and errno is set accordingly.
+ */
+static SP_Process* run(char** argv, const SP_Opts* opts, char* outputs[2],
+                       uint64_t sizes[2]) {
+    SP_Opts runOpts = opts ? *opts : (SP_Opts){0};
+    if (runOpts.spstdin.type == SP_REDIR_INHERIT) {
+        // Reading the caller's stdin would make the result depend on it.
+        runOpts.spstdin = SP_REDIR_DEVNULL();
+    }
+    SP_RedirOpt* redirs[] = {&runOpts.spstdout, &runOpts.spstderr};
+    for (int i = 0; i < 2; i++) {
+        if (redirs[i]->type == SP_REDIR_INHERIT) {
+            *redirs[i] = SP_REDIR_PIPE();
+        }
+    }
+    SP_Process* proc = sp_open(argv, &runOpts);
+    if (!proc) {
+        return NULL;
+    }
+    SP_Capture capture = {0};
+    if (proc->spstdout || proc->spstderr) {
+        if (sp_capture(proc, &capture) < 0) {
+            int tmpErrno = errno;
+            sp_capture_free(&capture);
+            sp_destroy(proc);
+            errno = tmpErrno;
+            return NULL;
+        }
+    }
+    if (sp_wait(proc) < 0) {
+        sp_capture_free(&capture);
+        sp_destroy(proc);
+        return NULL;
+    }
+    // Drained, the outputs are replayed from memory instead.
+    FILE** files[] = {&proc->spstdout, &proc->spstderr};
+    for (int i = 0; i < 2; i++) {
+        if (*files[i]) {
+            fclose(*files[i]);
+            *files[i] = NULL;
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        sizes[i] = capture.bytes[i + 1];
+        outputs[i] = malloc(sizes[i] + 1);
+        if (!outputs[i]) {
+            free(outputs[0]);
+            sp_capture_free(&capture);
+            sp_destroy(proc);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    uint64_t offsets[2] = {0, 0};
+    for (SP_CaptureRecord* r = sp_capture_next(&capture, NULL); r;
+         r = sp_capture_next(&capture, r)) {
+        int i = r->stream - 1;
+        memcpy(outputs[i] + offsets[i], r->data, r->size);
+        offsets[i] += r->size;
+    }
+    sp_capture_free(&capture);
+    return proc;
+}
+
+SP_Cache* sp_cache_create(const char* dir, uint64_t maxBytes) {
+    if (!dir) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        return NULL;
+    }
+    SP_Cache* cache = calloc(1, sizeof *cache);
+    if (!cache) {
+        return NULL;
+    }
+    cache->dirFd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cache->dirFd < 0) {
+        free(cache);
+        return NULL;
+    }
+    cache->maxBytes = maxBytes;
+    pthread_mutex_init(&cache->mutex, NULL);
+    // Measures what is already stored.
+    evict(cache);
+    return cache;
+}
+
+SP_Process* sp_cache_run(SP_Cache* cache, char** argv, SP_Opts* opts,
+                         const SP_CacheKey* key) {
+    if (!cache || !argv || !argv[0]) {
+        errno = EINVAL;
+        return NULL;
+    }
+    SP_CacheHash hash;
+    if (!cacheable(opts) || hash_command(&hash, argv, opts, key) < 0) {
+        __atomic_add_fetch(&cache->stats.bypassed, 1, __ATOMIC_RELAXED);
+        return sp_run(argv, opts);
+    }
+    char name[33];
+    hash_name(&hash, name);
+    SP_CacheHeader header;
+    char* data = load(cache, name, &header);
+    if (data) {
+        __atomic_add_fetch(&cache->stats.hits, 1, __ATOMIC_RELAXED);
+        SP_Process* proc = calloc(1, sizeof *proc);
+        char* outputs[] = {data + sizeof header,
+                           data + sizeof header + header.size[0]};
+        if (proc) {
+            proc->sockets[0] = proc->sockets[1] = proc->sockets[2] = -1;
+            proc->status = SP_STATUS_DEAD;
+            proc->exitCode = header.exitCode;
+            proc->argv = sp_dupe_array(argv);
+        }
+        if (!proc || !proc->argv ||
+            replay(proc, opts, outputs, header.size) < 0) {
+            sp_destroy(proc);
+            free(data);
+            errno = ENOMEM;
+            return NULL;
+        }
+        free(data);
+        return proc;
+    }
+
+    __atomic_add_fetch(&cache->stats.misses, 1, __ATOMIC_RELAXED);
+    char* outputs[2];
+    uint64_t sizes[2];
+    SP_Process* proc = run(argv, opts, outputs, sizes);
+    if (!proc) {
+        return NULL;
+    }
+    if (proc->exitCode < SP_EXIT_NOT_EXECUTE) {
+        store(cache, name, proc->exitCode, outputs, sizes);
+    }
+    int err = replay(proc, opts, outputs, sizes);
+    free(outputs[0]);
+    free(outputs[1]);
+    if (err < 0) {
+        sp_destroy(proc);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return proc;
+}
+
+void sp_cache_stats(SP_Cache* cache, SP_CacheStats* stats) {
+    if (!cache || !stats) {
+        return;
+    }
+    uint64_t* src = (uint64_t*)&cache->stats;
+    uint64_t* dst = (uint64_t*)stats;
+    for (size_t i = 0; i < sizeof *stats / sizeof(uint64_t); i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+void sp_cache_destroy(SP_Cache* cache) {
+    if (!cache) {
+        return;
+    }
+    close(cache->dirFd);
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
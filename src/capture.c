@@ -0,0 +1,139 @@
+#include "subprocess/capture.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "subprocess/stats.h"
+#include "util.h"
+
+/**
+ * Maximum number of bytes read into a single record.
+ */
+#define SP_CAPTURE_CHUNK (64 * 1024)
+
+/**
+ * Round size up so every record stays aligned for its header.
+ *
+ * @param[in] size
+ */
+#define SP_CAPTURE_ALIGN(size)                       \
+    (((size) + __alignof__(SP_CaptureRecord) - 1) & \
+     ~(__alignof__(SP_CaptureRecord) - 1))
+
+/**
+ * Make sure there is room for a record holding SP_CAPTURE_CHUNK bytes at the end of capture.
+ *
+ * @param[in,out] capture
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int reserve(SP_Capture* capture) {
+    size_t needed =
+        capture->size + sizeof(SP_CaptureRecord) + SP_CAPTURE_CHUNK;
+    if (needed <= capture->capacity) {
+        return 0;
+    }
+    size_t capacity = capture->capacity ? capture->capacity : needed;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    char* tmp = realloc(capture->buf, capacity);
+    if (!tmp) {
+        return -1;
+    }
+    capture->buf = tmp;
+    capture->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Read one chunk from fd directly into a new record at the end of capture.
+ *
+ * @param[in,out] capture
+ * @param[in] fd
+ * @param[in] stream the target fd is connected to in the child.
+ * @return the number of bytes read, 0 on end of file, or -1 on error and errno is set.
+ */
+static ssize_t read_record(SP_Capture* capture, int fd, SP_RedirTarget stream) {
+    if (reserve(capture) < 0) {
+        return -1;
+    }
+    SP_CaptureRecord* record =
+        (SP_CaptureRecord*)(capture->buf + capture->size);
+    ssize_t n = read(fd, record->data, SP_CAPTURE_CHUNK);
+    if (n <= 0) {
+        return n;
+    }
+    record->timestamp = sp_now_ns();
+    record->size = n;
+    record->stream = stream;
+    capture->size += SP_CAPTURE_ALIGN(sizeof *record + n);
+    capture->count++;
+    capture->bytes[stream] += n;
+    sp_stats_bytes(0, n);
+    return n;
+}
+
+int sp_capture(SP_Process* proc, SP_Capture* capture) {
+    if (!proc || !capture || (!proc->spstdout && !proc->spstderr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct pollfd fds[] = {
+        {.fd = proc->spstdout ? fileno(proc->spstdout) : -1, .events = POLLIN},
+        {.fd = proc->spstderr ? fileno(proc->spstderr) : -1, .events = POLLIN},
+    };
+    SP_RedirTarget streams[] = {SP_STDOUT_FILENO, SP_STDERR_FILENO};
+    int nOpen = (fds[0].fd >= 0) + (fds[1].fd >= 0);
+    while (nOpen > 0) {
+        if (poll(fds, SP_SIZE_FIXED_ARR(fds), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        for (int i = 0; i < SP_SIZE_FIXED_ARR(fds); i++) {
+            if (fds[i].fd < 0 || !fds[i].revents) {
+                continue;
+            }
+            ssize_t n = read_record(capture, fds[i].fd, streams[i]);
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                // Negative fds are ignored by poll()
+                fds[i].fd = -1;
+                nOpen--;
+            }
+        }
+    }
+    return 0;
+}
+
+SP_CaptureRecord* sp_capture_next(SP_Capture* capture,
+                                  SP_CaptureRecord* record) {
+    if (!capture || !capture->buf) {
+        return NULL;
+    }
+    size_t offset = 0;
+    if (record) {
+        offset = (char*)record - capture->buf +
+                 SP_CAPTURE_ALIGN(sizeof *record + record->size);
+    }
+    if (offset >= capture->size) {
+        return NULL;
+    }
+    return (SP_CaptureRecord*)(capture->buf + offset);
+}
+
+void sp_capture_free(SP_Capture* capture) {
+    if (!capture) {
+        return;
+    }
+    free(capture->buf);
+    *capture = (SP_Capture){0};
+}
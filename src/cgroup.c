@@ -0,0 +1,230 @@
+#include "subprocess/cgroup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Milliseconds sp_cgroup_reaped() and sp_cgroup_free() wait for the processes left in
+ * the cgroup to exit once killed.
+ */
+#define SP_CGROUP_KILL_WAIT_MS 1000
+
+struct sp_cgroup {
+    char* path;  ///< the directory of the cgroup.
+    int fd;      ///< the opened directory, or -1 once the process is reaped.
+};
+
+// Numbers the cgroups of a caller so their names are unique.
+static uint64_t counter = 0;
+
+/**
+ * Write a value to a file of a cgroup.
+ *
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int write_value(int dirFd, const char* name, const char* value) {
+    int fd = openat(dirFd, name, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t size = strlen(value);
+    ssize_t n = write(fd, value, size);
+    int tmpErrno = errno;
+    close(fd);
+    if (n != (ssize_t)size) {
+        errno = n < 0 ? tmpErrno : EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Read a counter of a flat keyed file of a cgroup, e.g. `oom_kill 1` in memory.events.
+ *
+ * @return the value, or 0 if the file or the key does not exist.
+ */
+static uint64_t read_key(int dirFd, const char* name, const char* key) {
+    int fd = openat(dirFd, name, O_RDONLY | O_CLOEXEC);
+    FILE* file = fd >= 0 ? fdopen(fd, "r") : NULL;
+    if (!file) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    char line[128];
+    uint64_t value = 0;
+    size_t size = strlen(key);
+    while (fgets(line, sizeof line, file)) {
+        if (!strncmp(line, key, size) && line[size] == ' ') {
+            value = strtoull(line + size + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return value;
+}
+
+/**
+ * Write the limits of the options to a new cgroup.
+ *
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int write_limits(int dirFd, const SP_CgroupOpts* opts) {
+    char value[48];
+    if (opts->memoryMax) {
+        snprintf(value, sizeof value, "%" PRIu64, opts->memoryMax);
+        if (write_value(dirFd, "memory.max", value) < 0) {
+            return -1;
+        }
+    }
+    if (opts->cpuQuotaUs) {
+        uint64_t period = opts->cpuPeriodUs ? opts->cpuPeriodUs
+                                            : SP_CGROUP_CPU_PERIOD_US;
+        snprintf(value, sizeof value, "%" PRIu64 " %" PRIu64,
+                 opts->cpuQuotaUs, period);
+        if (write_value(dirFd, "cpu.max", value) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Kill every process left in a cgroup, e.g. daemons started by the process.
+ */
+static void kill_members(int dirFd) {
+    if (!write_value(dirFd, "cgroup.kill", "1")) {
+        return;
+    }
+    // Before Linux 5.14 they are killed one by one, processes forked meanwhile
+    // are killed by the next call.
+    int fd = openat(dirFd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+    FILE* procs = fd >= 0 ? fdopen(fd, "r") : NULL;
+    if (!procs) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    int pid;
+    while (fscanf(procs, "%d", &pid) == 1) {
+        kill(pid, SIGKILL);
+    }
+    fclose(procs);
+}
+
+const char* sp_cgroup_path(const SP_Process* proc) {
+    return proc && proc->cgroup ? proc->cgroup->path : NULL;
+}
+
+int sp_cgroup_create(SP_Process* proc, const SP_Opts* opts) {
+    if (!proc || !opts || !opts->cgroup || !opts->cgroup->parent) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct sp_cgroup* cgroup = calloc(1, sizeof *cgroup);
+    if (!cgroup) {
+        return -1;
+    }
+    cgroup->fd = -1;
+    const char* parent = opts->cgroup->parent;
+    size_t size = strlen(parent) + 64;
+    cgroup->path = malloc(size);
+    if (!cgroup->path) {
+        free(cgroup);
+        return -1;
+    }
+    uint64_t n = __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+    snprintf(cgroup->path, size, "%s/sp-%d-%" PRIu64, parent, getpid(), n);
+    if (mkdir(cgroup->path, 0755) < 0) {
+        free(cgroup->path);
+        free(cgroup);
+        return -1;
+    }
+    proc->cgroup = cgroup;
+    // clone3(2) needs a descriptor of the directory itself, the files are opened from it.
+    cgroup->fd = open(cgroup->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cgroup->fd < 0 || write_limits(cgroup->fd, opts->cgroup) < 0) {
+        int tmpErrno = errno;
+        sp_cgroup_free(proc);
+        errno = tmpErrno;
+        return -1;
+    }
+    return 0;
+}
+
+int sp_cgroup_fd(const SP_Process* proc) {
+    return proc && proc->cgroup ? proc->cgroup->fd : -1;
+}
+
+void sp_cgroup_reaped(SP_Process* proc) {
+    struct sp_cgroup* cgroup = proc->cgroup;
+    if (!cgroup || cgroup->fd < 0) {
+        return;
+    }
+    if (read_key(cgroup->fd, "memory.events", "oom_kill")) {
+        proc->limitHit |= SP_LIMIT_HIT_MEMORY;
+    }
+    if (read_key(cgroup->fd, "cpu.stat", "nr_throttled")) {
+        proc->limitHit |= SP_LIMIT_HIT_CPU_THROTTLED;
+    }
+    close(cgroup->fd);
+    cgroup->fd = -1;
+}
+
+char* sp_cgroup_release(SP_Process* proc) {
+    struct sp_cgroup* cgroup = proc ? proc->cgroup : NULL;
+    if (!cgroup) {
+        return NULL;
+    }
+    char* path = cgroup->path;
+    if (cgroup->fd >= 0) {
+        close(cgroup->fd);
+    }
+    free(cgroup);
+    proc->cgroup = NULL;
+    return path;
+}
+
+int sp_cgroup_remove(const char* path, int timeoutMs) {
+    int dirFd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) {
+        return -1;
+    }
+    int ret;
+    // The cgroup is busy until the killed processes have exited.
+    for (int i = 0;; i++) {
+        kill_members(dirFd);
+        ret = rmdir(path);
+        if (!ret || errno != EBUSY) {
+            break;
+        }
+        if (read_key(dirFd, "cgroup.events", "populated")) {
+            errno = EAGAIN;
+        }
+        if (errno != EAGAIN || i >= timeoutMs) {
+            break;
+        }
+        usleep(1000);
+    }
+    int tmpErrno = errno;
+    close(dirFd);
+    errno = tmpErrno;
+    return ret;
+}
+
+void sp_cgroup_free(SP_Process* proc) {
+    char* path = sp_cgroup_release(proc);
+    if (path) {
+        sp_cgroup_remove(path, SP_CGROUP_KILL_WAIT_MS);
+        free(path);
+    }
+}
@@ -0,0 +1,42 @@
+#define _GNU_SOURCE  // for memfd_create()
+
+#include "subprocess/channel.h"
+
+#include <sys/mman.h>
+
+int sp_channel_create(SP_Channel* channel, size_t capacity) {
+    if (!channel || !capacity || capacity > (SIZE_MAX >> 1)) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t size = SP_CHANNEL_DATA_OFFSET;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    capacity = size;
+    int fd = memfd_create("sp_channel", MFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t mapSize = SP_CHANNEL_DATA_OFFSET + capacity;
+    void* mem = MAP_FAILED;
+    if (ftruncate(fd, mapSize) == 0) {
+        mem = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mem == MAP_FAILED) {
+        int tmpErrno = errno;
+        close(fd);
+        errno = tmpErrno;
+        return -1;
+    }
+    // The memfd is zero filled, so only the layout needs to be set.
+    SP_ChannelShared* shared = mem;
+    shared->capacity = capacity;
+    shared->creatorPid = getpid();
+    shared->magic = SP_CHANNEL_MAGIC;
+    channel->fd = fd;
+    channel->shared = shared;
+    channel->data = (char*)mem + SP_CHANNEL_DATA_OFFSET;
+    channel->mapSize = mapSize;
+    return 0;
+}
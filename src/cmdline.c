@@ -0,0 +1,606 @@
+#include "subprocess/cmdline.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Types of tokens in a command line.
+ */
+typedef enum sp_token_type {
+    SP_TOKEN_END = 0,  ///< End of the command line.
+    SP_TOKEN_WORD,     ///< A word, with quotes and escapes removed.
+    SP_TOKEN_PIPE,     ///< `|`
+    SP_TOKEN_REDIR,    ///< A redirection operator.
+} SP_TokenType;
+
+/**
+ * A token of a command line.
+ */
+typedef struct sp_token {
+    SP_TokenType type;      ///< The type of token.
+    char* word;             ///< The word for SP_TOKEN_WORD, owned by the token.
+    SP_RedirTarget target;  ///< The fd being redirected for SP_TOKEN_REDIR.
+    SP_RedirType redir;     ///< The type of redirection for SP_TOKEN_REDIR.
+} SP_Token;
+
+/**
+ * A redirection of a command, in the order it is written.
+ */
+typedef struct sp_stage_redir {
+    SP_RedirTarget target;  ///< The fd being redirected.
+    /**
+     * SP_REDIR_PATH, SP_REDIR_APPEND, SP_REDIR_STDOUT for `2>&1` or SP_REDIR_STDERR
+     * for `>&2`.
+     */
+    SP_RedirType type;
+    char* path;  ///< The path, or NULL for fd duplication. Owned by the stage.
+} SP_StageRedir;
+
+/**
+ * A command of a pipeline as it is being parsed.
+ */
+typedef struct sp_stage {
+    char** argv;             ///< NULL terminated arguments, owned by the stage.
+    size_t argc;             ///< Number of arguments.
+    size_t capacity;         ///< Allocated size of argv.
+    SP_StageRedir* redirs;   ///< Redirections in the order they are written.
+    size_t nRedirs;          ///< Number of redirections.
+    size_t redirsCapacity;   ///< Allocated size of redirs.
+} SP_Stage;
+
+/**
+ * What a fd of a command refers to once its redirections are applied, see stage_opts().
+ * Values from SP_FD_PATH on are SP_FD_PATH plus the index of the redirection opening it.
+ */
+enum {
+    SP_FD_PIPE = 3,  ///< The pipe to the next command. Lower values are the fds on entry.
+    SP_FD_PATH,      ///< The first path.
+};
+
+/**
+ * A growable string used while lexing words.
+ */
+typedef struct sp_string {
+    char* buf;
+    size_t size;
+    size_t capacity;
+} SP_String;
+
+/**
+ * Append a character to str.
+ *
+ * @param[in,out] str
+ * @param[in] c
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int string_push(SP_String* str, char c) {
+    if (str->size + 1 >= str->capacity) {
+        size_t capacity = str->capacity ? str->capacity * 2 : 32;
+        char* tmp = realloc(str->buf, capacity);
+        if (!tmp) {
+            return -1;
+        }
+        str->buf = tmp;
+        str->capacity = capacity;
+    }
+    str->buf[str->size++] = c;
+    str->buf[str->size] = 0;
+    return 0;
+}
+
+/**
+ * Checks if c ends an unquoted word.
+ *
+ * @param[in] c
+ * @return true if c is whitespace or an operator.
+ */
+static bool is_word_end(char c) {
+    return !c || isspace((unsigned char)c) || strchr("|<>;&()`", c);
+}
+
+/**
+ * Lex a word starting at *s, removing quotes and escapes.
+ *
+ * @param[in,out] s advanced past the word.
+ * @param[out] tok
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int lex_word(const char** s, SP_Token* tok) {
+    SP_String str = {0};
+    const char* p = *s;
+    int err = 0;
+    while (!err && !is_word_end(*p)) {
+        if (*p == '\'') {
+            const char* end = strchr(p + 1, '\'');
+            if (!end) {
+                errno = EINVAL;
+                err = -1;
+                break;
+            }
+            for (p++; !err && p < end; p++) {
+                err = string_push(&str, *p);
+            }
+            p++;
+        } else if (*p == '"') {
+            for (p++; !err && *p != '"'; p++) {
+                if (!*p) {
+                    errno = EINVAL;
+                    err = -1;
+                    break;
+                }
+                if (*p == '\\' && strchr("\"\\$`\n", p[1]) && p[1]) {
+                    p++;
+                    if (*p == '\n') {
+                        continue;
+                    }
+                }
+                err = string_push(&str, *p);
+            }
+            p++;
+        } else if (*p == '\\') {
+            if (!p[1]) {
+                errno = EINVAL;
+                err = -1;
+                break;
+            }
+            if (p[1] != '\n') {
+                err = string_push(&str, p[1]);
+            }
+            p += 2;
+        } else {
+            err = string_push(&str, *p++);
+        }
+    }
+    // Quoted empty words such as '' still count as words.
+    if (!err && !str.buf) {
+        str.buf = strdup("");
+        err = SP_NORMALIZE_ERROR(str.buf);
+    }
+    if (err) {
+        free(str.buf);
+        return -1;
+    }
+    *s = p;
+    tok->type = SP_TOKEN_WORD;
+    tok->word = str.buf;
+    return 0;
+}
+
+/**
+ * Lex a redirection operator starting at *s.
+ *
+ * @param[in,out] s advanced past the operator.
+ * @param[out] tok
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int lex_redir(const char** s, SP_Token* tok) {
+    const char* p = *s;
+    int fd = -1;
+    if (isdigit((unsigned char)*p)) {
+        fd = *p++ - '0';
+    }
+    tok->type = SP_TOKEN_REDIR;
+    if (*p == '<') {
+        p++;
+        tok->target = fd < 0 ? SP_STDIN_FILENO : fd;
+        tok->redir = SP_REDIR_PATH;
+        if (*p == '<' || *p == '&' || *p == '>') {
+            // Here documents, fd duplication, and read-write are not supported.
+            errno = EINVAL;
+            return -1;
+        }
+    } else {
+        p++;
+        tok->target = fd < 0 ? SP_STDOUT_FILENO : fd;
+        tok->redir = SP_REDIR_PATH;
+        if (*p == '>') {
+            p++;
+            tok->redir = SP_REDIR_APPEND;
+        } else if (*p == '|') {
+            p++;
+        } else if (*p == '&') {
+            p++;
+            int dupFd = isdigit((unsigned char)*p) ? *p++ - '0' : -1;
+            if (tok->target == SP_STDERR_FILENO && dupFd == SP_STDOUT_FILENO) {
+                tok->redir = SP_REDIR_STDOUT;
+            } else if (tok->target == SP_STDOUT_FILENO &&
+                       dupFd == SP_STDERR_FILENO) {
+                tok->redir = SP_REDIR_STDERR;
+            } else {
+                errno = EINVAL;
+                return -1;
+            }
+            if (!is_word_end(*p) && !isdigit((unsigned char)*p)) {
+                errno = EINVAL;
+                return -1;
+            }
+        }
+    }
+    if (tok->target > SP_STDERR_FILENO) {
+        errno = EINVAL;
+        return -1;
+    }
+    *s = p;
+    return 0;
+}
+
+/**
+ * Lex the next token of a command line.
+ *
+ * @param[in,out] s advanced past the token.
+ * @param[out] tok
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int next_token(const char** s, SP_Token* tok) {
+    *tok = (SP_Token){0};
+    while (isspace((unsigned char)**s)) {
+        (*s)++;
+    }
+    const char* p = *s;
+    if (!*p) {
+        tok->type = SP_TOKEN_END;
+        return 0;
+    }
+    if (*p == '|') {
+        if (p[1] == '|' || p[1] == '&') {
+            errno = EINVAL;
+            return -1;
+        }
+        tok->type = SP_TOKEN_PIPE;
+        (*s)++;
+        return 0;
+    }
+    if (*p == '<' || *p == '>' ||
+        (isdigit((unsigned char)*p) && (p[1] == '<' || p[1] == '>'))) {
+        return lex_redir(s, tok);
+    }
+    if (strchr(";&()`", *p)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return lex_word(s, tok);
+}
+
+/**
+ * Free the memory owned by a stage.
+ *
+ * @param[in,out] stage
+ */
+static void stage_free(SP_Stage* stage) {
+    for (size_t i = 0; i < stage->argc; i++) {
+        free(stage->argv[i]);
+    }
+    free(stage->argv);
+    for (size_t i = 0; i < stage->nRedirs; i++) {
+        free(stage->redirs[i].path);
+    }
+    free(stage->redirs);
+    *stage = (SP_Stage){0};
+}
+
+/**
+ * Free an array of stages.
+ *
+ * @param[in,out] stages
+ * @param[in] nStages
+ */
+static void stages_free(SP_Stage* stages, size_t nStages) {
+    for (size_t i = 0; i < nStages; i++) {
+        stage_free(&stages[i]);
+    }
+    free(stages);
+}
+
+/**
+ * Append an argument to a stage, taking ownership of word.
+ *
+ * @param[in,out] stage
+ * @param[in] word
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int stage_push_arg(SP_Stage* stage, char* word) {
+    // Room for the NULL terminator.
+    if (stage->argc + 1 >= stage->capacity) {
+        size_t capacity = stage->capacity ? stage->capacity * 2 : 8;
+        char** tmp = realloc(stage->argv, capacity * sizeof *tmp);
+        if (!tmp) {
+            return -1;
+        }
+        stage->argv = tmp;
+        stage->capacity = capacity;
+    }
+    stage->argv[stage->argc++] = word;
+    stage->argv[stage->argc] = NULL;
+    return 0;
+}
+
+/**
+ * Append a redirection to a stage, taking ownership of path.
+ *
+ * @param[in,out] stage
+ * @param[in] tok the redirection operator
+ * @param[in] path the path, or NULL for fd duplication.
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int stage_push_redir(SP_Stage* stage, SP_Token* tok, char* path) {
+    if (stage->nRedirs == stage->redirsCapacity) {
+        size_t capacity = stage->redirsCapacity ? stage->redirsCapacity * 2 : 4;
+        SP_StageRedir* tmp = realloc(stage->redirs, capacity * sizeof *tmp);
+        if (!tmp) {
+            free(path);
+            return -1;
+        }
+        stage->redirs = tmp;
+        stage->redirsCapacity = capacity;
+    }
+    stage->redirs[stage->nRedirs++] =
+        (SP_StageRedir){.target = tok->target, .type = tok->redir, .path = path};
+    return 0;
+}
+
+/**
+ * Parse a command line into stages.
+ *
+ * @param[in] cmdline
+ * @param[out] nStages number of stages parsed.
+ * @return the stages, or NULL on error and errno is set.
+ */
+static SP_Stage* parse(const char* cmdline, size_t* nStages) {
+    size_t capacity = 4;
+    SP_Stage* stages = calloc(capacity, sizeof *stages);
+    if (!stages) {
+        return NULL;
+    }
+    size_t n = 1;
+    int err = 0;
+    SP_Token tok;
+    do {
+        err = next_token(&cmdline, &tok);
+        if (err) {
+            break;
+        }
+        SP_Stage* stage = &stages[n - 1];
+        switch (tok.type) {
+        case SP_TOKEN_WORD:
+            err = stage_push_arg(stage, tok.word);
+            if (err) {
+                free(tok.word);
+            }
+            break;
+        case SP_TOKEN_REDIR: {
+            char* path = NULL;
+            if (tok.redir == SP_REDIR_PATH || tok.redir == SP_REDIR_APPEND) {
+                SP_Token pathTok;
+                err = next_token(&cmdline, &pathTok);
+                if (!err && pathTok.type != SP_TOKEN_WORD) {
+                    errno = EINVAL;
+                    err = -1;
+                }
+                path = pathTok.word;
+            }
+            if (!err) {
+                err = stage_push_redir(stage, &tok, path);
+            }
+            break;
+        }
+        case SP_TOKEN_PIPE:
+        case SP_TOKEN_END:
+            if (!stage->argc) {
+                errno = EINVAL;
+                err = -1;
+                break;
+            }
+            if (tok.type == SP_TOKEN_END) {
+                break;
+            }
+            if (n == capacity) {
+                SP_Stage* tmp = realloc(stages, capacity * 2 * sizeof *tmp);
+                if (!tmp) {
+                    err = -1;
+                    break;
+                }
+                memset(tmp + capacity, 0, capacity * sizeof *tmp);
+                stages = tmp;
+                capacity *= 2;
+            }
+            n++;
+            break;
+        }
+    } while (!err && tok.type != SP_TOKEN_END);
+    if (err) {
+        int tmpErrno = errno;
+        stages_free(stages, n);
+        errno = tmpErrno;
+        return NULL;
+    }
+    *nStages = n;
+    return stages;
+}
+
+/**
+ * Build the options for a stage of the pipeline.
+ *
+ * The redirections are replayed in order on what each fd refers to, starting from the
+ * pipes and the inherited options. The result is expressed with one sp_redir_opt per
+ * target: the fds keeping what they had first, then the inherited fds moved elsewhere
+ * before their target changes, then the pipe and the paths, then the duplicates of those.
+ *
+ * @param[in] stage
+ * @param[in] base options shared by every stage.
+ * @param[in] in the pipe from the previous process, or NULL if it has none.
+ * @param[in] first true for the first stage.
+ * @param[in] last true for the last stage.
+ * @param[out] opts the options
+ * @param[out] pipeTarget the fd holding the pipe to the next process, or -1 if none does.
+ * @return 0 on success, -1 on error and errno is set. errno is EINVAL if the
+ *         redirections can't be expressed, e.g. `>&2 2>file` where stderr is not
+ *         inherited.
+ */
+static int stage_opts(SP_Stage* stage, SP_Opts* base, FILE* in, bool first,
+                      bool last, SP_Opts* opts, int* pipeTarget) {
+    *opts = base ? *base : (SP_Opts){0};
+    if (!first) {
+        opts->spstdin = in ? SP_REDIR_FILE(in) : SP_REDIR_DEVNULL();
+    }
+    SP_RedirOpt* redirs[] = {&opts->spstdin, &opts->spstdout, &opts->spstderr};
+    SP_RedirOpt initial[3] = {*redirs[0], *redirs[1], *redirs[2]};
+    int fds[3] = {SP_STDIN_FILENO, last ? SP_STDOUT_FILENO : SP_FD_PIPE,
+                  SP_STDERR_FILENO};
+    for (size_t i = 0; i < stage->nRedirs; i++) {
+        SP_StageRedir* redir = &stage->redirs[i];
+        if (redir->type == SP_REDIR_STDOUT) {
+            fds[redir->target] = fds[SP_STDOUT_FILENO];
+        } else if (redir->type == SP_REDIR_STDERR) {
+            fds[redir->target] = fds[SP_STDERR_FILENO];
+        } else {
+            fds[redir->target] = SP_FD_PATH + i;
+        }
+    }
+    // The first fd referring to something sets it up, the others duplicate it.
+    int owners[3];
+    for (int t = 0; t < 3; t++) {
+        owners[t] = t;
+        for (int u = 0; u < t; u++) {
+            if (fds[u] == fds[t]) {
+                owners[t] = u;
+                break;
+            }
+        }
+        if (fds[t] < SP_FD_PIPE && fds[fds[t]] == fds[t]) {
+            owners[t] = fds[t];
+        }
+    }
+    *pipeTarget = -1;
+    size_t n = 0;
+    for (int phase = 0; phase < 4; phase++) {
+        for (int t = 0; t < 3; t++) {
+            int fd = fds[t];
+            bool kept = fd == t;
+            bool moved = fd < SP_FD_PIPE && !kept && fds[fd] != fd;
+            bool owned = fd >= SP_FD_PIPE && owners[t] == t;
+            bool dup = !kept && !moved && !owned;
+            if ((phase == 0 && !kept) || (phase == 1 && !moved) ||
+                (phase == 2 && !owned) || (phase == 3 && !dup)) {
+                continue;
+            }
+            opts->redirOrder[n++] = t;
+            if (kept) {
+                continue;
+            }
+            if (moved) {
+                // Only an inherited fd is still in place to be duplicated.
+                if (initial[fd].type != SP_REDIR_INHERIT) {
+                    errno = EINVAL;
+                    return -1;
+                }
+                *redirs[t] = SP_REDIR_FD(fd);
+            } else if (fd == SP_FD_PIPE && owned) {
+                *redirs[t] = SP_REDIR_PIPE();
+                *pipeTarget = t;
+            } else if (owned) {
+                SP_StageRedir* redir = &stage->redirs[fd - SP_FD_PATH];
+                *redirs[t] = (SP_RedirOpt){.type = redir->type,
+                                           .value.path = redir->path};
+            } else {
+                *redirs[t] = owners[t] == SP_STDOUT_FILENO ? SP_REDIR_STDOUT()
+                                                           : SP_REDIR_STDERR();
+            }
+        }
+    }
+    return 0;
+}
+
+SP_Pipeline* sp_open_cmdline(const char* cmdline, SP_Opts* opts) {
+    if (!cmdline) {
+        errno = EINVAL;
+        return NULL;
+    }
+    size_t nStages;
+    SP_Stage* stages = parse(cmdline, &nStages);
+    if (!stages) {
+        return NULL;
+    }
+    // Check every stage before spawning anything.
+    SP_Opts procOpts;
+    int pipeTarget = -1;
+    for (size_t i = 0; i < nStages; i++) {
+        if (stage_opts(&stages[i], opts, NULL, !i, i == nStages - 1,
+                       &procOpts, &pipeTarget) < 0) {
+            stages_free(stages, nStages);
+            return NULL;
+        }
+    }
+    SP_Pipeline* pipeline = calloc(1, sizeof *pipeline);
+    if (pipeline) {
+        pipeline->procs = calloc(nStages, sizeof *pipeline->procs);
+    }
+    if (!pipeline || !pipeline->procs) {
+        free(pipeline);
+        stages_free(stages, nStages);
+        return NULL;
+    }
+    FILE** in = NULL;
+    for (size_t i = 0; i < nStages; i++) {
+        stage_opts(&stages[i], opts, in ? *in : NULL, !i, i == nStages - 1,
+                   &procOpts, &pipeTarget);
+        SP_Process* proc = sp_open(stages[i].argv, &procOpts);
+        if (!proc) {
+            int tmpErrno = errno;
+            sp_pipeline_destroy(pipeline);
+            stages_free(stages, nStages);
+            errno = tmpErrno;
+            return NULL;
+        }
+        pipeline->procs[pipeline->size++] = proc;
+        if (in && *in) {
+            // Only the next process reads from the pipe.
+            fclose(*in);
+            *in = NULL;
+        }
+        in = pipeTarget == SP_STDOUT_FILENO   ? &proc->spstdout
+             : pipeTarget == SP_STDERR_FILENO ? &proc->spstderr
+                                              : NULL;
+    }
+    stages_free(stages, nStages);
+    return pipeline;
+}
+
+SP_Pipeline* sp_run_cmdline(const char* cmdline, SP_Opts* opts) {
+    SP_Pipeline* pipeline = sp_open_cmdline(cmdline, opts);
+    if (!pipeline) {
+        return NULL;
+    }
+    if (sp_pipeline_wait(pipeline) < 0) {
+        sp_pipeline_destroy(pipeline);
+        return NULL;
+    }
+    return pipeline;
+}
+
+int sp_pipeline_wait(SP_Pipeline* pipeline) {
+    if (!pipeline || !pipeline->size) {
+        errno = EINVAL;
+        return -1;
+    }
+    int exitCode = -1;
+    for (size_t i = 0; i < pipeline->size; i++) {
+        exitCode = sp_wait(pipeline->procs[i]);
+        if (exitCode < 0) {
+            return -1;
+        }
+    }
+    return exitCode;
+}
+
+void sp_pipeline_destroy(SP_Pipeline* pipeline) {
+    if (!pipeline) {
+        return;
+    }
+    for (size_t i = 0; i < pipeline->size; i++) {
+        sp_destroy(pipeline->procs[i]);
+    }
+    free(pipeline->procs);
+    free(pipeline);
+}
@@ -0,0 +1,569 @@
+#include "subprocess/coproc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "subprocess/pipe.h"
+#include "util.h"
+
+/**
+ * Bytes read from the child at once.
+ */
+#define SP_COPROC_READ_SIZE 65536
+
+/**
+ * A growable byte buffer consumed from the front.
+ */
+typedef struct sp_coproc_buffer {
+    char* data;       ///< allocated memory.
+    size_t offset;    ///< bytes already consumed.
+    size_t size;      ///< bytes in use, including the consumed ones.
+    size_t capacity;  ///< allocated size of data.
+} SP_CoprocBuffer;
+
+/**
+ * A request that has not been received yet.
+ */
+typedef struct sp_coproc_request {
+    size_t id;            ///< id of the request.
+    char* msg;            ///< copy of the request.
+    size_t size;          ///< size of msg.
+    uint64_t deadlineNs;  ///< time the request times out, or 0.
+    int attempts;         ///< children that died while serving the request.
+    int error;            ///< errno if the request failed, else 0.
+    char* response;       ///< the response, or NULL if not answered yet.
+    size_t responseSize;  ///< size of response.
+} SP_CoprocRequest;
+
+struct sp_coproc {
+    char** argv;                ///< deep copy of argv.
+    SP_Opts opts;               ///< copy of the options with pipes on stdin and stdout.
+    SP_CoprocFraming framing;   ///< how messages are delimited.
+    SP_Process* process;        ///< the child, or NULL until restarted.
+    int inFd;                   ///< write end of the child's stdin.
+    int outFd;                  ///< read end of the child's stdout.
+    SP_CoprocBuffer out;        ///< framed requests not written yet.
+    SP_CoprocBuffer in;         ///< bytes read from the child not parsed yet.
+    SP_CoprocRequest* pending;  ///< ring buffer of requests not received yet.
+    size_t head;                ///< index of the oldest request.
+    size_t size;                ///< number of requests in the ring buffer.
+    size_t capacity;            ///< allocated size of pending.
+    size_t nextId;              ///< id of the next request.
+    size_t spawns;              ///< number of children started.
+};
+
+/**
+ * Make room for n more bytes at the end of a buffer,
+ * dropping the consumed bytes first.
+ *
+ * @param[in,out] buf
+ * @param[in] n
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static int buffer_reserve(SP_CoprocBuffer* buf, size_t n) {
+    if (buf->offset) {
+        memmove(buf->data, buf->data + buf->offset, buf->size - buf->offset);
+        buf->size -= buf->offset;
+        buf->offset = 0;
+    }
+    if (buf->size + n <= buf->capacity) {
+        return 0;
+    }
+    size_t capacity = buf->capacity ? buf->capacity : 4096;
+    while (capacity < buf->size + n) {
+        capacity *= 2;
+    }
+    char* tmp = realloc(buf->data, capacity);
+    if (!tmp) {
+        return -1;
+    }
+    buf->data = tmp;
+    buf->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Frame a request and add it to co->out.
+ *
+ * @param[in,out] co
+ * @param[in] req
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static int encode(SP_Coproc* co, SP_CoprocRequest* req) {
+    if (buffer_reserve(&co->out, req->size + 4) < 0) {
+        return -1;
+    }
+    char* dst = co->out.data + co->out.size;
+    if (co->framing == SP_FRAME_LENGTH) {
+        uint32_t size = req->size;
+        *dst++ = size >> 24;
+        *dst++ = size >> 16;
+        *dst++ = size >> 8;
+        *dst++ = size;
+    }
+    memcpy(dst, req->msg, req->size);
+    dst += req->size;
+    if (co->framing == SP_FRAME_LINE) {
+        *dst++ = '\n';
+    }
+    co->out.size = dst - co->out.data;
+    return 0;
+}
+
+/**
+ * Get a request by its position in the ring buffer.
+ *
+ * @param[in] co
+ * @param[in] i 0 for the oldest request.
+ * @return the request
+ */
+static SP_CoprocRequest* request_at(const SP_Coproc* co, size_t i) {
+    return &co->pending[(co->head + i) % co->capacity];
+}
+
+/**
+ * Find the oldest request waiting for a response from the child.
+ *
+ * @param[in] co
+ * @return the request, or NULL if there is none.
+ */
+static SP_CoprocRequest* first_unanswered(const SP_Coproc* co) {
+    for (size_t i = 0; i < co->size; i++) {
+        SP_CoprocRequest* req = request_at(co, i);
+        if (!req->response && !req->error) {
+            return req;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Match every complete message in co->in to the unanswered requests.
+ * Messages that do not answer any request are dropped.
+ *
+ * @param[in,out] co
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static int decode(SP_Coproc* co) {
+    SP_CoprocBuffer* in = &co->in;
+    while (in->offset < in->size) {
+        char* start = in->data + in->offset;
+        size_t avail = in->size - in->offset;
+        char* msg;
+        size_t size;
+        size_t frameSize;
+        if (co->framing == SP_FRAME_LENGTH) {
+            if (avail < 4) {
+                return 0;
+            }
+            unsigned char* p = (unsigned char*)start;
+            size = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+                   (uint32_t)p[2] << 8 | p[3];
+            if (avail - 4 < size) {
+                return 0;
+            }
+            msg = start + 4;
+            frameSize = size + 4;
+        } else {
+            char* end = memchr(start, '\n', avail);
+            if (!end) {
+                return 0;
+            }
+            msg = start;
+            size = end - start;
+            frameSize = size + 1;
+        }
+        SP_CoprocRequest* req = first_unanswered(co);
+        if (req) {
+            req->response = malloc(size + 1);
+            if (!req->response) {
+                return -1;
+            }
+            memcpy(req->response, msg, size);
+            req->response[size] = '\0';
+            req->responseSize = size;
+        }
+        in->offset += frameSize;
+    }
+    in->offset = 0;
+    in->size = 0;
+    return 0;
+}
+
+/**
+ * Read everything available from the child without blocking.
+ *
+ * @param[in,out] co
+ * @return 1 if the child closed its stdout, 0 otherwise, or -1 on error and errno is set
+ *         accordingly.
+ */
+static int drain(SP_Coproc* co) {
+    while (true) {
+        if (buffer_reserve(&co->in, SP_COPROC_READ_SIZE) < 0) {
+            return -1;
+        }
+        ssize_t n = read(co->outFd, co->in.data + co->in.size,
+                         co->in.capacity - co->in.size);
+        if (n > 0) {
+            co->in.size += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            return decode(co);
+        }
+        // EOF, or the pipe is broken which is handled the same way.
+        return decode(co) < 0 ? -1 : 1;
+    }
+}
+
+/**
+ * Write as much of co->out as the pipe accepts without raising SIGPIPE.
+ *
+ * @param[in,out] co
+ * @return 1 if the child closed its stdin, 0 otherwise, or -1 on error and errno is set
+ *         accordingly.
+ */
+static int flush(SP_Coproc* co) {
+    sigset_t pipeSet;
+    sigset_t oldSet;
+    sigset_t pendingSet;
+    sigemptyset(&pipeSet);
+    sigaddset(&pipeSet, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSet, &oldSet);
+    sigpending(&pendingSet);
+    bool wasPending = sigismember(&pendingSet, SIGPIPE);
+
+    int ret = 0;
+    while (co->out.offset < co->out.size) {
+        ssize_t n = write(co->inFd, co->out.data + co->out.offset,
+                          co->out.size - co->out.offset);
+        if (n >= 0) {
+            co->out.offset += n;
+        } else if (errno == EPIPE) {
+            ret = 1;
+            break;
+        } else if (errno != EINTR) {
+            ret = errno == EAGAIN ? 0 : -1;
+            break;
+        }
+    }
+    if (ret == 1 && !wasPending) {
+        // Discard the SIGPIPE raised by the write.
+        struct timespec zero = {0};
+        while (sigtimedwait(&pipeSet, NULL, &zero) < 0 && errno == EINTR) {
+        }
+    }
+    int tmpErrno = errno;
+    pthread_sigmask(SIG_SETMASK, &oldSet, NULL);
+    errno = tmpErrno;
+    if (co->out.offset == co->out.size) {
+        co->out.offset = 0;
+        co->out.size = 0;
+    }
+    return ret;
+}
+
+/**
+ * Stop the child and forget the bytes buffered for it.
+ *
+ * @param[in,out] co
+ * @param[in] graceMs milliseconds to wait for the child to exit after closing its stdin.
+ */
+static void stop(SP_Coproc* co, int graceMs) {
+    if (!co->process) {
+        return;
+    }
+    sp_close(co->process);
+    if (graceMs > 0 && sp_poll(co->process) >= 0 &&
+        co->process->status != SP_STATUS_DEAD) {
+        int pidfd = sp_pidfd(co->process);
+        if (pidfd >= 0) {
+            struct pollfd pfd = {.fd = pidfd, .events = POLLIN};
+            while (poll(&pfd, 1, graceMs) < 0 && errno == EINTR) {
+            }
+            sp_fd_close(&pidfd);
+        } else {
+            struct timespec ms = {.tv_nsec = 1000000};
+            for (int i = 0; i < graceMs && sp_poll(co->process) >= 0 &&
+                            co->process->status != SP_STATUS_DEAD;
+                 i++) {
+                nanosleep(&ms, NULL);
+            }
+        }
+        sp_poll(co->process);
+    }
+    // Kills the child if it is still running.
+    sp_destroy(co->process);
+    co->process = NULL;
+    co->inFd = -1;
+    co->outFd = -1;
+    co->in.offset = co->in.size = 0;
+    co->out.offset = co->out.size = 0;
+}
+
+/**
+ * Handle the child closing its pipes: the oldest unanswered request is blamed and failed
+ * once it exceeds SP_COPROC_RETRIES, and the child is reaped to be restarted on demand.
+ *
+ * @param[in,out] co
+ */
+static void died(SP_Coproc* co) {
+    SP_CoprocRequest* req = first_unanswered(co);
+    if (req && ++req->attempts > SP_COPROC_RETRIES) {
+        req->error = EPIPE;
+    }
+    stop(co, 0);
+}
+
+/**
+ * Start the child and send it every unanswered request.
+ *
+ * @param[in,out] co
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static int spawn(SP_Coproc* co) {
+    SP_Process* proc = sp_open(co->argv, &co->opts);
+    if (!proc) {
+        return -1;
+    }
+    co->process = proc;
+    co->inFd = fileno(proc->spstdin);
+    co->outFd = fileno(proc->spstdout);
+    co->spawns++;
+    int fds[] = {co->inFd, co->outFd};
+    for (size_t i = 0; i < SP_SIZE_FIXED_ARR(fds); i++) {
+        int flags = fcntl(fds[i], F_GETFL);
+        if (flags < 0 || fcntl(fds[i], F_SETFL, flags | O_NONBLOCK) < 0) {
+            stop(co, 0);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < co->size; i++) {
+        SP_CoprocRequest* req = request_at(co, i);
+        if (!req->response && !req->error && encode(co, req) < 0) {
+            stop(co, 0);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Exchange bytes with the child, restarting it as needed.
+ *
+ * @param[in,out] co
+ * @param[in] wait if true, wait until the oldest request is answered, fails or times out.
+ *            Otherwise return as soon as the pipes would block.
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static int pump(SP_Coproc* co, bool wait) {
+    while (true) {
+        SP_CoprocRequest* oldest = co->size ? request_at(co, 0) : NULL;
+        if (wait && (!oldest || oldest->response || oldest->error)) {
+            return 0;
+        }
+        if (!co->process) {
+            if (!first_unanswered(co)) {
+                return 0;
+            }
+            if (spawn(co) < 0) {
+                return -1;
+            }
+        }
+        int ret = flush(co);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 1) {
+            // Collect what the child wrote before closing its stdin.
+            if (drain(co) < 0) {
+                return -1;
+            }
+            died(co);
+            continue;
+        }
+
+        int timeout = 0;
+        if (wait) {
+            timeout = -1;
+            if (oldest->deadlineNs) {
+                uint64_t now = sp_now_ns();
+                timeout = now < oldest->deadlineNs
+                              ? (oldest->deadlineNs - now + 999999) / 1000000
+                              : 0;
+            }
+        }
+        struct pollfd fds[] = {
+            {.fd = co->outFd, .events = POLLIN},
+            // A closed stdin is only noticed when writing to it.
+            {.fd = co->out.size ? co->inFd : -1, .events = POLLOUT},
+        };
+        int n = poll(fds, SP_SIZE_FIXED_ARR(fds), timeout);
+        if (n < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (n == 0 && !wait) {
+            return 0;
+        }
+        if (n > 0 && fds[0].revents) {
+            ret = drain(co);
+            if (ret < 0) {
+                return -1;
+            }
+            if (ret == 1) {
+                died(co);
+            }
+        }
+        if (wait && oldest->deadlineNs && !oldest->response &&
+            !oldest->error && sp_now_ns() >= oldest->deadlineNs) {
+            // Late responses could not be told apart, so start over.
+            oldest->error = ETIMEDOUT;
+            stop(co, 0);
+        }
+    }
+}
+
+SP_Coproc* sp_coproc_create(char** argv, SP_Opts* opts,
+                            SP_CoprocFraming framing) {
+    if (!argv || !argv[0] ||
+        (framing != SP_FRAME_LINE && framing != SP_FRAME_LENGTH)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    SP_Coproc* co = calloc(1, sizeof *co);
+    if (!co) {
+        return NULL;
+    }
+    co->framing = framing;
+    co->inFd = -1;
+    co->outFd = -1;
+    if (opts) {
+        co->opts = *opts;
+    }
+    co->opts.spstdin = SP_REDIR_PIPE();
+    co->opts.spstdout = SP_REDIR_PIPE();
+    co->argv = sp_dupe_array(argv);
+    if (!co->argv || spawn(co) < 0) {
+        int tmpErrno = errno;
+        sp_coproc_destroy(co);
+        errno = tmpErrno;
+        return NULL;
+    }
+    return co;
+}
+
+ssize_t sp_coproc_send(SP_Coproc* co, const void* msg, size_t size,
+                       int timeoutMs) {
+    if (!co || (!msg && size) || size > UINT32_MAX ||
+        (co->framing == SP_FRAME_LINE && size && memchr(msg, '\n', size))) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (co->size == co->capacity) {
+        size_t capacity = co->capacity ? co->capacity * 2 : 16;
+        SP_CoprocRequest* tmp = realloc(co->pending, capacity * sizeof *tmp);
+        if (!tmp) {
+            return -1;
+        }
+        // The ring buffer is full, so the requests before head wrapped around.
+        memcpy(tmp + co->capacity, tmp, co->head * sizeof *tmp);
+        co->pending = tmp;
+        co->capacity = capacity;
+    }
+    SP_CoprocRequest req = {.id = co->nextId, .size = size};
+    req.msg = malloc(size ? size : 1);
+    if (!req.msg) {
+        return -1;
+    }
+    memcpy(req.msg, msg, size);
+    if (timeoutMs >= 0) {
+        req.deadlineNs = sp_now_ns() + (uint64_t)timeoutMs * 1000000;
+    }
+    if (co->process && encode(co, &req) < 0) {
+        free(req.msg);
+        return -1;
+    }
+    *request_at(co, co->size) = req;
+    co->size++;
+    // The request is queued even if the child can't be restarted right now.
+    pump(co, false);
+    return co->nextId++;
+}
+
+int sp_coproc_recv(SP_Coproc* co, size_t* id, char** response,
+                   size_t* size) {
+    if (!co || !response || !size) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!co->size) {
+        errno = ENOMSG;
+        return -1;
+    }
+    if (pump(co, true) < 0) {
+        return -1;
+    }
+    SP_CoprocRequest req = *request_at(co, 0);
+    co->head = (co->head + 1) % co->capacity;
+    co->size--;
+    free(req.msg);
+    if (id) {
+        *id = req.id;
+    }
+    if (req.error) {
+        free(req.response);
+        errno = req.error;
+        return -1;
+    }
+    *response = req.response;
+    *size = req.responseSize;
+    return 0;
+}
+
+int sp_coproc_call(SP_Coproc* co, const void* msg, size_t size,
+                   int timeoutMs, char** response, size_t* responseSize) {
+    if (co && co->size) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (sp_coproc_send(co, msg, size, timeoutMs) < 0) {
+        return -1;
+    }
+    return sp_coproc_recv(co, NULL, response, responseSize);
+}
+
+size_t sp_coproc_pending(const SP_Coproc* co) { return co ? co->size : 0; }
+
+size_t sp_coproc_restarts(const SP_Coproc* co) {
+    return co && co->spawns ? co->spawns - 1 : 0;
+}
+
+SP_Process* sp_coproc_process(SP_Coproc* co) {
+    return co ? co->process : NULL;
+}
+
+void sp_coproc_destroy(SP_Coproc* co) {
+    if (!co) {
+        return;
+    }
+    stop(co, SP_COPROC_GRACE_MS);
+    for (size_t i = 0; i < co->size; i++) {
+        SP_CoprocRequest* req = request_at(co, i);
+        free(req->msg);
+        free(req->response);
+    }
+    free(co->pending);
+    free(co->in.data);
+    free(co->out.data);
+    sp_free_array(co->argv);
+    free(co);
+}
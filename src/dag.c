@@ -0,0 +1,569 @@
+#include "subprocess/dag.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "subprocess/pipe.h"
+#include "util.h"
+
+/**
+ * Milliseconds between sp_poll() calls for processes that have no pidfd.
+ */
+#define SP_DAG_POLL_MS 10
+
+/**
+ * A node of the graph.
+ */
+typedef struct sp_dag_node {
+    char** argv;         ///< deep copy of argv.
+    SP_Opts opts;        ///< copy of the options.
+    bool hasOpts;        ///< opts was given to sp_dag_add().
+    uint64_t cost;       ///< expected run time, at least 1.
+    ssize_t pipeFrom;    ///< the node writing to stdin, or -1.
+    ssize_t pipeTo;      ///< the node reading stdout, or -1.
+    size_t* dependents;  ///< the nodes depending on this one.
+    size_t nDependents;  ///< number of dependents.
+    size_t capacity;     ///< allocated size of dependents.
+    size_t group;        ///< the first node of the pipeline this node is part of.
+    SP_DagResult result; ///< see sp_dag_result()
+} SP_DagNode;
+
+/**
+ * A node that has been started.
+ */
+typedef struct sp_dag_running {
+    size_t node;          ///< id of the node.
+    SP_Process* process;  ///< the running process.
+    int pidfd;            ///< pidfd of the process, or -1 if unavailable.
+    bool cancelled;       ///< killed because of a failure.
+} SP_DagRunning;
+
+/**
+ * State of sp_dag_run(), indexed by the first node of each group.
+ * A group is a pipeline of nodes connected by pipes, or a single node.
+ */
+typedef struct sp_dag_state {
+    size_t* waiting;         ///< number of dependencies not finished yet.
+    uint64_t* priority;      ///< longest path of costs to the end of the graph.
+    size_t* size;            ///< number of nodes in the group.
+    bool* started;           ///< the group was started.
+    bool* skipped;           ///< the group will never be started.
+    size_t* ready;           ///< groups ready to be started.
+    size_t nReady;           ///< number of ready groups.
+    SP_DagRunning* running;  ///< running nodes.
+    size_t nRunning;         ///< number of running nodes.
+    struct pollfd* fds;      ///< pollfds of the running nodes.
+    bool stopping;           ///< a node failed with #SP_DAG_FAIL_FAST.
+    uint64_t startNs;        ///< time sp_dag_run() was called.
+} SP_DagState;
+
+struct sp_dag {
+    size_t maxRunning;        ///< maximum number of running processes.
+    int flags;                ///< see sp_dag_flags.
+    SP_DagCallback callback;  ///< called when a node finishes.
+    void* data;               ///< passed to callback.
+    SP_DagNode* nodes;        ///< the nodes, indexed by id.
+    size_t size;              ///< number of nodes.
+    size_t capacity;          ///< allocated size of nodes.
+    SP_DagState state;        ///< state of the current sp_dag_run().
+};
+
+SP_Dag* sp_dag_create(size_t maxRunning, int flags, SP_DagCallback callback,
+                      void* data) {
+    if (!maxRunning ||
+        (flags & ~(SP_DAG_KEEP_GOING | SP_DAG_CRITICAL_PATH))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    SP_Dag* dag = calloc(1, sizeof *dag);
+    if (!dag) {
+        return NULL;
+    }
+    dag->maxRunning = maxRunning;
+    dag->flags = flags;
+    dag->callback = callback;
+    dag->data = data;
+    return dag;
+}
+
+ssize_t sp_dag_add(SP_Dag* dag, char** argv, SP_Opts* opts, uint64_t cost) {
+    if (!dag || !argv || !argv[0]) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (dag->size == dag->capacity) {
+        size_t capacity = dag->capacity ? dag->capacity * 2 : 16;
+        SP_DagNode* tmp = realloc(dag->nodes, capacity * sizeof *tmp);
+        if (!tmp) {
+            return -1;
+        }
+        dag->nodes = tmp;
+        dag->capacity = capacity;
+    }
+    SP_DagNode node = {
+        .hasOpts = opts != NULL,
+        .cost = cost ? cost : 1,
+        .pipeFrom = -1,
+        .pipeTo = -1,
+        .result = {.id = dag->size, .exitCode = -1},
+    };
+    node.argv = sp_dupe_array(argv);
+    if (!node.argv) {
+        return -1;
+    }
+    if (opts) {
+        node.opts = *opts;
+    }
+    dag->nodes[dag->size] = node;
+    return dag->size++;
+}
+
+int sp_dag_depend(SP_Dag* dag, size_t node, size_t dependency) {
+    if (!dag || node >= dag->size || dependency >= dag->size ||
+        node == dependency) {
+        errno = EINVAL;
+        return -1;
+    }
+    SP_DagNode* dep = &dag->nodes[dependency];
+    if (dep->nDependents == dep->capacity) {
+        size_t capacity = dep->capacity ? dep->capacity * 2 : 4;
+        size_t* tmp = realloc(dep->dependents, capacity * sizeof *tmp);
+        if (!tmp) {
+            return -1;
+        }
+        dep->dependents = tmp;
+        dep->capacity = capacity;
+    }
+    dep->dependents[dep->nDependents++] = node;
+    return 0;
+}
+
+int sp_dag_pipe(SP_Dag* dag, size_t from, size_t to) {
+    if (!dag || from >= dag->size || to >= dag->size ||
+        dag->nodes[from].pipeTo >= 0 || dag->nodes[to].pipeFrom >= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    // Pipes form chains, so a cycle means to already writes into from.
+    for (ssize_t i = from; i >= 0; i = dag->nodes[i].pipeFrom) {
+        if ((size_t)i == to) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    dag->nodes[from].pipeTo = to;
+    dag->nodes[to].pipeFrom = from;
+    return 0;
+}
+
+/**
+ * Get the group of a node, which is the first node of its pipeline.
+ */
+static size_t group_of(SP_Dag* dag, size_t node) {
+    return dag->nodes[node].group;
+}
+
+/**
+ * Free the state of sp_dag_run().
+ */
+static void state_free(SP_DagState* state) {
+    free(state->waiting);
+    free(state->priority);
+    free(state->size);
+    free(state->started);
+    free(state->skipped);
+    free(state->ready);
+    free(state->running);
+    free(state->fds);
+    *state = (SP_DagState){0};
+}
+
+/**
+ * Group the nodes, count the dependencies of every group, and compute their priorities.
+ *
+ * @return 0 on success, -1 on error and errno is set to EINVAL if the graph has a cycle.
+ */
+static int state_init(SP_Dag* dag) {
+    SP_DagState* state = &dag->state;
+    size_t n = dag->size ? dag->size : 1;
+    state->waiting = calloc(n, sizeof *state->waiting);
+    state->priority = calloc(n, sizeof *state->priority);
+    state->size = calloc(n, sizeof *state->size);
+    state->started = calloc(n, sizeof *state->started);
+    state->skipped = calloc(n, sizeof *state->skipped);
+    state->ready = calloc(n, sizeof *state->ready);
+    state->running = calloc(n, sizeof *state->running);
+    state->fds = calloc(n, sizeof *state->fds);
+    size_t* order = calloc(n, sizeof *order);
+    size_t* waiting = calloc(n, sizeof *waiting);
+    if (!state->waiting || !state->priority || !state->size ||
+        !state->started || !state->skipped || !state->ready ||
+        !state->running || !state->fds || !order || !waiting) {
+        free(order);
+        free(waiting);
+        return -1;
+    }
+    size_t nGroups = 0;
+    for (size_t i = 0; i < dag->size; i++) {
+        SP_DagNode* node = &dag->nodes[i];
+        node->result = (SP_DagResult){.id = i, .exitCode = -1};
+        size_t group = i;
+        while (dag->nodes[group].pipeFrom >= 0) {
+            group = dag->nodes[group].pipeFrom;
+        }
+        node->group = group;
+        state->size[group]++;
+        nGroups += group == i;
+    }
+    int err = 0;
+    for (size_t i = 0; !err && i < dag->size; i++) {
+        SP_DagNode* node = &dag->nodes[i];
+        for (size_t j = 0; j < node->nDependents; j++) {
+            size_t group = group_of(dag, node->dependents[j]);
+            // Nodes of a pipeline run together, so they cannot wait on each other.
+            err = group == node->group ? -1 : 0;
+            state->waiting[group]++;
+        }
+    }
+    // Order the groups topologically.
+    size_t nOrder = 0;
+    memcpy(waiting, state->waiting, n * sizeof *waiting);
+    for (size_t i = 0; i < dag->size; i++) {
+        if (dag->nodes[i].group == i && !waiting[i]) {
+            order[nOrder++] = i;
+        }
+    }
+    for (size_t k = 0; !err && k < nOrder; k++) {
+        for (ssize_t i = order[k]; i >= 0; i = dag->nodes[i].pipeTo) {
+            SP_DagNode* node = &dag->nodes[i];
+            for (size_t j = 0; j < node->nDependents; j++) {
+                size_t group = group_of(dag, node->dependents[j]);
+                if (!--waiting[group]) {
+                    order[nOrder++] = group;
+                }
+            }
+        }
+    }
+    if (err || nOrder != nGroups) {
+        free(order);
+        free(waiting);
+        errno = EINVAL;
+        return -1;
+    }
+    // A group comes before everything depending on it, so go backwards.
+    for (size_t k = nOrder; k > 0; k--) {
+        size_t group = order[k - 1];
+        uint64_t cost = 0;
+        uint64_t after = 0;
+        for (ssize_t i = group; i >= 0; i = dag->nodes[i].pipeTo) {
+            SP_DagNode* node = &dag->nodes[i];
+            cost = node->cost > cost ? node->cost : cost;
+            for (size_t j = 0; j < node->nDependents; j++) {
+                uint64_t p = state->priority[group_of(dag, node->dependents[j])];
+                after = p > after ? p : after;
+            }
+        }
+        state->priority[group] = cost + after;
+    }
+    free(order);
+    free(waiting);
+    return 0;
+}
+
+/**
+ * Report the result of a node to the callback.
+ *
+ * @param[in,out] dag
+ * @param[in] id the node.
+ * @param[in] process the process that ran the node, or NULL.
+ */
+static void report(SP_Dag* dag, size_t id, SP_Process* process) {
+    SP_DagResult* result = &dag->nodes[id].result;
+    if (dag->callback) {
+        result->process = process;
+        dag->callback(result, dag->data);
+        result->process = NULL;
+    }
+}
+
+/**
+ * Add a group to the ready groups.
+ */
+static void make_ready(SP_Dag* dag, size_t group) {
+    SP_DagState* state = &dag->state;
+    uint64_t now = sp_now_ns() - state->startNs;
+    for (ssize_t i = group; i >= 0; i = dag->nodes[i].pipeTo) {
+        dag->nodes[i].result.readyNs = now;
+    }
+    state->ready[state->nReady++] = group;
+}
+
+/**
+ * Never start a group, nor any group depending on it, and report its nodes as cancelled.
+ */
+static void skip(SP_Dag* dag, size_t group) {
+    SP_DagState* state = &dag->state;
+    if (state->skipped[group] || state->started[group]) {
+        return;
+    }
+    state->skipped[group] = true;
+    for (size_t i = 0; i < state->nReady; i++) {
+        if (state->ready[i] == group) {
+            state->ready[i] = state->ready[--state->nReady];
+            break;
+        }
+    }
+    for (ssize_t i = group; i >= 0; i = dag->nodes[i].pipeTo) {
+        SP_DagNode* node = &dag->nodes[i];
+        node->result.error = ECANCELED;
+        report(dag, i, NULL);
+        for (size_t j = 0; j < node->nDependents; j++) {
+            skip(dag, group_of(dag, node->dependents[j]));
+        }
+    }
+}
+
+/**
+ * Check whether a node did not succeed.
+ * Like the shell, a writer killed by SIGPIPE because the next node of its pipeline stopped
+ * reading early, e.g. `yes | head -1`, is not a failure; the reader decides.
+ */
+static bool failed(SP_Dag* dag, size_t id) {
+    SP_DagNode* node = &dag->nodes[id];
+    if (node->result.error) {
+        return true;
+    }
+    return node->result.exitCode &&
+           !(node->pipeTo >= 0 &&
+             node->result.exitCode == SIGPIPE + SP_SIGNAL_OFFSET);
+}
+
+/**
+ * Handle the end of a node: release its dependents if it succeeded,
+ * or skip them and possibly stop the whole graph if it failed.
+ *
+ * @param[in,out] dag
+ * @param[in] id the node.
+ */
+static void finish(SP_Dag* dag, size_t id) {
+    SP_DagState* state = &dag->state;
+    SP_DagNode* node = &dag->nodes[id];
+    if (!failed(dag, id)) {
+        for (size_t j = 0; j < node->nDependents; j++) {
+            size_t group = group_of(dag, node->dependents[j]);
+            if (!state->skipped[group] && !--state->waiting[group]) {
+                make_ready(dag, group);
+            }
+        }
+        return;
+    }
+    if (!(dag->flags & SP_DAG_KEEP_GOING) && !state->stopping) {
+        state->stopping = true;
+        for (size_t i = 0; i < state->nRunning; i++) {
+            state->running[i].cancelled = true;
+            sp_kill(state->running[i].process);
+        }
+        for (size_t i = 0; i < dag->size; i++) {
+            if (dag->nodes[i].group == i) {
+                skip(dag, i);
+            }
+        }
+    }
+    for (size_t j = 0; j < node->nDependents; j++) {
+        skip(dag, group_of(dag, node->dependents[j]));
+    }
+}
+
+/**
+ * Start every node of a group, connecting them with pipes.
+ */
+static void start(SP_Dag* dag, size_t group) {
+    SP_DagState* state = &dag->state;
+    state->started[group] = true;
+    SP_Process* prev = NULL;
+    for (ssize_t i = group; i >= 0; i = dag->nodes[i].pipeTo) {
+        SP_DagNode* node = &dag->nodes[i];
+        SP_Process* proc = NULL;
+        if (state->stopping) {
+            // A node of the pipeline failed to start.
+            node->result.error = ECANCELED;
+        } else {
+            node->result.startNs = sp_now_ns() - state->startNs;
+            SP_Opts opts = node->hasOpts ? node->opts : (SP_Opts){0};
+            if (node->pipeFrom >= 0) {
+                opts.spstdin = prev && prev->spstdout
+                                   ? SP_REDIR_FILE(prev->spstdout)
+                                   : SP_REDIR_DEVNULL();
+            }
+            if (node->pipeTo >= 0) {
+                opts.spstdout = SP_REDIR_PIPE();
+            }
+            proc = sp_open(node->argv, &opts);
+            node->result.error = proc ? 0 : errno;
+        }
+        if (prev && prev->spstdout) {
+            // Only the next process reads from the pipe.
+            fclose(prev->spstdout);
+            prev->spstdout = NULL;
+        }
+        prev = proc;
+        if (!proc) {
+            node->result.endNs = node->result.startNs;
+            report(dag, i, NULL);
+            finish(dag, i);
+            continue;
+        }
+        state->running[state->nRunning++] = (SP_DagRunning){
+            .node = i,
+            .process = proc,
+            .pidfd = sp_pidfd(proc),
+        };
+    }
+}
+
+/**
+ * Choose the next ready group that fits in the running limit.
+ *
+ * @return the index of the group in state->ready, or -1 if none fits.
+ */
+static ssize_t pick(SP_Dag* dag) {
+    SP_DagState* state = &dag->state;
+    ssize_t best = -1;
+    for (size_t i = 0; i < state->nReady; i++) {
+        size_t group = state->ready[i];
+        if (state->nRunning &&
+            state->nRunning + state->size[group] > dag->maxRunning) {
+            continue;
+        }
+        if (best >= 0) {
+            size_t other = state->ready[best];
+            bool first = dag->flags & SP_DAG_CRITICAL_PATH
+                             ? state->priority[group] > state->priority[other] ||
+                                   (state->priority[group] ==
+                                        state->priority[other] &&
+                                    group < other)
+                             : group < other;
+            if (!first) {
+                continue;
+            }
+        }
+        best = i;
+    }
+    return best;
+}
+
+/**
+ * Wait for at least one running node to exit and finish every node that exited.
+ *
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int reap(SP_Dag* dag) {
+    SP_DagState* state = &dag->state;
+    bool needsPolling = false;
+    for (size_t i = 0; i < state->nRunning; i++) {
+        state->fds[i] = (struct pollfd){
+            .fd = state->running[i].pidfd,
+            .events = POLLIN,
+        };
+        needsPolling |= state->running[i].pidfd < 0;
+    }
+    int n = poll(state->fds, state->nRunning,
+                 needsPolling ? SP_DAG_POLL_MS : -1);
+    if (n < 0 && errno != EINTR) {
+        return -1;
+    }
+    for (size_t i = state->nRunning; i > 0; i--) {
+        SP_DagRunning job = state->running[i - 1];
+        if (n > 0 && job.pidfd >= 0 && !state->fds[i - 1].revents) {
+            continue;
+        }
+        if (sp_poll(job.process) < 0 ||
+            job.process->status != SP_STATUS_DEAD) {
+            continue;
+        }
+        sp_fd_close(&job.pidfd);
+        state->running[i - 1] = state->running[--state->nRunning];
+        state->fds[i - 1] = state->fds[state->nRunning];
+        SP_DagResult* result = &dag->nodes[job.node].result;
+        result->exitCode = job.process->exitCode;
+        result->error = job.cancelled ? ECANCELED : 0;
+        result->endNs = sp_now_ns() - state->startNs;
+        report(dag, job.node, job.process);
+        sp_destroy(job.process);
+        finish(dag, job.node);
+    }
+    return 0;
+}
+
+int sp_dag_run(SP_Dag* dag) {
+    if (!dag) {
+        errno = EINVAL;
+        return -1;
+    }
+    SP_DagState* state = &dag->state;
+    if (state_init(dag) < 0) {
+        int tmpErrno = errno;
+        state_free(state);
+        errno = tmpErrno;
+        return -1;
+    }
+    state->startNs = sp_now_ns();
+    for (size_t i = 0; i < dag->size; i++) {
+        if (dag->nodes[i].group == i && !state->waiting[i]) {
+            make_ready(dag, i);
+        }
+    }
+    int err = 0;
+    while (!err && (state->nReady || state->nRunning)) {
+        ssize_t next;
+        while ((next = pick(dag)) >= 0) {
+            size_t group = state->ready[next];
+            state->ready[next] = state->ready[--state->nReady];
+            start(dag, group);
+        }
+        if (state->nRunning) {
+            err = reap(dag);
+        }
+    }
+    if (err) {
+        // Do not leave processes behind.
+        int tmpErrno = errno;
+        for (size_t i = 0; i < state->nRunning; i++) {
+            sp_kill(state->running[i].process);
+            sp_wait(state->running[i].process);
+            sp_destroy(state->running[i].process);
+            sp_fd_close(&state->running[i].pidfd);
+        }
+        state_free(state);
+        errno = tmpErrno;
+        return -1;
+    }
+    state_free(state);
+    int nFailed = 0;
+    for (size_t i = 0; i < dag->size; i++) {
+        nFailed += failed(dag, i);
+    }
+    return nFailed;
+}
+
+const SP_DagResult* sp_dag_result(SP_Dag* dag, size_t node) {
+    if (!dag || node >= dag->size) {
+        return NULL;
+    }
+    return &dag->nodes[node].result;
+}
+
+void sp_dag_destroy(SP_Dag* dag) {
+    if (!dag) {
+        return;
+    }
+    for (size_t i = 0; i < dag->size; i++) {
+        sp_free_array(dag->nodes[i].argv);
+        free(dag->nodes[i].dependents);
+    }
+    free(dag->nodes);
+    free(dag);
+}
@@ -0,0 +1,499 @@
+#define _GNU_SOURCE  // for memmem() and memrchr()
+
+#include "subprocess/filter.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "subprocess/stats.h"
+#include "util.h"
+
+/**
+ * Maximum number of bytes read from the input per iteration.
+ */
+#define SP_FILTER_CHUNK (64 * 1024)
+
+/**
+ * State of a SHA-256 computation.
+ */
+typedef struct sp_sha256 {
+    uint32_t h[8];          ///< the hash so far.
+    uint64_t size;          ///< number of bytes hashed.
+    unsigned char buf[64];  ///< the incomplete block.
+    size_t bufSize;         ///< number of bytes in buf.
+} SP_Sha256;
+
+/**
+ * State kept by a filter between chunks.
+ */
+typedef struct sp_filter_state {
+    bool done;         ///< the filter returned SP_FILTER_DONE.
+    char* line;        ///< the incomplete last line kept by grep.
+    size_t lineSize;   ///< number of bytes in line.
+    size_t capacity;   ///< allocated size of line.
+    uint64_t count;    ///< lines emitted by head.
+    SP_Sha256 sha256;  ///< the digest computed by sha256.
+} SP_FilterState;
+
+/**
+ * A chain of filters being run.
+ */
+typedef struct sp_filter_chain {
+    SP_Filter* filters;      ///< the filters.
+    SP_FilterState* states;  ///< the state of each filter.
+    SP_FilterOut* outs;      ///< the output of each filter.
+    size_t nFilters;         ///< number of filters.
+    int fd;                  ///< where the last filter writes, or -1.
+    bool done;               ///< the first filter needs no more input.
+} SP_FilterChain;
+
+struct sp_filter_out {
+    SP_FilterChain* chain;  ///< the chain.
+    size_t next;            ///< index of the filter receiving the output.
+};
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_init(SP_Sha256* sha) {
+    static const uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                  0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                  0x1f83d9ab, 0x5be0cd19};
+    memcpy(sha->h, h, sizeof h);
+    sha->size = 0;
+    sha->bufSize = 0;
+}
+
+static void sha256_block(SP_Sha256* sha, const unsigned char* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ w[i - 15] >> 3;
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ w[i - 2] >> 10;
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = sha->h[0], b = sha->h[1], c = sha->h[2], d = sha->h[3];
+    uint32_t e = sha->h[4], f = sha->h[5], g = sha->h[6], h = sha->h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+        uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+        uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    sha->h[0] += a;
+    sha->h[1] += b;
+    sha->h[2] += c;
+    sha->h[3] += d;
+    sha->h[4] += e;
+    sha->h[5] += f;
+    sha->h[6] += g;
+    sha->h[7] += h;
+}
+
+static void sha256_update(SP_Sha256* sha, const unsigned char* data,
+                          size_t size) {
+    sha->size += size;
+    if (sha->bufSize) {
+        size_t n = 64 - sha->bufSize < size ? 64 - sha->bufSize : size;
+        memcpy(sha->buf + sha->bufSize, data, n);
+        sha->bufSize += n;
+        data += n;
+        size -= n;
+        if (sha->bufSize < 64) {
+            return;
+        }
+        sha256_block(sha, sha->buf);
+        sha->bufSize = 0;
+    }
+    for (; size >= 64; data += 64, size -= 64) {
+        sha256_block(sha, data);
+    }
+    memcpy(sha->buf, data, size);
+    sha->bufSize = size;
+}
+
+static void sha256_final(SP_Sha256* sha, unsigned char* digest) {
+    uint64_t bits = sha->size * 8;
+    unsigned char pad[72] = {0x80};
+    size_t padSize = (sha->bufSize < 56 ? 56 : 120) - sha->bufSize;
+    for (int i = 0; i < 8; i++) {
+        pad[padSize + i] = bits >> (56 - i * 8);
+    }
+    sha256_update(sha, pad, padSize + 8);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = sha->h[i] >> 24;
+        digest[i * 4 + 1] = sha->h[i] >> 16;
+        digest[i * 4 + 2] = sha->h[i] >> 8;
+        digest[i * 4 + 3] = sha->h[i];
+    }
+}
+
+/**
+ * Count the newlines in data.
+ *
+ * The inner loop has no branches and a narrow accumulator, so the compiler vectorizes
+ * it into byte compares on 16 or 32 bytes at a time, which is much faster than
+ * calling memchr(3) for every line when lines are short.
+ *
+ * @param[in] data
+ * @param[in] size
+ * @return the number of newlines.
+ */
+static uint64_t count_lines(const char* data, size_t size) {
+    uint64_t total = 0;
+    while (size > 0) {
+        // The count of a block must fit in the accumulator.
+        size_t n = size < 255 ? size : 255;
+        uint8_t count = 0;
+        for (size_t i = 0; i < n; i++) {
+            count += data[i] == '\n';
+        }
+        total += count;
+        data += n;
+        size -= n;
+    }
+    return total;
+}
+
+/**
+ * Append bytes to the incomplete line kept by grep.
+ *
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int line_append(SP_FilterState* state, const char* data, size_t size) {
+    size_t needed = state->lineSize + size;
+    if (needed > state->capacity) {
+        size_t capacity = state->capacity ? state->capacity : 256;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        char* tmp = realloc(state->line, capacity);
+        if (!tmp) {
+            return -1;
+        }
+        state->line = tmp;
+        state->capacity = capacity;
+    }
+    memcpy(state->line + state->lineSize, data, size);
+    state->lineSize = needed;
+    return 0;
+}
+
+/**
+ * Emit a single line if it contains the pattern.
+ */
+static int grep_line(SP_Filter* filter, const char* line, size_t size,
+                     SP_FilterOut* out) {
+    const char* pattern = filter->value.pattern;
+    if (!memmem(line, size, pattern, strlen(pattern))) {
+        return 0;
+    }
+    filter->lines++;
+    return sp_filter_emit(out, line, size) < 0 ? -1 : 0;
+}
+
+static int grep(SP_Filter* filter, SP_FilterState* state, const char* data,
+                size_t size, SP_FilterOut* out) {
+    if (!data) {
+        // The last line has no newline.
+        int err = state->lineSize
+                      ? grep_line(filter, state->line, state->lineSize, out)
+                      : 0;
+        state->lineSize = 0;
+        return err;
+    }
+    const char* end = data + size;
+    if (state->lineSize) {
+        const char* newline = memchr(data, '\n', size);
+        const char* stop = newline ? newline + 1 : end;
+        if (line_append(state, data, stop - data) < 0) {
+            return -1;
+        }
+        data = stop;
+        if (!newline) {
+            return 0;
+        }
+        int err = grep_line(filter, state->line, state->lineSize, out);
+        state->lineSize = 0;
+        if (err) {
+            return -1;
+        }
+    }
+    // Search the complete lines as a whole, so lines that do not match are
+    // skipped by memmem() without being split first.
+    const char* pattern = filter->value.pattern;
+    size_t patternSize = strlen(pattern);
+    const char* last = memrchr(data, '\n', end - data);
+    const char* full = last ? last + 1 : data;
+    while (data < full) {
+        const char* match = memmem(data, full - data, pattern, patternSize);
+        if (!match) {
+            break;
+        }
+        const char* start = memrchr(data, '\n', match - data);
+        start = start ? start + 1 : data;
+        // The pattern has no newline, so the line ends before full.
+        const char* stop = (char*)memchr(match, '\n', full - match) + 1;
+        filter->lines++;
+        int ret = sp_filter_emit(out, start, stop - start);
+        if (ret) {
+            // Stop matching once the rest of the chain is done too.
+            return ret;
+        }
+        data = stop;
+    }
+    return line_append(state, full, end - full);
+}
+
+static int head(SP_Filter* filter, const char* data, size_t size,
+                SP_FilterOut* out) {
+    uint64_t left = filter->value.limit - filter->bytesOut;
+    if (data && sp_filter_emit(out, data, left < size ? left : size) < 0) {
+        return -1;
+    }
+    return filter->bytesOut < filter->value.limit ? 0 : SP_FILTER_DONE;
+}
+
+static int head_lines(SP_Filter* filter, SP_FilterState* state,
+                      const char* data, size_t size, SP_FilterOut* out) {
+    uint64_t left = filter->value.limit - state->count;
+    if (!data) {
+        return left ? 0 : SP_FILTER_DONE;
+    }
+    const char* end = data + size;
+    const char* stop = data;
+    while (left && stop < end) {
+        const char* newline = memchr(stop, '\n', end - stop);
+        if (!newline) {
+            stop = end;
+            break;
+        }
+        stop = newline + 1;
+        left--;
+    }
+    state->count = filter->value.limit - left;
+    if (sp_filter_emit(out, data, stop - data) < 0) {
+        return -1;
+    }
+    return left ? 0 : SP_FILTER_DONE;
+}
+
+/**
+ * Give a chunk of input to a filter, or signal the end of the input if data is NULL.
+ *
+ * @return 0 to continue, SP_FILTER_DONE when no more input is needed,
+ *         or -1 on error and errno is set.
+ */
+static int run(SP_FilterChain* chain, size_t i, const char* data,
+               size_t size) {
+    SP_Filter* filter = &chain->filters[i];
+    SP_FilterState* state = &chain->states[i];
+    SP_FilterOut* out = &chain->outs[i];
+    if (state->done) {
+        return SP_FILTER_DONE;
+    }
+    filter->bytesIn += size;
+    int ret = 0;
+    switch (filter->type) {
+    case SP_FILTER_FN:
+        ret = filter->value.fn(filter, data, size, out);
+        break;
+    case SP_FILTER_COUNT:
+        filter->lines += count_lines(data, size);
+        ret = data && sp_filter_emit(out, data, size) < 0 ? -1 : 0;
+        break;
+    case SP_FILTER_GREP:
+        ret = grep(filter, state, data, size, out);
+        break;
+    case SP_FILTER_HEAD:
+        ret = head(filter, data, size, out);
+        break;
+    case SP_FILTER_HEAD_LINES:
+        ret = head_lines(filter, state, data, size, out);
+        break;
+    case SP_FILTER_SHA256:
+        if (data) {
+            sha256_update(&state->sha256, (const unsigned char*)data, size);
+            ret = sp_filter_emit(out, data, size) < 0 ? -1 : 0;
+        } else {
+            sha256_final(&state->sha256, filter->digest);
+        }
+        break;
+    }
+    if (ret < 0) {
+        return -1;
+    }
+    if (ret == SP_FILTER_DONE) {
+        // The filters before keep running, their output to this one is dropped.
+        state->done = true;
+        if (i == 0) {
+            chain->done = true;
+        }
+    }
+    return state->done ? SP_FILTER_DONE : 0;
+}
+
+int sp_filter_emit(SP_FilterOut* out, const char* data, size_t size) {
+    if (!out || (!data && size)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!size) {
+        return 0;
+    }
+    SP_FilterChain* chain = out->chain;
+    chain->filters[out->next - 1].bytesOut += size;
+    if (out->next < chain->nFilters) {
+        return run(chain, out->next, data, size);
+    }
+    if (chain->fd >= 0 && sp_write_all(chain->fd, data, size) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Check the filters and reset their results.
+ *
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int chain_init(SP_FilterChain* chain, SP_Filter* filters,
+                      size_t nFilters, int outFd, SP_FilterState* states,
+                      SP_FilterOut* outs) {
+    if (!filters || !nFilters) {
+        errno = EINVAL;
+        return -1;
+    }
+    *chain = (SP_FilterChain){
+        .filters = filters,
+        .states = states,
+        .outs = outs,
+        .nFilters = nFilters,
+        .fd = outFd,
+    };
+    for (size_t i = 0; i < nFilters; i++) {
+        SP_Filter* filter = &filters[i];
+        bool valid;
+        switch (filter->type) {
+        case SP_FILTER_FN:
+            valid = filter->value.fn;
+            break;
+        case SP_FILTER_GREP:
+            valid = filter->value.pattern && !strchr(filter->value.pattern, '\n');
+            break;
+        case SP_FILTER_COUNT:
+        case SP_FILTER_HEAD:
+        case SP_FILTER_HEAD_LINES:
+        case SP_FILTER_SHA256:
+            valid = true;
+            break;
+        default:
+            valid = false;
+        }
+        if (!valid) {
+            errno = EINVAL;
+            return -1;
+        }
+        filter->bytesIn = 0;
+        filter->bytesOut = 0;
+        filter->lines = 0;
+        memset(filter->digest, 0, sizeof filter->digest);
+        states[i] = (SP_FilterState){0};
+        sha256_init(&states[i].sha256);
+        outs[i] = (SP_FilterOut){.chain = chain, .next = i + 1};
+    }
+    return 0;
+}
+
+/**
+ * Signal the end of the input to every filter in order, then free the states.
+ *
+ * @param[in,out] chain
+ * @param[in] err whether the chain already failed, in which case it is only freed.
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int chain_finish(SP_FilterChain* chain, int err) {
+    for (size_t i = 0; !err && i < chain->nFilters; i++) {
+        err = run(chain, i, NULL, 0) < 0 ? -1 : 0;
+    }
+    int tmpErrno = errno;
+    for (size_t i = 0; i < chain->nFilters; i++) {
+        free(chain->states[i].line);
+    }
+    errno = tmpErrno;
+    return err;
+}
+
+ssize_t sp_filter(int fd, SP_Filter* filters, size_t nFilters, int outFd) {
+    if (fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    SP_FilterChain chain;
+    SP_FilterState states[nFilters ? nFilters : 1];
+    SP_FilterOut outs[nFilters ? nFilters : 1];
+    if (chain_init(&chain, filters, nFilters, outFd, states, outs) < 0) {
+        return -1;
+    }
+    char buf[SP_FILTER_CHUNK];
+    ssize_t total = 0;
+    int err = 0;
+    while (!err && !chain.done) {
+        ssize_t n = read(fd, buf, sizeof buf);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            err = n;
+            break;
+        }
+        total += n;
+        sp_stats_bytes(0, n);
+        err = run(&chain, 0, buf, n) < 0 ? -1 : 0;
+    }
+    err = chain_finish(&chain, err);
+    return err ? -1 : total;
+}
+
+int sp_filter_buf(const char* buf, size_t size, SP_Filter* filters,
+                  size_t nFilters, int outFd) {
+    if (!buf && size) {
+        errno = EINVAL;
+        return -1;
+    }
+    SP_FilterChain chain;
+    SP_FilterState states[nFilters ? nFilters : 1];
+    SP_FilterOut outs[nFilters ? nFilters : 1];
+    if (chain_init(&chain, filters, nFilters, outFd, states, outs) < 0) {
+        return -1;
+    }
+    int err = size && run(&chain, 0, buf, size) < 0 ? -1 : 0;
+    return chain_finish(&chain, err);
+}
@@ -0,0 +1,388 @@
+#include "subprocess/jobqueue.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "subprocess/pipe.h"
+#include "subprocess/pressure.h"
+#include "util.h"
+
+/**
+ * Milliseconds between sp_poll() calls for jobs that have no pidfd.
+ */
+#define SP_JOBQUEUE_POLL_MS 10
+
+/**
+ * A job waiting for a free slot.
+ */
+typedef struct sp_job {
+    size_t id;        ///< id of the job.
+    char** argv;      ///< deep copy of argv, or NULL once cancelled.
+    SP_Opts opts;     ///< copy of the options.
+    bool hasOpts;     ///< opts was given to sp_jobqueue_push().
+} SP_Job;
+
+/**
+ * A job that has been started.
+ */
+typedef struct sp_running_job {
+    size_t id;             ///< id of the job.
+    SP_Process* process;   ///< the running process.
+    int pidfd;             ///< pidfd of the process, or -1 if unavailable.
+    bool cancelled;        ///< sp_jobqueue_cancel() was called on the job.
+    int error;             ///< errno if the process could not be waited on, else 0.
+    uint64_t startNs;      ///< time the job was started.
+} SP_RunningJob;
+
+struct sp_jobqueue {
+    size_t maxRunning;        ///< maximum number of running jobs.
+    SP_JobCallback callback;  ///< called when a job finishes.
+    void* data;               ///< passed to callback.
+    SP_Job* jobs;             ///< ring buffer of queued jobs.
+    size_t head;              ///< index of the first queued job.
+    size_t size;              ///< number of jobs in the ring buffer.
+    size_t capacity;          ///< allocated size of jobs.
+    SP_RunningJob* running;   ///< running jobs, allocated to hold maxRunning.
+    size_t nRunning;          ///< number of running jobs.
+    SP_RunningJob* done;      ///< jobs reaped by the current poll.
+    struct pollfd* fds;       ///< pollfds, allocated to hold maxRunning.
+    size_t nextId;            ///< id of the next pushed job.
+    SP_JobQueueStats stats;   ///< counters, see sp_jobqueue_stats().
+    uint64_t firstStartNs;    ///< time the first job was started, or 0.
+    uint64_t lastFinishNs;    ///< time the last job finished.
+    SP_Pressure* pressure;    ///< throttles starting jobs, or NULL.
+};
+
+/**
+ * Report the result of a job to the callback and update the counters.
+ *
+ * @param[in,out] queue
+ * @param[in] result
+ */
+static void report(SP_JobQueue* queue, SP_JobResult* result) {
+    if (result->error == ECANCELED) {
+        queue->stats.cancelled++;
+    } else if (result->error && !result->process) {
+        queue->stats.spawnErrors++;
+    } else if (result->exitCode) {
+        queue->stats.failed++;
+    } else {
+        queue->stats.succeeded++;
+    }
+    queue->lastFinishNs = sp_now_ns();
+    if (queue->callback) {
+        queue->callback(result, queue->data);
+    }
+}
+
+/**
+ * Remove the first job of the ring buffer.
+ *
+ * @param[in,out] queue
+ * @return the job
+ */
+static SP_Job pop_job(SP_JobQueue* queue) {
+    SP_Job job = queue->jobs[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->size--;
+    return job;
+}
+
+/**
+ * Start queued jobs until the running limit is reached.
+ *
+ * @param[in,out] queue
+ * @return the number of jobs that failed to start and were reported.
+ */
+static int fill(SP_JobQueue* queue) {
+    int reported = 0;
+    while (queue->size && queue->nRunning < queue->maxRunning) {
+        // A job always runs so the queue makes progress.
+        if (queue->nRunning && !sp_pressure_admit(queue->pressure)) {
+            break;
+        }
+        SP_Job job = pop_job(queue);
+        if (!job.argv) {
+            // Cancelled while queued and already reported.
+            continue;
+        }
+        queue->stats.queued--;
+        if (!queue->firstStartNs) {
+            queue->firstStartNs = sp_now_ns();
+        }
+        uint64_t startNs = sp_now_ns();
+        SP_Process* proc = sp_open(job.argv, job.hasOpts ? &job.opts : NULL);
+        int err = errno;
+        sp_free_array(job.argv);
+        if (!proc) {
+            SP_JobResult result = {.id = job.id, .exitCode = -1, .error = err};
+            report(queue, &result);
+            reported++;
+            continue;
+        }
+        queue->running[queue->nRunning++] = (SP_RunningJob){
+            .id = job.id,
+            .process = proc,
+            .pidfd = sp_pidfd(proc),
+            .startNs = startNs,
+        };
+        queue->stats.running++;
+    }
+    return reported;
+}
+
+/**
+ * Reap every running job that has exited, moving it to queue->done.
+ *
+ * @param[in,out] queue
+ * @param[in] fds the pollfds of the running jobs, or NULL to check all of them.
+ * @return the number of jobs moved.
+ */
+static size_t reap(SP_JobQueue* queue, struct pollfd* fds) {
+    size_t nDone = 0;
+    for (size_t i = queue->nRunning; i > 0; i--) {
+        SP_RunningJob* job = &queue->running[i - 1];
+        if (fds && job->pidfd >= 0 && !fds[i - 1].revents) {
+            continue;
+        }
+        if (sp_poll(job->process) < 0) {
+            if (errno != ECHILD) {
+                continue;
+            }
+            // Reaped elsewhere, e.g. by waitpid(-1), it can't be waited on anymore.
+            job->error = ECHILD;
+            job->process->status = SP_STATUS_DEAD;
+            job->process->exitCode = -1;
+        } else if (job->process->status != SP_STATUS_DEAD) {
+            continue;
+        }
+        sp_fd_close(&job->pidfd);
+        queue->done[nDone++] = *job;
+        *job = queue->running[--queue->nRunning];
+        queue->stats.running--;
+    }
+    return nDone;
+}
+
+SP_JobQueue* sp_jobqueue_create(size_t maxRunning, SP_JobCallback callback,
+                                void* data) {
+    if (!maxRunning) {
+        errno = EINVAL;
+        return NULL;
+    }
+    SP_JobQueue* queue = calloc(1, sizeof *queue);
+    if (!queue) {
+        return NULL;
+    }
+    queue->maxRunning = maxRunning;
+    queue->callback = callback;
+    queue->data = data;
+    queue->running = calloc(maxRunning, sizeof *queue->running);
+    queue->done = calloc(maxRunning, sizeof *queue->done);
+    queue->fds = calloc(maxRunning, sizeof *queue->fds);
+    if (!queue->running || !queue->done || !queue->fds) {
+        sp_jobqueue_destroy(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+ssize_t sp_jobqueue_push(SP_JobQueue* queue, char** argv, SP_Opts* opts) {
+    if (!queue || !argv || !argv[0]) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (queue->size == queue->capacity) {
+        size_t capacity = queue->capacity ? queue->capacity * 2 : 16;
+        SP_Job* tmp = realloc(queue->jobs, capacity * sizeof *tmp);
+        if (!tmp) {
+            return -1;
+        }
+        // The ring buffer is full, so the jobs before head wrapped around.
+        memcpy(tmp + queue->capacity, tmp, queue->head * sizeof *tmp);
+        queue->jobs = tmp;
+        queue->capacity = capacity;
+    }
+    SP_Job job = {.id = queue->nextId, .hasOpts = opts != NULL};
+    job.argv = sp_dupe_array(argv);
+    if (!job.argv) {
+        return -1;
+    }
+    if (opts) {
+        job.opts = *opts;
+    }
+    queue->jobs[(queue->head + queue->size) % queue->capacity] = job;
+    queue->size++;
+    queue->stats.pushed++;
+    queue->stats.queued++;
+    return queue->nextId++;
+}
+
+int sp_jobqueue_poll(SP_JobQueue* queue, int timeoutMs) {
+    if (!queue) {
+        errno = EINVAL;
+        return -1;
+    }
+    int reported = fill(queue);
+    uint64_t deadline = sp_now_ns() + (uint64_t)timeoutMs * 1000000;
+    while (queue->nRunning && !reported) {
+        bool needsPolling = false;
+        for (size_t i = 0; i < queue->nRunning; i++) {
+            queue->fds[i] = (struct pollfd){
+                .fd = queue->running[i].pidfd,
+                .events = POLLIN,
+            };
+            needsPolling |= queue->running[i].pidfd < 0;
+        }
+        int timeout = -1;
+        if (timeoutMs >= 0) {
+            uint64_t now = sp_now_ns();
+            timeout = now < deadline ? (deadline - now + 999999) / 1000000 : 0;
+        }
+        if (needsPolling && (timeout < 0 || timeout > SP_JOBQUEUE_POLL_MS)) {
+            timeout = SP_JOBQUEUE_POLL_MS;
+        }
+        int interval = sp_pressure_interval(queue->pressure);
+        bool throttled = queue->pressure && queue->size &&
+                         queue->nRunning < queue->maxRunning;
+        if (throttled && (timeout < 0 || timeout > interval)) {
+            // Sample the pressure again even if no job exits.
+            timeout = interval;
+        }
+        int n = poll(queue->fds, queue->nRunning, timeout);
+        if (n < 0 && errno != EINTR) {
+            return -1;
+        }
+        size_t nDone = reap(queue, n > 0 ? queue->fds : NULL);
+        if (nDone || throttled) {
+            // Start the next jobs before running the callbacks.
+            reported += fill(queue);
+        }
+        for (size_t i = 0; i < nDone; i++) {
+            SP_RunningJob* job = &queue->done[i];
+            SP_JobResult result = {
+                .id = job->id,
+                .process = job->process,
+                .exitCode = job->process->exitCode,
+                .error = job->error       ? job->error
+                         : job->cancelled ? ECANCELED
+                                          : 0,
+                .runtimeNs = sp_now_ns() - job->startNs,
+            };
+            report(queue, &result);
+            sp_destroy(job->process);
+            reported++;
+        }
+        if (!nDone && timeoutMs >= 0 && sp_now_ns() >= deadline) {
+            break;
+        }
+    }
+    return reported;
+}
+
+int sp_jobqueue_set_pressure(SP_JobQueue* queue, SP_Pressure* pressure) {
+    if (!queue) {
+        errno = EINVAL;
+        return -1;
+    }
+    queue->pressure = pressure;
+    return 0;
+}
+
+int sp_jobqueue_wait(SP_JobQueue* queue) {
+    if (!queue) {
+        errno = EINVAL;
+        return -1;
+    }
+    while (queue->size || queue->nRunning) {
+        if (sp_jobqueue_poll(queue, -1) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int sp_jobqueue_cancel(SP_JobQueue* queue, size_t id) {
+    if (!queue) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < queue->nRunning; i++) {
+        SP_RunningJob* job = &queue->running[i];
+        if (job->id == id && !job->cancelled) {
+            job->cancelled = true;
+            return sp_kill(job->process);
+        }
+    }
+    for (size_t i = 0; i < queue->size; i++) {
+        SP_Job* job = &queue->jobs[(queue->head + i) % queue->capacity];
+        if (job->id == id && job->argv) {
+            sp_free_array(job->argv);
+            job->argv = NULL;
+            queue->stats.queued--;
+            SP_JobResult result = {.id = id, .exitCode = -1, .error = ECANCELED};
+            report(queue, &result);
+            return 0;
+        }
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+void sp_jobqueue_cancel_all(SP_JobQueue* queue) {
+    if (!queue) {
+        return;
+    }
+    for (size_t i = 0; i < queue->nRunning; i++) {
+        if (!queue->running[i].cancelled) {
+            queue->running[i].cancelled = true;
+            sp_kill(queue->running[i].process);
+        }
+    }
+    while (queue->size) {
+        SP_Job job = pop_job(queue);
+        if (job.argv) {
+            sp_free_array(job.argv);
+            queue->stats.queued--;
+            SP_JobResult result = {
+                .id = job.id,
+                .exitCode = -1,
+                .error = ECANCELED,
+            };
+            report(queue, &result);
+        }
+    }
+}
+
+void sp_jobqueue_stats(SP_JobQueue* queue, SP_JobQueueStats* stats) {
+    if (!queue || !stats) {
+        return;
+    }
+    *stats = queue->stats;
+    if (queue->firstStartNs) {
+        bool active = queue->size || queue->nRunning;
+        uint64_t end = active ? sp_now_ns() : queue->lastFinishNs;
+        stats->elapsedNs = end - queue->firstStartNs;
+    }
+    size_t finished = stats->succeeded + stats->failed + stats->spawnErrors +
+                      stats->cancelled;
+    if (stats->elapsedNs) {
+        stats->jobsPerSec = finished * 1e9 / stats->elapsedNs;
+    }
+}
+
+void sp_jobqueue_destroy(SP_JobQueue* queue) {
+    if (!queue) {
+        return;
+    }
+    sp_jobqueue_cancel_all(queue);
+    while (queue->nRunning && sp_jobqueue_poll(queue, -1) >= 0) {
+    }
+    free(queue->jobs);
+    free(queue->running);
+    free(queue->done);
+    free(queue->fds);
+    free(queue);
+}
@@ -5,9 +5,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "subprocess/error.h"
+#include "subprocess/stats.h"
 
 int sp_fd_close(int* fd) {
     if (!fd || *fd < 0) {
@@ -38,8 +40,45 @@ int sp_pipe_close(int fd[2]) {
     return SP_NORMALIZE_ERROR(!sp_fd_close(&fd[0]) && !sp_fd_close(&fd[1]));
 }
 
+/**
+ * Create the socketpair of SP_REDIR_SOCKET() at opt->value.pipeFd.
+ *
+ * @param[in,out] opt
+ * @param[in] nonBlocking
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int socket_create(SP_RedirOpt* opt, bool nonBlocking) {
+    int type = opt->flags ? opt->flags : SOCK_STREAM;
+    if (type != SOCK_STREAM && type != SOCK_SEQPACKET) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fd[2];
+    type |= SOCK_CLOEXEC | (nonBlocking ? SOCK_NONBLOCK : 0);
+    if (socketpair(AF_UNIX, type, 0, fd) < 0) {
+        return -1;
+    }
+    int size = opt->size;
+    for (int i = 0; size > 0 && i < 2; i++) {
+        if (setsockopt(fd[i], SOL_SOCKET, SO_SNDBUF, &size, sizeof size) < 0 ||
+            setsockopt(fd[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof size) < 0) {
+            int tmpErrno = errno;
+            sp_pipe_close(fd);
+            errno = tmpErrno;
+            return -1;
+        }
+    }
+    opt->value.pipeFd[0] = fd[0];
+    opt->value.pipeFd[1] = fd[1];
+    return 0;
+}
+
 int sp_pipe_create(SP_RedirOpt* opt, bool nonBlocking) {
-    if (!opt || !(opt->type == SP_REDIR_PIPE || opt->type == SP_REDIR_BYTES)) {
+    if (opt && opt->type == SP_REDIR_SOCKET) {
+        return socket_create(opt, nonBlocking);
+    }
+    if (!opt || !(opt->type == SP_REDIR_PIPE || opt->type == SP_REDIR_BYTES ||
+                  opt->type == SP_REDIR_TAIL)) {
         return 0;
     }
     int flags = O_CLOEXEC | (nonBlocking ? O_NONBLOCK : 0);
@@ -50,11 +89,12 @@ int sp_pipe_create(SP_RedirOpt* opt, bool nonBlocking) {
     if (opt->type == SP_REDIR_BYTES) {  // TODO: need better solution
         if (write(fd[1], opt->value.bytes, opt->size) < 0) {
             int tmpErrno = errno;
-            sp_pipe_close(opt->value.pipeFd);
+            sp_pipe_close(fd);
             errno = tmpErrno;
             return -1;
         }
         sp_fd_close(&fd[1]);
+        sp_stats_bytes(opt->size, 0);
     }
     opt->value.pipeFd[0] = fd[0];
     opt->value.pipeFd[1] = fd[1];
@@ -0,0 +1,835 @@
+#define _GNU_SOURCE  // for strerrordesc_np() and fallocate()
+
+#include "subprocess/plan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "subprocess/error.h"
+
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+
+/**
+ * Search path used by execvp(3) when PATH is not set.
+ */
+#define SP_PLAN_DEFAULT_PATH "/bin:/usr/bin"
+
+/**
+ * Shell used to run executables without a recognized format, like execvp(3) does.
+ */
+#define SP_PLAN_SHELL "/bin/sh"
+
+extern char** environ;
+
+/**
+ * Header of the message read by SP_OP_GATE, followed by the NUL terminated arguments,
+ * environment variables and candidates.
+ */
+typedef struct sp_plan_gate_header {
+    uint64_t size;         ///< bytes of the strings.
+    uint32_t argc;         ///< number of arguments.
+    uint32_t envc;         ///< number of environment variables.
+    uint32_t nCandidates;  ///< number of candidates.
+    uint32_t search;       ///< sp_plan::search.
+} SP_PlanGateHeader;
+
+/**
+ * Append an operation to the plan, which is allocated large enough by sp_plan_compile().
+ *
+ * @param[in,out] plan
+ * @param[in] type
+ * @param[in] what printed to stderr if the operation fails.
+ * @return the operation, with no fds set.
+ */
+static SP_PlanOp* add_op(SP_Plan* plan, SP_PlanOpType type, const char* what) {
+    SP_PlanOp* op = &plan->ops[plan->size++];
+    *op = (SP_PlanOp){.type = type, .fd = -1, .target = -1, .what = what};
+    return op;
+}
+
+/**
+ * Append a trace mark to the plan.
+ *
+ * @param[in,out] plan
+ * @param[in] mark
+ */
+static void add_mark(SP_Plan* plan, SP_TraceMark mark) {
+    add_op(plan, SP_OP_MARK, "trace")->arg = mark;
+}
+
+/**
+ * Append an operation failing with EINVAL to the plan.
+ *
+ * @param[in,out] plan
+ * @param[in] what
+ */
+static void add_fail(SP_Plan* plan, const char* what) {
+    add_op(plan, SP_OP_FAIL, what)->arg = EINVAL;
+}
+
+/**
+ * Append operations moving fd to target to the plan.
+ *
+ * @param[in,out] plan
+ * @param[in] fd
+ * @param[in] target
+ * @param[in] what
+ * @param[in] closeFd close fd once it has been moved.
+ */
+static void add_dup2(SP_Plan* plan, int fd, int target, const char* what,
+                     bool closeFd) {
+    SP_PlanOp* op = add_op(plan, SP_OP_DUP2, what);
+    op->fd = fd;
+    op->target = target;
+    if (closeFd && fd != target) {
+        add_op(plan, SP_OP_CLOSE, what)->fd = fd;
+    }
+}
+
+/**
+ * Append the operations of a redirection to the plan.
+ *
+ * @param[in,out] plan
+ * @param[in] redir
+ * @param[in] target
+ */
+static void add_redirect(SP_Plan* plan, SP_RedirOpt* redir,
+                         SP_RedirTarget target) {
+    SP_PlanOp* op;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    switch (redir->type) {
+    case SP_REDIR_INHERIT:
+        break;
+    case SP_REDIR_APPEND:
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+        // fallthrough
+    case SP_REDIR_DEVNULL:
+        // fallthrough
+    case SP_REDIR_PATH:
+        if (!redir->value.path) {
+            add_fail(plan, "redirect: PATH");
+            break;
+        }
+        op = add_op(plan, SP_OP_OPEN, "redirect: PATH");
+        op->path = redir->value.path;
+        op->target = target;
+        op->arg = target == SP_STDIN_FILENO ? O_RDONLY : flags;
+        op->mode = 0666;
+        break;
+    case SP_REDIR_OPEN:
+        if (!redir->value.path) {
+            add_fail(plan, "redirect: OPEN");
+            break;
+        }
+        op = add_op(plan, SP_OP_OPEN, "redirect: OPEN");
+        op->path = redir->value.path;
+        op->target = target;
+        op->arg = redir->flags;
+        op->mode = redir->mode;
+        op->length = redir->size;
+        break;
+    case SP_REDIR_FD:
+        add_dup2(plan, redir->value.fd, target, "redirect: FD", true);
+        break;
+    case SP_REDIR_TAIL:
+        if (target == SP_STDIN_FILENO) {
+            add_fail(plan, "redirect: TAIL");
+            break;
+        }
+        // fallthrough
+    case SP_REDIR_PIPE:
+    case SP_REDIR_SOCKET: {
+        int* pipeFd = redir->value.pipeFd;
+        const char* what = redir->type == SP_REDIR_PIPE   ? "redirect: PIPE"
+                           : redir->type == SP_REDIR_TAIL ? "redirect: TAIL"
+                                                          : "redirect: SOCKET";
+        add_dup2(plan, target == SP_STDIN_FILENO ? pipeFd[0] : pipeFd[1],
+                 target, what, false);
+        add_op(plan, SP_OP_CLOSE, what)->fd = pipeFd[0];
+        add_op(plan, SP_OP_CLOSE, what)->fd = pipeFd[1];
+        break;
+    }
+    case SP_REDIR_BYTES:
+        add_dup2(plan, redir->value.pipeFd[0], target, "redirect: BYTES",
+                 true);
+        break;
+    case SP_REDIR_STDERR:
+        if (target != SP_STDOUT_FILENO) {
+            add_fail(plan, "redirect: STDERR");
+            break;
+        }
+        add_dup2(plan, SP_STDERR_FILENO, SP_STDOUT_FILENO, "redirect: STDERR",
+                 false);
+        break;
+    case SP_REDIR_STDOUT:
+        if (target != SP_STDERR_FILENO) {
+            add_fail(plan, "redirect: STDOUT");
+            break;
+        }
+        add_dup2(plan, SP_STDOUT_FILENO, SP_STDERR_FILENO, "redirect: STDOUT",
+                 false);
+        break;
+    default:
+        add_fail(plan, "redirect");
+    }
+}
+
+/**
+ * Checks if the redirection order is valid and fixes it if not.
+ * Also sets the default order.
+ *
+ * @param[in,out] order
+ */
+static void check_redirect_order(SP_RedirTarget order[3]) {
+    if (order[0] == order[1] || order[0] == order[2] || order[1] == order[2]) {
+        order[0] = SP_STDIN_FILENO;
+        order[1] = SP_STDOUT_FILENO;
+        order[2] = SP_STDERR_FILENO;
+    }
+}
+
+/**
+ * Converts a redirection target to the corresponding redirection options.
+ *
+ * @param[in] opts
+ * @param[in] target
+ * @return the redirection options for the target or NULL if the target is invalid
+ */
+static SP_RedirOpt* sp_fd_to_redir_opts(SP_Opts* opts, SP_RedirTarget target) {
+    switch (target) {
+    case SP_STDIN_FILENO:
+        return &opts->spstdin;
+    case SP_STDOUT_FILENO:
+        return &opts->spstdout;
+    case SP_STDERR_FILENO:
+        return &opts->spstderr;
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * Append the operations closing every fd above stderr, except the targets of the fd map.
+ *
+ * @param[in,out] plan
+ * @param[in] opts
+ */
+static void add_close_fds(SP_Plan* plan, SP_Opts* opts) {
+    long fdLimit = sysconf(_SC_OPEN_MAX);
+    if (fdLimit < 0) {
+        add_fail(plan, "inheritFds: sysconf");
+        return;
+    }
+    plan->fdLimit = fdLimit;
+    int first = STDERR_FILENO + 1;
+    while (true) {
+        // Close everything up to the next target.
+        int keep = -1;
+        for (size_t i = 0; i < opts->fdMapSize; i++) {
+            int childFd = opts->fdMap[i].childFd;
+            if (childFd >= first && (keep < 0 || childFd < keep)) {
+                keep = childFd;
+            }
+        }
+        if (keep != first) {
+            SP_PlanOp* op = add_op(plan, SP_OP_CLOSE_RANGE, "inheritFds");
+            op->fd = first;
+            op->target = keep < 0 ? -1 : keep - 1;
+        }
+        if (keep < 0) {
+            return;
+        }
+        first = keep + 1;
+    }
+}
+
+/**
+ * Build the list of paths to execute, mirroring the PATH search of execvp(3).
+ *
+ * @param[in,out] plan
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static int add_candidates(SP_Plan* plan) {
+    char* file = plan->argv[0];
+    bool search = plan->search && *file && !strchr(file, '/');
+    const char* path = NULL;
+    size_t nDirs = 0;
+    size_t size = 0;
+    if (search) {
+        path = getenv("PATH");
+        if (!path) {
+            path = SP_PLAN_DEFAULT_PATH;
+        }
+        nDirs = 1;
+        for (const char* c = path; *c; c++) {
+            nDirs += *c == ':';
+        }
+        size = strlen(path) + nDirs * (strlen(file) + 2);
+    }
+    char** candidates = malloc((nDirs + 2) * sizeof(char*) + size);
+    if (!candidates) {
+        return -1;
+    }
+    plan->candidates = candidates;
+    if (!search) {
+        // An empty program name is not found, like with execvp(3).
+        candidates[0] = *file || !plan->search ? file : NULL;
+        candidates[1] = NULL;
+        return 0;
+    }
+    char* dst = (char*)(candidates + nDirs + 2);
+    size_t n = 0;
+    const char* dir = path;
+    while (true) {
+        const char* end = strchrnul(dir, ':');
+        if (end == dir) {
+            // An empty entry is the current directory.
+            candidates[n++] = file;
+        } else {
+            candidates[n++] = dst;
+            memcpy(dst, dir, end - dir);
+            dst += end - dir;
+            *dst++ = '/';
+            dst = stpcpy(dst, file) + 1;
+        }
+        if (!*end) {
+            break;
+        }
+        dir = end + 1;
+    }
+    candidates[n] = NULL;
+    return 0;
+}
+
+int sp_plan_exec(SP_Plan* plan, char** argv, char** env) {
+    if (!plan || !argv || !argv[0]) {
+        errno = EINVAL;
+        return -1;
+    }
+    *plan = (SP_Plan){.argv = argv, .env = env, .search = !env};
+    while (argv[plan->argc]) {
+        plan->argc++;
+    }
+    return add_candidates(plan);
+}
+
+int sp_plan_gate(SP_Plan* plan, int fd, int parentFd) {
+    if (!plan || fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t extra = parentFd >= 0 ? 2 : 1;
+    SP_PlanOp* ops = realloc(plan->ops, (plan->size + extra) * sizeof *ops);
+    if (!ops) {
+        return -1;
+    }
+    plan->ops = ops;
+    plan->capacity = plan->size + extra;
+    if (parentFd >= 0) {
+        // The child's copy of the parent's end would hide the end of file.
+        memmove(ops + 1, ops, plan->size * sizeof *ops);
+        plan->size++;
+        ops[0] = (SP_PlanOp){
+            .type = SP_OP_CLOSE, .fd = parentFd, .target = -1, .what = "gate"};
+    }
+    add_op(plan, SP_OP_GATE, "gate")->fd = fd;
+    return 0;
+}
+
+int sp_plan_cgroup(SP_Plan* plan, int fd) {
+    if (!plan || fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < plan->size; i++) {
+        if (plan->ops[i].type == SP_OP_CGROUP) {
+            plan->ops[i].fd = fd;
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+int sp_plan_message(const SP_Plan* plan, char** msg, size_t* size) {
+    if (!plan || !plan->argv || !plan->candidates || !msg || !size) {
+        errno = EINVAL;
+        return -1;
+    }
+    char** env = plan->env ? plan->env : environ;
+    char** lists[] = {plan->argv, env, plan->candidates};
+    uint32_t counts[3] = {0, 0, 0};
+    SP_PlanGateHeader header = {.search = plan->search};
+    for (int i = 0; i < 3; i++) {
+        for (char** str = lists[i]; *str; str++) {
+            header.size += strlen(*str) + 1;
+            counts[i]++;
+        }
+    }
+    header.argc = counts[0];
+    header.envc = counts[1];
+    header.nCandidates = counts[2];
+    *size = sizeof header + header.size;
+    *msg = malloc(*size);
+    if (!*msg) {
+        return -1;
+    }
+    memcpy(*msg, &header, sizeof header);
+    char* dst = *msg + sizeof header;
+    for (int i = 0; i < 3; i++) {
+        for (char** str = lists[i]; *str; str++) {
+            dst = stpcpy(dst, *str) + 1;
+        }
+    }
+    return 0;
+}
+
+int sp_plan_compile(SP_Plan* plan, char** argv, SP_Opts* opts, pid_t parent) {
+    if (sp_plan_exec(plan, argv, opts ? opts->env : NULL) < 0) {
+        return -1;
+    }
+    if (!opts) {
+        return 0;
+    }
+    // Room for the worst case, so that add_op() never reallocates.
+    plan->capacity = 24 + 3 * opts->fdMapSize;
+    plan->ops = malloc(plan->capacity * sizeof *plan->ops);
+    if (!plan->ops) {
+        sp_plan_free(plan);
+        return -1;
+    }
+    SP_PlanOp* op;
+    if (opts->cgroup) {
+        // First, so the cgroup accounts for everything the child does.
+        add_op(plan, SP_OP_CGROUP, "cgroup: cgroup.procs")->fd = -1;
+    }
+    if (opts->cwd) {
+        add_op(plan, SP_OP_CHDIR, "cwd: chdir")->path = opts->cwd;
+    }
+    if (opts->detach) {
+        add_op(plan, SP_OP_SETSID, "detach: setsid");
+    } else if (opts->newGroup || opts->signalGroup) {
+        add_op(plan, SP_OP_SETPGID, "newGroup: setpgid");
+    }
+    if (opts->deathSignal) {
+        op = add_op(plan, SP_OP_DEATHSIG, "deathSignal: prctl");
+        op->arg = opts->deathSignal;
+        op->fd = parent;
+    }
+    // Move the sources of the fd map above every target, so that neither
+    // placing the targets nor the redirections can clobber a source.
+    int minFd = STDERR_FILENO + 1;
+    for (size_t i = 0; i < opts->fdMapSize; i++) {
+        if (opts->fdMap[i].childFd >= minFd) {
+            minFd = opts->fdMap[i].childFd + 1;
+        }
+    }
+    for (size_t i = 0; i < opts->fdMapSize; i++) {
+        op = add_op(plan, SP_OP_MOVE, "fdMap: fcntl");
+        op->fd = opts->fdMap[i].parentFd;
+        op->target = minFd;
+        op->arg = plan->nMoved++;
+    }
+    add_mark(plan, SP_TRACE_REDIRECT_BEGIN);
+    check_redirect_order(opts->redirOrder);
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(opts->redirOrder); i++) {
+        SP_RedirOpt* redir = sp_fd_to_redir_opts(opts, opts->redirOrder[i]);
+        if (!redir) {
+            add_fail(plan, "redirect");
+            continue;
+        }
+        add_redirect(plan, redir, opts->redirOrder[i]);
+    }
+    for (size_t i = 0; i < opts->fdMapSize; i++) {
+        // dup2() clears close-on-exec on the target.
+        op = add_op(plan, SP_OP_PLACE, "fdMap: dup2");
+        op->fd = opts->fdMap[i].parentFd;
+        op->target = opts->fdMap[i].childFd;
+        op->arg = i;
+    }
+    add_mark(plan, SP_TRACE_REDIRECT_END);
+    if (opts->rlimitsSize && !opts->rlimits) {
+        add_fail(plan, "rlimits");
+    } else if (opts->rlimitsSize) {
+        plan->rlimits = opts->rlimits;
+        add_op(plan, SP_OP_RLIMIT, "rlimits: setrlimit")->arg =
+            opts->rlimitsSize;
+    }
+    if (!opts->inheritFds) {
+        add_mark(plan, SP_TRACE_CLOSE_BEGIN);
+        add_close_fds(plan, opts);
+        add_mark(plan, SP_TRACE_CLOSE_END);
+    }
+    return 0;
+}
+
+/**
+ * Write a number in decimal, async-signal-safe.
+ *
+ * @param[out] buf large enough for any int.
+ * @param[in] n
+ * @return the start of the number in buf, which is NUL terminated.
+ */
+static char* format_int(char buf[12], int n) {
+    char* p = buf + 11;
+    *p = '\0';
+    unsigned int u = n < 0 ? -(unsigned int)n : (unsigned int)n;
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (n < 0) {
+        *--p = '-';
+    }
+    return p;
+}
+
+/**
+ * Print an error message to stderr like SP_ERROR_MSG(), async-signal-safe.
+ *
+ * @param[in] what
+ * @param[in] detail printed after what, or NULL.
+ * @param[in] err errno
+ */
+static void report(const char* what, const char* detail, int err) {
+    char num[12];
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 32)
+    const char* desc = strerrordesc_np(err);
+#else
+    const char* desc = NULL;
+#endif
+    if (!desc) {
+        desc = format_int(num, err);
+    }
+    struct iovec iov[] = {
+        {"SP: ", 4},
+        {(char*)what, strlen(what)},
+        {": ", detail ? 2 : 0},
+        {(char*)detail, detail ? strlen(detail) : 0},
+        {": ", 2},
+        {(char*)desc, strlen(desc)},
+        {"\n", 1},
+    };
+    ssize_t unused = writev(STDERR_FILENO, iov, SP_SIZE_FIXED_ARR(iov));
+    (void)unused;
+}
+
+int sp_plan_open(const char* path, int flags, mode_t mode, off_t length,
+                 int target) {
+    int fd = open(path, flags, mode);
+    if (fd >= 0 && length > 0 &&
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, length) < 0 &&
+        errno != EOPNOTSUPP && errno != ENOSYS) {
+        int tmpErrno = errno;
+        close(fd);
+        errno = tmpErrno;
+        return -1;
+    }
+    if (fd < 0 || fd == target) {
+        return SP_NORMALIZE_ERROR(fd >= 0);
+    }
+    if (dup2(fd, target) < 0) {
+        int tmpErrno = errno;
+        close(fd);
+        errno = tmpErrno;
+        return -1;
+    }
+    return close(fd);
+}
+
+/**
+ * Run a single operation.
+ *
+ * @param[in] plan
+ * @param[in] op
+ * @param[in,out] moved the fds moved by SP_OP_MOVE.
+ * @param[in,out] trace
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int run_op(const SP_Plan* plan, const SP_PlanOp* op, int* moved,
+                  SP_TraceChild* trace) {
+    int fd;
+    switch (op->type) {
+    case SP_OP_MARK:
+        SP_TRACE_MARK(trace, op->arg);
+        return 0;
+    case SP_OP_CHDIR:
+        return chdir(op->path);
+    case SP_OP_SETSID:
+        return SP_NORMALIZE_ERROR(setsid() >= 0);
+    case SP_OP_SETPGID:
+        return setpgid(0, 0);
+    case SP_OP_DEATHSIG:
+        if (prctl(PR_SET_PDEATHSIG, op->arg) < 0) {
+            return -1;
+        }
+        // The parent may have died before the death signal was set.
+        if (getppid() != op->fd) {
+            raise(op->arg);
+        }
+        return 0;
+    case SP_OP_OPEN:
+        return sp_plan_open(op->path, op->arg, op->mode, op->length,
+                            op->target);
+    case SP_OP_DUP2:
+        return SP_NORMALIZE_ERROR(dup2(op->fd, op->target) >= 0);
+    case SP_OP_CLOSE:
+        return close(op->fd);
+    case SP_OP_MOVE:
+        moved[op->arg] = fcntl(op->fd, F_DUPFD_CLOEXEC, op->target);
+        return SP_NORMALIZE_ERROR(moved[op->arg] >= 0);
+    case SP_OP_PLACE:
+        return SP_NORMALIZE_ERROR(dup2(moved[op->arg], op->target) >= 0);
+    case SP_OP_CLOSE_RANGE:
+        if (syscall(SYS_close_range, op->fd,
+                    op->target < 0 ? ~0U : (unsigned int)op->target, 0) < 0) {
+            // Not supported by the kernel.
+            int last = op->target < 0 ? plan->fdLimit - 1 : op->target;
+            for (fd = op->fd; fd <= last; fd++) {
+                close(fd);
+            }
+        }
+        return 0;
+    case SP_OP_CGROUP:
+        if (op->fd < 0) {
+            return 0;
+        }
+        fd = openat(op->fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return -1;
+        }
+        // 0 is the writing process.
+        if (write(fd, "0", 1) != 1) {
+            int tmpErrno = errno;
+            close(fd);
+            errno = tmpErrno;
+            return -1;
+        }
+        return close(fd);
+    case SP_OP_RLIMIT:
+        for (int i = 0; i < op->arg; i++) {
+            const SP_Rlimit* limit = &plan->rlimits[i];
+            struct rlimit value = {limit->soft, limit->hard};
+            if (setrlimit(limit->resource, &value) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    case SP_OP_FAIL:
+        errno = op->arg;
+        return -1;
+    case SP_OP_GATE:
+        // Run by sp_plan_run().
+        break;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+/**
+ * Read exactly size bytes, async-signal-safe.
+ *
+ * @return 0 on success, -1 on error and errno is set, errno is 0 on end of file.
+ */
+static int read_full(int fd, char* buf, size_t size) {
+    while (size > 0) {
+        ssize_t n = read(fd, buf, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = 0;
+            }
+            return -1;
+        }
+        buf += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/**
+ * Split the strings of a message into a NULL terminated list.
+ *
+ * @return the end of the strings.
+ */
+static char* split_strings(char* src, char** list, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        list[i] = src;
+        src += strlen(src) + 1;
+    }
+    list[n] = NULL;
+    return src;
+}
+
+/**
+ * Wait for the program to execute on the fd of a SP_OP_GATE, async-signal-safe.
+ * The memory is mapped with mmap(2) since malloc(3) can't be used.
+ *
+ * @param[in] op
+ * @param[out] gated the plan to execute.
+ * @return 0 on success, -1 on error and errno is set, errno is 0 if the gate was
+ *         closed without a message.
+ */
+static int read_gate(const SP_PlanOp* op, SP_Plan* gated) {
+    SP_PlanGateHeader header;
+    if (read_full(op->fd, (char*)&header, sizeof header) < 0) {
+        return -1;
+    }
+    size_t nPointers = header.argc + header.envc + header.nCandidates + 3;
+    size_t size = nPointers * sizeof(char*) + header.size;
+    char** mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return -1;
+    }
+    char* strings = (char*)(mem + nPointers);
+    if (read_full(op->fd, strings, header.size) < 0) {
+        if (!errno) {
+            errno = EPIPE;
+        }
+        return -1;
+    }
+    close(op->fd);
+    if (!header.argc || strings[header.size - 1]) {
+        errno = EINVAL;
+        return -1;
+    }
+    *gated = (SP_Plan){
+        .argc = header.argc,
+        .search = header.search,
+        .argv = mem,
+        .env = mem + header.argc + 1,
+        .candidates = mem + header.argc + header.envc + 2,
+    };
+    strings = split_strings(strings, gated->argv, header.argc);
+    strings = split_strings(strings, gated->env, header.envc);
+    split_strings(strings, gated->candidates, header.nCandidates);
+    return 0;
+}
+
+/**
+ * Execute the program of the plan, trying every candidate in turn like execvp(3).
+ *
+ * @param[in] plan
+ * @return the errno of the failure, if every candidate failed.
+ */
+static int exec_candidates(const SP_Plan* plan) {
+    char** argv = plan->argv;
+    char** env = plan->env ? plan->env : environ;
+    if (!plan->search) {
+        execve(argv[0], argv, env);
+        return errno;
+    }
+    bool denied = false;
+    int err = ENOENT;
+    for (char** path = plan->candidates; *path; path++) {
+        execve(*path, argv, env);
+        err = errno;
+        if (err == ENOEXEC) {
+            // Run it as a shell script.
+            char* shArgv[plan->argc + 2];
+            shArgv[0] = SP_PLAN_SHELL;
+            shArgv[1] = *path;
+            memcpy(shArgv + 2, argv + 1, plan->argc * sizeof(char*));
+            execve(SP_PLAN_SHELL, shArgv, env);
+            return errno;
+        }
+        switch (err) {
+        case EACCES:
+            denied = true;
+            // fallthrough
+        case ENOENT:
+        case ENOTDIR:
+        case ESTALE:
+        case ENODEV:
+        case ETIMEDOUT:
+            continue;
+        default:
+            return err;
+        }
+    }
+    return denied ? EACCES : err;
+}
+
+int sp_plan_run(const SP_Plan* plan, SP_TraceChild* trace) {
+    SP_TRACE_MARK(trace, SP_TRACE_CHILD_START);
+    int moved[plan->nMoved ? plan->nMoved : 1];
+    SP_Plan gated;
+    for (size_t i = 0; i < plan->size; i++) {
+        const SP_PlanOp* op = &plan->ops[i];
+        if (op->type == SP_OP_GATE) {
+            if (read_gate(op, &gated) < 0) {
+                if (!errno) {
+                    // Closed by the parent, e.g. a pool being destroyed.
+                    return 0;
+                }
+                report(op->what, NULL, errno);
+                return SP_EXIT_NOT_EXECUTE;
+            }
+            plan = &gated;
+            break;
+        }
+        if (run_op(plan, op, moved, trace) < 0) {
+            int err = errno;
+            char num[12];
+            const char* detail = op->path;
+            if (!detail && op->fd >= 0 && op->type != SP_OP_DEATHSIG) {
+                detail = format_int(num, op->fd);
+            }
+            report(op->what, detail, err);
+            return SP_EXIT_NOT_EXECUTE;
+        }
+    }
+    SP_TRACE_MARK(trace, SP_TRACE_EXEC);
+    if (plan->fn) {
+        // Closed by exec otherwise.
+        for (size_t i = 0; i < plan->nMoved; i++) {
+            close(moved[i]);
+        }
+        if (plan->env) {
+            environ = plan->env;
+        }
+        int ret = plan->fn(plan->fnArg);
+        fflush(NULL);
+        return ret;
+    }
+    int err = exec_candidates(plan);
+    report("exec", plan->argv[0], err);
+    switch (err) {
+    case EISDIR:
+    case EACCES:
+    case ELIBBAD:
+    case ENOEXEC:
+    case EIO:
+        return SP_EXIT_NOT_EXECUTE;
+    default:
+        return SP_EXIT_NOT_FOUND;
+    }
+}
+
+void sp_plan_free(SP_Plan* plan) {
+    if (!plan) {
+        return;
+    }
+    free(plan->ops);
+    free(plan->candidates);
+    plan->ops = NULL;
+    plan->candidates = NULL;
+    plan->size = 0;
+    plan->capacity = 0;
+}
@@ -0,0 +1,286 @@
+#include "subprocess/pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "subprocess/pipe.h"
+#include "subprocess/plan.h"
+#include "util.h"
+
+/**
+ * A child waiting on its gate.
+ */
+typedef struct sp_pool_child {
+    SP_Process* proc;  ///< the child.
+    int gate;          ///< the parent's end of the gate.
+} SP_PoolChild;
+
+struct sp_pool {
+    SP_Opts opts;       ///< options of every child.
+    SP_FdMap* fdMap;    ///< copy of sp_opts::fdMap.
+    size_t size;        ///< number of children kept waiting.
+    SP_PoolChild* warm; ///< the waiting children, the last one is used first.
+    size_t nWarm;       ///< number of waiting children.
+    bool failed;        ///< forking failed, retried after the next sp_pool_open().
+    int failedErrno;    ///< errno of the failure.
+    bool stop;          ///< the thread must exit.
+    uint64_t hits;      ///< see sp_pool_stats::hits
+    uint64_t misses;    ///< see sp_pool_stats::misses
+    pthread_mutex_t mutex;   ///< protects the fields above.
+    pthread_cond_t refill;   ///< signals the thread.
+    pthread_cond_t changed;  ///< signals sp_pool_fill().
+    pthread_t thread;        ///< the thread forking children.
+};
+
+/**
+ * Fork a child waiting on a new gate, mapped above every other mapped fd.
+ *
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static int spawn_child(SP_Pool* pool, SP_PoolChild* child) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        return -1;
+    }
+    size_t n = pool->opts.fdMapSize;
+    SP_FdMap fdMap[n + 1];
+    int gateFd = STDERR_FILENO + 1;
+    for (size_t i = 0; i < n; i++) {
+        fdMap[i] = pool->fdMap[i];
+        if (fdMap[i].childFd >= gateFd) {
+            gateFd = fdMap[i].childFd + 1;
+        }
+    }
+    fdMap[n] = (SP_FdMap){fds[0], gateFd};
+    // sp_open() writes the pipes it creates into the options.
+    SP_Opts opts = pool->opts;
+    opts.fdMap = fdMap;
+    opts.fdMapSize = n + 1;
+    child->proc = sp_open_gated(&opts, gateFd, fds[1]);
+    int tmpErrno = errno;
+    close(fds[0]);
+    if (!child->proc) {
+        close(fds[1]);
+        errno = tmpErrno;
+        return -1;
+    }
+    child->gate = fds[1];
+    return 0;
+}
+
+/**
+ * Kill a child that was not used.
+ */
+static void discard_child(SP_PoolChild* child) {
+    // The child exits by itself once the gate is closed, unless it was killed first.
+    sp_fd_close(&child->gate);
+    sp_destroy(child->proc);
+    child->proc = NULL;
+}
+
+static void* refill(void* arg) {
+    SP_Pool* pool = arg;
+    pthread_mutex_lock(&pool->mutex);
+    while (!pool->stop) {
+        if (pool->nWarm >= pool->size || pool->failed) {
+            pthread_cond_wait(&pool->refill, &pool->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        SP_PoolChild child;
+        int err = spawn_child(pool, &child);
+        int tmpErrno = errno;
+        pthread_mutex_lock(&pool->mutex);
+        if (err) {
+            // Not retried in a loop, e.g. when out of processes.
+            pool->failed = true;
+            pool->failedErrno = tmpErrno;
+        } else if (pool->stop) {
+            pthread_mutex_unlock(&pool->mutex);
+            discard_child(&child);
+            pthread_mutex_lock(&pool->mutex);
+        } else {
+            pool->warm[pool->nWarm++] = child;
+        }
+        pthread_cond_broadcast(&pool->changed);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+SP_Pool* sp_pool_create(const SP_Opts* opts, size_t size) {
+    // The death signal follows the refill thread, which sp_pool_destroy() ends.
+    if (opts && (opts->notify || opts->deathSignal ||
+                 (opts->fdMapSize && !opts->fdMap))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    SP_Pool* pool = calloc(1, sizeof *pool);
+    if (!pool) {
+        return NULL;
+    }
+    if (opts) {
+        pool->opts = *opts;
+    }
+    pool->size = size;
+    size_t fdMapSize = pool->opts.fdMapSize;
+    pool->fdMap = malloc((fdMapSize ? fdMapSize : 1) * sizeof(SP_FdMap));
+    pool->warm = malloc((size ? size : 1) * sizeof(SP_PoolChild));
+    if (!pool->fdMap || !pool->warm) {
+        free(pool->fdMap);
+        free(pool->warm);
+        free(pool);
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (fdMapSize) {
+        memcpy(pool->fdMap, opts->fdMap, fdMapSize * sizeof(SP_FdMap));
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->refill, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+    int err = pthread_create(&pool->thread, NULL, refill, pool);
+    if (err) {
+        pthread_cond_destroy(&pool->changed);
+        pthread_cond_destroy(&pool->refill);
+        pthread_mutex_destroy(&pool->mutex);
+        free(pool->fdMap);
+        free(pool->warm);
+        free(pool);
+        errno = err;
+        return NULL;
+    }
+    return pool;
+}
+
+int sp_pool_fill(SP_Pool* pool) {
+    if (!pool) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->nWarm < pool->size && !pool->failed) {
+        pthread_cond_wait(&pool->changed, &pool->mutex);
+    }
+    int err = pool->failed ? pool->failedErrno : 0;
+    pthread_mutex_unlock(&pool->mutex);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Send a whole message through a gate.
+ *
+ * @return 0 on success, -1 on error and errno is set accordingly.
+ */
+static int send_all(int fd, const char* msg, size_t size) {
+    while (size > 0) {
+        // The child may have died, which must not raise SIGPIPE.
+        ssize_t n = send(fd, msg, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        msg += n;
+        size -= n;
+    }
+    return 0;
+}
+
+SP_Process* sp_pool_open(SP_Pool* pool, char** argv, char** env) {
+    if (!pool || !argv || !argv[0]) {
+        errno = EINVAL;
+        return NULL;
+    }
+    SP_Plan plan;
+    char* msg;
+    size_t size;
+    if (sp_plan_exec(&plan, argv, env ? env : pool->opts.env) < 0) {
+        return NULL;
+    }
+    int err = sp_plan_message(&plan, &msg, &size);
+    sp_plan_free(&plan);
+    if (err) {
+        return NULL;
+    }
+    SP_PoolChild child;
+    while (true) {
+        pthread_mutex_lock(&pool->mutex);
+        bool warm = pool->nWarm > 0;
+        if (warm) {
+            child = pool->warm[--pool->nWarm];
+            pool->hits++;
+        } else {
+            pool->misses++;
+        }
+        pool->failed = false;
+        pthread_cond_signal(&pool->refill);
+        pthread_mutex_unlock(&pool->mutex);
+        if (!warm && spawn_child(pool, &child) < 0) {
+            free(msg);
+            return NULL;
+        }
+        if (send_all(child.gate, msg, size) == 0) {
+            break;
+        }
+        int tmpErrno = errno;
+        discard_child(&child);
+        if (!warm) {
+            free(msg);
+            errno = tmpErrno;
+            return NULL;
+        }
+        // A waiting child died, e.g. it was killed, so try another one.
+    }
+    free(msg);
+    sp_fd_close(&child.gate);
+    child.proc->argv = sp_dupe_array(argv);
+    if (!child.proc->argv) {
+        sp_destroy(child.proc);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return child.proc;
+}
+
+void sp_pool_stats(SP_Pool* pool, SP_PoolStats* stats) {
+    if (!pool || !stats) {
+        return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    *stats = (SP_PoolStats){
+        .warm = pool->nWarm,
+        .hits = pool->hits,
+        .misses = pool->misses,
+    };
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void sp_pool_destroy(SP_Pool* pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_signal(&pool->refill);
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_join(pool->thread, NULL);
+    for (size_t i = 0; i < pool->nWarm; i++) {
+        discard_child(&pool->warm[i]);
+    }
+    pthread_cond_destroy(&pool->changed);
+    pthread_cond_destroy(&pool->refill);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->fdMap);
+    free(pool->warm);
+    free(pool);
+}
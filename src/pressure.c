@@ -0,0 +1,208 @@
+#include "subprocess/pressure.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "subprocess/stats.h"
+#include "util.h"
+
+/**
+ * Default of sp_pressure_opts::target.
+ */
+#define SP_PRESSURE_TARGET 10.0
+
+/**
+ * Default of sp_pressure_opts::intervalMs.
+ */
+#define SP_PRESSURE_INTERVAL_MS 500
+
+static const char* files[] = {"cpu", "memory", "io"};
+
+struct sp_pressure {
+    char* dir;            ///< directory of the pressure files.
+    double target;        ///< see sp_pressure_opts::target
+    size_t minLimit;      ///< see sp_pressure_opts::minLimit
+    size_t maxLimit;      ///< see sp_pressure_opts::maxLimit
+    int intervalMs;       ///< see sp_pressure_opts::intervalMs
+    size_t limit;         ///< the current limit.
+    uint64_t sampleNs;    ///< time of the previous sample, or 0.
+    uint64_t total[3];    ///< stall time of the previous sample in microseconds.
+    bool hasTotal[3];     ///< total holds a value.
+};
+
+/**
+ * Read the `some` line of a pressure file, e.g.
+ * `some avg10=1.50 avg60=0.80 avg300=0.20 total=123456`
+ *
+ * @param[in] path
+ * @param[out] avg10 percentage of time stalled over the last 10 seconds.
+ * @param[out] total stall time in microseconds since boot.
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int read_some(const char* path, double* avg10, uint64_t* total) {
+    FILE* file = fopen(path, "re");
+    if (!file) {
+        return -1;
+    }
+    char line[256];
+    int err = -1;
+    while (err && fgets(line, sizeof line, file)) {
+        unsigned long long value;
+        if (sscanf(line, "some avg10=%lf avg60=%*f avg300=%*f total=%llu",
+                   avg10, &value) == 2) {
+            *total = value;
+            err = 0;
+        }
+    }
+    fclose(file);
+    if (err) {
+        errno = EINVAL;
+    }
+    return err;
+}
+
+SP_Pressure* sp_pressure_create(const SP_PressureOpts* opts) {
+    SP_PressureOpts o = opts ? *opts : (SP_PressureOpts){0};
+    if (o.target < 0 || o.intervalMs < 0 ||
+        (o.maxLimit && o.minLimit > o.maxLimit)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    SP_Pressure* pressure = calloc(1, sizeof *pressure);
+    if (!pressure) {
+        return NULL;
+    }
+    pressure->dir = strdup(o.dir ? o.dir : SP_PRESSURE_DIR);
+    if (!pressure->dir) {
+        free(pressure);
+        return NULL;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpus = cpus > 0 ? cpus : 1;
+    pressure->target = o.target ? o.target : SP_PRESSURE_TARGET;
+    pressure->minLimit = o.minLimit ? o.minLimit : 1;
+    pressure->maxLimit = o.maxLimit ? o.maxLimit : 2 * cpus;
+    if (pressure->maxLimit < pressure->minLimit) {
+        pressure->maxLimit = pressure->minLimit;
+    }
+    pressure->intervalMs = o.intervalMs ? o.intervalMs : SP_PRESSURE_INTERVAL_MS;
+    pressure->limit = cpus;
+    if (pressure->limit < pressure->minLimit) {
+        pressure->limit = pressure->minLimit;
+    }
+    if (pressure->limit > pressure->maxLimit) {
+        pressure->limit = pressure->maxLimit;
+    }
+    return pressure;
+}
+
+int sp_pressure_update(SP_Pressure* pressure, SP_PressureSample* sample) {
+    if (!pressure) {
+        errno = EINVAL;
+        return -1;
+    }
+    SP_PressureSample s = {.stall = {-1, -1, -1}};
+    uint64_t now = sp_now_ns();
+    double stall = -1;
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(files); i++) {
+        char path[strlen(pressure->dir) + 16];
+        snprintf(path, sizeof path, "%s/%s", pressure->dir, files[i]);
+        double avg10;
+        uint64_t total;
+        if (read_some(path, &avg10, &total) < 0) {
+            pressure->hasTotal[i] = false;
+            continue;
+        }
+        s.stall[i] = avg10;
+        // avg10 lags behind a change of the limit by seconds, so once there is a
+        // previous sample the stall time between the two samples is used instead.
+        if (pressure->hasTotal[i] && now > pressure->sampleNs &&
+            total >= pressure->total[i]) {
+            double elapsedUs = (now - pressure->sampleNs) / 1000.0;
+            s.stall[i] = (total - pressure->total[i]) * 100.0 / elapsedUs;
+        }
+        pressure->total[i] = total;
+        pressure->hasTotal[i] = true;
+        stall = s.stall[i] > stall ? s.stall[i] : stall;
+    }
+    pressure->sampleNs = now;
+    SP_Stats stats;
+    sp_stats_get(&stats);
+    s.live = stats.live;
+    if (stall > pressure->target) {
+        // Back off quickly so a thrashing machine recovers.
+        pressure->limit /= 2;
+        if (pressure->limit < pressure->minLimit) {
+            pressure->limit = pressure->minLimit;
+        }
+    } else if (stall >= 0 && stall < pressure->target / 2 &&
+               pressure->limit < pressure->maxLimit) {
+        pressure->limit++;
+    }
+    s.limit = pressure->limit;
+    if (sample) {
+        *sample = s;
+    }
+    return 0;
+}
+
+size_t sp_pressure_limit(SP_Pressure* pressure) {
+    if (!pressure) {
+        return 0;
+    }
+    if (sp_now_ns() - pressure->sampleNs >=
+        (uint64_t)pressure->intervalMs * 1000000) {
+        sp_pressure_update(pressure, NULL);
+    }
+    return pressure->limit;
+}
+
+bool sp_pressure_admit(SP_Pressure* pressure) {
+    if (!pressure) {
+        return true;
+    }
+    size_t limit = sp_pressure_limit(pressure);
+    SP_Stats stats;
+    sp_stats_get(&stats);
+    return stats.live < limit;
+}
+
+SP_Process* sp_pressure_open(SP_Pressure* pressure, char** argv, SP_Opts* opts,
+                             int timeoutMs) {
+    if (!pressure) {
+        errno = EINVAL;
+        return NULL;
+    }
+    uint64_t deadline = sp_now_ns() + (uint64_t)timeoutMs * 1000000;
+    while (!sp_pressure_admit(pressure)) {
+        uint64_t now = sp_now_ns();
+        if (timeoutMs >= 0 && now >= deadline) {
+            errno = ETIMEDOUT;
+            return NULL;
+        }
+        // Children exiting are only noticed once reaped, so check again soon.
+        uint64_t sleepNs = 10 * 1000000;
+        if (timeoutMs >= 0 && deadline - now < sleepNs) {
+            sleepNs = deadline - now;
+        }
+        struct timespec ts = {.tv_nsec = sleepNs};
+        nanosleep(&ts, NULL);
+    }
+    return sp_open(argv, opts);
+}
+
+int sp_pressure_interval(SP_Pressure* pressure) {
+    return pressure ? pressure->intervalMs : SP_PRESSURE_INTERVAL_MS;
+}
+
+void sp_pressure_destroy(SP_Pressure* pressure) {
+    if (!pressure) {
+        return;
+    }
+    free(pressure->dir);
+    free(pressure);
+}
@@ -3,59 +3,41 @@
 #include <errno.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
+#include <linux/sched.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-/**
- * Free a NULL terminated array of strings.
- *
- * @param[in,out] arr
- */
-static void free_array(char** arr) {
-    if (!arr) {
-        return;
-    }
-    for (int i = 0; arr[i]; i++) {
-        free(arr[i]);
-    }
-    free(arr);
-}
+#include "subprocess/cgroup.h"
+#include "subprocess/plan.h"
+#include "subprocess/pool.h"
+#include "subprocess/ready.h"
+#include "subprocess/reaper.h"
+#include "subprocess/stats.h"
+#include "subprocess/tail.h"
+#include "subprocess/trace.h"
+#include "util.h"
 
-/**
- * Dupe a NULL terminated array of strings.
- *
- * @param[in] arr
- * @return a copy of arr or NULL on error
- */
-static char** dupe_array(char** arr) {
-    char** dupeArr = malloc(sizeof(char*));
-    int size = 1;
-    int i;
-    char** tmp;
-    for (i = 0; arr[i]; i++) {
-        if (i == size - 1) {
-            // Double strategy with room for NULL byte at the end
-            size *= 2;
-            tmp = realloc(dupeArr, sizeof(char*) * size);
-            if (!tmp) {
-                dupeArr[i] = NULL;
-                free_array(dupeArr);
-                return NULL;
-            }
-            dupeArr = tmp;
-        }
-        dupeArr[i] = strdup(arr[i]);
-        if (!dupeArr[i]) {
-            free_array(dupeArr);
-            return NULL;
-        }
-    }
-    dupeArr[i] = NULL;
-    return dupeArr;
-}
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+/// How long sp_destroy() waits for the killed members of a group to be reaped.
+#define SP_GROUP_REAP_WAIT_MS 1000
 
 /**
  * Wrapper around fclose() to first check if file is NULL.
@@ -69,183 +51,172 @@ static void safe_fclose(FILE* file) {
 }
 
 /**
- * Creates all pipes specified in opts.
+ * Gets the redirections of stdin, stdout, and stderr.
  *
- * @param[in,out] opts
- * @return 0 on success, -1 on error
+ * @param[in] opts
+ * @param[out] redirs
  */
-static int sp_create_pipes(SP_Opts* opts) {
-    return SP_NORMALIZE_ERROR(
-        !sp_pipe_create(&opts->spstdin, opts->nonBlockingPipes) &&
-        !sp_pipe_create(&opts->spstdout, opts->nonBlockingPipes) &&
-        !sp_pipe_create(&opts->spstderr, opts->nonBlockingPipes));
+static void sp_redirs(SP_Opts* opts, SP_RedirOpt* redirs[3]) {
+    redirs[0] = &opts->spstdin;
+    redirs[1] = &opts->spstdout;
+    redirs[2] = &opts->spstderr;
 }
 
 /**
- * Checks if the redirection order is valid and fixes it if not.
- * Also sets the default order.
+ * Checks if a redirection has a pipe created by sp_pipe_create().
  *
- * @param[in,out] order
+ * @param[in] redir
+ * @return true if redir has a pipe.
  */
-static void check_redirect_order(SP_RedirTarget order[3]) {
-    if (order[0] == order[1] || order[0] == order[2] || order[1] == order[2]) {
-        order[0] = SP_STDIN_FILENO;
-        order[1] = SP_STDOUT_FILENO;
-        order[2] = SP_STDERR_FILENO;
-    }
+static bool sp_has_pipe(SP_RedirOpt* redir) {
+    return redir->type == SP_REDIR_PIPE || redir->type == SP_REDIR_BYTES ||
+           redir->type == SP_REDIR_TAIL || redir->type == SP_REDIR_SOCKET;
 }
 
 /**
- * Converts a redirection target to the corresponding redirection options.
+ * Closes the pipes in opts that the parent has not taken ownership of.
+ * Intended to be called in the parent once the child has been forked, or when spawning fails.
  *
- * @param[in] opts
- * @param[in] target
- * @return the redirection options for the target or NULL if the target is invalid
+ * @param[in,out] opts
  */
-static SP_RedirOpt* sp_fd_to_redir_opts(SP_Opts* opts, SP_RedirTarget target) {
-    switch (target) {
-    case SP_STDIN_FILENO:
-        return &opts->spstdin;
-    case SP_STDOUT_FILENO:
-        return &opts->spstdout;
-    case SP_STDERR_FILENO:
-        return &opts->spstderr;
-    default:
-        errno = EINVAL;
-        return NULL;
+static void sp_close_pipes(SP_Opts* opts) {
+    SP_RedirOpt* redirs[3];
+    sp_redirs(opts, redirs);
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(redirs); i++) {
+        if (sp_has_pipe(redirs[i])) {
+            sp_pipe_close(redirs[i]->value.pipeFd);
+        }
     }
 }
 
 /**
- * Redirections for stdin, stdout, and stderr as specified in opts.
+ * Creates all pipes specified in opts.
+ * On error the pipes that were created are closed.
  *
  * @param[in,out] opts
  * @return 0 on success, -1 on error
  */
-static int sp_redirect_all(SP_Opts* opts) {
-    check_redirect_order(opts->redirOrder);
-    for (int i = 0; i < SP_SIZE_FIXED_ARR(opts->redirOrder); i++) {
-        SP_RedirOpt* redirOpt = sp_fd_to_redir_opts(opts, opts->redirOrder[i]);
-        int err = sp_redirect(redirOpt, opts->redirOrder[i]);
-        if (err < 0) {
-            return err;
+static int sp_create_pipes(SP_Opts* opts) {
+    SP_RedirOpt* redirs[3];
+    sp_redirs(opts, redirs);
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(redirs); i++) {
+        if (sp_pipe_create(redirs[i], opts->nonBlockingPipes) < 0) {
+            int tmpErrno = errno;
+            while (i--) {
+                if (sp_has_pipe(redirs[i])) {
+                    sp_pipe_close(redirs[i]->value.pipeFd);
+                }
+            }
+            errno = tmpErrno;
+            return -1;
         }
     }
     return 0;
 }
 
 /**
- * Processes and applies the options for the child process.
+ * Checks that the fd map in opts is valid.
  *
- * @param[in,out] opts
- * @return 0 on success, -1 on error
+ * @param[in] opts
+ * @return 0 if valid, -1 otherwise and errno is set to EINVAL.
  */
-static int sp_handle_child_opts(SP_Opts* opts) {
-    if (!opts) {
+static int sp_check_fd_map(SP_Opts* opts) {
+    if (!opts || !opts->fdMapSize) {
         return 0;
     }
-    if (opts->cwd && chdir(opts->cwd) < 0) {
-        SP_ERROR_MSG("cwd: chdir: %s", opts->cwd);
-        return -1;
-    }
-    if (opts->detach && setsid() < 0) {
-        SP_ERROR_MSG("detach: setsid");
-        return -1;
-    }
-    if (sp_redirect_all(opts) < 0) {
-        // Error output is done in redirect.c since it has access to
-        // specific details.
+    if (!opts->fdMap) {
+        errno = EINVAL;
         return -1;
     }
-    if (!opts->inheritFds) {
-        int fdLimit = sysconf(_SC_OPEN_MAX);
-        if (fdLimit < 0) {
-            SP_ERROR_MSG(
-                "inheritFds: sysconf: unable to determine max number of open "
-                "file descriptors");
+    for (size_t i = 0; i < opts->fdMapSize; i++) {
+        SP_FdMap* map = &opts->fdMap[i];
+        if (map->parentFd < 0 || map->childFd <= STDERR_FILENO) {
+            errno = EINVAL;
             return -1;
         }
-        for (int i = STDERR_FILENO + 1; i < fdLimit; i++) {
-            close(i);
+        for (size_t j = 0; j < i; j++) {
+            if (opts->fdMap[j].childFd == map->childFd) {
+                errno = EINVAL;
+                return -1;
+            }
         }
-
-        // // Possibly a better way that only calls close() on file descriptors that are actually open
-        // DIR* dir = opendir("/proc/self/fd");
-        // if (!dir) {
-        //     SP_ERROR_MSG("inheritFds: opendir: /proc/%d/fd", getpid());
-        //     return -1;
-        // }
-        // int dirFd = dirfd(dir);
-        // struct dirent* entry;
-        // while ((entry = readdir(dir))) {
-        //     int fdNum = atoi(entry->d_name);
-        //     if (fdNum != dirFd && fdNum > STDERR_FILENO) {
-        //         close(fdNum);
-        //     }
-        // }
-        // closedir(dir);
     }
     return 0;
 }
 
 /**
- * Sets up and executes the child process.
+ * Checks if the process will lead its own process group.
  *
- * @paramp[in] argv NULL terminated array of arguments
- * @param[in,out] opts Options for the child process
- * @return an error code if exec fails
+ * @param[in] opts
+ * @return true if the process will lead its own process group.
  */
-static int sp_child_exec(char** argv, SP_Opts* opts) {
-    if (sp_handle_child_opts(opts) < 0) {
-        return SP_EXIT_NOT_EXECUTE;
-    }
-    if (opts && opts->env) {
-        execve(argv[0], argv, opts->env);
-    } else {
-        execvp(argv[0], argv);
-    }
-    SP_ERROR_MSG("exec: %s", argv[0]);
-    switch (errno) {
-    case EISDIR:
-    case EACCES:
-    case ELIBBAD:
-    case ENOEXEC:
-    case EIO:
-        return SP_EXIT_NOT_EXECUTE;
-    default:
-        return SP_EXIT_NOT_FOUND;
-    }
+static bool sp_leads_group(SP_Opts* opts) {
+    return opts && (opts->detach || opts->newGroup || opts->signalGroup);
 }
 
 /**
  * fdopen()'s the correct end of the pipes and closes the other end.
  * Intended to be called in the parent process after fork()
+ * The opened ends are set to -1 in opts, since they are owned by proc.
  *
  * @param proc
  * @param opts options used to setup the process
  * @return 0 on success, -1 on error
  */
 static int sp_fdopen_all(SP_Process* proc, SP_Opts* opts) {
-    // TODO: remove dupe code
-    if (opts->spstdin.type == SP_REDIR_PIPE) {
-        proc->spstdin = sp_pipe_fdopen(opts->spstdin.value.pipeFd, true);
-        if (!proc->spstdin) {
-            return -1;
+    SP_RedirOpt* redirs[3];
+    sp_redirs(opts, redirs);
+    FILE** files[] = {&proc->spstdin, &proc->spstdout, &proc->spstderr};
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(redirs); i++) {
+        int* fd = redirs[i]->value.pipeFd;
+        bool isInput = i == SP_STDIN_FILENO;
+        if (redirs[i]->type == SP_REDIR_SOCKET) {
+            // A single FILE* can't both read and write without seeking, and
+            // would merge SOCK_SEQPACKET messages. The other end is closed
+            // with the pipes.
+            proc->sockets[i] = fd[isInput ? 1 : 0];
+            fd[isInput ? 1 : 0] = -1;
+            continue;
+        } else if (redirs[i]->type == SP_REDIR_PIPE) {
+            *files[i] = sp_pipe_fdopen(fd, isInput);
+        } else {
+            continue;
         }
-    }
-    if (opts->spstdout.type == SP_REDIR_PIPE) {
-        proc->spstdout = sp_pipe_fdopen(opts->spstdout.value.pipeFd, false);
-        if (!proc->spstdout) {
+        if (!*files[i]) {
             return -1;
         }
+        fd[isInput ? 1 : 0] = -1;
     }
-    if (opts->spstderr.type == SP_REDIR_PIPE) {
-        proc->spstderr = sp_pipe_fdopen(opts->spstderr.value.pipeFd, false);
-        if (!proc->spstderr) {
-            return -1;
+    return 0;
+}
+
+/**
+ * fork(2) a child, directly into a cgroup with clone3(2) if cgroupFd is not -1.
+ * Where the kernel can't, the plan is changed so the child moves itself instead.
+ *
+ * @param[in,out] plan
+ * @param[in] cgroupFd the cgroup directory, or -1.
+ * @return the result of fork(2).
+ */
+static pid_t sp_fork(SP_Plan* plan, int cgroupFd) {
+    if (cgroupFd < 0) {
+        return fork();
+    }
+    // A function runs in the child, so it needs the fork handlers of fork(3).
+    if (!plan->fn) {
+        struct clone_args args = {
+            .flags = CLONE_INTO_CGROUP,
+            .exit_signal = SIGCHLD,
+            .cgroup = cgroupFd,
+        };
+        pid_t pid = syscall(SYS_clone3, &args, sizeof args);
+        // Older kernels lack clone3(2) or CLONE_INTO_CGROUP.
+        if (pid >= 0 || (errno != ENOSYS && errno != E2BIG && errno != EINVAL)) {
+            return pid;
         }
     }
-    return 0;
+    sp_plan_cgroup(plan, cgroupFd);
+    return fork();
 }
 
 SP_Process* sp_run(char** argv, SP_Opts* opts) {
@@ -260,42 +231,177 @@ SP_Process* sp_run(char** argv, SP_Opts* opts) {
     return proc;
 }
 
-SP_Process* sp_open(char** argv, SP_Opts* opts) {
-    if (!argv || !argv[0]) {
-        errno = EINVAL;
-        return NULL;
-    }
+/**
+ * Spawn a process.
+ *
+ * @param[in] argv
+ * @param[in,out] opts
+ * @param[in] gateFd if not -1 the child waits for its program on this fd, see sp_plan_gate().
+ * @param[in] gateParentFd the parent's end of gateFd.
+ * @param[in] fn if not NULL the child runs it instead of argv, see sp_fork_fn().
+ * @param[in] fnArg the argument of fn.
+ * @return the process or NULL on error and errno is set accordingly.
+ * @see sp_open
+ */
+static SP_Process* sp_spawn(char** argv, SP_Opts* opts, int gateFd,
+                            int gateParentFd, SP_ChildFn fn, void* fnArg) {
+    bool tracing = SP_TRACE_ENABLED();
+    uint64_t openNs = sp_trace_now();
     SP_Process* proc = calloc(1, sizeof *proc);
     if (!proc) {
+        sp_stats_failed(SP_STAGE_ALLOC);
         return NULL;
     }
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(proc->sockets); i++) {
+        proc->sockets[i] = -1;
+    }
 
     if (opts && sp_create_pipes(opts) < 0) {
+        sp_stats_failed(SP_STAGE_PIPES);
         sp_destroy(proc);
         return NULL;
     }
-    proc->pid = fork();
-    int err;
+    if (opts && opts->notify && sp_ready_create(proc, opts) < 0) {
+        sp_stats_failed(SP_STAGE_NOTIFY);
+        sp_ready_forked(proc, opts);
+        sp_close_pipes(opts);
+        sp_destroy(proc);
+        return NULL;
+    }
+    if (opts && opts->cgroup && sp_cgroup_create(proc, opts) < 0) {
+        sp_stats_failed(SP_STAGE_CGROUP);
+        sp_ready_forked(proc, opts);
+        sp_close_pipes(opts);
+        sp_destroy(proc);
+        return NULL;
+    }
+    pid_t parent = getpid();
+    // Everything the child does is decided here, so it only makes system calls.
+    SP_Plan plan;
+    int failed = sp_plan_compile(&plan, argv, opts, parent);
+    if (!failed && gateFd >= 0 &&
+        sp_plan_gate(&plan, gateFd, gateParentFd) < 0) {
+        sp_plan_free(&plan);
+        failed = -1;
+    }
+    if (!failed) {
+        plan.fn = fn;
+        plan.fnArg = fnArg;
+    }
+    if (!failed && proc->ready) {
+        plan.env = sp_ready_env(proc, plan.env);
+        if (!plan.env) {
+            sp_plan_free(&plan);
+            failed = -1;
+        }
+    }
+    if (failed) {
+        sp_stats_failed(SP_STAGE_ALLOC);
+        if (opts) {
+            sp_ready_forked(proc, opts);
+            sp_close_pipes(opts);
+        }
+        sp_destroy(proc);
+        return NULL;
+    }
+    uint64_t forkNs = 0;
+    if (tracing) {
+        // Tracing continues without the child's events if this fails.
+        proc->trace = sp_trace_child_create();
+        forkNs = sp_trace_now();
+        if (proc->trace) {
+            proc->trace->marks[SP_TRACE_FORK] = forkNs;
+        }
+    }
+    proc->pid = sp_fork(&plan, sp_cgroup_fd(proc));
+    uint64_t forkedNs = tracing ? sp_trace_now() : 0;
     switch (proc->pid) {
     case -1:  // FORK ERROR
+        sp_plan_free(&plan);
+        sp_stats_failed(SP_STAGE_FORK);
+        if (opts) {
+            sp_ready_forked(proc, opts);
+            sp_close_pipes(opts);
+        }
         sp_destroy(proc);
         return NULL;
     case 0:  // CHILD
-        err = sp_child_exec(argv, opts);
-        sp_destroy(proc);
-        _exit(err);
+        _exit(sp_plan_run(&plan, proc->trace));
     default:  // PARENT
+        sp_plan_free(&plan);
+        if (opts) {
+            sp_ready_forked(proc, opts);
+        }
+        sp_stats_spawned();
         proc->status = SP_STATUS_RUNNING;
         proc->exitCode = -1;
-        if (opts && sp_fdopen_all(proc, opts) < 0) {
-            sp_destroy(proc);
-            return NULL;
+        if (sp_leads_group(opts)) {
+            // Also set in the parent so the group exists before either returns.
+            if (!opts->detach) {
+                setpgid(proc->pid, proc->pid);
+            }
+            proc->pgid = proc->pid;
+            proc->signalGroup = opts->signalGroup;
+        }
+        if (opts) {
+            int err = sp_fdopen_all(proc, opts) < 0 ||
+                      sp_tail_start(proc, opts) < 0;
+            int tmpErrno = errno;
+            // The child has its own copies, e.g. of the read end for
+            // SP_REDIR_BYTES.
+            sp_close_pipes(opts);
+            if (err) {
+                sp_stats_failed(SP_STAGE_SETUP);
+                sp_destroy(proc);
+                errno = tmpErrno;
+                return NULL;
+            }
+        }
+        if (gateFd < 0 && !fn) {
+            proc->argv = sp_dupe_array(argv);
         }
-        proc->argv = dupe_array(argv);
+    }
+    uint64_t setupNs = sp_trace_now();
+    sp_stats_opened(setupNs - openNs);
+    if (tracing) {
+        sp_trace_event("create_pipes", proc->pid, false, openNs, forkNs);
+        sp_trace_event("fork", proc->pid, false, forkNs, forkedNs);
+        sp_trace_event("parent_setup", proc->pid, false, forkedNs,
+                       setupNs);
+        sp_trace_event("sp_open", proc->pid, false, openNs, setupNs);
     }
     return proc;
 }
 
+SP_Process* sp_open(char** argv, SP_Opts* opts) {
+    if (!argv || !argv[0] || sp_check_fd_map(opts) < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return sp_spawn(argv, opts, -1, -1, NULL, NULL);
+}
+
+SP_Process* sp_open_gated(SP_Opts* opts, int gateFd, int gateParentFd) {
+    if (!opts || gateFd < 0 || sp_check_fd_map(opts) < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    // Only used to compile the plan, the program is sent through the gate.
+    char* argv[] = {"", NULL};
+    return sp_spawn(argv, opts, gateFd, gateParentFd, NULL, NULL);
+}
+
+SP_Process* sp_fork_fn(SP_ChildFn fn, void* arg, SP_Opts* opts) {
+    if (!fn || sp_check_fd_map(opts) < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    // The child would write what is buffered again when it flushes.
+    fflush(NULL);
+    char* argv[] = {"", NULL};
+    return sp_spawn(argv, opts, -1, -1, fn, arg);
+}
+
 int sp_terminate(SP_Process* proc) {
     return sp_signal(proc, SIGTERM);
 }
@@ -304,8 +410,35 @@ int sp_kill(SP_Process* proc) {
     return sp_signal(proc, SIGKILL);
 }
 
+/**
+ * Check if the process group id of a process can't have been reused yet.
+ * That is the case while the leader or another member of the group is an unreaped
+ * child of the caller, once all are gone the id may belong to an unrelated group.
+ *
+ * @param proc
+ * @return true if the group may be signalled
+ */
+static bool group_pinned(SP_Process* proc) {
+    if (!proc->signalGroup || proc->pgid <= 0) {
+        return false;
+    }
+    if (proc->status == SP_STATUS_RUNNING) {
+        return true;
+    }
+    siginfo_t info;
+    return waitid(P_PGID, proc->pgid, &info, WEXITED | WNOHANG | WNOWAIT) == 0;
+}
+
 int sp_signal(SP_Process* proc, int signal) {
-    if (!proc || proc->status == SP_STATUS_DEAD) {
+    if (!proc) {
+        errno = EINVAL;
+        return -1;
+    }
+    // The group can outlive its leader.
+    if (group_pinned(proc)) {
+        return kill(-proc->pgid, signal);
+    }
+    if (proc->status == SP_STATUS_DEAD) {
         errno = EINVAL;
         return -1;
     }
@@ -315,6 +448,9 @@ int sp_signal(SP_Process* proc, int signal) {
 void sp_close(SP_Process* proc) {
     safe_fclose(proc->spstdin);
     proc->spstdin = NULL;
+    if (proc->sockets[SP_STDIN_FILENO] >= 0) {
+        shutdown(proc->sockets[SP_STDIN_FILENO], SHUT_WR);
+    }
 }
 
 /**
@@ -334,6 +470,8 @@ static int sp_wait_opts(SP_Process* proc, int options) {
     if (proc->status == SP_STATUS_DEAD) {
         return proc->exitCode;
     }
+    uint64_t waitNs =
+        SP_TRACE_ENABLED() && !(options & WNOHANG) ? sp_trace_now() : 0;
     int stat;
     int pid = waitpid(proc->pid, &stat, options);
     if (pid <= 0) {
@@ -345,6 +483,23 @@ static int sp_wait_opts(SP_Process* proc, int options) {
         proc->exitCode = WTERMSIG(stat) + SP_SIGNAL_OFFSET;
     }
     proc->status = SP_STATUS_DEAD;
+    if (WIFSIGNALED(stat) && WTERMSIG(stat) == SIGXCPU) {
+        proc->limitHit |= SP_LIMIT_HIT_CPU;
+    } else if (WIFSIGNALED(stat) && WTERMSIG(stat) == SIGXFSZ) {
+        proc->limitHit |= SP_LIMIT_HIT_FSIZE;
+    }
+    sp_cgroup_reaped(proc);
+    sp_stats_reaped(proc->exitCode);
+    if (proc->trace || waitNs) {
+        uint64_t reapedNs = sp_trace_now();
+        if (waitNs) {
+            sp_trace_event("sp_wait", proc->pid, false, waitNs, reapedNs);
+        }
+        sp_trace_child_finish(proc->trace, proc->pid, reapedNs);
+        proc->trace = NULL;
+    }
+    // Descendants still holding the tail pipes open must not block the caller.
+    sp_tail_join(proc, true);
     return proc->exitCode;
 }
 
@@ -360,13 +515,64 @@ void sp_destroy(SP_Process* proc) {
     if (!proc) {
         return;
     }
+    // Don't wait for descendants still holding the tail pipes open.
+    sp_tail_free(proc);
+    sp_ready_free(proc);
     if (proc->status == SP_STATUS_RUNNING) {
         sp_kill(proc);
         sp_wait(proc);
     }
-    free_array(proc->argv);
+    if (group_pinned(proc)) {
+        // The rest of the group may still run after the leader was waited on, e.g.
+        // `sh -c 'worker &'`.
+        kill(-proc->pgid, SIGKILL);
+        // Reap the rest of the group that was reparented to us, but don't hang on a
+        // member that is slow to die. Those are left for the caller to reap.
+        for (int i = 0; i < SP_GROUP_REAP_WAIT_MS; i++) {
+            pid_t pid;
+            while ((pid = waitpid(-proc->pgid, NULL, WNOHANG)) > 0) {
+            }
+            if (pid < 0 && errno != EINTR) {
+                break;
+            }
+            usleep(1000);
+        }
+    }
+    sp_trace_child_finish(proc->trace, proc->pid, 0);
+    sp_cgroup_free(proc);
+    sp_free_array(proc->argv);
     safe_fclose(proc->spstdin);
     safe_fclose(proc->spstderr);
     safe_fclose(proc->spstdout);
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(proc->sockets); i++) {
+        sp_fd_close(&proc->sockets[i]);
+    }
     free(proc);
 }
+
+void sp_destroy_async(SP_Process* proc) {
+    if (!proc) {
+        return;
+    }
+    if (proc->status == SP_STATUS_RUNNING) {
+        sp_kill(proc);
+        // If the reaper is unavailable fall back to waiting in sp_destroy()
+        sp_reap_async(proc);
+    }
+    if (proc->spstdin) {
+        __fpurge(proc->spstdin);
+    }
+    sp_destroy(proc);
+}
+
+int sp_pidfd(SP_Process* proc) {
+    if (!proc || proc->status == SP_STATUS_DEAD) {
+        errno = EINVAL;
+        return -1;
+    }
+    return syscall(SYS_pidfd_open, proc->pid, 0);
+}
+
+int sp_subreaper(bool enable) {
+    return prctl(PR_SET_CHILD_SUBREAPER, enable ? 1 : 0);
+}
@@ -0,0 +1,393 @@
+#define _GNU_SOURCE  // for pipe2() and struct ucred
+
+#include "subprocess/ready.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "subprocess/pipe.h"
+#include "util.h"
+
+extern char** environ;
+
+/**
+ * The message telling the parent the process is ready.
+ */
+#define SP_READY_MESSAGE "READY=1"
+
+/**
+ * Milliseconds between checks of the process without pidfd support.
+ */
+#define SP_READY_POLL_MS 10
+
+/**
+ * State of the notification of a process.
+ */
+struct sp_ready {
+    SP_NotifyType type;  ///< how the process notifies.
+    int fd;              ///< read end of the pipe or the socket.
+    int childFd;         ///< write end of the pipe for SP_NOTIFY_FD, or -1.
+    bool ready;          ///< "READY=1" was received.
+    bool closed;         ///< the write end of the pipe was closed.
+    char line[64];       ///< start of the current line for SP_NOTIFY_FD.
+    size_t lineSize;     ///< bytes of the current line, may exceed sizeof line.
+    SP_FdMap* fdMap;     ///< the options' fdMap, restored after fork(2).
+    size_t fdMapSize;    ///< the options' fdMapSize.
+    SP_FdMap* childMap;  ///< fdMap including childFd.
+    char** env;          ///< environment of the process, freed after fork(2).
+    char var[128];       ///< the variable passing the notification.
+};
+
+/**
+ * Process the end of a line.
+ */
+static void end_line(struct sp_ready* ready) {
+    size_t size = sizeof SP_READY_MESSAGE - 1;
+    if (ready->lineSize == size &&
+        !memcmp(ready->line, SP_READY_MESSAGE, size)) {
+        ready->ready = true;
+    }
+    ready->lineSize = 0;
+}
+
+/**
+ * Split received bytes into lines.
+ */
+static void parse(struct sp_ready* ready, const char* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == '\n') {
+            end_line(ready);
+        } else {
+            if (ready->lineSize < sizeof ready->line) {
+                ready->line[ready->lineSize] = data[i];
+            }
+            ready->lineSize++;
+        }
+    }
+}
+
+/**
+ * Receive a datagram on the socket and check its sender, like NotifyAccess=main
+ * of systemd.service(5).
+ *
+ * @param[out] trusted set to whether the datagram was sent by the process itself.
+ */
+static ssize_t receive(int fd, pid_t pid, char* buf, size_t size,
+                       bool* trusted) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(struct ucred))];
+    } control;
+    struct iovec iov = {.iov_base = buf, .iov_len = size};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf,
+    };
+    *trusted = false;
+    ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0) {
+        return n;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+        if (cmsg->cmsg_type == SCM_RIGHTS) {
+            // Passed file descriptors are not used.
+            size_t nFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < nFds; i++) {
+                int passed;
+                memcpy(&passed, CMSG_DATA(cmsg) + i * sizeof(int),
+                       sizeof passed);
+                close(passed);
+            }
+        } else if (cmsg->cmsg_type == SCM_CREDENTIALS &&
+                   cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+            struct ucred cred;
+            memcpy(&cred, CMSG_DATA(cmsg), sizeof cred);
+            *trusted = pid > 0 && cred.pid == pid;
+        }
+    }
+    return n;
+}
+
+/**
+ * Read every notification received so far without blocking.
+ *
+ * @param[in] pid the process, the only sender accepted for SP_NOTIFY_SOCKET.
+ */
+static void drain(struct sp_ready* ready, pid_t pid) {
+    char buf[512];
+    while (!ready->closed) {
+        bool trusted = true;
+        ssize_t n = ready->type == SP_NOTIFY_SOCKET
+                        ? receive(ready->fd, pid, buf, sizeof buf, &trusted)
+                        : read(ready->fd, buf, sizeof buf);
+        if ((n < 0 && errno == EINTR) ||
+            (n == 0 && ready->type == SP_NOTIFY_SOCKET)) {
+            // An empty datagram doesn't close the socket.
+            continue;
+        }
+        if (n <= 0) {
+            // EAGAIN once drained, other errors are treated as the end.
+            ready->closed = n == 0 || errno != EAGAIN;
+            break;
+        }
+        if (!trusted) {
+            // Any process can send to the abstract address.
+            continue;
+        }
+        parse(ready, buf, n);
+        if (ready->type == SP_NOTIFY_SOCKET) {
+            // Every datagram ends the last line.
+            end_line(ready);
+        }
+    }
+    if (ready->closed) {
+        end_line(ready);
+    }
+}
+
+/**
+ * Create the socket, bound to an abstract address chosen by the kernel.
+ */
+static int create_socket(struct sp_ready* ready) {
+    ready->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (ready->fd < 0) {
+        return -1;
+    }
+    // Makes the kernel attach the sender to every datagram, see unix(7).
+    int on = 1;
+    if (setsockopt(ready->fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof on) < 0) {
+        return -1;
+    }
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    // Binding only the family autobinds an abstract address, see unix(7).
+    socklen_t size = sizeof(sa_family_t);
+    if (bind(ready->fd, (struct sockaddr*)&addr, size) < 0) {
+        return -1;
+    }
+    size = sizeof addr;
+    if (getsockname(ready->fd, (struct sockaddr*)&addr, &size) < 0) {
+        return -1;
+    }
+    size_t nameSize = size - offsetof(struct sockaddr_un, sun_path);
+    int n = snprintf(ready->var, sizeof ready->var, "%s=@",
+                     SP_NOTIFY_SOCKET_ENV);
+    if (nameSize < 1 || n + nameSize > sizeof ready->var) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    // Skip the leading NUL of the abstract name.
+    memcpy(ready->var + n, addr.sun_path + 1, nameSize - 1);
+    return 0;
+}
+
+/**
+ * Create the pipe and add its write end to the options' fdMap, at the lowest fd above
+ * the standard streams and every other mapped fd.
+ */
+static int create_pipe(struct sp_ready* ready, SP_Opts* opts) {
+    int fd[2];
+    if (pipe2(fd, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    ready->fd = fd[0];
+    ready->childFd = fd[1];
+    int flags = fcntl(ready->fd, F_GETFL);
+    if (flags < 0 || fcntl(ready->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return -1;
+    }
+    size_t size = opts->fdMapSize;
+    ready->childMap = malloc((size + 1) * sizeof(SP_FdMap));
+    if (!ready->childMap) {
+        return -1;
+    }
+    int childFd = 3;
+    for (size_t i = 0; i < size; i++) {
+        ready->childMap[i] = opts->fdMap[i];
+        if (opts->fdMap[i].childFd >= childFd) {
+            childFd = opts->fdMap[i].childFd + 1;
+        }
+    }
+    ready->childMap[size] = (SP_FdMap){ready->childFd, childFd};
+    snprintf(ready->var, sizeof ready->var, "%s=%d", SP_NOTIFY_FD_ENV,
+             childFd);
+    ready->fdMap = opts->fdMap;
+    ready->fdMapSize = size;
+    opts->fdMap = ready->childMap;
+    opts->fdMapSize = size + 1;
+    return 0;
+}
+
+int sp_ready_create(SP_Process* proc, SP_Opts* opts) {
+    if (!proc || !opts || (opts->notify != SP_NOTIFY_FD &&
+                           opts->notify != SP_NOTIFY_SOCKET)) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct sp_ready* ready = calloc(1, sizeof *ready);
+    if (!ready) {
+        return -1;
+    }
+    proc->ready = ready;
+    ready->type = opts->notify;
+    ready->fd = -1;
+    ready->childFd = -1;
+    if (ready->type == SP_NOTIFY_SOCKET) {
+        return create_socket(ready);
+    }
+    return create_pipe(ready, opts);
+}
+
+char** sp_ready_env(SP_Process* proc, char** env) {
+    struct sp_ready* ready = proc->ready;
+    if (!env) {
+        env = environ;
+    }
+    size_t n = 0;
+    while (env[n]) {
+        n++;
+    }
+    ready->env = malloc((n + 2) * sizeof(char*));
+    if (!ready->env) {
+        return NULL;
+    }
+    size_t fdSize = strlen(SP_NOTIFY_FD_ENV "=");
+    size_t socketSize = strlen(SP_NOTIFY_SOCKET_ENV "=");
+    size_t size = 0;
+    for (size_t i = 0; i < n; i++) {
+        // Notifications meant for the caller are not inherited.
+        if (!strncmp(env[i], SP_NOTIFY_FD_ENV "=", fdSize) ||
+            !strncmp(env[i], SP_NOTIFY_SOCKET_ENV "=", socketSize)) {
+            continue;
+        }
+        ready->env[size++] = env[i];
+    }
+    ready->env[size++] = ready->var;
+    ready->env[size] = NULL;
+    return ready->env;
+}
+
+void sp_ready_forked(SP_Process* proc, SP_Opts* opts) {
+    struct sp_ready* ready = proc->ready;
+    if (!ready) {
+        return;
+    }
+    sp_fd_close(&ready->childFd);
+    if (ready->childMap) {
+        opts->fdMap = ready->fdMap;
+        opts->fdMapSize = ready->fdMapSize;
+        free(ready->childMap);
+        ready->childMap = NULL;
+    }
+    free(ready->env);
+    ready->env = NULL;
+}
+
+void sp_ready_free(SP_Process* proc) {
+    struct sp_ready* ready = proc->ready;
+    if (!ready) {
+        return;
+    }
+    sp_fd_close(&ready->fd);
+    sp_fd_close(&ready->childFd);
+    free(ready->childMap);
+    free(ready->env);
+    free(ready);
+    proc->ready = NULL;
+}
+
+int sp_ready_fd(const SP_Process* proc) {
+    return proc && proc->ready ? proc->ready->fd : -1;
+}
+
+int sp_wait_ready(SP_Process* proc, int timeoutMs) {
+    if (!proc || !proc->ready) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct sp_ready* ready = proc->ready;
+    drain(ready, proc->pid);
+    if (ready->ready) {
+        return 0;
+    }
+    // Fails once the process was waited on, which is checked below.
+    int pidfd = sp_pidfd(proc);
+    uint64_t deadline = timeoutMs > 0 ? sp_now_ns() / 1000000 + timeoutMs : 0;
+    while (true) {
+        if (ready->closed || sp_poll(proc) >= 0) {
+            // Notifications sent right before exiting were drained above.
+            drain(ready, proc->pid);
+            if (ready->ready) {
+                break;
+            }
+            sp_fd_close(&pidfd);
+            errno = ECHILD;
+            return -1;
+        }
+        int wait = timeoutMs;
+        if (timeoutMs > 0) {
+            uint64_t now = sp_now_ns() / 1000000;
+            wait = now < deadline ? deadline - now : 0;
+        }
+        if (wait == 0) {
+            sp_fd_close(&pidfd);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (pidfd < 0 && (wait < 0 || wait > SP_READY_POLL_MS)) {
+            // Without pidfd support an exit is only noticed by checking.
+            wait = SP_READY_POLL_MS;
+        }
+        struct pollfd fds[] = {
+            {.fd = ready->fd, .events = POLLIN},
+            {.fd = pidfd, .events = POLLIN},
+        };
+        if (poll(fds, SP_SIZE_FIXED_ARR(fds), wait) < 0 && errno != EINTR) {
+            sp_fd_close(&pidfd);
+            return -1;
+        }
+        drain(ready, proc->pid);
+        if (ready->ready) {
+            break;
+        }
+    }
+    sp_fd_close(&pidfd);
+    return 0;
+}
+
+SP_Process* sp_open_ready(char** argv, SP_Opts* opts, int timeoutMs) {
+    SP_Opts defaults = {0};
+    if (!opts) {
+        opts = &defaults;
+    }
+    SP_NotifyType notify = opts->notify;
+    if (notify == SP_NOTIFY_NONE) {
+        opts->notify = SP_NOTIFY_FD;
+    }
+    SP_Process* proc = sp_open(argv, opts);
+    opts->notify = notify;
+    if (!proc) {
+        return NULL;
+    }
+    if (sp_wait_ready(proc, timeoutMs) < 0) {
+        int tmpErrno = errno;
+        sp_destroy(proc);
+        errno = tmpErrno;
+        return NULL;
+    }
+    return proc;
+}
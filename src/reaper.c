@@ -0,0 +1,259 @@
+#include "subprocess/reaper.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "subprocess/cgroup.h"
+#include "subprocess/pipe.h"
+#include "subprocess/stats.h"
+
+/**
+ * Milliseconds between waitpid(2) polls for processes that have no pidfd,
+ * or whose process group still has members left to reap.
+ */
+#define SP_REAP_POLL_MS 100
+
+/**
+ * A process waiting to be reaped.
+ */
+typedef struct sp_reap_entry {
+    pid_t pid;   ///< pid of the process, or 0 once it has been reaped.
+    pid_t pgid;  ///< process group to reap after the process, or 0.
+    int pidfd;   ///< pidfd of the process, or -1 if unavailable.
+    char* cgroup;  ///< cgroup of the process to remove once reaped, or NULL.
+} SP_ReapEntry;
+
+static pthread_mutex_t reaperLock = PTHREAD_MUTEX_INITIALIZER;
+static bool reaperStarted = false;
+static bool atforkRegistered = false;
+static int reaperWakeFd = -1;
+// Entries handed over by sp_reap_async() that the reaper has not picked up yet.
+static SP_ReapEntry* queued = NULL;
+static size_t nQueued = 0;
+static size_t queuedCapacity = 0;
+static size_t pending = 0;
+
+/**
+ * Try to reap the entry without blocking.
+ *
+ * @param[in,out] entry
+ * @return true if the process and its group have been reaped.
+ */
+static bool reap(SP_ReapEntry* entry) {
+    if (entry->pid > 0) {
+        pid_t pid = waitpid(entry->pid, NULL, WNOHANG);
+        if (pid == 0 || (pid < 0 && errno == EINTR)) {
+            return false;
+        }
+        entry->pid = 0;
+        sp_fd_close(&entry->pidfd);
+        sp_stats_reaped(-1);
+    }
+    if (entry->pgid > 0) {
+        pid_t pid;
+        while ((pid = waitpid(-entry->pgid, NULL, WNOHANG)) > 0) {
+        }
+        if (pid >= 0 || errno != ECHILD) {
+            return false;
+        }
+    }
+    if (entry->cgroup) {
+        if (sp_cgroup_remove(entry->cgroup, 0) < 0 && errno == EAGAIN) {
+            // Checked again until the killed processes have exited.
+            return false;
+        }
+        free(entry->cgroup);
+        entry->cgroup = NULL;
+    }
+    return true;
+}
+
+/**
+ * Move the queued entries into the reaper's own list.
+ *
+ * @param[in,out] entries
+ * @param[in,out] n number of entries
+ * @param[in,out] capacity allocated size of entries
+ * @param[in,out] fds pollfds, allocated to hold capacity + 1
+ * @return true if all queued entries were taken.
+ */
+static bool take_queued(SP_ReapEntry** entries, size_t* n, size_t* capacity,
+                        struct pollfd** fds) {
+    pthread_mutex_lock(&reaperLock);
+    if (*n + nQueued > *capacity) {
+        size_t newCapacity = (*n + nQueued) * 2;
+        SP_ReapEntry* tmp = realloc(*entries, newCapacity * sizeof **entries);
+        if (tmp) {
+            *entries = tmp;
+            struct pollfd* tmpFds =
+                realloc(*fds, (newCapacity + 1) * sizeof **fds);
+            if (tmpFds) {
+                *fds = tmpFds;
+                *capacity = newCapacity;
+            }
+        }
+    }
+    if (*n + nQueued <= *capacity) {
+        memcpy(*entries + *n, queued, nQueued * sizeof *queued);
+        *n += nQueued;
+        nQueued = 0;
+    }
+    bool taken = !nQueued;
+    pthread_mutex_unlock(&reaperLock);
+    return taken;
+}
+
+/**
+ * Entry point of the reaper thread.
+ *
+ * @param[in] arg unused
+ * @return never returns
+ */
+static void* reaper_main(void* arg) {
+    SP_ReapEntry* entries = NULL;
+    size_t n = 0;
+    size_t capacity = 0;
+    struct pollfd* fds = malloc(sizeof *fds);
+    while (!fds) {
+        // Nothing can be reaped without memory, keep trying.
+        sleep(1);
+        fds = malloc(sizeof *fds);
+    }
+    for (;;) {
+        bool needsPolling = !take_queued(&entries, &n, &capacity, &fds);
+        fds[0] = (struct pollfd){.fd = reaperWakeFd, .events = POLLIN};
+        for (size_t i = 0; i < n; i++) {
+            fds[i + 1] =
+                (struct pollfd){.fd = entries[i].pidfd, .events = POLLIN};
+            needsPolling |= entries[i].pidfd < 0;
+        }
+        if (poll(fds, n + 1, needsPolling ? SP_REAP_POLL_MS : -1) < 0) {
+            continue;
+        }
+        if (fds[0].revents) {
+            uint64_t count;
+            read(reaperWakeFd, &count, sizeof count);
+        }
+        for (size_t i = n; i > 0; i--) {
+            SP_ReapEntry* entry = &entries[i - 1];
+            if ((entry->pidfd < 0 || fds[i].revents) && reap(entry)) {
+                *entry = entries[--n];
+                __atomic_sub_fetch(&pending, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return arg;
+}
+
+/**
+ * Reset the reaper in a forked child, the thread does not exist there
+ * and the queued processes are not children of the child.
+ */
+static void reaper_atfork_child(void) {
+    reaperLock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    if (reaperStarted) {
+        sp_fd_close(&reaperWakeFd);
+    }
+    reaperStarted = false;
+    nQueued = 0;
+    pending = 0;
+}
+
+/**
+ * Start the reaper thread if it is not running.
+ * Must be called with reaperLock held.
+ *
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int reaper_start(void) {
+    if (reaperStarted) {
+        return 0;
+    }
+    if (!atforkRegistered) {
+        int err = pthread_atfork(NULL, NULL, reaper_atfork_child);
+        if (err) {
+            errno = err;
+            return -1;
+        }
+        atforkRegistered = true;
+    }
+    reaperWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (reaperWakeFd < 0) {
+        return -1;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    // Signals are left to the application's threads.
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    int err = pthread_create(&thread, &attr, reaper_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        sp_fd_close(&reaperWakeFd);
+        errno = err;
+        return -1;
+    }
+    reaperStarted = true;
+    return 0;
+}
+
+int sp_reap_async(SP_Process* proc) {
+    if (!proc || proc->status != SP_STATUS_RUNNING) {
+        errno = EINVAL;
+        return -1;
+    }
+    SP_ReapEntry entry = {
+        .pid = proc->pid,
+        .pgid = proc->signalGroup ? proc->pgid : 0,
+        .pidfd = sp_pidfd(proc),
+    };
+    pthread_mutex_lock(&reaperLock);
+    int err = reaper_start();
+    if (!err && nQueued == queuedCapacity) {
+        size_t capacity = queuedCapacity ? queuedCapacity * 2 : 16;
+        SP_ReapEntry* tmp = realloc(queued, capacity * sizeof *queued);
+        if (tmp) {
+            queued = tmp;
+            queuedCapacity = capacity;
+        } else {
+            err = -1;
+        }
+    }
+    if (!err) {
+        entry.cgroup = sp_cgroup_release(proc);
+        queued[nQueued++] = entry;
+        __atomic_add_fetch(&pending, 1, __ATOMIC_RELAXED);
+    }
+    int wakeFd = reaperWakeFd;
+    pthread_mutex_unlock(&reaperLock);
+    if (err) {
+        int tmpErrno = errno;
+        sp_fd_close(&entry.pidfd);
+        errno = tmpErrno;
+        return -1;
+    }
+    uint64_t one = 1;
+    write(wakeFd, &one, sizeof one);
+    proc->status = SP_STATUS_DEAD;
+    proc->exitCode = -1;
+    // The reaper owns the group now, sp_destroy() must not wait for it.
+    proc->pgid = 0;
+    return 0;
+}
+
+size_t sp_reap_pending(void) {
+    return __atomic_load_n(&pending, __ATOMIC_RELAXED);
+}
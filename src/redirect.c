@@ -5,6 +5,7 @@
 
 #include "subprocess/error.h"
 #include "subprocess/pipe.h"
+#include "subprocess/plan.h"
 
 /**
  * dup2() oldFd to newFd.
@@ -90,7 +91,19 @@ int sp_redirect(SP_RedirOpt* opts, SP_RedirTarget target) {
         // fallthrough
     case SP_REDIR_PATH:
         err = sp_freopen(opts->value.path, target, append);
-        snprintf(msg, msgLen, "PATH: %s", opts->value.path);
+        snprintf(msg, msgLen, "PATH: %s",
+                 opts->value.path ? opts->value.path : "(null)");
+        break;
+    case SP_REDIR_OPEN:
+        if (opts->value.path) {
+            err = sp_plan_open(opts->value.path, opts->flags, opts->mode,
+                               opts->size, target);
+        } else {
+            errno = EINVAL;
+            err = -1;
+        }
+        snprintf(msg, msgLen, "OPEN: %s",
+                 opts->value.path ? opts->value.path : "(null)");
         break;
     case SP_REDIR_FD:
         err = sp_dup2_close(opts->value.fd, target);
@@ -101,6 +114,21 @@ int sp_redirect(SP_RedirOpt* opts, SP_RedirTarget target) {
         snprintf(msg, msgLen, "PIPE: [%d,%d]", opts->value.pipeFd[0],
                  opts->value.pipeFd[1]);
         break;
+    case SP_REDIR_SOCKET:
+        err = sp_dup2_pipe(opts->value.pipeFd, target);
+        snprintf(msg, msgLen, "SOCKET: [%d,%d]", opts->value.pipeFd[0],
+                 opts->value.pipeFd[1]);
+        break;
+    case SP_REDIR_TAIL:
+        snprintf(msg, msgLen, "TAIL: [%d,%d]", opts->value.pipeFd[0],
+                 opts->value.pipeFd[1]);
+        if (target == SP_STDIN_FILENO) {
+            errno = EINVAL;
+            err = -1;
+        } else {
+            err = sp_dup2_pipe(opts->value.pipeFd, target);
+        }
+        break;
     case SP_REDIR_BYTES:
         err = sp_dup2_close(opts->value.pipeFd[0], target);
         snprintf(msg, msgLen, "BYTES: %d", opts->value.pipeFd[0]);
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE  // for memfd_create() and MSG_CMSG_CLOEXEC
+
+#include "subprocess/socket.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ssize_t sp_socket_send(int sock, const void* data, size_t size, const int* fds,
+                       size_t nFds) {
+    if (sock < 0 || (size && !data) || (nFds && !fds) ||
+        nFds > SP_SOCKET_MAX_FDS) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!size && nFds) {
+        // Without a byte the descriptors would silently not be sent.
+        int type;
+        socklen_t len = sizeof type;
+        if (getsockopt(sock, SOL_SOCKET, SO_TYPE, &type, &len) < 0) {
+            return -1;
+        }
+        if (type == SOCK_STREAM) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    struct iovec iov = {.iov_base = (void*)data, .iov_len = size};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    // Aligned for struct cmsghdr.
+    union {
+        char buf[CMSG_SPACE(SP_SOCKET_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    if (nFds) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(nFds * sizeof(int));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nFds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nFds * sizeof(int));
+    }
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+ssize_t sp_socket_recv(int sock, void* buf, size_t size, int* fds,
+                       size_t* nFds) {
+    size_t capacity = nFds ? *nFds : 0;
+    if (sock < 0 || (size && !buf) || (capacity && !fds)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (nFds) {
+        *nFds = 0;
+    }
+    struct iovec iov = {.iov_base = buf, .iov_len = size};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    union {
+        char buf[CMSG_SPACE(SP_SOCKET_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return -1;
+    }
+    size_t received = 0;
+    bool overflow = msg.msg_flags & MSG_CTRUNC;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int* data = (int*)CMSG_DATA(cmsg);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, data + i, sizeof fd);
+            if (received < capacity) {
+                fds[received++] = fd;
+            } else {
+                close(fd);
+                overflow = true;
+            }
+        }
+    }
+    if (overflow) {
+        // Half of the descriptors is of no use to the caller.
+        for (size_t i = 0; i < received; i++) {
+            close(fds[i]);
+        }
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (nFds) {
+        *nFds = received;
+    }
+    return n;
+}
+
+int sp_memfd_create(const char* name, size_t size, void** map) {
+    if (!name || (map && !size)) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0) {
+        int tmpErrno = errno;
+        close(fd);
+        errno = tmpErrno;
+        return -1;
+    }
+    if (map) {
+        *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (*map == MAP_FAILED) {
+            int tmpErrno = errno;
+            *map = NULL;
+            close(fd);
+            errno = tmpErrno;
+            return -1;
+        }
+    }
+    return fd;
+}
+
+void* sp_memfd_map(int fd, size_t* size) {
+    struct stat st;
+    if (!size || fstat(fd, &st) < 0) {
+        if (!size) {
+            errno = EINVAL;
+        }
+        return NULL;
+    }
+    if (!st.st_size) {
+        errno = EINVAL;
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    *size = st.st_size;
+    return map;
+}
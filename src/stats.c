@@ -0,0 +1,108 @@
+#include "subprocess/stats.h"
+
+#include "subprocess/error.h"
+
+/**
+ * The counters, only accessed with atomic operations.
+ */
+static SP_Stats counters;
+
+/**
+ * Add to a counter.
+ *
+ * @param[in,out] counter
+ * @param[in] n
+ */
+static void add(uint64_t* counter, uint64_t n) {
+    __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+/**
+ * Copy counters atomically.
+ *
+ * @param[out] dst
+ * @param[in] src
+ * @param[in] n number of counters
+ */
+static void copy(uint64_t* dst, uint64_t* src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+void sp_stats_get(SP_Stats* stats) {
+    if (!stats) {
+        return;
+    }
+    // Every member is a uint64_t.
+    copy((uint64_t*)stats, (uint64_t*)&counters,
+         sizeof counters / sizeof(uint64_t));
+}
+
+void sp_stats_reset(void) {
+    uint64_t* all = (uint64_t*)&counters;
+    for (size_t i = 0; i < sizeof counters / sizeof(uint64_t); i++) {
+        // Processes that are still running will be reaped later, and reaps racing with
+        // the reset must not be lost.
+        if (&all[i] != &counters.live) {
+            __atomic_store_n(&all[i], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+uint64_t sp_stats_latency(const SP_Stats* stats, double percentile) {
+    uint64_t total = 0;
+    for (int i = 0; i < SP_STATS_LATENCY_BUCKETS; i++) {
+        total += stats->latency[i];
+    }
+    if (!total) {
+        return 0;
+    }
+    double rank = percentile / 100 * total;
+    uint64_t seen = 0;
+    for (int i = 0; i < SP_STATS_LATENCY_BUCKETS; i++) {
+        seen += stats->latency[i];
+        if (seen && seen >= rank) {
+            return i == SP_STATS_LATENCY_BUCKETS - 1 ? UINT64_MAX
+                                                      : (uint64_t)2 << i;
+        }
+    }
+    return UINT64_MAX;
+}
+
+void sp_stats_spawned(void) {
+    add(&counters.spawns, 1);
+    add(&counters.live, 1);
+}
+
+void sp_stats_opened(uint64_t latencyNs) {
+    int bucket = latencyNs ? 63 - __builtin_clzll(latencyNs) : 0;
+    if (bucket >= SP_STATS_LATENCY_BUCKETS) {
+        bucket = SP_STATS_LATENCY_BUCKETS - 1;
+    }
+    add(&counters.latency[bucket], 1);
+    add(&counters.latencySumNs, latencyNs);
+}
+
+void sp_stats_failed(SP_SpawnStage stage) {
+    if (stage < SP_N_STAGES) {
+        add(&counters.failures[stage], 1);
+    }
+}
+
+void sp_stats_reaped(int exitCode) {
+    __atomic_sub_fetch(&counters.live, 1, __ATOMIC_RELAXED);
+    add(&counters.reaped, 1);
+    if (exitCode == SP_EXIT_NOT_EXECUTE || exitCode == SP_EXIT_NOT_FOUND) {
+        add(&counters.failures[SP_STAGE_EXEC], 1);
+    }
+}
+
+void sp_stats_bytes(size_t written, size_t read) {
+    if (written) {
+        add(&counters.bytesWritten, written);
+    }
+    if (read) {
+        add(&counters.bytesRead, read);
+    }
+}
@@ -0,0 +1,273 @@
+#include "subprocess/tail.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "subprocess/pipe.h"
+#include "subprocess/stats.h"
+
+/**
+ * Size of the buffer used to discard output when nothing is kept.
+ */
+#define SP_TAIL_SCRATCH_SIZE 4096
+
+/**
+ * A ring buffer holding the last bytes of an output.
+ */
+typedef struct sp_tail_ring {
+    bool enabled;     ///< the output is redirected with SP_REDIR_TAIL().
+    int fd;           ///< read end of the pipe, or -1 once drained.
+    char* buf;        ///< the kept bytes.
+    size_t capacity;  ///< allocated size of buf.
+    size_t pos;       ///< index in buf where the next byte is written.
+    uint64_t total;   ///< bytes read so far, accessed atomically.
+    bool linear;      ///< buf has been rotated to start with the oldest byte.
+} SP_TailRing;
+
+/**
+ * State of the thread draining the outputs of a process.
+ */
+struct sp_tail {
+    SP_TailRing rings[2];  ///< stdout and stderr.
+    pthread_t thread;      ///< the draining thread.
+    int stopFd;            ///< eventfd telling the thread to stop.
+    bool joined;           ///< the thread has been joined.
+};
+
+/**
+ * Read everything currently available in the pipe into the ring.
+ *
+ * @param[in,out] ring
+ * @return false once the pipe has been closed.
+ */
+static bool drain(SP_TailRing* ring) {
+    char scratch[SP_TAIL_SCRATCH_SIZE];
+    for (;;) {
+        char* dst = scratch;
+        size_t len = sizeof scratch;
+        if (ring->capacity) {
+            dst = ring->buf + ring->pos;
+            len = ring->capacity - ring->pos;
+        }
+        ssize_t n = read(ring->fd, dst, len);
+        if (n > 0) {
+            if (ring->capacity) {
+                ring->pos = (ring->pos + n) % ring->capacity;
+            }
+            __atomic_add_fetch(&ring->total, n, __ATOMIC_RELAXED);
+            sp_stats_bytes(0, n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            return true;
+        } else {
+            sp_fd_close(&ring->fd);
+            return false;
+        }
+    }
+}
+
+/**
+ * Entry point of the draining thread.
+ *
+ * @param[in,out] arg the sp_tail
+ * @return NULL
+ */
+static void* tail_main(void* arg) {
+    struct sp_tail* tail = arg;
+    bool stopping = false;
+    while (!stopping) {
+        struct pollfd fds[3] = {{.fd = tail->stopFd, .events = POLLIN}};
+        size_t n = 1;
+        for (int i = 0; i < SP_SIZE_FIXED_ARR(tail->rings); i++) {
+            fds[i + 1] =
+                (struct pollfd){.fd = tail->rings[i].fd, .events = POLLIN};
+            n += tail->rings[i].fd >= 0;
+        }
+        if (n == 1) {
+            break;
+        }
+        if (poll(fds, SP_SIZE_FIXED_ARR(fds), -1) < 0) {
+            continue;
+        }
+        stopping = fds[0].revents;
+        for (int i = 0; i < SP_SIZE_FIXED_ARR(tail->rings); i++) {
+            if (tail->rings[i].fd >= 0 && (stopping || fds[i + 1].revents)) {
+                drain(&tail->rings[i]);
+            }
+        }
+    }
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(tail->rings); i++) {
+        sp_fd_close(&tail->rings[i].fd);
+    }
+    return NULL;
+}
+
+/**
+ * Reverse the bytes of buf in place.
+ *
+ * @param[in,out] buf
+ * @param[in] size
+ */
+static void reverse(char* buf, size_t size) {
+    for (size_t i = 0; i < size / 2; i++) {
+        char c = buf[i];
+        buf[i] = buf[size - 1 - i];
+        buf[size - 1 - i] = c;
+    }
+}
+
+/**
+ * Get the ring of a target.
+ *
+ * @param[in] process
+ * @param[in] target
+ * @return the ring or NULL if the target is not redirected with SP_REDIR_TAIL().
+ */
+static SP_TailRing* get_ring(SP_Process* process, SP_RedirTarget target) {
+    if (!process || !process->tail ||
+        (target != SP_STDOUT_FILENO && target != SP_STDERR_FILENO) ||
+        !process->tail->rings[target - 1].enabled) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return &process->tail->rings[target - 1];
+}
+
+const char* sp_tail(SP_Process* process, SP_RedirTarget target, size_t* size) {
+    SP_TailRing* ring = get_ring(process, target);
+    if (!ring || !size) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (process->status != SP_STATUS_DEAD) {
+        errno = EBUSY;
+        return NULL;
+    }
+    sp_tail_join(process, true);
+    if (!ring->linear && ring->total > ring->capacity) {
+        // Rotate left by pos so the oldest byte comes first.
+        reverse(ring->buf, ring->pos);
+        reverse(ring->buf + ring->pos, ring->capacity - ring->pos);
+        reverse(ring->buf, ring->capacity);
+    }
+    ring->linear = true;
+    *size = ring->total < ring->capacity ? ring->total : ring->capacity;
+    // An empty buffer is still a valid result.
+    return ring->buf ? ring->buf : "";
+}
+
+const char* sp_tail_lines(SP_Process* process, SP_RedirTarget target,
+                          size_t nLines, size_t* size) {
+    size_t bufSize;
+    const char* buf = sp_tail(process, target, &bufSize);
+    if (!buf) {
+        return NULL;
+    }
+    // The newline ending the last line does not start another one.
+    size_t start = bufSize && buf[bufSize - 1] == '\n' ? bufSize - 1 : bufSize;
+    if (!nLines) {
+        start = bufSize;
+    }
+    for (; nLines && start > 0; start--) {
+        if (buf[start - 1] == '\n' && !--nLines) {
+            break;
+        }
+    }
+    *size = bufSize - start;
+    return buf + start;
+}
+
+uint64_t sp_tail_total(SP_Process* process, SP_RedirTarget target) {
+    SP_TailRing* ring = get_ring(process, target);
+    return ring ? __atomic_load_n(&ring->total, __ATOMIC_RELAXED) : 0;
+}
+
+int sp_tail_start(SP_Process* process, SP_Opts* opts) {
+    SP_RedirOpt* redirs[] = {&opts->spstdout, &opts->spstderr};
+    if (redirs[0]->type != SP_REDIR_TAIL && redirs[1]->type != SP_REDIR_TAIL) {
+        return 0;
+    }
+    struct sp_tail* tail = calloc(1, sizeof *tail);
+    if (!tail) {
+        return -1;
+    }
+    tail->stopFd = -1;
+    tail->joined = true;
+    tail->rings[0].fd = -1;
+    tail->rings[1].fd = -1;
+    process->tail = tail;
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(redirs); i++) {
+        SP_TailRing* ring = &tail->rings[i];
+        if (redirs[i]->type != SP_REDIR_TAIL) {
+            continue;
+        }
+        ring->enabled = true;
+        ring->fd = redirs[i]->value.pipeFd[0];
+        redirs[i]->value.pipeFd[0] = -1;
+        sp_fd_close(&redirs[i]->value.pipeFd[1]);
+        int flags = fcntl(ring->fd, F_GETFL);
+        if (flags < 0 || fcntl(ring->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            return -1;
+        }
+        ring->capacity = redirs[i]->size;
+        if (ring->capacity) {
+            ring->buf = malloc(ring->capacity);
+            if (!ring->buf) {
+                return -1;
+            }
+        }
+    }
+    tail->stopFd = eventfd(0, EFD_CLOEXEC);
+    if (tail->stopFd < 0) {
+        return -1;
+    }
+    // Signals are left to the application's threads.
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&tail->thread, NULL, tail_main, tail);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    tail->joined = false;
+    return 0;
+}
+
+void sp_tail_join(SP_Process* process, bool stop) {
+    if (!process || !process->tail || process->tail->joined) {
+        return;
+    }
+    struct sp_tail* tail = process->tail;
+    if (stop) {
+        uint64_t one = 1;
+        write(tail->stopFd, &one, sizeof one);
+    }
+    pthread_join(tail->thread, NULL);
+    tail->joined = true;
+}
+
+void sp_tail_free(SP_Process* process) {
+    if (!process || !process->tail) {
+        return;
+    }
+    sp_tail_join(process, true);
+    struct sp_tail* tail = process->tail;
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(tail->rings); i++) {
+        sp_fd_close(&tail->rings[i].fd);
+        free(tail->rings[i].buf);
+    }
+    sp_fd_close(&tail->stopFd);
+    free(tail);
+    process->tail = NULL;
+}
@@ -0,0 +1,298 @@
+#define _GNU_SOURCE  // for splice(), tee() and pipe2()
+
+#include "subprocess/tee.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "subprocess/error.h"
+#include "subprocess/pipe.h"
+#include "subprocess/stats.h"
+#include "util.h"
+
+/**
+ * Maximum number of bytes moved from the source per iteration.
+ */
+#define SP_TEE_CHUNK (64 * 1024)
+
+/**
+ * Append bytes read from fd to the capture buffer of sink.
+ *
+ * @param[in,out] sink
+ * @param[in] fd
+ * @param[in] size number of bytes to read.
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int capture(SP_TeeSink* sink, int fd, size_t size) {
+    size_t needed = sink->size + size;
+    if (needed > sink->capacity) {
+        size_t capacity = sink->capacity ? sink->capacity : SP_TEE_CHUNK;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        char* tmp = realloc(sink->buf, capacity);
+        if (!tmp) {
+            return -1;
+        }
+        sink->buf = tmp;
+        sink->capacity = capacity;
+    }
+    while (size > 0) {
+        ssize_t n = read(fd, sink->buf + sink->size, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            errno = n ? errno : EIO;
+            return -1;
+        }
+        sink->size += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/**
+ * Move exactly size bytes from the pipe pipeFd to outFd.
+ * Falls back to read(2) and write(2) when outFd cannot be spliced to,
+ * e.g. files opened with O_APPEND.
+ *
+ * @param[in] pipeFd read end of a pipe holding at least size bytes.
+ * @param[in] outFd
+ * @param[in] size
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int drain(int pipeFd, int outFd, size_t size) {
+    char buf[SP_TEE_CHUNK];
+    bool canSplice = true;
+    while (size > 0) {
+        ssize_t n;
+        if (canSplice) {
+            n = splice(pipeFd, NULL, outFd, NULL, size, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINVAL) {
+                canSplice = false;
+                continue;
+            }
+            if (n < 0 && errno == EAGAIN && !sp_wait_writable(outFd)) {
+                continue;
+            }
+        } else {
+            n = read(pipeFd, buf, size < sizeof buf ? size : sizeof buf);
+            if (n > 0 && sp_write_all(outFd, buf, n) < 0) {
+                return -1;
+            }
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            errno = n ? errno : EIO;
+            return -1;
+        }
+        size -= n;
+    }
+    return 0;
+}
+
+/**
+ * Move exactly size bytes from the pipe pipeFd to the sink.
+ *
+ * @param[in,out] sink
+ * @param[in] pipeFd read end of a pipe holding at least size bytes.
+ * @param[in] outFd the file descriptor of the sink, unused for captures.
+ * @param[in] size
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int sink_drain(SP_TeeSink* sink, int pipeFd, int outFd, size_t size) {
+    if (sink->type == SP_TEE_CAPTURE) {
+        return capture(sink, pipeFd, size);
+    }
+    if (drain(pipeFd, outFd, size) < 0) {
+        return -1;
+    }
+    sink->size += size;
+    return 0;
+}
+
+/**
+ * Move up to SP_TEE_CHUNK bytes from fd into the empty pipe pipeFd.
+ * Falls back to read(2) and write(2) when fd cannot be spliced from,
+ * and waits for fd if it is non-blocking and has nothing to read yet.
+ *
+ * @param[in] fd
+ * @param[in] pipeFd write end of an empty pipe.
+ * @param[in,out] canSplice set to false once splicing from fd has failed.
+ * @return the number of bytes moved, 0 on end of file, or -1 on error and errno is set.
+ */
+static ssize_t fill(int fd, int pipeFd, bool* canSplice) {
+    ssize_t n;
+    do {
+        if (*canSplice) {
+            n = splice(fd, NULL, pipeFd, NULL, SP_TEE_CHUNK, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINVAL) {
+                *canSplice = false;
+                errno = EINTR;  // retry with read()
+            }
+        } else {
+            char buf[SP_TEE_CHUNK];
+            n = read(fd, buf, sizeof buf);
+            if (n > 0 && sp_write_all(pipeFd, buf, n) < 0) {
+                return -1;
+            }
+        }
+        if (n < 0 && errno == EAGAIN && !sp_wait_readable(fd)) {
+            errno = EINTR;  // retry now that fd is readable
+        }
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+/**
+ * Open the file descriptor of every sink.
+ *
+ * @param[in,out] sinks
+ * @param[in] nSinks
+ * @param[out] fds the file descriptor for each sink, -1 for captures.
+ * @return 0 on success, -1 on error and errno is set.
+ */
+static int sinks_open(SP_TeeSink* sinks, size_t nSinks, int* fds) {
+    for (size_t i = 0; i < nSinks; i++) {
+        fds[i] = -1;
+    }
+    for (size_t i = 0; i < nSinks; i++) {
+        SP_TeeSink* sink = &sinks[i];
+        switch (sink->type) {
+        case SP_TEE_FD:
+            fds[i] = sink->value.fd;
+            break;
+        case SP_TEE_PATH:
+        case SP_TEE_APPEND:
+            if (!sink->value.path) {
+                errno = EINVAL;
+                return -1;
+            }
+            fds[i] = open(sink->value.path,
+                          O_WRONLY | O_CREAT | O_CLOEXEC |
+                              (sink->type == SP_TEE_APPEND ? O_APPEND
+                                                           : O_TRUNC),
+                          0666);
+            if (fds[i] < 0) {
+                return -1;
+            }
+            break;
+        case SP_TEE_CAPTURE:
+            break;
+        case SP_TEE_PROCESS:
+            if (!sink->value.process || !sink->value.process->spstdin) {
+                errno = EINVAL;
+                return -1;
+            }
+            fflush(sink->value.process->spstdin);
+            fds[i] = fileno(sink->value.process->spstdin);
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+        }
+        if (sink->type != SP_TEE_CAPTURE && fds[i] < 0) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Close the files opened for path sinks.
+ *
+ * @param[in] sinks
+ * @param[in] nSinks
+ * @param[in,out] fds
+ */
+static void sinks_close(SP_TeeSink* sinks, size_t nSinks, int* fds) {
+    for (size_t i = 0; i < nSinks; i++) {
+        if (sinks[i].type == SP_TEE_PATH || sinks[i].type == SP_TEE_APPEND) {
+            sp_fd_close(&fds[i]);
+        }
+    }
+}
+
+ssize_t sp_tee(int fd, SP_TeeSink* sinks, size_t nSinks) {
+    if (fd < 0 || !sinks || !nSinks) {
+        errno = EINVAL;
+        return -1;
+    }
+    int* fds = calloc(nSinks, sizeof *fds);
+    if (!fds) {
+        return -1;
+    }
+    // Data is spliced from fd into chunk, duplicated into copy with tee()
+    // for every sink but the last, and the last sink consumes chunk.
+    int chunk[2] = {-1, -1};
+    int copy[2] = {-1, -1};
+    ssize_t total = 0;
+    int err = sinks_open(sinks, nSinks, fds);
+    if (!err) {
+        err = SP_NORMALIZE_ERROR(!pipe2(chunk, O_CLOEXEC) &&
+                                 !pipe2(copy, O_CLOEXEC));
+    }
+    if (!err) {
+        // copy must be able to hold everything in chunk for tee() to never be short.
+        int size = fcntl(chunk[0], F_GETPIPE_SZ);
+        if (size > 0) {
+            fcntl(copy[0], F_SETPIPE_SZ, size);
+        }
+    }
+    size_t nProcesses = 0;
+    for (size_t i = 0; i < nSinks; i++) {
+        nProcesses += sinks[i].type == SP_TEE_PROCESS;
+    }
+    bool canSplice = true;
+    while (!err) {
+        ssize_t n = fill(fd, chunk[1], &canSplice);
+        if (n <= 0) {
+            err = n;
+            break;
+        }
+        total += n;
+        sp_stats_bytes(n * nProcesses, n);
+        for (size_t i = 0; !err && i < nSinks - 1; i++) {
+            ssize_t copied;
+            while ((copied = tee(chunk[0], copy[1], n, 0)) < 0 &&
+                   errno == EINTR) {
+            }
+            if (copied != n) {
+                errno = copied < 0 ? errno : EIO;
+                err = -1;
+                break;
+            }
+            err = sink_drain(&sinks[i], copy[0], fds[i], n);
+        }
+        if (!err) {
+            err = sink_drain(&sinks[nSinks - 1], chunk[0], fds[nSinks - 1], n);
+        }
+    }
+    int tmpErrno = errno;
+    sinks_close(sinks, nSinks, fds);
+    free(fds);
+    sp_pipe_close(chunk);
+    sp_pipe_close(copy);
+    errno = tmpErrno;
+    return err ? -1 : total;
+}
+
+void sp_tee_free(SP_TeeSink* sinks, size_t nSinks) {
+    if (!sinks) {
+        return;
+    }
+    for (size_t i = 0; i < nSinks; i++) {
+        if (sinks[i].type == SP_TEE_CAPTURE) {
+            free(sinks[i].buf);
+            sinks[i].buf = NULL;
+            sinks[i].capacity = 0;
+        }
+    }
+}
@@ -0,0 +1,311 @@
+#define _GNU_SOURCE  // for gettid()
+
+#include "subprocess/trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "util.h"
+
+/**
+ * Number of events in each chunk of a thread's buffer.
+ */
+#define SP_TRACE_CHUNK_EVENTS 256
+
+/**
+ * A recorded event.
+ */
+typedef struct sp_trace_event {
+    const char* name;  ///< static name of the event.
+    pid_t pid;         ///< process shown as the owner of the track.
+    pid_t tid;         ///< thread shown as the owner of the track.
+    pid_t child;       ///< child the event is about, or 0.
+    uint64_t ts;       ///< begin in ns.
+    uint64_t dur;      ///< duration in ns.
+} SP_TraceEvent;
+
+/**
+ * A fixed-size block of events. Chunks are never moved, so the exporter can read
+ * a chunk while its thread appends to it.
+ */
+typedef struct sp_trace_chunk {
+    struct sp_trace_chunk* next;  ///< next chunk, accessed atomically.
+    size_t size;                  ///< number of events, accessed atomically.
+    SP_TraceEvent events[SP_TRACE_CHUNK_EVENTS];  ///< the events.
+} SP_TraceChunk;
+
+/**
+ * Events recorded by a single thread, only appended to by that thread.
+ * Once the thread exits the buffer keeps its events for the exporter, and is
+ * reused by the next thread that records an event.
+ */
+typedef struct sp_trace_buffer {
+    struct sp_trace_buffer* next;  ///< next buffer in the list of all buffers.
+    SP_TraceChunk* head;           ///< first chunk, protected by buffersLock.
+    size_t cleared;       ///< events of head discarded by sp_trace_clear().
+    SP_TraceChunk* tail;  ///< chunk being appended to, accessed atomically.
+    pid_t tid;            ///< thread owning the buffer.
+    bool orphaned;        ///< its thread exited, protected by buffersLock.
+} SP_TraceBuffer;
+
+int spTraceEnabled = 0;
+
+static pthread_mutex_t buffersLock = PTHREAD_MUTEX_INITIALIZER;
+static SP_TraceBuffer* buffers = NULL;
+static __thread SP_TraceBuffer* threadBuffer = NULL;
+static pthread_once_t bufferKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t bufferKey;
+static bool bufferKeyCreated = false;
+
+/**
+ * Hand the buffer of an exiting thread over to the next thread that needs one.
+ *
+ * @param[in,out] arg the buffer.
+ */
+static void buffer_orphan(void* arg) {
+    SP_TraceBuffer* buffer = arg;
+    // Events recorded by later destructors go to another buffer.
+    threadBuffer = NULL;
+    pthread_mutex_lock(&buffersLock);
+    buffer->orphaned = true;
+    pthread_mutex_unlock(&buffersLock);
+}
+
+/**
+ * Create the key whose destructor orphans the buffer of an exiting thread.
+ */
+static void buffer_key_create(void) {
+    bufferKeyCreated = !pthread_key_create(&bufferKey, buffer_orphan);
+}
+
+/**
+ * Take a buffer orphaned by an exited thread.
+ * Must be called with buffersLock held.
+ *
+ * @return the buffer, or NULL if there is none.
+ */
+static SP_TraceBuffer* buffer_adopt(void) {
+    for (SP_TraceBuffer* buffer = buffers; buffer; buffer = buffer->next) {
+        if (buffer->orphaned) {
+            buffer->orphaned = false;
+            return buffer;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get the buffer of the calling thread, creating it on first use.
+ *
+ * @return the buffer or NULL on error
+ */
+static SP_TraceBuffer* get_buffer(void) {
+    if (threadBuffer) {
+        return threadBuffer;
+    }
+    pthread_once(&bufferKeyOnce, buffer_key_create);
+    pthread_mutex_lock(&buffersLock);
+    SP_TraceBuffer* buffer = buffer_adopt();
+    pthread_mutex_unlock(&buffersLock);
+    if (!buffer) {
+        buffer = calloc(1, sizeof *buffer);
+        if (!buffer) {
+            return NULL;
+        }
+        buffer->head = calloc(1, sizeof *buffer->head);
+        if (!buffer->head) {
+            free(buffer);
+            return NULL;
+        }
+        buffer->tail = buffer->head;
+        pthread_mutex_lock(&buffersLock);
+        buffer->next = buffers;
+        buffers = buffer;
+        pthread_mutex_unlock(&buffersLock);
+    }
+    buffer->tid = gettid();
+    if (bufferKeyCreated) {
+        pthread_setspecific(bufferKey, buffer);
+    }
+    threadBuffer = buffer;
+    return buffer;
+}
+
+void sp_trace_enable(bool enable) {
+    __atomic_store_n(&spTraceEnabled, enable, __ATOMIC_RELAXED);
+}
+
+uint64_t sp_trace_now(void) {
+    return sp_now_ns();
+}
+
+void sp_trace_event(const char* name, pid_t child, bool inChild,
+                    uint64_t beginNs, uint64_t endNs) {
+    SP_TraceBuffer* buffer = get_buffer();
+    if (!buffer) {
+        return;
+    }
+    SP_TraceChunk* chunk = buffer->tail;
+    size_t size = chunk->size;
+    if (size == SP_TRACE_CHUNK_EVENTS) {
+        SP_TraceChunk* next = calloc(1, sizeof *next);
+        if (!next) {
+            return;
+        }
+        __atomic_store_n(&chunk->next, next, __ATOMIC_RELEASE);
+        __atomic_store_n(&buffer->tail, next, __ATOMIC_RELEASE);
+        chunk = next;
+        size = 0;
+    }
+    chunk->events[size] = (SP_TraceEvent){
+        .name = name,
+        .pid = inChild ? child : getpid(),
+        .tid = inChild ? child : buffer->tid,
+        .child = child,
+        .ts = beginNs,
+        .dur = endNs > beginNs ? endNs - beginNs : 0,
+    };
+    // Publish the event to the exporter.
+    __atomic_store_n(&chunk->size, size + 1, __ATOMIC_RELEASE);
+}
+
+SP_TraceChild* sp_trace_child_create(void) {
+    SP_TraceChild* trace = mmap(NULL, sizeof *trace, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return trace == MAP_FAILED ? NULL : trace;
+}
+
+void sp_trace_child_finish(SP_TraceChild* trace, pid_t pid,
+                           uint64_t reapedNs) {
+    if (!trace) {
+        return;
+    }
+    static const struct {
+        const char* name;
+        SP_TraceMark begin;
+        SP_TraceMark end;
+    } phases[] = {
+        {"fork", SP_TRACE_FORK, SP_TRACE_CHILD_START},
+        {"child_opts", SP_TRACE_CHILD_START, SP_TRACE_REDIRECT_BEGIN},
+        {"redirect", SP_TRACE_REDIRECT_BEGIN, SP_TRACE_REDIRECT_END},
+        {"close_fds", SP_TRACE_CLOSE_BEGIN, SP_TRACE_CLOSE_END},
+    };
+    uint64_t* marks = trace->marks;
+    for (size_t i = 0; i < sizeof phases / sizeof *phases; i++) {
+        uint64_t begin = marks[phases[i].begin];
+        uint64_t end = marks[phases[i].end];
+        if (begin && end) {
+            sp_trace_event(phases[i].name, pid, true, begin, end);
+        }
+    }
+    if (marks[SP_TRACE_EXEC] && reapedNs) {
+        sp_trace_event("run", pid, true, marks[SP_TRACE_EXEC], reapedNs);
+    }
+    munmap(trace, sizeof *trace);
+}
+
+/**
+ * Write a single event as JSON.
+ *
+ * @param[in,out] file
+ * @param[in] event
+ * @param[in] first the event is the first of the array.
+ * @return 0 on success, -1 on error
+ */
+static int write_event(FILE* file, SP_TraceEvent* event, bool first) {
+    // Timestamps are in microseconds, keep the nanoseconds as decimals.
+    int n = fprintf(file,
+                    "%s\n{\"name\":\"%s\",\"cat\":\"subprocess\",\"ph\":\"X\","
+                    "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"child\":%d}}",
+                    first ? "" : ",", event->name,
+                    (unsigned long long)(event->ts / 1000),
+                    (unsigned)(event->ts % 1000),
+                    (unsigned long long)(event->dur / 1000),
+                    (unsigned)(event->dur % 1000), event->pid, event->tid,
+                    event->child);
+    return n < 0 ? -1 : 0;
+}
+
+int sp_trace_export(FILE* file) {
+    if (!file) {
+        errno = EINVAL;
+        return -1;
+    }
+    int err = fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file) < 0;
+    bool first = true;
+    pthread_mutex_lock(&buffersLock);
+    for (SP_TraceBuffer* buffer = buffers; buffer && !err;
+         buffer = buffer->next) {
+        for (SP_TraceChunk* chunk = buffer->head; chunk && !err;
+             chunk = __atomic_load_n(&chunk->next, __ATOMIC_ACQUIRE)) {
+            size_t size = __atomic_load_n(&chunk->size, __ATOMIC_ACQUIRE);
+            size_t i = chunk == buffer->head ? buffer->cleared : 0;
+            for (; i < size && !err; i++) {
+                err = write_event(file, &chunk->events[i], first);
+                first = false;
+            }
+        }
+    }
+    pthread_mutex_unlock(&buffersLock);
+    if (!err) {
+        err = fputs("\n]}\n", file) < 0;
+    }
+    return err ? -1 : 0;
+}
+
+size_t sp_trace_count(void) {
+    size_t count = 0;
+    pthread_mutex_lock(&buffersLock);
+    for (SP_TraceBuffer* buffer = buffers; buffer; buffer = buffer->next) {
+        for (SP_TraceChunk* chunk = buffer->head; chunk;
+             chunk = __atomic_load_n(&chunk->next, __ATOMIC_ACQUIRE)) {
+            count += __atomic_load_n(&chunk->size, __ATOMIC_ACQUIRE);
+            if (chunk == buffer->head) {
+                count -= buffer->cleared;
+            }
+        }
+    }
+    pthread_mutex_unlock(&buffersLock);
+    return count;
+}
+
+/**
+ * Free the chunks of a buffer from head up to, but excluding, last.
+ *
+ * @param[in,out] buffer
+ * @param[in] last a chunk reachable from the head of buffer.
+ */
+static void buffer_free_chunks(SP_TraceBuffer* buffer, SP_TraceChunk* last) {
+    while (buffer->head != last) {
+        SP_TraceChunk* next =
+            __atomic_load_n(&buffer->head->next, __ATOMIC_ACQUIRE);
+        free(buffer->head);
+        buffer->head = next;
+    }
+}
+
+void sp_trace_clear(void) {
+    pthread_mutex_lock(&buffersLock);
+    SP_TraceBuffer** link = &buffers;
+    while (*link) {
+        SP_TraceBuffer* buffer = *link;
+        if (buffer->orphaned) {
+            // Nobody appends to it, so it can go with its events.
+            *link = buffer->next;
+            buffer_free_chunks(buffer, NULL);
+            free(buffer);
+            continue;
+        }
+        // Only the chunk being appended to is still written by its thread, the
+        // events in it so far are skipped instead.
+        SP_TraceChunk* tail = __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE);
+        buffer_free_chunks(buffer, tail);
+        buffer->cleared = __atomic_load_n(&tail->size, __ATOMIC_ACQUIRE);
+        link = &buffer->next;
+    }
+    pthread_mutex_unlock(&buffersLock);
+}
@@ -0,0 +1,80 @@
+#include "util.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "subprocess/error.h"
+
+void sp_free_array(char** arr) {
+    if (!arr) {
+        return;
+    }
+    for (size_t i = 0; arr[i]; i++) {
+        free(arr[i]);
+    }
+    free(arr);
+}
+
+char** sp_dupe_array(char** arr) {
+    size_t n = 0;
+    while (arr[n]) {
+        n++;
+    }
+    char** dupeArr = calloc(n + 1, sizeof *dupeArr);
+    if (!dupeArr) {
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        dupeArr[i] = strdup(arr[i]);
+        if (!dupeArr[i]) {
+            sp_free_array(dupeArr);
+            return NULL;
+        }
+    }
+    return dupeArr;
+}
+
+uint64_t sp_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int sp_wait_readable(int fd) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    int err;
+    while ((err = poll(&pfd, 1, -1)) < 0 && errno == EINTR) {
+    }
+    return SP_NORMALIZE_ERROR(err >= 0);
+}
+
+int sp_wait_writable(int fd) {
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    int err;
+    while ((err = poll(&pfd, 1, -1)) < 0 && errno == EINTR) {
+    }
+    return SP_NORMALIZE_ERROR(err >= 0);
+}
+
+int sp_write_all(int fd, const void* buf, size_t size) {
+    const char* data = buf;
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN && !sp_wait_writable(fd)) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
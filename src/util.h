@@ -0,0 +1,75 @@
+/**
+ * @file
+ * @brief Internal helpers
+ *
+ * Small helpers shared by the modules of the library. Not installed, the header
+ * lives next to the sources.
+ */
+
+#ifndef SP_UTIL_H
+#define SP_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Free a NULL terminated array of strings.
+ *
+ * @param[in,out] arr can be NULL.
+ */
+void sp_free_array(char** arr);
+
+/**
+ * Dupe a NULL terminated array of strings.
+ *
+ * @param[in] arr
+ * @return a copy of arr to be freed with sp_free_array(), or NULL on error and errno
+ *         is set.
+ */
+char** sp_dupe_array(char** arr);
+
+/**
+ * Get the current time of the monotonic clock.
+ *
+ * @return nanoseconds
+ */
+uint64_t sp_now_ns(void);
+
+/**
+ * Block until fd is readable.
+ * Used when a non-blocking pipe is currently empty.
+ *
+ * @param[in] fd
+ * @return 0 on success, -1 on error and errno is set.
+ */
+int sp_wait_readable(int fd);
+
+/**
+ * Block until fd is writable.
+ * Used when a non-blocking pipe is currently full.
+ *
+ * @param[in] fd
+ * @return 0 on success, -1 on error and errno is set.
+ */
+int sp_wait_writable(int fd);
+
+/**
+ * Write all size bytes of buf to fd, retrying on EINTR, and waiting for the fd
+ * on EAGAIN if it is non-blocking.
+ *
+ * @param[in] fd
+ * @param[in] buf
+ * @param[in] size
+ * @return 0 on success, -1 on error and errno is set.
+ */
+int sp_write_all(int fd, const void* buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SP_UTIL_H
@@ -0,0 +1,257 @@
+#include "subprocess/cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util_test.h"
+
+static char dir[] = "/tmp/sp-cache-XXXXXX";
+static char counter[64];
+static SP_Cache* cache;
+
+static void setup(void) {
+    strcpy(dir, "/tmp/sp-cache-XXXXXX");
+    cr_assert(not(zero(ptr, mkdtemp(dir))));
+    snprintf(counter, sizeof counter, "%s.count", dir);
+    cache = sp_cache_create(dir, 0);
+    cr_assert(not(zero(ptr, cache)));
+}
+
+static void teardown(void) {
+    sp_cache_destroy(cache);
+    sp_destroy(sp_run(SP_ARGV("rm", "-rf", dir, counter), NULL));
+}
+
+TestSuite(cache, .timeout = 15, .init = setup, .fini = teardown);
+
+/**
+ * Counts its runs in the file $1, then echoes stdin and writes to stderr.
+ */
+static char* script = "echo >> \"$1\"; cat; echo err >&2; exit 3";
+
+/**
+ * Counts its runs in the file $1 and prints 100 bytes.
+ */
+static char* script100 = "printf %0100d 0; echo >> \"$1\"";
+
+/**
+ * @return the number of times script ran.
+ */
+static int runs(void) {
+    FILE* file = fopen(counter, "r");
+    int n = 0;
+    while (file && fgetc(file) != EOF) {
+        n++;
+    }
+    if (file) {
+        fclose(file);
+    }
+    return n;
+}
+
+static SP_Process* run(SP_Opts* opts, const SP_CacheKey* key) {
+    return sp_cache_run(cache, SP_ARGV("sh", "-c", script, "sh", counter),
+                        opts, key);
+}
+
+Test(cache, hit) {
+    for (int i = 0; i < 3; i++) {
+        SP_Process* proc = run(SP_OPTS(.spstdin = SP_REDIR_BYTES("in\n", 3),
+                                       .spstdout = SP_REDIR_PIPE(),
+                                       .spstderr = SP_REDIR_PIPE()),
+                               NULL);
+        cr_assert(not(zero(ptr, proc)));
+        cr_assert(eq(int, proc->status, SP_STATUS_DEAD));
+        cr_assert(eq(int, proc->exitCode, 3));
+        cr_assert(eq(int, sp_wait(proc), 3));
+        cr_assert(i ? zero(int, proc->pid) : gt(int, proc->pid, 0));
+        cr_assert(eq(str, proc->argv[0], "sh"));
+        assert_file_contents(proc->spstdout, "in\n");
+        assert_file_contents(proc->spstderr, "err\n");
+        sp_destroy(proc);
+    }
+    cr_assert(eq(int, runs(), 1));
+    SP_CacheStats stats;
+    sp_cache_stats(cache, &stats);
+    cr_assert(eq(u64, stats.hits, 2));
+    cr_assert(eq(u64, stats.misses, 1));
+    cr_assert(eq(u64, stats.stores, 1));
+    cr_assert(zero(u64, stats.bypassed));
+    cr_assert(gt(u64, stats.bytes, 0));
+}
+
+Test(cache, key) {
+    char input[64];
+    snprintf(input, sizeof input, "%s.input", dir);
+    FILE* file = fopen(input, "w");
+    fputs("a", file);
+    fclose(file);
+    SP_CacheKey key = {.env = SP_ARGV("KEYED"), .files = SP_ARGV(input)};
+    char* envs[][4] = {
+        {"PATH=/usr/bin:/bin", "KEYED=1", "OTHER=1", NULL},
+        {"PATH=/usr/bin:/bin", "KEYED=1", "OTHER=2", NULL},
+        {"PATH=/usr/bin:/bin", "KEYED=2", "OTHER=1", NULL},
+    };
+    for (int i = 0; i < 3; i++) {
+        SP_Process* proc = sp_cache_run(
+            cache, SP_ARGV("/bin/sh", "-c", script, "sh", counter),
+            SP_OPTS(.env = envs[i], .spstderr = SP_REDIR_DEVNULL(),
+                    .spstdout = SP_REDIR_DEVNULL()),
+            &key);
+        cr_assert(not(zero(ptr, proc)));
+        sp_destroy(proc);
+    }
+    // Only the keyed variable matters.
+    cr_assert(eq(int, runs(), 2));
+
+    file = fopen(input, "w");
+    fputs("b", file);
+    fclose(file);
+    sp_destroy(sp_cache_run(
+        cache, SP_ARGV("/bin/sh", "-c", script, "sh", counter),
+        SP_OPTS(.env = envs[0], .spstderr = SP_REDIR_DEVNULL(),
+                .spstdout = SP_REDIR_DEVNULL()),
+        &key));
+    cr_assert(eq(int, runs(), 3));
+    unlink(input);
+
+    // As does stdin.
+    sp_destroy(run(SP_OPTS(.spstdin = SP_REDIR_BYTES("a", 1),
+                           .spstdout = SP_REDIR_DEVNULL()),
+                   NULL));
+    sp_destroy(run(SP_OPTS(.spstdin = SP_REDIR_BYTES("b", 1),
+                           .spstdout = SP_REDIR_DEVNULL()),
+                   NULL));
+    cr_assert(eq(int, runs(), 5));
+}
+
+Test(cache, inherit) {
+    // Replayed to the caller's stdout, with stdin from /dev/null.
+    char path[64];
+    snprintf(path, sizeof path, "%s.out", dir);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int saved = dup(STDOUT_FILENO);
+    fflush(stdout);
+    dup2(fd, STDOUT_FILENO);
+    for (int i = 0; i < 2; i++) {
+        sp_destroy(run(SP_OPTS(.spstderr = SP_REDIR_DEVNULL()), NULL));
+    }
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    lseek(fd, 0, SEEK_SET);
+    FILE* file = fdopen(fd, "r");
+    assert_file_contents(file, "");
+    fclose(file);
+    unlink(path);
+
+    char* argv[] = {"sh", "-c", "echo out; echo >> \"$1\"", "sh", counter,
+                    NULL};
+    fflush(stdout);
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    saved = dup(STDOUT_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    for (int i = 0; i < 2; i++) {
+        sp_destroy(sp_cache_run(cache, argv, NULL, NULL));
+    }
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    lseek(fd, 0, SEEK_SET);
+    file = fdopen(fd, "r");
+    assert_file_contents(file, "out\nout\n");
+    fclose(file);
+    unlink(path);
+    cr_assert(eq(int, runs(), 2));
+}
+
+Test(cache, not_stored) {
+    for (int i = 0; i < 2; i++) {
+        SP_Process* proc = sp_cache_run(
+            cache,
+            SP_ARGV("sh", "-c", "echo >> \"$1\"; kill -9 $$", "sh", counter),
+            NULL, NULL);
+        cr_assert(eq(int, proc->exitCode, SP_SIGNAL_OFFSET + 9));
+        sp_destroy(proc);
+    }
+    cr_assert(eq(int, runs(), 2));
+    SP_CacheStats stats;
+    sp_cache_stats(cache, &stats);
+    cr_assert(eq(u64, stats.misses, 2));
+    cr_assert(zero(u64, stats.stores));
+}
+
+Test(cache, bypassed) {
+    for (int i = 0; i < 2; i++) {
+        sp_destroy(run(SP_OPTS(.spstdin = SP_REDIR_BYTES("", 0),
+                               .spstdout = SP_REDIR_FILE(stderr)),
+                       NULL));
+    }
+    cr_assert(eq(int, runs(), 2));
+    SP_CacheStats stats;
+    sp_cache_stats(cache, &stats);
+    cr_assert(eq(u64, stats.bypassed, 2));
+    cr_assert(zero(u64, stats.misses));
+
+    // A NULL path fails in the child, like sp_run().
+    SP_Process* proc = run(SP_OPTS(.spstdout = SP_REDIR_PATH(NULL),
+                                   .spstderr = SP_REDIR_DEVNULL()),
+                           NULL);
+    cr_assert(eq(int, proc->exitCode, SP_EXIT_NOT_EXECUTE));
+    sp_destroy(proc);
+    sp_cache_stats(cache, &stats);
+    cr_assert(eq(u64, stats.bypassed, 3));
+}
+
+Test(cache, eviction) {
+    sp_cache_destroy(cache);
+    // Room for about two results.
+    cache = sp_cache_create(dir, 300);
+    char arg[2] = "a";
+    for (int i = 0; i < 5; i++) {
+        arg[0] = 'a' + i;
+        sp_destroy(sp_cache_run(
+            cache, SP_ARGV("sh", "-c", script100, arg, counter),
+            SP_OPTS(.spstdout = SP_REDIR_PIPE()), NULL));
+    }
+    SP_CacheStats stats;
+    sp_cache_stats(cache, &stats);
+    cr_assert(eq(u64, stats.stores, 5));
+    cr_assert(ge(u64, stats.evictions, 3));
+    cr_assert(le(u64, stats.bytes, 300));
+    // The most recent result is kept.
+    sp_destroy(sp_cache_run(
+        cache, SP_ARGV("sh", "-c", script100, arg, counter),
+        SP_OPTS(.spstdout = SP_REDIR_PIPE()), NULL));
+    cr_assert(eq(int, runs(), 5));
+}
+
+Test(cache, persistent) {
+    sp_destroy(run(SP_OPTS(.spstdout = SP_REDIR_PIPE(),
+                           .spstderr = SP_REDIR_DEVNULL()),
+                   NULL));
+    sp_cache_destroy(cache);
+    cache = sp_cache_create(dir, 0);
+    SP_Process* proc = run(SP_OPTS(.spstdout = SP_REDIR_PIPE(),
+                                   .spstderr = SP_REDIR_DEVNULL()),
+                           NULL);
+    cr_assert(eq(int, proc->exitCode, 3));
+    cr_assert(eq(int, runs(), 1));
+    SP_CacheStats stats;
+    sp_cache_stats(cache, &stats);
+    cr_assert(eq(u64, stats.hits, 1));
+    cr_assert(gt(u64, stats.bytes, 0));
+    sp_destroy(proc);
+}
+
+Test(cache, errors) {
+    cr_assert(zero(ptr, sp_cache_create(NULL, 0)));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(zero(ptr, sp_cache_create("/dev/null/cache", 0)));
+    cr_assert(zero(ptr, sp_cache_run(NULL, SP_ARGV("true"), NULL, NULL)));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(zero(ptr, sp_cache_run(cache, SP_ARGV(NULL), NULL, NULL)));
+    cr_assert(eq(int, errno, EINVAL));
+}
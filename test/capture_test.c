@@ -0,0 +1,72 @@
+#include "subprocess/capture.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "subprocess/process.h"
+#include "util_test.h"
+
+static SP_Process* proc;
+static SP_Capture capture;
+
+static void teardown(void) {
+    sp_destroy(proc);
+    sp_capture_free(&capture);
+}
+
+TestSuite(capture, .timeout = 10, .fini = teardown);
+
+Test(capture, interleaved) {
+    SP_Opts opts = {
+        .spstdout = SP_REDIR_PIPE(),
+        .spstderr = SP_REDIR_PIPE(),
+    };
+    proc = sp_open(
+        SP_ARGV("sh", "-c",
+                "echo out1; sleep 0.05; echo err1 >&2; sleep 0.05; echo out2"),
+        &opts);
+    cr_assert(zero(int, sp_capture(proc, &capture)));
+    cr_assert(zero(int, sp_wait(proc)));
+
+    struct {
+        int stream;
+        char* data;
+    } expected[] = {
+        {SP_STDOUT_FILENO, "out1\n"},
+        {SP_STDERR_FILENO, "err1\n"},
+        {SP_STDOUT_FILENO, "out2\n"},
+    };
+    cr_assert(eq(sz, capture.count, SP_SIZE_FIXED_ARR(expected)));
+    cr_assert(eq(sz, capture.bytes[SP_STDOUT_FILENO], 10));
+    cr_assert(eq(sz, capture.bytes[SP_STDERR_FILENO], 5));
+
+    SP_CaptureRecord* record = NULL;
+    uint64_t last = 0;
+    for (size_t i = 0; i < SP_SIZE_FIXED_ARR(expected); i++) {
+        record = sp_capture_next(&capture, record);
+        cr_assert(not(zero(ptr, record)));
+        cr_assert(eq(int, record->stream, expected[i].stream));
+        cr_assert(eq(sz, record->size, strlen(expected[i].data)));
+        cr_assert(zero(memcmp(record->data, expected[i].data, record->size)));
+        cr_assert(ge(u64, record->timestamp, last));
+        last = record->timestamp;
+    }
+    cr_assert(zero(ptr, sp_capture_next(&capture, record)));
+}
+
+Test(capture, stdout_only) {
+    proc = sp_open(SP_ARGV("printf", "abc123"),
+                   SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    cr_assert(zero(int, sp_capture(proc, &capture)));
+    SP_CaptureRecord* record = sp_capture_next(&capture, NULL);
+    cr_assert(not(zero(ptr, record)));
+    cr_assert(eq(int, record->stream, SP_STDOUT_FILENO));
+    cr_assert(zero(memcmp(record->data, "abc123", record->size)));
+}
+
+Test(capture, no_pipes) {
+    proc = sp_open(SP_ARGV("true"), 0);
+    cr_assert(eq(int, sp_capture(proc, &capture), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(zero(ptr, sp_capture_next(&capture, NULL)));
+}
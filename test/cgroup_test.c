@@ -0,0 +1,231 @@
+#include "subprocess/cgroup.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util_test.h"
+
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+
+static SP_Process* proc;
+
+static void teardown(void) {
+    sp_destroy(proc);
+}
+
+TestSuite(limits, .timeout = 15, .fini = teardown);
+
+Test(limits, rlimits) {
+    proc = sp_run(SP_ARGV("sh", "-c", "ulimit -n; ulimit -c"),
+                  SP_OPTS(.spstdout = SP_REDIR_PIPE(),
+                          SP_RLIMITS({RLIMIT_NOFILE, 42, 64},
+                                     {RLIMIT_CORE, 0, 0})));
+    cr_assert(zero(int, proc->exitCode));
+    assert_file_contents(proc->spstdout, "42\n0\n");
+    cr_assert(zero(int, proc->limitHit));
+}
+
+Test(limits, cpu) {
+    // SIGXCPU at the soft limit, one second of CPU time.
+    proc = sp_run(SP_ARGV("sh", "-c", "while :; do :; done"),
+                  SP_OPTS(SP_RLIMITS({RLIMIT_CPU, 1, 5})));
+    cr_assert(eq(int, proc->exitCode, SIGXCPU + SP_SIGNAL_OFFSET));
+    cr_assert(eq(int, proc->limitHit, SP_LIMIT_HIT_CPU));
+}
+
+Test(limits, rlimit_errors) {
+    // A soft limit above the hard limit.
+    proc = sp_run(SP_ARGV("true"),
+                  SP_OPTS(.spstderr = SP_REDIR_DEVNULL(),
+                          SP_RLIMITS({RLIMIT_NOFILE, 2, 1})));
+    cr_assert(eq(int, proc->exitCode, SP_EXIT_NOT_EXECUTE));
+    sp_destroy(proc);
+    proc = sp_run(SP_ARGV("true"), SP_OPTS(.spstderr = SP_REDIR_DEVNULL(),
+                                           .rlimitsSize = 1));
+    cr_assert(eq(int, proc->exitCode, SP_EXIT_NOT_EXECUTE));
+}
+
+static int hang(void* arg) {
+    return pause();
+}
+
+static int allocate(void* arg) {
+    // Touch every page so the memory is charged to the cgroup.
+    for (size_t i = 0; i < 64; i++) {
+        char* block = malloc(8 << 20);
+        if (!block) {
+            return 1;
+        }
+        memset(block, 1, 8 << 20);
+    }
+    return 0;
+}
+
+static int spin(void* arg) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (now.tv_sec - start.tv_sec < 1);
+    return 0;
+}
+
+/**
+ * Create a cgroup to be the parent of the test's, or skip the test if cgroup v2
+ * is not writable.
+ */
+static void make_parent(char* parent, size_t size) {
+    const char* roots[] = {"/sys/fs/cgroup/unified", "/sys/fs/cgroup"};
+    for (size_t i = 0; i < SP_SIZE_FIXED_ARR(roots); i++) {
+        struct statfs fs;
+        if (statfs(roots[i], &fs) < 0 || fs.f_type != CGROUP2_SUPER_MAGIC) {
+            continue;
+        }
+        snprintf(parent, size, "%s/sp-test-%d", roots[i], getpid());
+        if (!mkdir(parent, 0755)) {
+            return;
+        }
+    }
+    cr_skip_test("cgroup v2 is not delegated to this user");
+}
+
+/**
+ * Enable a controller for the children of the parent, or skip the test.
+ */
+static void enable(const char* parent, const char* controller) {
+    char path[256];
+    snprintf(path, sizeof path, "%s/cgroup.subtree_control", parent);
+    FILE* file = fopen(path, "w");
+    bool enabled = file && fprintf(file, "+%s", controller) > 0;
+    if (file && fclose(file)) {
+        enabled = false;
+    }
+    if (!enabled) {
+        rmdir(parent);
+        cr_skip_test("the %s controller is not available", controller);
+    }
+}
+
+/**
+ * Wait for a process to show up in a cgroup.procs file.
+ *
+ * @return the first process in the file, or 0 after 5s.
+ */
+static int first_member(const char* path) {
+    int pid = 0;
+    for (int i = 0; i < 5000 && !pid; i++) {
+        FILE* procs = fopen(path, "r");
+        cr_assert(not(zero(ptr, procs)));
+        if (fscanf(procs, "%d", &pid) != 1) {
+            pid = 0;
+            usleep(1000);
+        }
+        fclose(procs);
+    }
+    return pid;
+}
+
+Test(limits, cgroup) {
+    char parent[128];
+    make_parent(parent, sizeof parent);
+    SP_CgroupOpts cgroup = {.parent = parent};
+    proc = sp_open(SP_ARGV("cat", "/proc/self/cgroup"),
+                   SP_OPTS(.spstdout = SP_REDIR_PIPE(), .cgroup = &cgroup));
+    cr_assert(not(zero(ptr, proc)));
+    char path[256];
+    snprintf(path, sizeof path, "%s", sp_cgroup_path(proc));
+    cr_assert(zero(strncmp(path, parent, strlen(parent))));
+    char line[256];
+    bool found = false;
+    while (fgets(line, sizeof line, proc->spstdout)) {
+        if (!strncmp(line, "0::", 3)) {
+            line[strcspn(line, "\n")] = '\0';
+            found = strlen(line) > 3 && strstr(path, line + 3);
+        }
+    }
+    cr_assert(found, "not in %s", path);
+    cr_assert(zero(int, sp_wait(proc)));
+    // Only removed by sp_destroy(), waiting doesn't block on it.
+    cr_assert(zero(int, access(path, F_OK)));
+    sp_destroy(proc);
+    cr_assert(eq(int, access(path, F_OK), -1));
+
+    // A function also runs in the cgroup, which it moves itself into.
+    proc = sp_fork_fn(hang, NULL, SP_OPTS(.cgroup = &cgroup));
+    cr_assert(not(zero(ptr, proc)));
+    snprintf(path, sizeof path, "%s/cgroup.procs", sp_cgroup_path(proc));
+    cr_assert(eq(int, first_member(path), proc->pid));
+    sp_destroy(proc);
+    proc = NULL;
+    cr_assert(eq(int, access(path, F_OK), -1));
+
+    // The limits can only be written where the controllers are enabled.
+    cgroup.memoryMax = 1 << 30;
+    SP_Process* limited = (sp_open)(SP_ARGV("true"), SP_OPTS(.cgroup = &cgroup));
+    if (limited) {
+        cr_assert(zero(int, sp_wait(limited)));
+        sp_destroy(limited);
+    } else {
+        cr_assert(eq(int, errno, ENOENT));
+    }
+    cr_assert(zero(int, rmdir(parent)));
+
+    cgroup.parent = "/nonexistent";
+    cr_assert(zero(ptr, (sp_open)(SP_ARGV("true"), SP_OPTS(.cgroup = &cgroup))));
+    cr_assert(eq(int, errno, ENOENT));
+}
+
+Test(limits, cgroup_descendants) {
+    char parent[128];
+    make_parent(parent, sizeof parent);
+    SP_CgroupOpts cgroup = {.parent = parent};
+    // The background sleep is left in the cgroup and killed to remove it.
+    proc = sp_run(SP_ARGV("sh", "-c", "sleep 100 &"),
+                  SP_OPTS(.cgroup = &cgroup));
+    cr_assert(zero(int, proc->exitCode));
+    char path[256];
+    snprintf(path, sizeof path, "%s", sp_cgroup_path(proc));
+    cr_assert(zero(int, access(path, F_OK)));
+    sp_destroy(proc);
+    proc = NULL;
+    cr_assert(eq(int, access(path, F_OK), -1));
+    cr_assert(zero(int, rmdir(parent)));
+}
+
+Test(limits, cgroup_memory) {
+    char parent[128];
+    make_parent(parent, sizeof parent);
+    enable(parent, "memory");
+    SP_CgroupOpts cgroup = {.parent = parent, .memoryMax = 32 << 20};
+    proc = sp_fork_fn(allocate, NULL, SP_OPTS(.cgroup = &cgroup));
+    cr_assert(not(zero(ptr, proc)));
+    sp_wait(proc);
+    cr_assert(eq(int, proc->exitCode, SIGKILL + SP_SIGNAL_OFFSET));
+    cr_assert(eq(int, proc->limitHit, SP_LIMIT_HIT_MEMORY));
+    sp_destroy(proc);
+    proc = NULL;
+    cr_assert(zero(int, rmdir(parent)));
+}
+
+Test(limits, cgroup_cpu) {
+    char parent[128];
+    make_parent(parent, sizeof parent);
+    enable(parent, "cpu");
+    SP_CgroupOpts cgroup = {.parent = parent, .cpuQuotaUs = 1000};
+    proc = sp_fork_fn(spin, NULL, SP_OPTS(.cgroup = &cgroup));
+    cr_assert(not(zero(ptr, proc)));
+    cr_assert(zero(int, sp_wait(proc)));
+    cr_assert(eq(int, proc->limitHit, SP_LIMIT_HIT_CPU_THROTTLED));
+    sp_destroy(proc);
+    proc = NULL;
+    cr_assert(zero(int, rmdir(parent)));
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "subprocess/channel.h"
+#include "subprocess/process.h"
+
+#define CHUNK (64 * 1024)
+#define CAPACITY (4 << 20)
+
+static char buf[CHUNK];
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int produce_channel(size_t total) {
+    SP_Channel ch;
+    if (sp_channel_attach(&ch, 3) < 0) {
+        perror("sp_channel_attach");
+        return 1;
+    }
+    for (size_t n = 0; n < total; n += CHUNK) {
+        if (sp_channel_write(&ch, buf, CHUNK) < 0) {
+            return 1;
+        }
+    }
+    sp_channel_close_write(&ch);
+    sp_channel_detach(&ch);
+    return 0;
+}
+
+static int produce_pipe(size_t total) {
+    for (size_t n = 0; n < total; n += CHUNK) {
+        if (write(STDOUT_FILENO, buf, CHUNK) != CHUNK) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void report(const char* name, size_t bytes, double seconds) {
+    printf("%-8s %8.2f GB/s  (%zu MiB in %.3f s)\n", name,
+           bytes / seconds / 1e9, bytes >> 20, seconds);
+}
+
+static size_t bench_channel(char* self, char* size) {
+    SP_Channel ch;
+    if (sp_channel_create(&ch, CAPACITY) < 0) {
+        perror("sp_channel_create");
+        exit(1);
+    }
+    SP_Process* p = sp_open(SP_ARGV(self, "--channel-child", size),
+                            SP_OPTS(SP_FD_MAP({ch.fd, 3})));
+    size_t total = 0;
+    ssize_t n;
+    while ((n = sp_channel_read(&ch, buf, CHUNK)) > 0) {
+        total += n;
+    }
+    sp_wait(p);
+    sp_destroy(p);
+    sp_channel_detach(&ch);
+    return total;
+}
+
+static size_t bench_pipe(char* self, char* size) {
+    SP_Process* p = sp_open(SP_ARGV(self, "--pipe-child", size),
+                            SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    int fd = fileno(p->spstdout);
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(fd, buf, CHUNK)) > 0) {
+        total += n;
+    }
+    sp_wait(p);
+    sp_destroy(p);
+    return total;
+}
+
+/**
+ * Compare the throughput of a channel with SP_REDIR_PIPE().
+ *
+ * Usage: channel-bench [MiB]
+ */
+int main(int argc, char* argv[]) {
+    if (argc == 3 && !strcmp(argv[1], "--channel-child")) {
+        return produce_channel((size_t)atoi(argv[2]) << 20);
+    }
+    if (argc == 3 && !strcmp(argv[1], "--pipe-child")) {
+        return produce_pipe((size_t)atoi(argv[2]) << 20);
+    }
+    char* size = argc > 1 ? argv[1] : "4096";
+    memset(buf, 'x', sizeof buf);
+
+    double start = now();
+    size_t bytes = bench_pipe(argv[0], size);
+    report("pipe", bytes, now() - start);
+
+    start = now();
+    bytes = bench_channel(argv[0], size);
+    report("channel", bytes, now() - start);
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include "subprocess/channel.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "subprocess/process.h"
+#include "util_test.h"
+
+#define TOTAL (1 << 20)
+
+static SP_Channel channel;
+
+static void setup(void) {
+    cr_assert(zero(int, sp_channel_create(&channel, 4096)));
+}
+
+static void teardown(void) { sp_channel_detach(&channel); }
+
+TestSuite(channel, .timeout = 15, .init = setup, .fini = teardown);
+
+Test(channel, layout) {
+    cr_assert(eq(u64, channel.shared->capacity, 4096));
+    cr_assert(eq(sz, channel.mapSize, SP_CHANNEL_DATA_OFFSET + 4096));
+    SP_Channel big;
+    cr_assert(zero(int, sp_channel_create(&big, 5000)));
+    cr_assert(eq(u64, big.shared->capacity, 8192));
+    sp_channel_detach(&big);
+}
+
+Test(channel, stream) {
+    // More than the capacity, so both sides have to wait on each other.
+    pid_t pid = fork();
+    cr_assert(ge(int, pid, 0));
+    if (pid == 0) {
+        SP_Channel child;
+        if (sp_channel_attach(&child, dup(channel.fd)) < 0) {
+            _exit(1);
+        }
+        unsigned char buf[1000];
+        for (size_t written = 0; written < TOTAL; written += sizeof buf) {
+            for (size_t i = 0; i < sizeof buf; i++) {
+                buf[i] = (written + i) % 251;
+            }
+            size_t n = TOTAL - written < sizeof buf ? TOTAL - written
+                                                    : sizeof buf;
+            if (sp_channel_write(&child, buf, n) != (ssize_t)n) {
+                _exit(2);
+            }
+        }
+        sp_channel_close_write(&child);
+        sp_channel_detach(&child);
+        _exit(0);
+    }
+    unsigned char buf[777];
+    size_t total = 0;
+    ssize_t n;
+    bool ok = true;
+    while ((n = sp_channel_read(&channel, buf, sizeof buf)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            ok &= buf[i] == (total + i) % 251;
+        }
+        total += n;
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    cr_assert(zero(int, WEXITSTATUS(status)));
+    cr_assert(eq(sz, total, TOTAL));
+    cr_assert(ok);
+}
+
+Test(channel, fd_map) {
+    SP_Process* proc = sp_open(
+        SP_ARGV("sh", "-c", "cat /proc/self/fdinfo/3 > /dev/null"),
+        SP_OPTS(SP_FD_MAP({channel.fd, 3})));
+    cr_assert(zero(int, sp_wait(proc)));
+    sp_destroy(proc);
+}
+
+Test(channel, reader_closed) {
+    char buf[4096] = {0};
+    sp_channel_close_read(&channel);
+    cr_assert(eq(sz, sp_channel_write(&channel, buf, 1), -1));
+    cr_assert(eq(int, errno, EPIPE));
+}
+
+Test(channel, writer_closed) {
+    sp_channel_write(&channel, "abc", 3);
+    sp_channel_close_write(&channel);
+    char buf[16];
+    cr_assert(eq(sz, sp_channel_read(&channel, buf, sizeof buf), 3));
+    cr_assert(zero(sz, sp_channel_read(&channel, buf, sizeof buf)));
+}
+
+Test(channel, writer_died) {
+    pid_t pid = fork();
+    cr_assert(ge(int, pid, 0));
+    if (pid == 0) {
+        SP_Channel child;
+        if (sp_channel_attach(&child, dup(channel.fd)) < 0) {
+            _exit(1);
+        }
+        sp_channel_write(&child, "abc", 3);
+        pause();
+        _exit(0);
+    }
+    char buf[16];
+    cr_assert(eq(sz, sp_channel_read(&channel, buf, sizeof buf), 3));
+    kill(pid, SIGKILL);
+    // Noticed before the child is waited on.
+    cr_assert(eq(sz, sp_channel_read(&channel, buf, sizeof buf), -1));
+    cr_assert(eq(int, errno, EPIPE));
+    waitpid(pid, NULL, 0);
+}
+
+Test(channel, reader_died) {
+    pid_t pid = fork();
+    cr_assert(ge(int, pid, 0));
+    if (pid == 0) {
+        SP_Channel child;
+        _exit(sp_channel_attach(&child, dup(channel.fd)) < 0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    cr_assert(zero(int, WEXITSTATUS(status)));
+    // More than the capacity, so the writer waits for the dead reader.
+    char buf[8192] = {0};
+    cr_assert(eq(sz, sp_channel_write(&channel, buf, sizeof buf), -1));
+    cr_assert(eq(int, errno, EPIPE));
+}
+
+Test(channel, attach_invalid) {
+    SP_Channel other;
+    FILE* file = tmpfile();
+    cr_assert(not(zero(ptr, file)));
+    char zeros[SP_CHANNEL_DATA_OFFSET + 4096] = {0};
+    fwrite(zeros, 1, sizeof zeros, file);
+    fflush(file);
+    cr_assert(eq(int, sp_channel_attach(&other, fileno(file)), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    fclose(file);
+}
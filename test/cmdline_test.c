@@ -0,0 +1,137 @@
+#include "subprocess/cmdline.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "subprocess/process.h"
+#include "util_test.h"
+
+static SP_Pipeline* pipeline;
+
+static void setup(void) { pipeline = NULL; }
+
+static void teardown(void) { sp_pipeline_destroy(pipeline); }
+
+TestSuite(cmdline, .timeout = 15, .init = setup, .fini = teardown);
+
+Test(cmdline, pipe_chain) {
+    pipeline = sp_run_cmdline("printf 'b\\na\\nb\\n' | sort | uniq -c | wc -l",
+                              SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    cr_assert(not(zero(ptr, pipeline)));
+    cr_assert(eq(sz, pipeline->size, 4));
+    for (size_t i = 0; i < pipeline->size; i++) {
+        cr_assert(zero(int, pipeline->procs[i]->exitCode));
+    }
+    assert_file_contents(pipeline->procs[3]->spstdout, "2\n");
+}
+
+Test(cmdline, redirect_path) {
+    unlink("test/txt.out");
+    pipeline = sp_run_cmdline("cat < test/txt.in | cat >test/txt.out", 0);
+    cr_assert(not(zero(ptr, pipeline)));
+    cr_assert(zero(int, sp_pipeline_wait(pipeline)));
+    diff_files("test/txt.in", "test/txt.out");
+}
+
+Test(cmdline, redirect_append) {
+    unlink("test/cmdline-append.out");
+    pipeline = sp_run_cmdline("echo 'Line 1' > test/cmdline-append.out", 0);
+    cr_assert(not(zero(ptr, pipeline)));
+    sp_pipeline_destroy(pipeline);
+    pipeline = sp_run_cmdline("echo Line\\ 2 1>> test/cmdline-append.out", 0);
+    cr_assert(not(zero(ptr, pipeline)));
+    diff_files("test/append.in", "test/cmdline-append.out");
+}
+
+Test(cmdline, redirect_stderr) {
+    pipeline = sp_run_cmdline("sh -c 'echo out; echo err >&2' 2>&1 | sort",
+                              SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    cr_assert(not(zero(ptr, pipeline)));
+    assert_file_contents(pipeline->procs[1]->spstdout, "err\nout\n");
+    sp_pipeline_destroy(pipeline);
+
+    pipeline =
+        sp_run_cmdline("echo hi >&2", SP_OPTS(.spstderr = SP_REDIR_PIPE()));
+    cr_assert(not(zero(ptr, pipeline)));
+    assert_file_contents(pipeline->procs[0]->spstderr, "hi\n");
+}
+
+Test(cmdline, redirect_order) {
+    // Only stderr goes through the pipe, stdout was moved after duplicating it.
+    pipeline = sp_run_cmdline(
+        "sh -c 'echo out; echo err >&2' 2>&1 >/dev/null | sed s/^/piped:/",
+        SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    cr_assert(not(zero(ptr, pipeline)));
+    assert_file_contents(pipeline->procs[1]->spstdout, "piped:err\n");
+    sp_pipeline_destroy(pipeline);
+
+    unlink("test/txt.out");
+    pipeline = sp_run_cmdline(
+        "sh -c 'echo out; echo err >&2' 2>&1 >test/txt.out | cat",
+        SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    cr_assert(not(zero(ptr, pipeline)));
+    assert_file_contents(pipeline->procs[1]->spstdout, "err\n");
+    FILE* out = fopen("test/txt.out", "r");
+    cr_assert(not(zero(ptr, out)));
+    assert_file_contents(out, "out\n");
+    fclose(out);
+    sp_pipeline_destroy(pipeline);
+
+    // Both go to the file, stderr duplicates stdout once it points there.
+    pipeline = sp_run_cmdline(
+        "sh -c 'echo out; echo err >&2' >test/txt.out 2>&1 | cat",
+        SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    cr_assert(not(zero(ptr, pipeline)));
+    assert_file_contents(pipeline->procs[1]->spstdout, "");
+    out = fopen("test/txt.out", "r");
+    assert_file_contents(out, "out\nerr\n");
+    fclose(out);
+    sp_pipeline_destroy(pipeline);
+
+    // stdout to the original stderr, which is then redirected.
+    pipeline = sp_run_cmdline("sh -c 'echo out' >&2 2>/dev/null",
+                              SP_OPTS(.spstderr = SP_REDIR_PIPE()));
+    cr_assert(zero(ptr, pipeline));
+    cr_assert(eq(int, errno, EINVAL));
+    pipeline = sp_run_cmdline("sh -c 'echo err >&2' >&2 2>/dev/null",
+                              SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    cr_assert(not(zero(ptr, pipeline)));
+    cr_assert(zero(int, pipeline->procs[0]->exitCode));
+    cr_assert(zero(ptr, pipeline->procs[0]->spstdout));
+    unlink("test/txt.out");
+}
+
+Test(cmdline, quoting) {
+    pipeline = sp_run_cmdline(
+        "printf '%s|' 'a b' \"c \\\"d\\\" $HOME\" e\\ f g'h'\"i\" ''",
+        SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    cr_assert(not(zero(ptr, pipeline)));
+    cr_assert(zero(int, sp_pipeline_wait(pipeline)));
+    assert_file_contents(pipeline->procs[0]->spstdout,
+                         "a b|c \"d\" $HOME|e f|ghi||");
+}
+
+Test(cmdline, exit_code) {
+    pipeline = sp_run_cmdline("true | false", 0);
+    cr_assert(not(zero(ptr, pipeline)));
+    cr_assert(eq(int, sp_pipeline_wait(pipeline), 1));
+    sp_pipeline_destroy(pipeline);
+    pipeline = sp_run_cmdline("false | true", 0);
+    cr_assert(not(zero(ptr, pipeline)));
+    cr_assert(zero(int, sp_pipeline_wait(pipeline)));
+}
+
+Test(cmdline, syntax_errors) {
+    char* invalid[] = {
+        "",          "   ",       "| cat",       "cat |",   "cat || cat",
+        "a ; b",     "a & b",     "a && b",      "(a)",     "echo `id`",
+        "echo 'abc", "echo \"ab", "echo \\",     "cat <",   "cat > | b",
+        "cat << EOF", "cat 3> f", "cat 2>&3",    "cat <&0", "a | | b",
+    };
+    for (size_t i = 0; i < SP_SIZE_FIXED_ARR(invalid); i++) {
+        errno = 0;
+        pipeline = sp_open_cmdline(invalid[i], 0);
+        cr_assert(zero(ptr, pipeline), "%s", invalid[i]);
+        cr_assert(eq(int, errno, EINVAL), "%s", invalid[i]);
+    }
+}
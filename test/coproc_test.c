@@ -0,0 +1,139 @@
+#include "subprocess/coproc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util_test.h"
+
+static SP_Coproc* co;
+static char* response;
+
+static void setup(void) {
+    co = NULL;
+    response = NULL;
+}
+
+static void teardown(void) {
+    sp_coproc_destroy(co);
+    free(response);
+}
+
+TestSuite(coproc, .timeout = 15, .init = setup, .fini = teardown);
+
+/**
+ * Echoes every line, taking 5 seconds for a line reading slow.
+ */
+static char* echoScript =
+    "while read -r x; do"
+    "  if [ \"$x\" = slow ]; then sleep 5; fi;"
+    "  echo \"$x\";"
+    "done";
+
+Test(coproc, call) {
+    co = sp_coproc_create(SP_ARGV("cat"), NULL, SP_FRAME_LINE);
+    cr_assert(not(zero(ptr, co)));
+    size_t size;
+    cr_assert(zero(int, sp_coproc_call(co, "hello", 5, -1, &response, &size)));
+    cr_assert(eq(sz, size, 5));
+    cr_assert(eq(str, response, "hello"));
+    cr_assert(zero(sz, sp_coproc_pending(co)));
+    cr_assert(zero(sz, sp_coproc_restarts(co)));
+}
+
+Test(coproc, pipelining) {
+    co = sp_coproc_create(SP_ARGV("cat"), NULL, SP_FRAME_LINE);
+    // Far more than a pipe holds, so sending must not block.
+    static char msg[65536];
+    memset(msg, 'x', sizeof msg);
+    for (int i = 0; i < 100; i++) {
+        msg[0] = 'a' + i % 26;
+        cr_assert(eq(sz, sp_coproc_send(co, msg, sizeof msg, -1), i));
+    }
+    cr_assert(eq(sz, sp_coproc_pending(co), 100));
+    for (size_t i = 0; i < 100; i++) {
+        size_t id;
+        size_t size;
+        cr_assert(zero(int, sp_coproc_recv(co, &id, &response, &size)));
+        cr_assert(eq(sz, id, i));
+        cr_assert(eq(sz, size, sizeof msg));
+        cr_assert(eq(int, response[0], 'a' + i % 26));
+        free(response);
+        response = NULL;
+    }
+    cr_assert(zero(sz, sp_coproc_pending(co)));
+}
+
+Test(coproc, length_framing) {
+    co = sp_coproc_create(SP_ARGV("cat"), NULL, SP_FRAME_LENGTH);
+    char msg[] = {'a', '\n', '\0', 'b'};
+    size_t size;
+    cr_assert(zero(
+        int, sp_coproc_call(co, msg, sizeof msg, -1, &response, &size)));
+    cr_assert(eq(sz, size, sizeof msg));
+    cr_assert(zero(memcmp(response, msg, sizeof msg)));
+    free(response);
+    cr_assert(zero(int, sp_coproc_call(co, "", 0, -1, &response, &size)));
+    cr_assert(zero(sz, size));
+}
+
+Test(coproc, restart) {
+    // Every child serves 2 requests.
+    co = sp_coproc_create(
+        SP_ARGV("sh", "-c", "for i in 1 2; do read -r x; echo \"$x\"; done"),
+        NULL, SP_FRAME_LINE);
+    char msg[2] = "0";
+    for (int i = 0; i < 5; i++) {
+        msg[0] = '0' + i;
+        sp_coproc_send(co, msg, 1, 5000);
+    }
+    for (int i = 0; i < 5; i++) {
+        size_t size;
+        cr_assert(zero(int, sp_coproc_recv(co, NULL, &response, &size)));
+        msg[0] = '0' + i;
+        cr_assert(eq(str, response, msg));
+        free(response);
+        response = NULL;
+    }
+    cr_assert(eq(sz, sp_coproc_restarts(co), 2));
+}
+
+Test(coproc, crash) {
+    co = sp_coproc_create(SP_ARGV("sh", "-c", "read -r x; exit 1"), NULL,
+                          SP_FRAME_LINE);
+    size_t size;
+    cr_assert(eq(int, sp_coproc_call(co, "x", 1, 5000, &response, &size), -1));
+    cr_assert(eq(int, errno, EPIPE));
+    cr_assert(eq(sz, sp_coproc_restarts(co), SP_COPROC_RETRIES));
+    cr_assert(zero(sz, sp_coproc_pending(co)));
+}
+
+Test(coproc, timeout) {
+    co = sp_coproc_create(SP_ARGV("sh", "-c", echoScript), NULL,
+                          SP_FRAME_LINE);
+    size_t id;
+    size_t size;
+    sp_coproc_send(co, "slow", 4, 100);
+    sp_coproc_send(co, "fast", 4, 5000);
+    cr_assert(eq(int, sp_coproc_recv(co, &id, &response, &size), -1));
+    cr_assert(eq(int, errno, ETIMEDOUT));
+    cr_assert(zero(sz, id));
+    // The next request is sent again to a new child.
+    cr_assert(zero(int, sp_coproc_recv(co, &id, &response, &size)));
+    cr_assert(eq(sz, id, 1));
+    cr_assert(eq(str, response, "fast"));
+    cr_assert(eq(sz, sp_coproc_restarts(co), 1));
+}
+
+Test(coproc, errors) {
+    cr_assert(zero(ptr, sp_coproc_create(NULL, NULL, SP_FRAME_LINE)));
+    cr_assert(eq(int, errno, EINVAL));
+    co = sp_coproc_create(SP_ARGV("cat"), NULL, SP_FRAME_LINE);
+    size_t size;
+    cr_assert(eq(int, sp_coproc_recv(co, NULL, &response, &size), -1));
+    cr_assert(eq(int, errno, ENOMSG));
+    cr_assert(eq(sz, sp_coproc_send(co, "a\nb", 3, -1), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(zero(sz, sp_coproc_send(co, "a", 1, -1)));
+    cr_assert(eq(int, sp_coproc_call(co, "b", 1, -1, &response, &size), -1));
+    cr_assert(eq(int, errno, EBUSY));
+}
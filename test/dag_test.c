@@ -0,0 +1,246 @@
+#include "subprocess/dag.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "subprocess/process.h"
+#include "util_test.h"
+
+#define N_NODES 16
+
+static SP_Dag* dag;
+static size_t order[N_NODES];
+static size_t nReported;
+static char logPath[64];
+
+static void setup(void) {
+    dag = NULL;
+    nReported = 0;
+    snprintf(logPath, sizeof logPath, "/tmp/sp-dag-%d.log", getpid());
+    unlink(logPath);
+}
+
+static void teardown(void) {
+    sp_dag_destroy(dag);
+    unlink(logPath);
+}
+
+static void on_done(const SP_DagResult* result, void* data) {
+    cr_assert(lt(sz, nReported, N_NODES));
+    order[nReported++] = result->id;
+}
+
+TestSuite(dag, .timeout = 15, .init = setup, .fini = teardown);
+
+/**
+ * Add a node appending name to the log.
+ */
+static ssize_t add(char* name, uint64_t cost) {
+    char cmd[128];
+    snprintf(cmd, sizeof cmd, "echo %s >> %s", name, logPath);
+    return sp_dag_add(dag, SP_ARGV("sh", "-c", cmd), NULL, cost);
+}
+
+Test(dag, dependencies) {
+    // c needs a and b, d needs c.
+    dag = sp_dag_create(4, SP_DAG_FAIL_FAST, on_done, NULL);
+    cr_assert(not(zero(ptr, dag)));
+    ssize_t d = add("d", 0);
+    ssize_t c = add("c", 0);
+    ssize_t a = add("a", 0);
+    ssize_t b = add("b", 0);
+    cr_assert(zero(int, sp_dag_depend(dag, c, a)));
+    cr_assert(zero(int, sp_dag_depend(dag, c, b)));
+    cr_assert(zero(int, sp_dag_depend(dag, d, c)));
+    cr_assert(zero(int, sp_dag_run(dag)));
+    cr_assert(eq(sz, nReported, 4));
+    cr_assert(eq(sz, order[2], c));
+    cr_assert(eq(sz, order[3], d));
+    const SP_DagResult* rc = sp_dag_result(dag, c);
+    for (ssize_t i = 0; i < 4; i++) {
+        const SP_DagResult* r = sp_dag_result(dag, i);
+        cr_assert(zero(int, r->exitCode));
+        cr_assert(zero(int, r->error));
+        cr_assert(zero(ptr, r->process));
+        cr_assert(le(u64, r->readyNs, r->startNs));
+        cr_assert(lt(u64, r->startNs, r->endNs));
+    }
+    cr_assert(ge(u64, rc->readyNs, sp_dag_result(dag, a)->endNs));
+    cr_assert(ge(u64, rc->readyNs, sp_dag_result(dag, b)->endNs));
+    cr_assert(lt(u64, sp_dag_result(dag, a)->readyNs, rc->readyNs));
+    FILE* file = fopen(logPath, "r");
+    char buf[16] = {0};
+    fread(buf, 1, sizeof buf - 1, file);
+    fclose(file);
+    cr_assert(zero(strcmp(buf + 4, "c\nd\n")));
+    cr_assert(zero(ptr, sp_dag_result(dag, 4)));
+}
+
+Test(dag, pipes) {
+    // printf "b\na\n" > in; cat in | sort | tr a-z A-Z > log
+    dag = sp_dag_create(1, SP_DAG_FAIL_FAST, NULL, NULL);
+    char input[80];
+    snprintf(input, sizeof input, "%s.in", logPath);
+    ssize_t gen = sp_dag_add(
+        dag, SP_ARGV("printf", "b\\na\\n"),
+        SP_OPTS(.spstdout = SP_REDIR_PATH(input)), 0);
+    ssize_t cat = sp_dag_add(dag, SP_ARGV("cat", input), NULL, 0);
+    ssize_t sort = sp_dag_add(dag, SP_ARGV("sort"), NULL, 0);
+    ssize_t tr = sp_dag_add(dag, SP_ARGV("tr", "a-z", "A-Z"),
+                            SP_OPTS(.spstdout = SP_REDIR_PATH(logPath)), 0);
+    cr_assert(zero(int, sp_dag_pipe(dag, sort, tr)));
+    cr_assert(zero(int, sp_dag_pipe(dag, cat, sort)));
+    cr_assert(zero(int, sp_dag_depend(dag, cat, gen)));
+    // Started together even though they exceed the limit.
+    cr_assert(zero(int, sp_dag_run(dag)));
+    FILE* file = fopen(logPath, "r");
+    assert_file_contents(file, "A\nB\n");
+    fclose(file);
+    unlink(input);
+    cr_assert(eq(u64, sp_dag_result(dag, cat)->readyNs,
+                 sp_dag_result(dag, tr)->readyNs));
+}
+
+Test(dag, pipe_closed_early) {
+    // yes | head -1, where yes is killed by SIGPIPE.
+    dag = sp_dag_create(2, SP_DAG_FAIL_FAST, NULL, NULL);
+    ssize_t yes = sp_dag_add(dag, SP_ARGV("yes"), NULL, 0);
+    ssize_t head = sp_dag_add(dag, SP_ARGV("head", "-1"),
+                              SP_OPTS(.spstdout = SP_REDIR_PATH(logPath)), 0);
+    ssize_t after = add("after", 0);
+    cr_assert(zero(int, sp_dag_pipe(dag, yes, head)));
+    // head may write after yes died, as it closes stdin before flushing stdout.
+    cr_assert(zero(int, sp_dag_depend(dag, after, yes)));
+    cr_assert(zero(int, sp_dag_depend(dag, after, head)));
+    cr_assert(zero(int, sp_dag_run(dag)));
+    cr_assert(eq(int, sp_dag_result(dag, yes)->exitCode,
+                 SIGPIPE + SP_SIGNAL_OFFSET));
+    cr_assert(zero(int, sp_dag_result(dag, after)->error));
+    FILE* file = fopen(logPath, "r");
+    assert_file_contents(file, "y\nafter\n");
+    fclose(file);
+
+    // The last node of the pipeline still fails it.
+    sp_dag_destroy(dag);
+    dag = sp_dag_create(2, SP_DAG_KEEP_GOING, NULL, NULL);
+    yes = sp_dag_add(dag, SP_ARGV("yes"), NULL, 0);
+    ssize_t fail = sp_dag_add(dag, SP_ARGV("false"), NULL, 0);
+    cr_assert(zero(int, sp_dag_pipe(dag, yes, fail)));
+    cr_assert(eq(int, sp_dag_run(dag), 1));
+}
+
+Test(dag, max_running) {
+    dag = sp_dag_create(2, SP_DAG_FAIL_FAST, NULL, NULL);
+    for (int i = 0; i < 6; i++) {
+        sp_dag_add(dag, SP_ARGV("sleep", "0.05"), NULL, 0);
+    }
+    cr_assert(zero(int, sp_dag_run(dag)));
+    for (size_t i = 0; i < 6; i++) {
+        uint64_t t = sp_dag_result(dag, i)->startNs;
+        int running = 0;
+        for (size_t j = 0; j < 6; j++) {
+            const SP_DagResult* r = sp_dag_result(dag, j);
+            running += r->startNs <= t && t < r->endNs;
+        }
+        cr_assert(le(int, running, 2));
+    }
+}
+
+Test(dag, critical_path) {
+    // x is added first, but y1 -> y2 is the longer path.
+    for (int flags = 0; flags < 2; flags++) {
+        dag = sp_dag_create(1, flags ? SP_DAG_CRITICAL_PATH : 0, on_done, NULL);
+        nReported = 0;
+        ssize_t x = add("x", 5);
+        ssize_t y1 = add("y1", 3);
+        ssize_t y2 = add("y2", 3);
+        sp_dag_depend(dag, y2, y1);
+        cr_assert(zero(int, sp_dag_run(dag)));
+        cr_assert(eq(sz, nReported, 3));
+        cr_assert(eq(sz, order[0], flags ? y1 : x));
+        sp_dag_destroy(dag);
+    }
+    dag = NULL;
+}
+
+Test(dag, fail_fast) {
+    dag = sp_dag_create(4, SP_DAG_FAIL_FAST, on_done, NULL);
+    ssize_t slow = sp_dag_add(dag, SP_ARGV("sleep", "5"), NULL, 0);
+    ssize_t fail = sp_dag_add(dag, SP_ARGV("sh", "-c", "sleep 0.05; exit 3"),
+                              NULL, 0);
+    ssize_t after = sp_dag_add(dag, SP_ARGV("true"), NULL, 0);
+    sp_dag_depend(dag, after, fail);
+    cr_assert(eq(int, sp_dag_run(dag), 3));
+    cr_assert(eq(sz, nReported, 3));
+    const SP_DagResult* r = sp_dag_result(dag, fail);
+    cr_assert(eq(int, r->exitCode, 3));
+    cr_assert(zero(int, r->error));
+    r = sp_dag_result(dag, slow);
+    cr_assert(eq(int, r->error, ECANCELED));
+    cr_assert(lt(u64, r->endNs, 4000000000));
+    r = sp_dag_result(dag, after);
+    cr_assert(eq(int, r->error, ECANCELED));
+    cr_assert(eq(int, r->exitCode, -1));
+    cr_assert(zero(u64, r->startNs));
+}
+
+Test(dag, keep_going) {
+    dag = sp_dag_create(4, SP_DAG_KEEP_GOING, on_done, NULL);
+    ssize_t fail = sp_dag_add(dag, SP_ARGV("false"), NULL, 0);
+    ssize_t ok = sp_dag_add(dag, SP_ARGV("sleep", "0.05"), NULL, 0);
+    ssize_t child = sp_dag_add(dag, SP_ARGV("true"), NULL, 0);
+    ssize_t grandchild = sp_dag_add(dag, SP_ARGV("true"), NULL, 0);
+    ssize_t other = sp_dag_add(dag, SP_ARGV("true"), NULL, 0);
+    sp_dag_depend(dag, child, fail);
+    sp_dag_depend(dag, grandchild, child);
+    sp_dag_depend(dag, other, ok);
+    cr_assert(eq(int, sp_dag_run(dag), 3));
+    cr_assert(eq(sz, nReported, 5));
+    cr_assert(eq(int, sp_dag_result(dag, fail)->exitCode, 1));
+    cr_assert(eq(int, sp_dag_result(dag, child)->error, ECANCELED));
+    cr_assert(eq(int, sp_dag_result(dag, grandchild)->error, ECANCELED));
+    cr_assert(zero(int, sp_dag_result(dag, ok)->exitCode));
+    cr_assert(zero(int, sp_dag_result(dag, other)->exitCode));
+    cr_assert(zero(int, sp_dag_result(dag, other)->error));
+}
+
+Test(dag, errors) {
+    cr_assert(zero(ptr, sp_dag_create(0, 0, NULL, NULL)));
+    cr_assert(eq(int, errno, EINVAL));
+    dag = sp_dag_create(2, 0, NULL, NULL);
+    cr_assert(eq(int, sp_dag_add(dag, SP_ARGV(NULL), NULL, 0), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    ssize_t a = sp_dag_add(dag, SP_ARGV("true"), NULL, 0);
+    ssize_t b = sp_dag_add(dag, SP_ARGV("true"), NULL, 0);
+    ssize_t c = sp_dag_add(dag, SP_ARGV("true"), NULL, 0);
+    cr_assert(eq(int, sp_dag_depend(dag, a, a), -1));
+    cr_assert(eq(int, sp_dag_depend(dag, a, 3), -1));
+    cr_assert(zero(int, sp_dag_pipe(dag, a, b)));
+    cr_assert(eq(int, sp_dag_pipe(dag, a, c), -1));
+    cr_assert(eq(int, sp_dag_pipe(dag, b, a), -1));
+    cr_assert(eq(int, errno, EINVAL));
+
+    // A node of a pipeline cannot wait on another one.
+    cr_assert(zero(int, sp_dag_depend(dag, b, a)));
+    cr_assert(eq(int, sp_dag_run(dag), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    sp_dag_destroy(dag);
+
+    dag = sp_dag_create(2, 0, NULL, NULL);
+    a = sp_dag_add(dag, SP_ARGV("true"), NULL, 0);
+    b = sp_dag_add(dag, SP_ARGV("true"), NULL, 0);
+    c = sp_dag_add(dag, SP_ARGV("true"), NULL, 0);
+    sp_dag_depend(dag, b, a);
+    sp_dag_depend(dag, c, b);
+    sp_dag_depend(dag, a, c);
+    cr_assert(eq(int, sp_dag_run(dag), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(eq(int, sp_dag_result(dag, a)->exitCode, -1));
+    sp_dag_destroy(dag);
+
+    dag = sp_dag_create(1, 0, NULL, NULL);
+    cr_assert(zero(int, sp_dag_run(dag)));
+}
@@ -0,0 +1,215 @@
+#include "subprocess/filter.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "subprocess/process.h"
+#include "util_test.h"
+
+static SP_Process* proc1;
+static SP_Process* proc2;
+static FILE* tmp;
+
+static void setup(void) {
+    proc1 = NULL;
+    proc2 = NULL;
+    tmp = NULL;
+}
+
+static void teardown(void) {
+    sp_destroy(proc1);
+    sp_destroy(proc2);
+    if (tmp) {
+        fclose(tmp);
+    }
+}
+
+TestSuite(filter, .timeout = 15, .init = setup, .fini = teardown);
+
+/**
+ * Emits the input one byte at a time, so the next filter sees every chunk boundary.
+ */
+static int split(SP_Filter* filter, const char* data, size_t size,
+                 SP_FilterOut* out) {
+    for (size_t i = 0; i < size; i++) {
+        if (sp_filter_emit(out, &data[i], 1) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Uppercases the input and counts the calls in arg.
+ */
+static int upper(SP_Filter* filter, const char* data, size_t size,
+                 SP_FilterOut* out) {
+    (*(int*)filter->arg)++;
+    char buf[size ? size : 1];
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = data[i] >= 'a' && data[i] <= 'z' ? data[i] - 'a' + 'A' : data[i];
+    }
+    return sp_filter_emit(out, buf, size);
+}
+
+static void assert_digest(unsigned char* digest, char* expected) {
+    char hex[SP_FILTER_SHA256_SIZE * 2 + 1];
+    for (int i = 0; i < SP_FILTER_SHA256_SIZE; i++) {
+        sprintf(&hex[i * 2], "%02x", digest[i]);
+    }
+    cr_assert(eq(str, hex, expected));
+}
+
+Test(filter, count) {
+    // seq 100000 | wc -l
+    proc1 = sp_open(SP_ARGV("seq", "100000"),
+                    SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    SP_Filter filter = SP_FILTER_COUNT();
+    ssize_t n = sp_filter(fileno(proc1->spstdout), &filter, 1, -1);
+    cr_assert(gt(int, n, 64 * 1024));
+    cr_assert(eq(u64, filter.lines, 100000));
+    cr_assert(eq(u64, filter.bytesIn, n));
+    cr_assert(eq(u64, filter.bytesOut, n));
+    cr_assert(zero(int, sp_wait(proc1)));
+}
+
+Test(filter, between_processes) {
+    // seq 1000 | grep -F 7 | head -n 5 | tr -d 7
+    proc1 = sp_open(SP_ARGV("seq", "1000"),
+                    SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    proc2 = sp_open(SP_ARGV("tr", "-d", "7"),
+                    SP_OPTS(.spstdin = SP_REDIR_PIPE(),
+                            .spstdout = SP_REDIR_PIPE()));
+    SP_Filter filters[] = {SP_FILTER_GREP("7"), SP_FILTER_HEAD_LINES(5)};
+    cr_assert(gt(int,
+                 sp_filter(fileno(proc1->spstdout), filters, 2,
+                           fileno(proc2->spstdin)),
+                 0));
+    sp_close(proc2);
+    assert_file_contents(proc2->spstdout, "\n1\n2\n3\n4\n");
+    cr_assert(zero(int, sp_wait(proc2)));
+    cr_assert(eq(u64, filters[0].lines, 5));
+    cr_assert(eq(u64, filters[1].bytesOut, strlen("7\n17\n27\n37\n47\n")));
+}
+
+Test(filter, grep) {
+    char* input = "ab\nxaby\n\nb\nbab\nxx\nlast ab";
+    tmp = tmpfile();
+    // Every chunk boundary must give the same lines.
+    SP_Filter filters[] = {SP_FILTER_FN(split, NULL), SP_FILTER_GREP("ab")};
+    cr_assert(zero(int, sp_filter_buf(input, strlen(input), filters, 2,
+                                      fileno(tmp))));
+    cr_assert(eq(u64, filters[1].lines, 4));
+    cr_assert(zero(int, sp_filter_buf(input, strlen(input), &filters[1], 1,
+                                      fileno(tmp))));
+    rewind(tmp);
+    assert_file_contents(tmp,
+                         "ab\nxaby\nbab\nlast ab"
+                         "ab\nxaby\nbab\nlast ab");
+
+    SP_Filter all = SP_FILTER_GREP("");
+    cr_assert(zero(int, sp_filter_buf(input, strlen(input), &all, 1, -1)));
+    cr_assert(eq(u64, all.lines, 7));
+    cr_assert(eq(u64, all.bytesOut, strlen(input)));
+}
+
+Test(filter, head) {
+    // yes | head -c 10, the writer gets SIGPIPE once the input is closed.
+    proc1 = sp_open(SP_ARGV("yes"), SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    tmp = tmpfile();
+    SP_Filter filter = SP_FILTER_HEAD(10);
+    cr_assert(gt(int, sp_filter(fileno(proc1->spstdout), &filter, 1,
+                                fileno(tmp)),
+                 0));
+    fclose(proc1->spstdout);
+    proc1->spstdout = NULL;
+    cr_assert(eq(int, sp_wait(proc1), SP_SIGNAL_OFFSET + SIGPIPE));
+    rewind(tmp);
+    assert_file_contents(tmp, "y\ny\ny\ny\ny\n");
+
+    SP_Filter lines[] = {SP_FILTER_HEAD_LINES(2), SP_FILTER_HEAD(3)};
+    cr_assert(zero(int, sp_filter_buf("a\nb\nc\n", 6, lines, 2, -1)));
+    cr_assert(eq(u64, lines[0].bytesOut, 4));
+    cr_assert(eq(u64, lines[1].bytesOut, 3));
+    SP_Filter none = SP_FILTER_HEAD(0);
+    cr_assert(zero(int, sp_filter_buf("a", 1, &none, 1, -1)));
+    cr_assert(zero(u64, none.bytesOut));
+}
+
+Test(filter, head_after_count) {
+    // seq 100000 | tee >(wc -l) | head -n 1, the count still sees every line.
+    proc1 = sp_open(SP_ARGV("seq", "100000"),
+                    SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    SP_Filter filters[] = {SP_FILTER_COUNT(), SP_FILTER_HEAD_LINES(1)};
+    ssize_t n = sp_filter(fileno(proc1->spstdout), filters, 2, -1);
+    cr_assert(gt(int, n, 64 * 1024));
+    cr_assert(eq(u64, filters[0].lines, 100000));
+    cr_assert(eq(u64, filters[1].bytesOut, 2));
+    cr_assert(zero(int, sp_wait(proc1)));
+}
+
+Test(filter, sha256) {
+    SP_Filter filter = SP_FILTER_SHA256();
+    cr_assert(zero(int, sp_filter_buf(NULL, 0, &filter, 1, -1)));
+    assert_digest(
+        filter.digest,
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    cr_assert(zero(int, sp_filter_buf("abc", 3, &filter, 1, -1)));
+    assert_digest(
+        filter.digest,
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    char* two = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    cr_assert(zero(int, sp_filter_buf(two, strlen(two), &filter, 1, -1)));
+    assert_digest(
+        filter.digest,
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    // Compared with sha256sum over several chunks of odd sizes.
+    proc1 = sp_open(SP_ARGV("seq", "200000"),
+                    SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    proc2 = sp_open(SP_ARGV("sh", "-c", "sha256sum | cut -c 1-64"),
+                    SP_OPTS(.spstdin = SP_REDIR_PIPE(),
+                            .spstdout = SP_REDIR_PIPE()));
+    SP_Filter filters[] = {SP_FILTER_COUNT(), SP_FILTER_SHA256()};
+    cr_assert(gt(int, sp_filter(fileno(proc1->spstdout), filters, 2,
+                                fileno(proc2->spstdin)),
+                 0));
+    sp_close(proc2);
+    char expected[80] = {0};
+    cr_assert(gt(int, fread(expected, 1, sizeof expected - 1, proc2->spstdout),
+                 0));
+    expected[64] = '\0';
+    assert_digest(filters[1].digest, expected);
+    cr_assert(eq(u64, filters[0].lines, 200000));
+}
+
+Test(filter, function) {
+    int calls = 0;
+    SP_Filter filters[] = {SP_FILTER_FN(upper, &calls), SP_FILTER_COUNT()};
+    tmp = tmpfile();
+    cr_assert(zero(int, sp_filter_buf("ab\ncd\n", 6, filters, 2, fileno(tmp))));
+    // Once for the input and once at the end.
+    cr_assert(eq(int, calls, 2));
+    cr_assert(eq(u64, filters[1].lines, 2));
+    rewind(tmp);
+    assert_file_contents(tmp, "AB\nCD\n");
+}
+
+Test(filter, invalid) {
+    SP_Filter filter = SP_FILTER_COUNT();
+    cr_assert(eq(int, sp_filter(-1, &filter, 1, -1), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(eq(int, sp_filter(STDIN_FILENO, NULL, 0, -1), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    filter = SP_FILTER_GREP("a\nb");
+    cr_assert(eq(int, sp_filter_buf("a", 1, &filter, 1, -1), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    filter = SP_FILTER_FN(NULL, NULL);
+    cr_assert(eq(int, sp_filter_buf("a", 1, &filter, 1, -1), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(eq(int, sp_filter_emit(NULL, "a", 1), -1));
+    cr_assert(eq(int, errno, EINVAL));
+}
@@ -0,0 +1,171 @@
+#include "subprocess/jobqueue.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "subprocess/process.h"
+#include "util_test.h"
+
+#define N_JOBS 32
+
+static SP_JobQueue* queue;
+static SP_JobResult results[N_JOBS];
+static size_t nResults;
+static size_t maxRunning;
+
+static void setup(void) {
+    queue = NULL;
+    nResults = 0;
+    maxRunning = 0;
+}
+
+static void teardown(void) { sp_jobqueue_destroy(queue); }
+
+static void on_done(const SP_JobResult* result, void* data) {
+    cr_assert(lt(sz, nResults, N_JOBS));
+    results[nResults++] = *result;
+    if (data) {
+        SP_JobQueueStats stats;
+        sp_jobqueue_stats(*(SP_JobQueue**)data, &stats);
+        if (stats.running > maxRunning) {
+            maxRunning = stats.running;
+        }
+    }
+}
+
+TestSuite(jobqueue, .timeout = 15, .init = setup, .fini = teardown);
+
+Test(jobqueue, bounded) {
+    queue = sp_jobqueue_create(4, on_done, NULL);
+    cr_assert(not(zero(ptr, queue)));
+    for (int i = 0; i < N_JOBS; i++) {
+        char code[8];
+        snprintf(code, sizeof code, "%d", i % 3);
+        cr_assert(eq(i64, sp_jobqueue_push(
+                              queue, SP_ARGV("sh", "-c", "exit $0", code), 0),
+                     i));
+    }
+    cr_assert(zero(int, sp_jobqueue_wait(queue)));
+    cr_assert(eq(sz, nResults, N_JOBS));
+    bool seen[N_JOBS] = {false};
+    for (size_t i = 0; i < nResults; i++) {
+        cr_assert(lt(sz, results[i].id, N_JOBS));
+        cr_assert(not(seen[results[i].id]));
+        seen[results[i].id] = true;
+        cr_assert(eq(int, results[i].exitCode, results[i].id % 3));
+        cr_assert(zero(int, results[i].error));
+    }
+    SP_JobQueueStats stats;
+    sp_jobqueue_stats(queue, &stats);
+    cr_assert(eq(sz, stats.pushed, N_JOBS));
+    cr_assert(zero(sz, stats.queued));
+    cr_assert(zero(sz, stats.running));
+    cr_assert(eq(sz, stats.succeeded, (N_JOBS + 2) / 3));
+    cr_assert(eq(sz, stats.failed, N_JOBS - (N_JOBS + 2) / 3));
+    cr_assert(gt(u64, stats.elapsedNs, 0));
+    cr_assert(stats.jobsPerSec > 0);
+}
+
+Test(jobqueue, max_running) {
+    // The callback samples the number of running jobs through the queue.
+    queue = sp_jobqueue_create(3, on_done, &queue);
+    for (int i = 0; i < 12; i++) {
+        sp_jobqueue_push(queue, SP_ARGV("sleep", "0.05"), 0);
+    }
+    int reported = sp_jobqueue_poll(queue, 5000);
+    cr_assert(gt(int, reported, 0));
+    SP_JobQueueStats stats;
+    sp_jobqueue_stats(queue, &stats);
+    cr_assert(le(sz, stats.running, 3));
+    cr_assert(zero(int, sp_jobqueue_wait(queue)));
+    cr_assert(eq(sz, nResults, 12));
+    cr_assert(le(sz, maxRunning, 3));
+    cr_assert(ge(sz, maxRunning, 1));
+    // 12 jobs of 50ms with 3 slots take at least 4 rounds.
+    sp_jobqueue_stats(queue, &stats);
+    cr_assert(ge(u64, stats.elapsedNs, 200000000));
+}
+
+Test(jobqueue, timeout) {
+    queue = sp_jobqueue_create(1, on_done, NULL);
+    sp_jobqueue_push(queue, SP_ARGV("sleep", "5"), 0);
+    cr_assert(zero(int, sp_jobqueue_poll(queue, 50)));
+    cr_assert(zero(sz, nResults));
+    cr_assert(zero(int, sp_jobqueue_poll(queue, 0)));
+}
+
+Test(jobqueue, cancel) {
+    queue = sp_jobqueue_create(1, on_done, NULL);
+    ssize_t running = sp_jobqueue_push(queue, SP_ARGV("sleep", "5"), 0);
+    ssize_t queued = sp_jobqueue_push(queue, SP_ARGV("true"), 0);
+    cr_assert(zero(int, sp_jobqueue_poll(queue, 0)));
+
+    cr_assert(zero(int, sp_jobqueue_cancel(queue, queued)));
+    cr_assert(eq(sz, nResults, 1));
+    cr_assert(eq(sz, results[0].id, queued));
+    cr_assert(eq(int, results[0].error, ECANCELED));
+    cr_assert(zero(ptr, results[0].process));
+
+    cr_assert(zero(int, sp_jobqueue_cancel(queue, running)));
+    cr_assert(zero(int, sp_jobqueue_wait(queue)));
+    cr_assert(eq(sz, nResults, 2));
+    cr_assert(eq(sz, results[1].id, running));
+    cr_assert(eq(int, results[1].error, ECANCELED));
+    cr_assert(eq(int, results[1].exitCode, SP_SIGNAL_OFFSET + SIGKILL));
+
+    cr_assert(eq(int, sp_jobqueue_cancel(queue, running), -1));
+    cr_assert(eq(int, errno, ENOENT));
+    SP_JobQueueStats stats;
+    sp_jobqueue_stats(queue, &stats);
+    cr_assert(eq(sz, stats.cancelled, 2));
+}
+
+Test(jobqueue, reaped_elsewhere) {
+    queue = sp_jobqueue_create(1, on_done, NULL);
+    sp_jobqueue_push(queue, SP_ARGV("sleep", "0.2"), 0);
+    cr_assert(zero(int, sp_jobqueue_poll(queue, 0)));
+    // The job is the newest sleep among the children of the test.
+    char parent[16];
+    snprintf(parent, sizeof parent, "%d", getpid());
+    SP_Process* pgrep = sp_run(SP_ARGV("pgrep", "-n", "-x", "-P", parent, "sleep"),
+                               SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    int pid = 0;
+    cr_assert(eq(int, fscanf(pgrep->spstdout, "%d", &pid), 1));
+    sp_destroy(pgrep);
+    cr_assert(eq(int, waitpid(pid, NULL, 0), pid));
+    // The job can't be waited on anymore, it must still finish.
+    cr_assert(zero(int, sp_jobqueue_wait(queue)));
+    cr_assert(eq(sz, nResults, 1));
+    cr_assert(eq(int, results[0].error, ECHILD));
+    cr_assert(eq(int, results[0].exitCode, -1));
+    SP_JobQueueStats stats;
+    sp_jobqueue_stats(queue, &stats);
+    cr_assert(eq(sz, stats.failed, 1));
+    cr_assert(zero(sz, stats.spawnErrors));
+}
+
+Test(jobqueue, destroy_cancels) {
+    queue = sp_jobqueue_create(2, on_done, NULL);
+    for (int i = 0; i < 5; i++) {
+        sp_jobqueue_push(queue, SP_ARGV("sleep", "5"), 0);
+    }
+    sp_jobqueue_poll(queue, 0);
+    sp_jobqueue_destroy(queue);
+    queue = NULL;
+    cr_assert(eq(sz, nResults, 5));
+    for (size_t i = 0; i < nResults; i++) {
+        cr_assert(eq(int, results[i].error, ECANCELED));
+    }
+}
+
+Test(jobqueue, invalid) {
+    cr_assert(zero(ptr, sp_jobqueue_create(0, NULL, NULL)));
+    cr_assert(eq(int, errno, EINVAL));
+    queue = sp_jobqueue_create(1, NULL, NULL);
+    cr_assert(eq(i64, sp_jobqueue_push(queue, SP_ARGV(NULL), 0), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(zero(int, sp_jobqueue_poll(queue, -1)));
+}
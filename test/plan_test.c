@@ -0,0 +1,126 @@
+#include "subprocess/plan.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util_test.h"
+
+static SP_Plan plan;
+static SP_Process* proc;
+static char* oldPath;
+
+static void setup(void) {
+    memset(&plan, 0, sizeof plan);
+    proc = NULL;
+    char* path = getenv("PATH");
+    oldPath = path ? strdup(path) : NULL;
+}
+
+static void teardown(void) {
+    sp_plan_free(&plan);
+    sp_destroy(proc);
+    if (oldPath) {
+        setenv("PATH", oldPath, 1);
+        free(oldPath);
+    }
+}
+
+TestSuite(plan, .timeout = 10, .init = setup, .fini = teardown);
+
+Test(plan, ops) {
+    SP_FdMap map[] = {{.parentFd = 0, .childFd = 5}};
+    SP_Opts opts = {
+        .cwd = "/",
+        .spstdout = SP_REDIR_DEVNULL(),
+        .spstderr = SP_REDIR_STDOUT(),
+        .fdMap = map,
+        .fdMapSize = 1,
+    };
+    cr_assert(zero(int, sp_plan_compile(&plan, SP_ARGV("ls"), &opts, 1)));
+    SP_PlanOpType expected[] = {
+        SP_OP_CHDIR, SP_OP_MOVE,  SP_OP_MARK,  SP_OP_OPEN,
+        SP_OP_DUP2,  SP_OP_PLACE, SP_OP_MARK,  SP_OP_MARK,
+        SP_OP_CLOSE_RANGE,        SP_OP_CLOSE_RANGE,
+        SP_OP_MARK,
+    };
+    cr_assert(eq(sz, plan.size, SP_SIZE_FIXED_ARR(expected)));
+    for (size_t i = 0; i < plan.size; i++) {
+        cr_expect(eq(int, plan.ops[i].type, expected[i]), "op %zu", i);
+    }
+    // Everything but the target of the fd map is closed.
+    cr_assert(eq(int, plan.ops[8].fd, 3));
+    cr_assert(eq(int, plan.ops[8].target, 4));
+    cr_assert(eq(int, plan.ops[9].fd, 6));
+    cr_assert(eq(int, plan.ops[9].target, -1));
+}
+
+Test(plan, invalid_redirect) {
+    SP_Opts opts = {.spstdin = SP_REDIR_STDOUT()};
+    cr_assert(zero(int, sp_plan_compile(&plan, SP_ARGV("ls"), &opts, 1)));
+    bool failed = false;
+    for (size_t i = 0; i < plan.size; i++) {
+        failed |= plan.ops[i].type == SP_OP_FAIL;
+    }
+    cr_assert(failed);
+}
+
+Test(plan, candidates) {
+    setenv("PATH", "/nope::/usr/bin", 1);
+    cr_assert(zero(int, sp_plan_compile(&plan, SP_ARGV("ls"), NULL, 1)));
+    cr_assert(zero(sz, plan.size));
+    cr_assert(eq(str, plan.candidates[0], "/nope/ls"));
+    cr_assert(eq(str, plan.candidates[1], "ls"));
+    cr_assert(eq(str, plan.candidates[2], "/usr/bin/ls"));
+    cr_assert(zero(ptr, plan.candidates[3]));
+    sp_plan_free(&plan);
+
+    cr_assert(zero(int, sp_plan_compile(&plan, SP_ARGV("./ls"), NULL, 1)));
+    cr_assert(eq(str, plan.candidates[0], "./ls"));
+    cr_assert(zero(ptr, plan.candidates[1]));
+}
+
+Test(plan, skips_not_executable) {
+    // A file that can't be executed earlier in PATH is skipped.
+    char dir[] = "/tmp/sp-plan-XXXXXX";
+    cr_assert(not(zero(ptr, mkdtemp(dir))));
+    char file[64];
+    snprintf(file, sizeof file, "%s/true", dir);
+    FILE* f = fopen(file, "w");
+    fclose(f);
+    char path[128];
+    snprintf(path, sizeof path, "%s:/bin:/usr/bin", dir);
+    setenv("PATH", path, 1);
+    proc = sp_run(SP_ARGV("true"), SP_OPTS(.spstderr = SP_REDIR_DEVNULL()));
+    unlink(file);
+    rmdir(dir);
+    cr_assert(zero(int, proc->exitCode));
+}
+
+Test(plan, shell_script) {
+    // Scripts without a shebang are run by /bin/sh, like with execvp(3).
+    char file[] = "/tmp/sp-plan-XXXXXX";
+    int fd = mkstemp(file);
+    cr_assert(ge(int, fd, 0));
+    cr_assert(eq(sz, write(fd, "echo \"$0 $1\"\n", 13), 13));
+    fchmod(fd, 0700);
+    close(fd);
+    proc = sp_run(SP_ARGV(file, "arg"), SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    char buf[BUF_SIZE];
+    cr_assert(not(zero(ptr, fgets(buf, sizeof buf, proc->spstdout))));
+    unlink(file);
+    char expected[BUF_SIZE];
+    snprintf(expected, sizeof expected, "%s arg\n", file);
+    cr_assert(eq(str, buf, expected));
+}
+
+Test(plan, error_message) {
+    proc = sp_run(SP_ARGV("ls"), SP_OPTS(.spstdin = SP_REDIR_PATH("NOPE"),
+                                         .spstderr = SP_REDIR_PIPE(),
+                                         .redirOrder = {2, 1, 0}));
+    cr_assert(eq(int, proc->exitCode, SP_EXIT_NOT_EXECUTE));
+    assert_file_contents(
+        proc->spstderr,
+        "SP: redirect: PATH: NOPE: No such file or directory\n");
+}
@@ -0,0 +1,139 @@
+#include "subprocess/pool.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "util_test.h"
+
+static SP_Pool* pool;
+
+static void setup(void) {
+    pool = NULL;
+}
+
+static void teardown(void) {
+    sp_pool_destroy(pool);
+}
+
+TestSuite(pool, .timeout = 15, .init = setup, .fini = teardown);
+
+Test(pool, open) {
+    pool = sp_pool_create(SP_OPTS(.spstdout = SP_REDIR_PIPE()), 2);
+    cr_assert(not(zero(ptr, pool)));
+    cr_assert(zero(int, sp_pool_fill(pool)));
+    SP_PoolStats stats;
+    sp_pool_stats(pool, &stats);
+    cr_assert(eq(sz, stats.warm, 2));
+    for (int i = 0; i < 5; i++) {
+        SP_Process* proc = sp_pool_open(pool, SP_ARGV("echo", "hi"), NULL);
+        cr_assert(not(zero(ptr, proc)));
+        cr_assert(eq(str, proc->argv[1], "hi"));
+        assert_file_contents(proc->spstdout, "hi\n");
+        cr_assert(zero(int, sp_wait(proc)));
+        sp_destroy(proc);
+    }
+    cr_assert(zero(int, sp_pool_fill(pool)));
+    sp_pool_stats(pool, &stats);
+    cr_assert(eq(sz, stats.warm, 2));
+    cr_assert(eq(u64, stats.hits + stats.misses, 5));
+    cr_assert(ge(u64, stats.hits, 1));
+}
+
+Test(pool, options) {
+    // The options are applied before the program is known.
+    int fd[2];
+    cr_assert(zero(int, pipe(fd)));
+    pool = sp_pool_create(
+        SP_OPTS(.cwd = "/", .spstdout = SP_REDIR_PIPE(),
+                .spstderr = SP_REDIR_STDOUT(), SP_FD_MAP({fd[1], 3})),
+        1);
+    cr_assert(zero(int, sp_pool_fill(pool)));
+    close(fd[1]);
+    SP_Process* proc = sp_pool_open(
+        pool,
+        SP_ARGV("sh", "-c",
+                "pwd; echo err >&2; echo map >&3; ls /proc/self/fd"),
+        NULL);
+    cr_assert(not(zero(ptr, proc)));
+    // Only the standard streams, fd 3 and the fd of ls itself are open.
+    assert_file_contents(proc->spstdout, "/\nerr\n0\n1\n2\n3\n4\n");
+    cr_assert(zero(int, sp_wait(proc)));
+    sp_destroy(proc);
+    sp_pool_destroy(pool);
+    pool = NULL;
+    FILE* file = fdopen(fd[0], "r");
+    assert_file_contents(file, "map\n");
+    fclose(file);
+}
+
+Test(pool, env) {
+    pool = sp_pool_create(SP_OPTS(.spstdout = SP_REDIR_PIPE()), 1);
+    cr_assert(zero(int, sp_pool_fill(pool)));
+    // The environment is the caller's at the time of the call.
+    setenv("SP_POOL_TEST", "now", 1);
+    SP_Process* proc =
+        sp_pool_open(pool, SP_ARGV("sh", "-c", "echo $SP_POOL_TEST"), NULL);
+    assert_file_contents(proc->spstdout, "now\n");
+    sp_destroy(proc);
+    unsetenv("SP_POOL_TEST");
+
+    proc = sp_pool_open(pool, SP_ARGV("/bin/sh", "-c", "echo $X"),
+                        SP_ARGV("X=y"));
+    assert_file_contents(proc->spstdout, "y\n");
+    sp_destroy(proc);
+}
+
+Test(pool, not_found) {
+    pool = sp_pool_create(SP_OPTS(.spstderr = SP_REDIR_DEVNULL()), 1);
+    SP_Process* proc =
+        sp_pool_open(pool, SP_ARGV("/nonexistent/program"), NULL);
+    cr_assert(not(zero(ptr, proc)));
+    cr_assert(eq(int, sp_wait(proc), SP_EXIT_NOT_FOUND));
+    sp_destroy(proc);
+}
+
+Test(pool, dead_child) {
+    pool = sp_pool_create(SP_OPTS(.spstdout = SP_REDIR_PIPE()), 1);
+    cr_assert(zero(int, sp_pool_fill(pool)));
+    SP_Process* proc = sp_pool_open(pool, SP_ARGV("echo", "1"), NULL);
+    sp_destroy(proc);
+    cr_assert(zero(int, sp_pool_fill(pool)));
+    // The waiting child is the oldest child of the test.
+    char parent[16];
+    snprintf(parent, sizeof parent, "%d", getpid());
+    proc = sp_run(SP_ARGV("pgrep", "-o", "-P", parent),
+                  SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    int pid = 0;
+    cr_assert(eq(int, fscanf(proc->spstdout, "%d", &pid), 1));
+    sp_destroy(proc);
+    cr_assert(zero(int, kill(pid, SIGKILL)));
+    // Left for the pool to reap, so it is known dead before it is used.
+    siginfo_t info;
+    cr_assert(zero(int, waitid(P_PID, pid, &info, WEXITED | WNOWAIT)));
+    proc = sp_pool_open(pool, SP_ARGV("echo", "2"), NULL);
+    cr_assert(not(zero(ptr, proc)));
+    assert_file_contents(proc->spstdout, "2\n");
+    sp_destroy(proc);
+}
+
+Test(pool, errors) {
+    cr_assert(zero(ptr, sp_pool_create(SP_OPTS(.notify = SP_NOTIFY_FD), 1)));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(zero(ptr, sp_pool_create(SP_OPTS(.deathSignal = SIGKILL), 1)));
+    cr_assert(eq(int, errno, EINVAL));
+    pool = sp_pool_create(NULL, 0);
+    cr_assert(not(zero(ptr, pool)));
+    cr_assert(zero(int, sp_pool_fill(pool)));
+    cr_assert(zero(ptr, sp_pool_open(pool, SP_ARGV(NULL), NULL)));
+    cr_assert(eq(int, errno, EINVAL));
+    // An empty pool forks on demand.
+    SP_Process* proc = sp_pool_open(pool, SP_ARGV("true"), NULL);
+    cr_assert(zero(int, sp_wait(proc)));
+    sp_destroy(proc);
+    SP_PoolStats stats;
+    sp_pool_stats(pool, &stats);
+    cr_assert(eq(u64, stats.misses, 1));
+}
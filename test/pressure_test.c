@@ -0,0 +1,172 @@
+#include "subprocess/pressure.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "subprocess/jobqueue.h"
+#include "subprocess/stats.h"
+#include "util_test.h"
+
+static char dir[] = "/tmp/sp-pressure-XXXXXX";
+static SP_Pressure* pressure;
+
+static void setup(void) {
+    strcpy(dir, "/tmp/sp-pressure-XXXXXX");
+    cr_assert(not(zero(ptr, mkdtemp(dir))));
+    pressure = NULL;
+}
+
+static void teardown(void) {
+    sp_pressure_destroy(pressure);
+    sp_destroy(sp_run(SP_ARGV("rm", "-rf", dir), NULL));
+}
+
+TestSuite(pressure, .timeout = 15, .init = setup, .fini = teardown);
+
+/**
+ * Simulate a pressure file, with the format of the kernel.
+ */
+static void simulate(char* name, double avg10, uint64_t total) {
+    char path[64];
+    snprintf(path, sizeof path, "%s/%s", dir, name);
+    FILE* file = fopen(path, "w");
+    cr_assert(not(zero(ptr, file)));
+    fprintf(file,
+            "some avg10=%.2f avg60=0.00 avg300=0.00 total=%llu\n"
+            "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n",
+            avg10, (unsigned long long)total);
+    fclose(file);
+}
+
+static uint64_t live(void) {
+    SP_Stats stats;
+    sp_stats_get(&stats);
+    return stats.live;
+}
+
+Test(pressure, adapt) {
+    pressure = sp_pressure_create(&(SP_PressureOpts){
+        .dir = dir, .target = 10, .minLimit = 1, .maxLimit = 4});
+    cr_assert(not(zero(ptr, pressure)));
+    simulate("cpu", 0, 1000);
+    simulate("io", 1, 1000);
+    SP_PressureSample sample;
+    // Low pressure, the limit grows by one per sample.
+    for (int i = 0; i < 6; i++) {
+        cr_assert(zero(int, sp_pressure_update(pressure, &sample)));
+    }
+    cr_assert(eq(sz, sample.limit, 4));
+    cr_assert(eq(sz, sp_pressure_limit(pressure), 4));
+    cr_assert(sample.stall[SP_PRESSURE_CPU] == 0);
+    cr_assert(sample.stall[SP_PRESSURE_MEMORY] < 0);
+    cr_assert(eq(u64, sample.live, live()));
+
+    // Stalling for 1000s since the previous sample, the limit is halved per sample.
+    simulate("io", 1, 1000 + 1000000000ULL);
+    cr_assert(zero(int, sp_pressure_update(pressure, &sample)));
+    cr_assert(sample.stall[SP_PRESSURE_IO] > 100);
+    cr_assert(eq(sz, sample.limit, 2));
+    simulate("io", 1, 1000 + 2000000000ULL);
+    sp_pressure_update(pressure, &sample);
+    simulate("io", 1, 1000 + 3000000000ULL);
+    sp_pressure_update(pressure, &sample);
+    cr_assert(eq(sz, sample.limit, 1));
+
+    // The stall time did not grow, so the pressure is low again.
+    sp_pressure_update(pressure, &sample);
+    cr_assert(eq(sz, sample.limit, 2));
+}
+
+Test(pressure, first_sample) {
+    // Without a previous sample, avg10 is used, and between target / 2 and target
+    // the limit holds.
+    pressure = sp_pressure_create(&(SP_PressureOpts){
+        .dir = dir, .target = 10, .maxLimit = 1000});
+    simulate("memory", 7, 5);
+    SP_PressureSample sample;
+    cr_assert(zero(int, sp_pressure_update(pressure, &sample)));
+    cr_assert(sample.stall[SP_PRESSURE_MEMORY] == 7);
+    cr_assert(sample.stall[SP_PRESSURE_CPU] < 0);
+    // The limit starts at the number of CPUs.
+    cr_assert(eq(sz, sample.limit, sysconf(_SC_NPROCESSORS_ONLN)));
+
+    // Nothing to read keeps the limit as it is.
+    sp_pressure_destroy(pressure);
+    pressure = sp_pressure_create(&(SP_PressureOpts){
+        .dir = "/nonexistent", .minLimit = 2, .maxLimit = 5});
+    cr_assert(zero(int, sp_pressure_update(pressure, &sample)));
+    cr_assert(sample.stall[SP_PRESSURE_IO] < 0);
+    cr_assert(eq(sz, sample.limit, 2));
+}
+
+Test(pressure, open) {
+    // Room for exactly one more child.
+    size_t limit = live() + 1;
+    pressure = sp_pressure_create(&(SP_PressureOpts){
+        .dir = dir, .minLimit = limit, .maxLimit = limit});
+    cr_assert(sp_pressure_admit(pressure));
+    SP_Process* proc =
+        sp_pressure_open(pressure, SP_ARGV("sleep", "10"), NULL, -1);
+    cr_assert(not(zero(ptr, proc)));
+    cr_assert(not(sp_pressure_admit(pressure)));
+    cr_assert(zero(ptr, sp_pressure_open(pressure, SP_ARGV("true"), NULL, 50)));
+    cr_assert(eq(int, errno, ETIMEDOUT));
+    sp_kill(proc);
+    sp_wait(proc);
+    sp_destroy(proc);
+    proc = sp_pressure_open(pressure, SP_ARGV("true"), NULL, 0);
+    cr_assert(not(zero(ptr, proc)));
+    cr_assert(zero(int, sp_wait(proc)));
+    sp_destroy(proc);
+}
+
+static SP_JobQueue* queue;
+static size_t maxRunning;
+
+static void on_done(const SP_JobResult* result, void* data) {
+    SP_JobQueueStats stats;
+    sp_jobqueue_stats(queue, &stats);
+    if (stats.running > maxRunning) {
+        maxRunning = stats.running;
+    }
+}
+
+Test(pressure, jobqueue) {
+    // Under high pressure, the queue runs one job at a time.
+    pressure = sp_pressure_create(
+        &(SP_PressureOpts){.dir = dir, .minLimit = 1, .maxLimit = 1});
+    simulate("cpu", 90, 0);
+    maxRunning = 0;
+    queue = sp_jobqueue_create(4, on_done, NULL);
+    cr_assert(zero(int, sp_jobqueue_set_pressure(queue, pressure)));
+    for (int i = 0; i < 6; i++) {
+        sp_jobqueue_push(queue, SP_ARGV("sleep", "0.02"), NULL);
+    }
+    cr_assert(zero(int, sp_jobqueue_wait(queue)));
+    SP_JobQueueStats stats;
+    sp_jobqueue_stats(queue, &stats);
+    cr_assert(eq(sz, stats.succeeded, 6));
+    cr_assert(eq(sz, maxRunning, 1));
+    sp_jobqueue_destroy(queue);
+}
+
+Test(pressure, errors) {
+    cr_assert(zero(ptr, sp_pressure_create(&(SP_PressureOpts){.target = -1})));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(zero(ptr, sp_pressure_create(
+                            &(SP_PressureOpts){.minLimit = 3, .maxLimit = 2})));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(eq(int, sp_pressure_update(NULL, NULL), -1));
+    cr_assert(zero(sz, sp_pressure_limit(NULL)));
+    cr_assert(zero(ptr, sp_pressure_open(NULL, SP_ARGV("true"), NULL, 0)));
+    cr_assert(eq(int, sp_jobqueue_set_pressure(NULL, NULL), -1));
+
+    // The system files, where the kernel has them.
+    pressure = sp_pressure_create(NULL);
+    cr_assert(not(zero(ptr, pressure)));
+    cr_assert(zero(int, sp_pressure_update(pressure, NULL)));
+    cr_assert(ge(sz, sp_pressure_limit(pressure), 1));
+}
@@ -0,0 +1,137 @@
+#include "subprocess/process.hpp"
+
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+
+#include <csignal>
+#include <string>
+#include <vector>
+
+TestSuite(cpp, .timeout = 10);
+
+Test(cpp, move_only) {
+    sp::Process proc = sp::Process::open({"sleep", "10"});
+    pid_t pid = proc.pid();
+    sp::Process moved = std::move(proc);
+    cr_assert(not(proc));
+    cr_assert(eq(int, moved.pid(), pid));
+    cr_assert(eq(int, moved.kill(), 0));
+    cr_assert(eq(int, moved.wait(), SIGKILL + SP_SIGNAL_OFFSET));
+}
+
+Test(cpp, opts) {
+    sp::Opts opts = sp::Opts().cwd("/").out(sp::Redir::pipe()).err(
+        sp::Redir::devnull());
+    sp::Process proc = sp::Process::run({"pwd"}, opts);
+    cr_assert(eq(int, proc.exitCode(), 0));
+    char buf[16] = {0};
+    cr_assert(not(zero(ptr, fgets(buf, sizeof buf, proc.out()))));
+    cr_assert(eq(str, buf, "/\n"));
+
+    proc = sp::Process::run(
+        {"cat"}, sp::Opts().in(sp::Redir::bytes("abc123")).out(
+                     sp::Redir::pipe()));
+    cr_assert(not(zero(ptr, fgets(buf, sizeof buf, proc.out()))));
+    cr_assert(eq(str, buf, "abc123"));
+}
+
+Test(cpp, socket) {
+    sp::Process proc = sp::Process::run(
+        {"sh", "-c", "echo hi >&0"},
+        sp::Opts().in(sp::Redir::socket(SOCK_SEQPACKET)));
+    char buf[16] = {0};
+    cr_assert(eq(int, read(proc.socket(SP_STDIN_FILENO), buf, sizeof buf), 3));
+    cr_assert(eq(str, buf, "hi\n"));
+}
+
+Test(cpp, rlimit) {
+    sp::Process proc = sp::Process::run(
+        {"sh", "-c", "ulimit -n"},
+        sp::Opts().rlimit(RLIMIT_NOFILE, 42, 42).out(sp::Redir::pipe()));
+    char buf[16] = {0};
+    cr_assert(not(zero(ptr, fgets(buf, sizeof buf, proc.out()))));
+    cr_assert(eq(str, buf, "42\n"));
+    cr_assert(zero(int, proc.limitHit()));
+}
+
+Test(cpp, ready) {
+    sp::Process proc = sp::Process::open(
+        {"sh", "-c", "echo READY=1 >&$SP_NOTIFY_FD; exec sleep 10"},
+        sp::Opts().notify());
+    cr_assert(eq(int, proc.waitReady(5000), 0));
+    cr_assert(eq(int, proc.poll(), -1));
+}
+
+Test(cpp, open_fails) {
+    bool thrown = false;
+    try {
+        sp::Process::open({});
+    } catch (const std::system_error& e) {
+        thrown = true;
+        cr_assert(eq(int, e.code().value(), EINVAL));
+    }
+    cr_assert(thrown);
+}
+
+static sp::Task<std::string> read_all(sp::EventLoop& loop,
+                                      sp::Process& proc) {
+    std::string out;
+    char buf[4];
+    while (size_t n = co_await proc.read(loop, buf, sizeof buf)) {
+        out.append(buf, n);
+    }
+    co_return out;
+}
+
+static sp::Task<int> echo(sp::EventLoop& loop, std::string* out) {
+    sp::Process proc = sp::Process::open(
+        {"sh", "-c", "printf abc; sleep 0.1; printf 123"},
+        sp::Opts().out(sp::Redir::pipe()));
+    *out = co_await read_all(loop, proc);
+    co_return co_await proc.exited(loop);
+}
+
+Test(cpp, coroutines) {
+    sp::EventLoop loop;
+    std::string out;
+    cr_assert(eq(int, loop.run(echo(loop, &out)), 0));
+    cr_assert(eq(str, out.c_str(), "abc123"));
+}
+
+static sp::Task<> sleeper(sp::EventLoop& loop, int* done) {
+    sp::Process proc = sp::Process::open({"sleep", "0.2"});
+    int exitCode = co_await proc.exited(loop);
+    if (!exitCode) {
+        (*done)++;
+    }
+}
+
+Test(cpp, concurrent) {
+    // All children are awaited concurrently from a single thread.
+    sp::EventLoop loop;
+    int done = 0;
+    for (int i = 0; i < 100; i++) {
+        loop.spawn(sleeper(loop, &done));
+    }
+    loop.run();
+    cr_assert(eq(int, done, 100));
+}
+
+static sp::Task<size_t> read_once(sp::EventLoop& loop, sp::Process& proc,
+                                  char* buf, size_t size) {
+    co_return co_await proc.read(loop, buf, size);
+}
+
+Test(cpp, read_then_file) {
+    const sp::Opts opts = sp::Opts().out(sp::Redir::pipe());
+    sp::Process proc = sp::Process::open(
+        {"sh", "-c", "echo abc; sleep 0.1; echo def"}, opts);
+    sp::EventLoop loop;
+    char buf[16] = {0};
+    cr_assert(eq(sz, loop.run(read_once(loop, proc, buf, 4)), 4));
+    cr_assert(eq(str, buf, "abc\n"));
+    // The pipe is left blocking for the FILE*.
+    cr_assert(not(zero(ptr, fgets(buf, sizeof buf, proc.out()))));
+    cr_assert(eq(str, buf, "def\n"));
+    cr_assert(zero(int, proc.wait()));
+}
@@ -1,6 +1,14 @@
 #include "subprocess/process.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "subprocess/redirect.h"
@@ -150,3 +158,243 @@ Test(proc, inheritFds) {
               "File was closed in parent");
     sp_destroy(proc2);
 }
+
+TestSuite(group, .timeout = 10, .fini = teardown);
+
+Test(group, newGroup) {
+    proc = sp_open(SP_ARGV("sleep", "10"), SP_OPTS(.newGroup = true));
+    cr_assert(eq(int, proc->pgid, proc->pid));
+    cr_assert(eq(int, getpgid(proc->pid), proc->pid));
+    cr_assert(not(proc->signalGroup));
+}
+
+Test(group, signalGroup) {
+    cr_assert(zero(int, sp_subreaper(true)));
+    proc = sp_open(SP_ARGV("sh", "-c", "sleep 10 & echo $!; wait"),
+                   SP_OPTS(.signalGroup = true, .spstdout = SP_REDIR_PIPE()));
+    cr_assert(eq(int, getpgid(proc->pid), proc->pid));
+    char buf[32];
+    cr_assert(not(zero(ptr, fgets(buf, sizeof buf, proc->spstdout))));
+    pid_t grandchild = atoi(buf);
+    cr_assert(eq(int, getpgid(grandchild), proc->pid));
+    sp_destroy(proc);
+    proc = NULL;
+    // Killed and reaped along with the rest of the group.
+    cr_assert(eq(int, kill(grandchild, 0), -1));
+    cr_assert(eq(int, errno, ESRCH));
+}
+
+Test(group, leaderExited) {
+    cr_assert(zero(int, sp_subreaper(true)));
+    proc = sp_run(SP_ARGV("sh", "-c", "sleep 10 & echo $!"),
+                  SP_OPTS(.signalGroup = true, .spstdout = SP_REDIR_PIPE()));
+    cr_assert(zero(int, proc->exitCode));
+    char buf[32];
+    cr_assert(not(zero(ptr, fgets(buf, sizeof buf, proc->spstdout))));
+    pid_t grandchild = atoi(buf);
+    // The group outlives its leader.
+    cr_assert(zero(int, sp_signal(proc, 0)));
+    sp_destroy(proc);
+    proc = NULL;
+    cr_assert(eq(int, kill(grandchild, 0), -1));
+    cr_assert(eq(int, errno, ESRCH));
+}
+
+Test(group, notPinned) {
+    cr_assert(zero(int, sp_subreaper(false)));
+    proc = sp_run(SP_ARGV("sh", "-c", "sleep 10 & echo $!"),
+                  SP_OPTS(.signalGroup = true, .spstdout = SP_REDIR_PIPE()));
+    cr_assert(zero(int, proc->exitCode));
+    char buf[32];
+    cr_assert(not(zero(ptr, fgets(buf, sizeof buf, proc->spstdout))));
+    pid_t grandchild = atoi(buf);
+    // The orphan isn't our child, so nothing keeps the group id from being reused.
+    cr_assert(eq(int, sp_signal(proc, SIGKILL), -1));
+    cr_assert(zero(int, kill(grandchild, 0)));
+    kill(grandchild, SIGKILL);
+}
+
+Test(group, deathSignal) {
+    cr_assert(zero(int, sp_subreaper(true)));
+    int fd[2];
+    cr_assert(zero(int, pipe(fd)));
+    pid_t parent = fork();
+    if (!parent) {
+        SP_Process* p = sp_open(SP_ARGV("sleep", "10"),
+                                SP_OPTS(.deathSignal = SIGKILL));
+        write(fd[1], &p->pid, sizeof p->pid);
+        // Wait for the child to set the death signal.
+        usleep(100000);
+        _exit(0);
+    }
+    pid_t child;
+    cr_assert(eq(int, read(fd[0], &child, sizeof child), sizeof child));
+    waitpid(parent, NULL, 0);
+    int stat;
+    cr_assert(eq(int, waitpid(child, &stat, 0), child));
+    cr_assert(WIFSIGNALED(stat));
+    cr_assert(eq(int, WTERMSIG(stat), SIGKILL));
+}
+
+TestSuite(fdMap, .timeout = 10, .fini = teardown);
+
+Test(fdMap, extraFds) {
+    int fd[2];
+    cr_assert(zero(int, pipe(fd)));
+    proc = sp_run(SP_ARGV("sh", "-c", "echo mapped >&5; exec 3<&-"),
+                  SP_OPTS(SP_FD_MAP({fd[1], 5}, {fd[1], 3})));
+    close(fd[1]);
+    cr_assert(zero(int, proc->exitCode));
+    FILE* file = fdopen(fd[0], "r");
+    assert_file_contents(file, "mapped\n");
+    fclose(file);
+}
+
+Test(fdMap, swap) {
+    // Each parentFd is also the childFd of the other entry.
+    int a[2];
+    int b[2];
+    cr_assert(zero(int, pipe(a)));
+    cr_assert(zero(int, pipe(b)));
+    cr_assert(eq(int, dup2(a[1], 7), 7));
+    cr_assert(eq(int, dup2(b[1], 8), 8));
+    close(a[1]);
+    close(b[1]);
+    proc = sp_run(SP_ARGV("sh", "-c", "echo A >&8; echo B >&7"),
+                  SP_OPTS(SP_FD_MAP({7, 8}, {8, 7}),
+                          .spstdout = SP_REDIR_FD(7)));
+    close(7);
+    close(8);
+    cr_assert(zero(int, proc->exitCode));
+    char buf[BUF_SIZE] = {0};
+    cr_assert(eq(int, read(a[0], buf, sizeof buf), 2));
+    cr_assert(eq(str, buf, "A\n"));
+    cr_assert(eq(int, read(b[0], buf, sizeof buf), 2));
+    cr_assert(eq(str, buf, "B\n"));
+    close(a[0]);
+    close(b[0]);
+}
+
+Test(fdMap, closesOthers) {
+    int fd[2];
+    cr_assert(zero(int, pipe(fd)));
+    cr_assert(eq(int, dup2(fd[1], 6), 6));
+    proc = sp_run(SP_ARGV("sh", "-c", "echo fail >&6"),
+                  SP_OPTS(SP_FD_MAP({fd[1], 4}),
+                          .spstderr = SP_REDIR_DEVNULL()));
+    close(6);
+    close(fd[0]);
+    close(fd[1]);
+    cr_assert(not(zero(int, proc->exitCode)));
+}
+
+Test(fdMap, invalid) {
+    cr_assert(zero(ptr, (sp_open)(SP_ARGV("true"),
+                                  SP_OPTS(SP_FD_MAP({0, STDERR_FILENO})))));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(zero(ptr, (sp_open)(SP_ARGV("true"),
+                                  SP_OPTS(SP_FD_MAP({0, 3}, {1, 3})))));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(zero(ptr, (sp_open)(SP_ARGV("true"),
+                                  SP_OPTS(SP_FD_MAP({-1, 3})))));
+    cr_assert(eq(int, errno, EINVAL));
+}
+
+/**
+ * Count the fds open in this process.
+ */
+static int count_fds(void) {
+    DIR* dir = opendir("/proc/self/fd");
+    cr_assert(not(zero(ptr, dir)));
+    int n = 0;
+    while (readdir(dir)) {
+        n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+TestSuite(leaks, .timeout = 10, .fini = teardown);
+
+Test(leaks, bytes) {
+    int before = count_fds();
+    proc = sp_run(SP_ARGV("cat"), SP_OPTS(.spstdin = SP_REDIR_BYTES("a", 1),
+                                          .spstdout = SP_REDIR_DEVNULL()));
+    cr_assert(zero(int, proc->exitCode));
+    cr_assert(eq(int, count_fds(), before));
+}
+
+Test(leaks, failed_pipes) {
+    int before = count_fds();
+    struct rlimit old;
+    getrlimit(RLIMIT_NOFILE, &old);
+    // Room for the stdin pipe, but not for the stdout pipe.
+    int a = dup(0);
+    int b = dup(0);
+    close(a);
+    close(b);
+    struct rlimit lim = {.rlim_cur = b + 1, .rlim_max = old.rlim_max};
+    setrlimit(RLIMIT_NOFILE, &lim);
+    SP_Process* p = (sp_open)(SP_ARGV("cat"),
+                              SP_OPTS(.spstdin = SP_REDIR_PIPE(),
+                                      .spstdout = SP_REDIR_PIPE()));
+    setrlimit(RLIMIT_NOFILE, &old);
+    cr_assert(zero(ptr, p));
+    cr_assert(eq(int, count_fds(), before));
+}
+
+TestSuite(fork_fn, .timeout = 10, .fini = teardown);
+
+static int upper(void* arg) {
+    char buf[64];
+    ssize_t n = read(STDIN_FILENO, buf, sizeof buf);
+    for (ssize_t i = 0; i < n; i++) {
+        buf[i] = toupper(buf[i]);
+    }
+    printf("%s:%.*s", (char*)arg, (int)n, buf);
+    return 7;
+}
+
+Test(fork_fn, pipes) {
+    proc = sp_fork_fn(upper, "out", SP_OPTS(.spstdin = SP_REDIR_PIPE(),
+                                             .spstdout = SP_REDIR_PIPE()));
+    cr_assert(not(zero(ptr, proc)));
+    cr_assert(zero(ptr, proc->argv));
+    fputs("abc", proc->spstdin);
+    sp_close(proc);
+    assert_file_contents(proc->spstdout, "out:ABC");
+    cr_assert(eq(int, sp_wait(proc), 7));
+}
+
+static int in_cwd(void* arg) {
+    char buf[PATH_MAX];
+    return getcwd(buf, sizeof buf) && !strcmp(buf, "/") &&
+                   getsid(0) == getpid() && fcntl(*(int*)arg, F_GETFD) < 0
+               ? 0
+               : 1;
+}
+
+Test(fork_fn, opts) {
+    // The options apply to the function like they do to a program.
+    int fd = dup(STDIN_FILENO);
+    proc = sp_fork_fn(in_cwd, &fd, SP_OPTS(.cwd = "/", .detach = true));
+    cr_assert(zero(int, sp_wait(proc)));
+    close(fd);
+    sp_destroy(proc);
+    proc = sp_fork_fn(in_cwd, &fd, SP_OPTS(.cwd = "NOPE",
+                                           .spstderr = SP_REDIR_DEVNULL()));
+    cr_assert(eq(int, sp_wait(proc), SP_EXIT_NOT_EXECUTE));
+}
+
+static int hang(void* arg) {
+    pause();
+    return 0;
+}
+
+Test(fork_fn, signal) {
+    proc = sp_fork_fn(hang, NULL, NULL);
+    cr_assert(zero(int, sp_signal(proc, SIGTERM)));
+    cr_assert(eq(int, sp_wait(proc), SIGTERM + SP_SIGNAL_OFFSET));
+    cr_assert(zero(ptr, sp_fork_fn(NULL, NULL, NULL)));
+    cr_assert(eq(int, errno, EINVAL));
+}
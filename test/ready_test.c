@@ -0,0 +1,200 @@
+#include "subprocess/ready.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util_test.h"
+
+static SP_Process* proc;
+
+static void setup(void) {
+    proc = NULL;
+}
+
+static void teardown(void) {
+    sp_destroy(proc);
+}
+
+TestSuite(ready, .timeout = 15, .init = setup, .fini = teardown);
+
+static long elapsed_ms(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 +
+           (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+Test(ready, fd) {
+    proc = sp_open(SP_ARGV("sh", "-c",
+                           "echo STATUS=starting >&$SP_NOTIFY_FD;"
+                           "echo READY=1 >&$SP_NOTIFY_FD;"
+                           "exec sleep 5"),
+                   SP_OPTS(.notify = SP_NOTIFY_FD));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cr_assert(zero(int, sp_wait_ready(proc, 5000)));
+    cr_assert(lt(i64, elapsed_ms(&start), 2000));
+    cr_assert(eq(int, sp_poll(proc), -1));
+    // Stays ready.
+    cr_assert(zero(int, sp_wait_ready(proc, 0)));
+}
+
+Test(ready, timeout) {
+    proc = sp_open(SP_ARGV("sleep", "5"), SP_OPTS(.notify = SP_NOTIFY_FD));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cr_assert(eq(int, sp_wait_ready(proc, 100), -1));
+    cr_assert(eq(int, errno, ETIMEDOUT));
+    long elapsed = elapsed_ms(&start);
+    cr_assert(ge(i64, elapsed, 90));
+    cr_assert(lt(i64, elapsed, 2000));
+    cr_assert(eq(int, sp_wait_ready(proc, 0), -1));
+    cr_assert(eq(int, errno, ETIMEDOUT));
+}
+
+Test(ready, exited) {
+    proc = sp_open(SP_ARGV("sh", "-c", "echo READY=0 >&$SP_NOTIFY_FD"),
+                   SP_OPTS(.notify = SP_NOTIFY_FD));
+    cr_assert(eq(int, sp_wait_ready(proc, 5000), -1));
+    cr_assert(eq(int, errno, ECHILD));
+}
+
+Test(ready, closed) {
+    // Still running, but can no longer notify.
+    proc = sp_open(SP_ARGV("sh", "-c", "eval \"exec $SP_NOTIFY_FD>&-\"; sleep 5"),
+                   SP_OPTS(.notify = SP_NOTIFY_FD));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cr_assert(eq(int, sp_wait_ready(proc, 5000), -1));
+    cr_assert(eq(int, errno, ECHILD));
+    cr_assert(lt(i64, elapsed_ms(&start), 2000));
+}
+
+Test(ready, ready_then_exited) {
+    proc = sp_open(SP_ARGV("sh", "-c", "printf READY=1 >&$SP_NOTIFY_FD"),
+                   SP_OPTS(.notify = SP_NOTIFY_FD));
+    cr_assert(zero(int, sp_wait(proc)));
+    // The last line doesn't need a newline.
+    cr_assert(zero(int, sp_wait_ready(proc, 0)));
+}
+
+/**
+ * Send what sd_notify(3) would to the abstract name in NOTIFY_SOCKET.
+ */
+static int notify(const char* name, const char* msg) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    size_t size = name ? strlen(name) : 0;
+    if (size < 2 || size > sizeof addr.sun_path || name[0] != '@') {
+        return -1;
+    }
+    memcpy(addr.sun_path + 1, name + 1, size - 1);
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    socklen_t addrSize = offsetof(struct sockaddr_un, sun_path) + size;
+    ssize_t n =
+        sendto(fd, msg, strlen(msg), 0, (struct sockaddr*)&addr, addrSize);
+    close(fd);
+    return n == (ssize_t)strlen(msg) ? 0 : -1;
+}
+
+static int notify_on_input(void* arg) {
+    (void)arg;
+    char line[8];
+    if (!fgets(line, sizeof line, stdin) ||
+        notify(getenv(SP_NOTIFY_SOCKET_ENV), "STATUS=up\nREADY=1") < 0) {
+        return 1;
+    }
+    pause();
+    return 0;
+}
+
+Test(ready, socket) {
+    proc = sp_fork_fn(notify_on_input, NULL,
+                      SP_OPTS(.notify = SP_NOTIFY_SOCKET,
+                              .spstdin = SP_REDIR_PIPE()));
+    cr_assert(not(zero(ptr, proc)));
+    cr_assert(eq(int, sp_wait_ready(proc, 0), -1));
+    cr_assert(eq(int, errno, ETIMEDOUT));
+
+    // Other processes can reach the socket but are ignored.
+    struct sockaddr_un addr;
+    socklen_t addrSize = sizeof addr;
+    cr_assert(zero(int, getsockname(sp_ready_fd(proc), (struct sockaddr*)&addr,
+                                    &addrSize)));
+    char name[sizeof addr.sun_path + 1] = "@";
+    memcpy(name + 1, addr.sun_path + 1,
+           addrSize - offsetof(struct sockaddr_un, sun_path) - 1);
+    cr_assert(zero(int, notify(name, "READY=1")));
+    cr_assert(eq(int, sp_wait_ready(proc, 100), -1));
+    cr_assert(eq(int, errno, ETIMEDOUT));
+
+    fputs("go\n", proc->spstdin);
+    fflush(proc->spstdin);
+    cr_assert(zero(int, sp_wait_ready(proc, 5000)));
+}
+
+Test(ready, poll) {
+    proc = sp_open(SP_ARGV("sh", "-c",
+                           "read -r x; echo READY=1 >&$SP_NOTIFY_FD; "
+                           "exec sleep 5"),
+                   SP_OPTS(.notify = SP_NOTIFY_FD,
+                           .spstdin = SP_REDIR_PIPE()));
+    struct pollfd pfd = {.fd = sp_ready_fd(proc), .events = POLLIN};
+    cr_assert(ge(int, pfd.fd, 0));
+    cr_assert(zero(int, poll(&pfd, 1, 100)));
+    fputs("go\n", proc->spstdin);
+    fflush(proc->spstdin);
+    cr_assert(eq(int, poll(&pfd, 1, 5000), 1));
+    cr_assert(zero(int, sp_wait_ready(proc, 0)));
+}
+
+Test(ready, env) {
+    // Notifications meant for the caller are replaced, and mapped fds are kept.
+    int fd[2];
+    cr_assert(zero(int, pipe(fd)));
+    proc = sp_open(SP_ARGV("/bin/sh", "-c",
+                           "echo \"$SP_NOTIFY_FD $NOTIFY_SOCKET $X\" >&3;"
+                           "echo READY=1 >&$SP_NOTIFY_FD"),
+                   SP_OPTS(.notify = SP_NOTIFY_FD,
+                           .env = SP_ARGV("PATH=/usr/bin:/bin", "X=y",
+                                          "SP_NOTIFY_FD=99",
+                                          "NOTIFY_SOCKET=@other"),
+                           SP_FD_MAP({fd[1], 3})));
+    cr_assert(not(zero(ptr, proc)));
+    close(fd[1]);
+    cr_assert(zero(int, sp_wait_ready(proc, 5000)));
+    FILE* file = fdopen(fd[0], "r");
+    assert_file_contents(file, "4  y\n");
+    fclose(file);
+}
+
+Test(ready, open_ready) {
+    proc = sp_open_ready(
+        SP_ARGV("sh", "-c", "echo READY=1 >&$SP_NOTIFY_FD; exec sleep 5"),
+        NULL, 5000);
+    cr_assert(not(zero(ptr, proc)));
+    cr_assert(eq(int, sp_poll(proc), -1));
+
+    SP_Opts opts = {0};
+    cr_assert(zero(ptr, sp_open_ready(SP_ARGV("true"), &opts, 5000)));
+    cr_assert(eq(int, errno, ECHILD));
+    cr_assert(eq(int, opts.notify, SP_NOTIFY_NONE));
+}
+
+Test(ready, errors) {
+    proc = sp_open(SP_ARGV("true"), NULL);
+    cr_assert(eq(int, sp_ready_fd(proc), -1));
+    cr_assert(eq(int, sp_wait_ready(proc, 0), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(eq(int, sp_wait_ready(NULL, 0), -1));
+    cr_assert(eq(int, errno, EINVAL));
+}
@@ -0,0 +1,68 @@
+#include "subprocess/reaper.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "subprocess/process.h"
+#include "util_test.h"
+
+TestSuite(reaper, .timeout = 10);
+
+/**
+ * Wait up to a few seconds for the reaper to catch up.
+ */
+static void wait_reaped(void) {
+    for (int i = 0; i < 500 && sp_reap_pending(); i++) {
+        usleep(10000);
+    }
+    cr_assert(zero(sz, sp_reap_pending()));
+}
+
+Test(reaper, destroy_async) {
+    SP_Process* proc = sp_open(SP_ARGV("sleep", "10"),
+                               SP_OPTS(.spstdin = SP_REDIR_PIPE()));
+    pid_t pid = proc->pid;
+    fprintf(proc->spstdin, "unflushed");
+    sp_destroy_async(proc);
+    wait_reaped();
+    cr_assert(eq(int, kill(pid, 0), -1));
+    cr_assert(eq(int, errno, ESRCH));
+}
+
+Test(reaper, many) {
+    pid_t pids[64];
+    for (size_t i = 0; i < SP_SIZE_FIXED_ARR(pids); i++) {
+        SP_Process* proc = sp_open(SP_ARGV("sleep", "10"), 0);
+        pids[i] = proc->pid;
+        sp_destroy_async(proc);
+    }
+    wait_reaped();
+    for (size_t i = 0; i < SP_SIZE_FIXED_ARR(pids); i++) {
+        cr_assert(eq(int, kill(pids[i], 0), -1));
+    }
+}
+
+Test(reaper, group) {
+    cr_assert(zero(int, sp_subreaper(true)));
+    SP_Process* proc =
+        sp_open(SP_ARGV("sh", "-c", "sleep 10 & echo $!; wait"),
+                SP_OPTS(.signalGroup = true, .spstdout = SP_REDIR_PIPE()));
+    char buf[32];
+    cr_assert(not(zero(ptr, fgets(buf, sizeof buf, proc->spstdout))));
+    pid_t grandchild = atoi(buf);
+    sp_destroy_async(proc);
+    wait_reaped();
+    cr_assert(eq(int, kill(grandchild, 0), -1));
+    cr_assert(eq(int, errno, ESRCH));
+}
+
+Test(reaper, not_running) {
+    SP_Process* proc = sp_run(SP_ARGV("true"), 0);
+    cr_assert(eq(int, sp_reap_async(proc), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(eq(int, sp_reap_async(NULL), -1));
+    sp_destroy_async(proc);
+    sp_destroy_async(NULL);
+}
@@ -1,9 +1,13 @@
+#define _GNU_SOURCE  // for O_TMPFILE
 
 #include "subprocess/redirect.h"
 
 #include <criterion/criterion.h>
 #include <criterion/new/assert.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "criterion/internal/new_asserts.h"
 #include "subprocess/process.h"
@@ -112,3 +116,59 @@ Test(redir, pipe_chain) {
     cr_assert(zero(int, proc3->exitCode));
     assert_file_contents(proc3->spstdout, "XYZ789\nABC123\n");
 }
+
+Test(redir, open_flags) {
+    char path[64];
+    snprintf(path, sizeof path, "/tmp/sp-redir-%d.out", getpid());
+    unlink(path);
+    proc1 = sp_run(SP_ARGV("echo", "hi"),
+                   SP_OPTS(.spstdout = SP_REDIR_OPEN(
+                               path, O_WRONLY | O_CREAT | O_EXCL, 0600,
+                               1 << 20)));
+    cr_assert(zero(int, proc1->exitCode));
+    struct stat st;
+    cr_assert(zero(int, stat(path, &st)));
+    cr_assert(eq(int, st.st_mode & 0777, 0600));
+    // The preallocated blocks don't change the size.
+    cr_assert(eq(i64, st.st_size, 3));
+    tmp = fopen(path, "r");
+    assert_file_contents(tmp, "hi\n");
+
+    // O_EXCL fails since the file exists.
+    sp_destroy(proc1);
+    proc1 = sp_run(SP_ARGV("echo", "again"),
+                   SP_OPTS(.spstdout = SP_REDIR_OPEN(
+                               path, O_WRONLY | O_CREAT | O_EXCL, 0600, 0),
+                           .spstderr = SP_REDIR_DEVNULL()));
+    cr_assert(eq(int, proc1->exitCode, SP_EXIT_NOT_EXECUTE));
+    unlink(path);
+}
+
+/**
+ * Check that stdout is an unnamed file holding what was written to it.
+ */
+static int check_tmpfile(void* arg) {
+    char buf[8] = {0};
+    struct stat st;
+    if (write(STDOUT_FILENO, "data", 4) != 4 || fstat(STDOUT_FILENO, &st) < 0 ||
+        lseek(STDOUT_FILENO, 0, SEEK_SET) < 0 ||
+        read(STDOUT_FILENO, buf, sizeof buf) != 4) {
+        return 2;
+    }
+    return st.st_nlink == 0 && !strcmp(buf, "data") ? 0 : 1;
+}
+
+Test(redir, open_tmpfile) {
+    proc1 = sp_fork_fn(check_tmpfile, NULL,
+                       SP_OPTS(.spstdout = SP_REDIR_OPEN(
+                                   "/tmp", O_RDWR | O_TMPFILE, 0600, 0)));
+    cr_assert(zero(int, sp_wait(proc1)));
+
+    proc2 = sp_run(SP_ARGV("true"),
+                   SP_OPTS(.spstdout = SP_REDIR_OPEN(NULL, O_WRONLY, 0, 0),
+                           .spstderr = SP_REDIR_DEVNULL()));
+    cr_assert(eq(int, proc2->exitCode, SP_EXIT_NOT_EXECUTE));
+    SP_RedirOpt missing = SP_REDIR_OPEN(NULL, O_WRONLY, 0, 0);
+    cr_assert(eq(int, sp_redirect(&missing, SP_STDOUT_FILENO), -1));
+    cr_assert(eq(int, errno, EINVAL));
+}
@@ -0,0 +1,156 @@
+#include "subprocess/socket.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "util_test.h"
+
+static SP_Process* proc;
+
+static void teardown(void) {
+    sp_destroy(proc);
+}
+
+TestSuite(socket, .timeout = 10, .fini = teardown);
+
+Test(socket, bidirectional) {
+    // One socket is both stdin and stdout of the child.
+    proc = sp_open(SP_ARGV("sh", "-c",
+                           "while read line; do echo \"got $line\" >&0; done; "
+                           "echo bye >&0"),
+                   SP_OPTS(.spstdin = SP_REDIR_SOCKET(SOCK_STREAM, 0)));
+    int sock = proc->sockets[SP_STDIN_FILENO];
+    cr_assert(ge(int, sock, 0));
+    cr_assert(zero(ptr, proc->spstdin));
+    cr_assert(eq(sz, write(sock, "hello\n", 6), 6));
+    // Only the writing half is shut down.
+    sp_close(proc);
+    char buf[32] = {0};
+    size_t size = 0;
+    ssize_t n;
+    while ((n = read(sock, buf + size, sizeof buf - 1 - size)) > 0) {
+        size += n;
+    }
+    cr_assert(eq(str, buf, "got hello\nbye\n"));
+    cr_assert(zero(int, sp_wait(proc)));
+}
+
+Test(socket, seqpacket) {
+    proc = sp_open(SP_ARGV("cat"),
+                   SP_OPTS(.spstdout = SP_REDIR_SOCKET(SOCK_SEQPACKET, 65536),
+                           .spstdin = SP_REDIR_BYTES("abc", 3)));
+    int sock = proc->sockets[SP_STDOUT_FILENO];
+    int type = 0;
+    int size = 0;
+    socklen_t len = sizeof type;
+    getsockopt(sock, SOL_SOCKET, SO_TYPE, &type, &len);
+    cr_assert(eq(int, type, SOCK_SEQPACKET));
+    len = sizeof size;
+    getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, &len);
+    // The kernel doubles the size for its bookkeeping.
+    cr_assert(ge(int, size, 65536));
+    char buf[16];
+    cr_assert(eq(sz, sp_socket_recv(sock, buf, sizeof buf, NULL, NULL), 3));
+    cr_assert(zero(memcmp(buf, "abc", 3)));
+    cr_assert(zero(sz, sp_socket_recv(sock, buf, sizeof buf, NULL, NULL)));
+    cr_assert(zero(int, sp_wait(proc)));
+}
+
+Test(socket, memfd) {
+    int sv[2];
+    cr_assert(zero(int, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv)));
+    void* map;
+    size_t size = 1 << 20;
+    int fd = sp_memfd_create("data", size, &map);
+    cr_assert(ge(int, fd, 0));
+    memset(map, 'x', size);
+    munmap(map, size);
+    int fds[] = {fd, STDIN_FILENO};
+    cr_assert(eq(sz, sp_socket_send(sv[0], "hi", 2, fds, 2), 2));
+    close(fd);
+
+    char buf[8];
+    int received[2];
+    size_t n = 2;
+    cr_assert(eq(sz, sp_socket_recv(sv[1], buf, sizeof buf, received, &n), 2));
+    cr_assert(eq(sz, n, 2));
+    cr_assert(fcntl(received[0], F_GETFD) & FD_CLOEXEC);
+    size_t mapped;
+    char* data = sp_memfd_map(received[0], &mapped);
+    cr_assert(not(zero(ptr, data)));
+    cr_assert(eq(sz, mapped, size));
+    cr_assert(eq(int, data[size - 1], 'x'));
+    munmap(data, mapped);
+    close(received[0]);
+    close(received[1]);
+
+    // Too many descriptors for the caller, none are kept.
+    int two[] = {STDIN_FILENO, STDIN_FILENO};
+    cr_assert(zero(sz, sp_socket_send(sv[0], "", 0, two, 2)));
+    n = 1;
+    cr_assert(eq(sz, sp_socket_recv(sv[1], buf, sizeof buf, received, &n), -1));
+    cr_assert(eq(int, errno, EMSGSIZE));
+    cr_assert(zero(sz, n));
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/**
+ * Write the memfd received on stdin to stdout.
+ */
+static int print_memfd(void* arg) {
+    char buf[8];
+    int fd;
+    size_t n = 1;
+    if (sp_socket_recv(STDIN_FILENO, buf, sizeof buf, &fd, &n) != 1 || n != 1) {
+        return 1;
+    }
+    size_t size;
+    char* data = sp_memfd_map(fd, &size);
+    return data && fwrite(data, 1, size, stdout) == size ? 0 : 2;
+}
+
+Test(socket, child_receives) {
+    proc = sp_fork_fn(print_memfd, NULL,
+                      SP_OPTS(.spstdin = SP_REDIR_SOCKET(SOCK_STREAM, 0),
+                              .spstdout = SP_REDIR_PIPE()));
+    void* map;
+    int fd = sp_memfd_create("payload", 5, &map);
+    memcpy(map, "hello", 5);
+    munmap(map, 5);
+    cr_assert(eq(sz, sp_socket_send(proc->sockets[SP_STDIN_FILENO], "x", 1, &fd,
+                                 1), 1));
+    close(fd);
+    assert_file_contents(proc->spstdout, "hello");
+    cr_assert(zero(int, sp_wait(proc)));
+}
+
+Test(socket, errors) {
+    cr_assert(eq(sz, sp_socket_send(-1, "", 0, NULL, 0), -1));
+    cr_assert(eq(sz, sp_socket_send(0, "", 0, NULL, SP_SOCKET_MAX_FDS + 1), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    // SOCK_STREAM can't send descriptors without bytes.
+    int sv[2];
+    cr_assert(zero(int, socketpair(AF_UNIX, SOCK_STREAM, 0, sv)));
+    int in = STDIN_FILENO;
+    cr_assert(eq(sz, sp_socket_send(sv[0], "", 0, &in, 1), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    close(sv[0]);
+    close(sv[1]);
+    size_t n = 1;
+    cr_assert(eq(sz, sp_socket_recv(0, NULL, 0, NULL, &n), -1));
+    cr_assert(eq(int, sp_memfd_create(NULL, 1, NULL), -1));
+    int fd = sp_memfd_create("empty", 0, NULL);
+    size_t size;
+    cr_assert(zero(ptr, sp_memfd_map(fd, &size)));
+    cr_assert(eq(int, errno, EINVAL));
+    close(fd);
+    cr_assert(zero(ptr, (sp_open)(SP_ARGV("true"),
+                                  SP_OPTS(.spstdout = SP_REDIR_SOCKET(
+                                              SOCK_DGRAM, 0)))));
+    cr_assert(eq(int, errno, EINVAL));
+}
@@ -0,0 +1,148 @@
+#include "subprocess/stats.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+#include "subprocess/process.h"
+#include "subprocess/tail.h"
+#include "util_test.h"
+
+static SP_Process* proc;
+static SP_Stats before;
+
+static void setup(void) {
+    proc = NULL;
+    sp_stats_get(&before);
+}
+
+static void teardown(void) { sp_destroy(proc); }
+
+TestSuite(stats, .timeout = 15, .init = setup, .fini = teardown);
+
+Test(stats, spawn_and_reap) {
+    proc = sp_open(SP_ARGV("sleep", "5"), 0);
+    SP_Stats after;
+    sp_stats_get(&after);
+    cr_assert(eq(u64, after.spawns - before.spawns, 1));
+    cr_assert(eq(u64, after.live - before.live, 1));
+    cr_assert(eq(u64, after.reaped, before.reaped));
+    uint64_t spawnsBefore = 0;
+    uint64_t spawnsAfter = 0;
+    for (int i = 0; i < SP_STATS_LATENCY_BUCKETS; i++) {
+        spawnsBefore += before.latency[i];
+        spawnsAfter += after.latency[i];
+    }
+    cr_assert(eq(u64, spawnsAfter - spawnsBefore, 1));
+    cr_assert(gt(u64, after.latencySumNs, before.latencySumNs));
+    cr_assert(gt(u64, sp_stats_latency(&after, 50), 0));
+
+    sp_kill(proc);
+    sp_wait(proc);
+    sp_stats_get(&after);
+    cr_assert(eq(u64, after.live, before.live));
+    cr_assert(eq(u64, after.reaped - before.reaped, 1));
+}
+
+Test(stats, exec_failure) {
+    proc = sp_run(SP_ARGV("/nonexistent/program"),
+                  SP_OPTS(.spstderr = SP_REDIR_DEVNULL()));
+    SP_Stats after;
+    sp_stats_get(&after);
+    cr_assert(eq(u64, after.failures[SP_STAGE_EXEC] -
+                          before.failures[SP_STAGE_EXEC],
+                 1));
+}
+
+Test(stats, pipes_failure) {
+    struct rlimit old;
+    getrlimit(RLIMIT_NOFILE, &old);
+    // No room for another fd, so the stdout pipe can not be created.
+    struct rlimit lim = {.rlim_cur = 3, .rlim_max = old.rlim_max};
+    setrlimit(RLIMIT_NOFILE, &lim);
+    SP_Process* p =
+        (sp_open)(SP_ARGV("true"), SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    setrlimit(RLIMIT_NOFILE, &old);
+    cr_assert(zero(ptr, p));
+    SP_Stats after;
+    sp_stats_get(&after);
+    cr_assert(eq(u64, after.failures[SP_STAGE_PIPES] -
+                          before.failures[SP_STAGE_PIPES],
+                 1));
+    cr_assert(eq(u64, after.spawns, before.spawns));
+}
+
+Test(stats, notify_failure) {
+    struct rlimit old;
+    getrlimit(RLIMIT_NOFILE, &old);
+    // No room for another fd, so the socket can not be created.
+    struct rlimit lim = {.rlim_cur = 3, .rlim_max = old.rlim_max};
+    setrlimit(RLIMIT_NOFILE, &lim);
+    SP_Process* p =
+        (sp_open)(SP_ARGV("true"), SP_OPTS(.notify = SP_NOTIFY_SOCKET));
+    setrlimit(RLIMIT_NOFILE, &old);
+    cr_assert(zero(ptr, p));
+    SP_Stats after;
+    sp_stats_get(&after);
+    cr_assert(eq(u64, after.failures[SP_STAGE_NOTIFY] -
+                          before.failures[SP_STAGE_NOTIFY],
+                 1));
+    cr_assert(eq(u64, after.failures[SP_STAGE_PIPES],
+                 before.failures[SP_STAGE_PIPES]));
+}
+
+Test(stats, bytes) {
+    proc = sp_run(SP_ARGV("cat"),
+                  SP_OPTS(.spstdin = SP_REDIR_BYTES("hello", 5),
+                          .spstdout = SP_REDIR_TAIL(16)));
+    SP_Stats after;
+    sp_stats_get(&after);
+    cr_assert(eq(u64, after.bytesWritten - before.bytesWritten, 5));
+    cr_assert(eq(u64, after.bytesRead - before.bytesRead, 5));
+}
+
+Test(stats, latency_percentile) {
+    SP_Stats stats = {0};
+    cr_assert(zero(u64, sp_stats_latency(&stats, 50)));
+    stats.latency[10] = 90;
+    stats.latency[20] = 10;
+    cr_assert(eq(u64, sp_stats_latency(&stats, 50), 2048));
+    cr_assert(eq(u64, sp_stats_latency(&stats, 90), 2048));
+    cr_assert(eq(u64, sp_stats_latency(&stats, 99), 2 << 20));
+}
+
+static atomic_bool resetting;
+
+static void* reset_loop(void* arg) {
+    do {
+        sp_stats_reset();
+    } while (atomic_load(&resetting));
+    return NULL;
+}
+
+Test(stats, reset_with_live_children) {
+    SP_Process* procs[16];
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(procs); i++) {
+        procs[i] = sp_open(SP_ARGV("true"), 0);
+    }
+    // Reaps racing with resets must all be counted.
+    atomic_store(&resetting, true);
+    pthread_t thread;
+    cr_assert(zero(int, pthread_create(&thread, NULL, reset_loop, NULL)));
+    for (int i = 0; i < SP_SIZE_FIXED_ARR(procs); i++) {
+        sp_wait(procs[i]);
+        sp_destroy(procs[i]);
+    }
+    atomic_store(&resetting, false);
+    pthread_join(thread, NULL);
+    SP_Stats after;
+    sp_stats_get(&after);
+    cr_assert(eq(u64, after.live, before.live));
+    cr_assert(zero(u64, after.spawns));
+
+    proc = sp_open(SP_ARGV("sleep", "5"), 0);
+    sp_stats_reset();
+    sp_stats_get(&after);
+    cr_assert(eq(u64, after.live, before.live + 1));
+    cr_assert(zero(u64, after.spawns));
+}
@@ -0,0 +1,346 @@
+/**
+ * Stress test spawning processes from several threads with random options and injected
+ * failures, then checking for leaked fds, unreaped children and memory growth.
+ *
+ * Linked against the static library with -Wl,--wrap so that pipe2(), fork() and fdopen()
+ * made by the library can be made to fail, see `make stress`.
+ *
+ * Usage: stress [-n spawns] [-t threads] [-f failures per 1000 calls] [-l fd limit]
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "subprocess/process.h"
+#include "subprocess/stats.h"
+#include "subprocess/tail.h"
+
+static size_t total = 100000;
+static size_t nThreads = 8;
+static unsigned int failRate = 5;
+static bool fdLimit;
+
+static size_t started;
+static size_t completed;
+static size_t injected;
+static size_t exhausted;
+static size_t errors;
+static bool done;
+
+static __thread unsigned int seed;
+static __thread bool injecting;
+
+int __real_pipe2(int fd[2], int flags);
+pid_t __real_fork(void);
+FILE* __real_fdopen(int fd, const char* mode);
+
+/**
+ * Decide whether the current call made by the library fails.
+ */
+static bool inject(void) {
+    if (!injecting || rand_r(&seed) % 1000 >= failRate) {
+        return false;
+    }
+    __atomic_add_fetch(&injected, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+int __wrap_pipe2(int fd[2], int flags) {
+    if (inject()) {
+        errno = EMFILE;
+        return -1;
+    }
+    return __real_pipe2(fd, flags);
+}
+
+pid_t __wrap_fork(void) {
+    if (inject()) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return __real_fork();
+}
+
+FILE* __wrap_fdopen(int fd, const char* mode) {
+    // Fails after the child was forked.
+    if (inject()) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return __real_fdopen(fd, mode);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int count_fds(void) {
+    DIR* dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return -1;
+    }
+    int n = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        n += entry->d_name[0] != '.';
+    }
+    closedir(dir);
+    // Not counting the fd of dir.
+    return n - 1;
+}
+
+static long rss_kb(void) {
+    FILE* file = fopen("/proc/self/status", "r");
+    if (!file) {
+        return -1;
+    }
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof line, file)) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(file);
+    return kb;
+}
+
+static void error(const char* scenario, const char* what) {
+    __atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+    fprintf(stderr, "%s: %s\n", scenario, what);
+}
+
+/**
+ * Read everything from file.
+ */
+static void read_output(FILE* file, char* buf, size_t size) {
+    size_t n = fread(buf, 1, size - 1, file);
+    buf[n] = '\0';
+}
+
+/**
+ * Run a random scenario. Processes that fail to start are expected when failures are
+ * injected or fds run out, anything else is an error.
+ */
+static void run_scenario(void) {
+    SP_Opts opts = {
+        .inheritFds = rand_r(&seed) % 2,
+        .newGroup = rand_r(&seed) % 4 == 0,
+        .spstderr = SP_REDIR_DEVNULL(),
+    };
+    SP_Process* proc = NULL;
+    char* scenario = "";
+    int fd[2] = {-1, -1};
+    injecting = true;
+    switch (rand_r(&seed) % 7) {
+    case 0:
+        scenario = "true";
+        opts.spstdout = SP_REDIR_DEVNULL();
+        proc = sp_open(SP_ARGV("true"), &opts);
+        break;
+    case 1:
+        scenario = "bytes";
+        opts.spstdin = SP_REDIR_BYTES("bytes\n", 6);
+        opts.spstdout = SP_REDIR_PIPE();
+        proc = sp_open(SP_ARGV("cat"), &opts);
+        break;
+    case 2:
+        scenario = "pipes";
+        opts.spstdin = SP_REDIR_PIPE();
+        opts.spstdout = SP_REDIR_PIPE();
+        proc = sp_open(SP_ARGV("cat"), &opts);
+        break;
+    case 3:
+        scenario = "exit";
+        proc = sp_open(SP_ARGV("sh", "-c", "exit 3"), &opts);
+        break;
+    case 4:
+        scenario = "not_found";
+        proc = sp_open(SP_ARGV("/nonexistent/program"), &opts);
+        break;
+    case 5:
+        scenario = "tail";
+        opts.spstdout = SP_REDIR_TAIL(4);
+        proc = sp_open(SP_ARGV("echo", "tail"), &opts);
+        break;
+    case 6:
+        scenario = "fd_map";
+        if (pipe(fd) < 0) {
+            break;
+        }
+        opts.spstdout = SP_REDIR_DEVNULL();
+        opts.fdMap = (SP_FdMap[]){{fd[1], 3}};
+        opts.fdMapSize = 1;
+        proc = sp_open(SP_ARGV("sh", "-c", "echo map >&3"), &opts);
+        close(fd[1]);
+        break;
+    }
+    injecting = false;
+    __atomic_add_fetch(&started, 1, __ATOMIC_RELAXED);
+    if (!proc) {
+        if (errno != EMFILE && errno != ENFILE && errno != EAGAIN &&
+            errno != ENOMEM) {
+            error(scenario, strerror(errno));
+        }
+        if (fd[0] >= 0) {
+            close(fd[0]);
+        }
+        return;
+    }
+
+    char output[256] = "";
+    char* expectedOutput = NULL;
+    if (!strcmp(scenario, "bytes")) {
+        read_output(proc->spstdout, output, sizeof output);
+        expectedOutput = "bytes\n";
+    } else if (!strcmp(scenario, "pipes")) {
+        fputs("pipes\n", proc->spstdin);
+        sp_close(proc);
+        read_output(proc->spstdout, output, sizeof output);
+        expectedOutput = "pipes\n";
+    } else if (!strcmp(scenario, "fd_map")) {
+        FILE* file = fdopen(fd[0], "r");
+        read_output(file, output, sizeof output);
+        fclose(file);
+        expectedOutput = "map\n";
+    }
+    int exitCode = sp_wait(proc);
+    int expected = 0;
+    if (!strcmp(scenario, "exit")) {
+        expected = 3;
+    } else if (!strcmp(scenario, "not_found")) {
+        expected = SP_EXIT_NOT_FOUND;
+    }
+    if (exitCode == SP_EXIT_NOT_EXECUTE && fdLimit) {
+        // The child ran out of fds while applying the options.
+        __atomic_add_fetch(&exhausted, 1, __ATOMIC_RELAXED);
+    } else if (exitCode != expected) {
+        error(scenario, "unexpected exit code");
+    } else if (expectedOutput && strcmp(output, expectedOutput)) {
+        error(scenario, "unexpected output");
+    } else if (!strcmp(scenario, "tail")) {
+        size_t size;
+        const char* tail = sp_tail(proc, SP_STDOUT_FILENO, &size);
+        if (!tail || size != 4 || memcmp(tail, "ail\n", 4)) {
+            error(scenario, "unexpected tail");
+        }
+    }
+    sp_destroy(proc);
+    __atomic_add_fetch(&completed, 1, __ATOMIC_RELAXED);
+}
+
+static void* worker(void* arg) {
+    seed = (unsigned int)(size_t)arg * 7919 + time(NULL);
+    while (__atomic_add_fetch(&started, 0, __ATOMIC_RELAXED) < total) {
+        run_scenario();
+    }
+    return NULL;
+}
+
+static void* reporter(void* arg) {
+    (void)arg;
+    double start = now();
+    size_t last = 0;
+    while (!__atomic_load_n(&done, __ATOMIC_RELAXED)) {
+        sleep(1);
+        size_t count = __atomic_load_n(&started, __ATOMIC_RELAXED);
+        SP_Stats stats;
+        sp_stats_get(&stats);
+        printf("%6.1fs %8zu spawns %7zu/s  live %3llu  injected %6zu  "
+               "fds %4d  rss %6ld KiB  p99 %llu ns\n",
+               now() - start, count, count - last,
+               (unsigned long long)stats.live,
+               __atomic_load_n(&injected, __ATOMIC_RELAXED), count_fds(),
+               rss_kb(), (unsigned long long)sp_stats_latency(&stats, 99));
+        fflush(stdout);
+        last = count;
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:f:l:")) != -1) {
+        switch (opt) {
+        case 'n':
+            total = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            nThreads = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            failRate = strtoul(optarg, NULL, 10);
+            break;
+        case 'l': {
+            // Low limits exhaust fds while spawning.
+            struct rlimit lim;
+            getrlimit(RLIMIT_NOFILE, &lim);
+            lim.rlim_cur = strtoul(optarg, NULL, 10);
+            setrlimit(RLIMIT_NOFILE, &lim);
+            fdLimit = true;
+            break;
+        }
+        default:
+            fprintf(stderr,
+                    "Usage: %s [-n spawns] [-t threads] [-f failures per "
+                    "1000 calls] [-l fd limit]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    int fdsBefore = count_fds();
+    long rssBefore = rss_kb();
+    double start = now();
+
+    pthread_t report;
+    pthread_create(&report, NULL, reporter, NULL);
+    pthread_t threads[nThreads];
+    for (size_t i = 0; i < nThreads; i++) {
+        pthread_create(&threads[i], NULL, worker, (void*)i);
+    }
+    for (size_t i = 0; i < nThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    __atomic_store_n(&done, true, __ATOMIC_RELAXED);
+    pthread_join(report, NULL);
+    double elapsed = now() - start;
+
+    int fdsAfter = count_fds();
+    SP_Stats stats;
+    sp_stats_get(&stats);
+    // Any child left, running or zombie, was not reaped by the library.
+    int children = 0;
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+        children++;
+    }
+    bool running = waitpid(-1, NULL, WNOHANG) == 0;
+
+    printf("\n%zu spawns in %.1fs (%.0f/s), %zu completed, %zu injected "
+           "failures, %zu children out of fds\n",
+           started, elapsed, started / elapsed, completed, injected,
+           exhausted);
+    printf("fds %d -> %d, rss %ld -> %ld KiB, live %llu, zombies %d%s\n",
+           fdsBefore, fdsAfter, rssBefore, rss_kb(),
+           (unsigned long long)stats.live, children,
+           running ? ", children still running" : "");
+    bool leaked =
+        fdsAfter != fdsBefore || stats.live || children || running;
+    if (leaked) {
+        fprintf(stderr, "LEAK detected\n");
+    }
+    if (errors) {
+        fprintf(stderr, "%zu errors\n", errors);
+    }
+    return leaked || errors ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+#include "subprocess/tail.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "subprocess/process.h"
+#include "util_test.h"
+
+static SP_Process* proc;
+
+static void setup(void) { proc = NULL; }
+
+static void teardown(void) { sp_destroy(proc); }
+
+TestSuite(tail, .timeout = 15, .init = setup, .fini = teardown);
+
+Test(tail, bounded) {
+    // Writes far more than a pipe can buffer, so the child only finishes
+    // if the pipe is drained while it runs.
+    proc = sp_run(SP_ARGV("sh", "-c",
+                          "head -c 1000000 /dev/zero | tr '\\0' a; echo; "
+                          "echo second; echo last"),
+                  SP_OPTS(.spstdout = SP_REDIR_TAIL(16)));
+    cr_assert(zero(int, proc->exitCode));
+    cr_assert(eq(u64, sp_tail_total(proc, SP_STDOUT_FILENO), 1000000 + 13));
+    size_t size;
+    const char* tail = sp_tail(proc, SP_STDOUT_FILENO, &size);
+    cr_assert(not(zero(ptr, (void*)tail)));
+    cr_assert(eq(sz, size, 16));
+    cr_assert(zero(memcmp(tail, "aaa\nsecond\nlast\n", 16)));
+
+    tail = sp_tail_lines(proc, SP_STDOUT_FILENO, 2, &size);
+    cr_assert(eq(sz, size, strlen("second\nlast\n")));
+    cr_assert(zero(memcmp(tail, "second\nlast\n", size)));
+    tail = sp_tail_lines(proc, SP_STDOUT_FILENO, 10, &size);
+    cr_assert(eq(sz, size, 16));
+    tail = sp_tail_lines(proc, SP_STDOUT_FILENO, 0, &size);
+    cr_assert(zero(sz, size));
+}
+
+Test(tail, both_outputs) {
+    proc = sp_run(SP_ARGV("sh", "-c", "echo out; echo err >&2"),
+                  SP_OPTS(.spstdout = SP_REDIR_TAIL(1024),
+                          .spstderr = SP_REDIR_TAIL(0)));
+    size_t size;
+    const char* tail = sp_tail(proc, SP_STDOUT_FILENO, &size);
+    cr_assert(eq(sz, size, 4));
+    cr_assert(zero(memcmp(tail, "out\n", 4)));
+    tail = sp_tail(proc, SP_STDERR_FILENO, &size);
+    cr_assert(not(zero(ptr, (void*)tail)));
+    cr_assert(zero(sz, size));
+    cr_assert(eq(u64, sp_tail_total(proc, SP_STDERR_FILENO), 4));
+}
+
+Test(tail, descendant_holds_pipe) {
+    // The background sleep keeps stdout open after the shell exits.
+    time_t start = time(NULL);
+    proc = sp_run(SP_ARGV("sh", "-c", "echo done; sleep 10 &"),
+                  SP_OPTS(.spstdout = SP_REDIR_TAIL(64), .signalGroup = true));
+    cr_assert(zero(int, proc->exitCode));
+    cr_assert(lt(int, time(NULL) - start, 5));
+    size_t size;
+    const char* tail = sp_tail(proc, SP_STDOUT_FILENO, &size);
+    cr_assert(eq(sz, size, 5));
+    cr_assert(zero(memcmp(tail, "done\n", 5)));
+}
+
+Test(tail, running) {
+    proc = sp_open(SP_ARGV("sh", "-c", "echo started; exec sleep 5"),
+                   SP_OPTS(.spstderr = SP_REDIR_TAIL(64)));
+    size_t size;
+    cr_assert(zero(ptr, (void*)sp_tail(proc, SP_STDERR_FILENO, &size)));
+    cr_assert(eq(int, errno, EBUSY));
+    cr_assert(zero(ptr, (void*)sp_tail(proc, SP_STDOUT_FILENO, &size)));
+    cr_assert(eq(int, errno, EINVAL));
+}
+
+Test(tail, invalid_stdin) {
+    proc = sp_run(SP_ARGV("true"), SP_OPTS(.spstdin = SP_REDIR_TAIL(64),
+                                           .spstderr = SP_REDIR_DEVNULL()));
+    cr_assert(eq(int, proc->exitCode, SP_EXIT_NOT_EXECUTE));
+}
@@ -0,0 +1,116 @@
+#include "subprocess/tee.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "subprocess/process.h"
+#include "util_test.h"
+
+static SP_Process* proc1;
+static SP_Process* proc2;
+static FILE* tmp;
+
+static void setup(void) {
+    proc1 = NULL;
+    proc2 = NULL;
+    tmp = NULL;
+}
+
+static void teardown(void) {
+    sp_destroy(proc1);
+    sp_destroy(proc2);
+    if (tmp) {
+        fclose(tmp);
+    }
+}
+
+TestSuite(tee, .timeout = 15, .init = setup, .fini = teardown);
+
+Test(tee, fan_out) {
+    // printf "abc123\nxyz789\n" | tee test/tee.out | tr a-z A-Z
+    unlink("test/tee.out");
+    tmp = tmpfile();
+    proc1 = sp_open(SP_ARGV("printf", "abc123\nxyz789\n"),
+                    SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    proc2 = sp_open(SP_ARGV("tr", "a-z", "A-Z"),
+                    SP_OPTS(.spstdin = SP_REDIR_PIPE(),
+                            .spstdout = SP_REDIR_PIPE()));
+    SP_TeeSink sinks[] = {
+        SP_TEE_PATH("test/tee.out"),
+        SP_TEE_CAPTURE(),
+        SP_TEE_FILE(tmp),
+        SP_TEE_PROCESS(proc2),
+    };
+    size_t size = strlen("abc123\nxyz789\n");
+    cr_assert(eq(int, sp_tee(fileno(proc1->spstdout), sinks,
+                             SP_SIZE_FIXED_ARR(sinks)),
+                 size));
+    sp_close(proc2);
+    cr_assert(zero(int, sp_wait(proc1)));
+    cr_assert(zero(int, sp_wait(proc2)));
+
+    for (size_t i = 0; i < SP_SIZE_FIXED_ARR(sinks); i++) {
+        cr_assert(eq(sz, sinks[i].size, size));
+    }
+    cr_assert(zero(memcmp(sinks[1].buf, "abc123\nxyz789\n", size)));
+    rewind(tmp);
+    assert_file_contents(tmp, "abc123\nxyz789\n");
+    assert_file_contents(proc2->spstdout, "ABC123\nXYZ789\n");
+    FILE* out = fopen("test/tee.out", "r");
+    assert_file_contents(out, "abc123\nxyz789\n");
+    fclose(out);
+    sp_tee_free(sinks, SP_SIZE_FIXED_ARR(sinks));
+    cr_assert(zero(ptr, sinks[1].buf));
+}
+
+Test(tee, large_append) {
+    // Larger than a pipe so the data is moved in several chunks.
+    unlink("test/tee-append.out");
+    size_t size = 1024 * 1024;
+    proc1 = sp_open(SP_ARGV("head", "-c", "1048576", "/dev/urandom"),
+                    SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    SP_TeeSink sinks[] = {
+        SP_TEE_CAPTURE(),
+        SP_TEE_APPEND("test/tee-append.out"),
+    };
+    cr_assert(eq(int, sp_tee(fileno(proc1->spstdout), sinks, 2), size));
+    cr_assert(eq(sz, sinks[0].size, size));
+    cr_assert(eq(sz, sinks[1].size, size));
+
+    FILE* out = fopen("test/tee-append.out", "r");
+    cr_assert(not(zero(ptr, out)));
+    char* buf = malloc(size);
+    cr_assert(eq(sz, fread(buf, 1, size, out), size));
+    cr_assert(zero(memcmp(buf, sinks[0].buf, size)));
+    free(buf);
+    fclose(out);
+    sp_tee_free(sinks, 2);
+}
+
+Test(tee, non_blocking) {
+    // The source is empty between the writes, which must not fail with EAGAIN.
+    proc1 = sp_open(SP_ARGV("sh", "-c", "echo abc; sleep 0.2; echo xyz"),
+                    SP_OPTS(.spstdout = SP_REDIR_PIPE(), .nonBlockingPipes = true));
+    SP_TeeSink sinks[] = {SP_TEE_CAPTURE(), SP_TEE_CAPTURE()};
+    cr_assert(eq(int, sp_tee(fileno(proc1->spstdout), sinks, 2), 8));
+    cr_assert(zero(int, sp_wait(proc1)));
+    for (size_t i = 0; i < SP_SIZE_FIXED_ARR(sinks); i++) {
+        cr_assert(eq(sz, sinks[i].size, 8));
+        cr_assert(zero(memcmp(sinks[i].buf, "abc\nxyz\n", 8)));
+    }
+    sp_tee_free(sinks, 2);
+}
+
+Test(tee, invalid) {
+    SP_TeeSink sink = SP_TEE_CAPTURE();
+    cr_assert(eq(int, sp_tee(-1, &sink, 1), -1));
+    cr_assert(eq(int, errno, EINVAL));
+    cr_assert(eq(int, sp_tee(STDIN_FILENO, NULL, 0), -1));
+    cr_assert(eq(int, errno, EINVAL));
+
+    proc1 = sp_open(SP_ARGV("true"), SP_OPTS(.spstdout = SP_REDIR_PIPE()));
+    sink = SP_TEE_PROCESS(proc1);  // stdin is not a pipe
+    cr_assert(eq(int, sp_tee(fileno(proc1->spstdout), &sink, 1), -1));
+    cr_assert(eq(int, errno, EINVAL));
+}
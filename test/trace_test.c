@@ -0,0 +1,110 @@
+#include "subprocess/trace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "subprocess/process.h"
+#include "util_test.h"
+
+static SP_Process* proc;
+static char* json;
+static size_t jsonSize;
+
+static void setup(void) {
+    proc = NULL;
+    json = NULL;
+    sp_trace_clear();
+    sp_trace_enable(true);
+}
+
+static void teardown(void) {
+    sp_trace_enable(false);
+    sp_trace_clear();
+    sp_destroy(proc);
+    free(json);
+}
+
+/**
+ * Export the trace into json.
+ */
+static void export_trace(void) {
+    free(json);
+    FILE* file = open_memstream(&json, &jsonSize);
+    cr_assert(not(zero(ptr, file)));
+    cr_assert(zero(int, sp_trace_export(file)));
+    fclose(file);
+}
+
+TestSuite(trace, .timeout = 15, .init = setup, .fini = teardown);
+
+Test(trace, phases) {
+    proc = sp_run(SP_ARGV("true"), SP_OPTS(.spstdout = SP_REDIR_DEVNULL()));
+    export_trace();
+    char* names[] = {"create_pipes", "fork",      "parent_setup",
+                     "sp_open",      "child_opts", "redirect",
+                     "close_fds",    "run",        "sp_wait"};
+    for (size_t i = 0; i < SP_SIZE_FIXED_ARR(names); i++) {
+        char needle[64];
+        snprintf(needle, sizeof needle, "\"name\":\"%s\"", names[i]);
+        cr_expect(not(zero(ptr, strstr(json, needle))), "%s", names[i]);
+    }
+    // Child phases are shown on the track of the child.
+    char needle[64];
+    char* run = strstr(json, "\"name\":\"run\"");
+    cr_assert(not(zero(ptr, run)));
+    snprintf(needle, sizeof needle, "\"pid\":%d,\"tid\":%d", proc->pid,
+             proc->pid);
+    char* track = strstr(run, needle);
+    cr_assert(not(zero(ptr, track)));
+    char* header = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    cr_assert(zero(strncmp(json, header, strlen(header))));
+    cr_assert(not(zero(ptr, strstr(json, "\n]}\n"))));
+    cr_assert(eq(sz, sp_trace_count(), SP_SIZE_FIXED_ARR(names) + 1));
+}
+
+Test(trace, disabled) {
+    sp_trace_enable(false);
+    proc = sp_run(SP_ARGV("true"), 0);
+    cr_assert(zero(sz, sp_trace_count()));
+    export_trace();
+    cr_assert(
+        eq(str, json, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n]}\n"));
+}
+
+Test(trace, many_events) {
+    // More events than fit in a single chunk of the thread's buffer.
+    for (int i = 0; i < 1000; i++) {
+        sp_trace_event("event", 0, false, i, i + 1);
+    }
+    cr_assert(eq(sz, sp_trace_count(), 1000));
+    sp_trace_clear();
+    cr_assert(zero(sz, sp_trace_count()));
+}
+
+static void* record_events(void* arg) {
+    for (int i = 0; i < *(int*)arg; i++) {
+        sp_trace_event("event", 0, false, i, i + 1);
+    }
+    return NULL;
+}
+
+Test(trace, threads) {
+    // The events of an exited thread are kept until cleared.
+    int n = 300;
+    pthread_t thread;
+    cr_assert(zero(int, pthread_create(&thread, NULL, record_events, &n)));
+    pthread_join(thread, NULL);
+    cr_assert(eq(sz, sp_trace_count(), n));
+
+    // Clearing while another thread records must not free its chunks.
+    n = 100000;
+    cr_assert(zero(int, pthread_create(&thread, NULL, record_events, &n)));
+    for (int i = 0; i < 1000; i++) {
+        sp_trace_clear();
+    }
+    pthread_join(thread, NULL);
+    cr_assert(le(sz, sp_trace_count(), n));
+    sp_trace_clear();
+    cr_assert(zero(sz, sp_trace_count()));
+}